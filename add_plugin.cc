@@ -0,0 +1,44 @@
+//cgi_main.cc 中 a+b 计算器的插件版本
+//编译成 add_plugin.so，启动服务器的时候加上 --plugin=add_plugin.so，
+//请求 /plugin/add?a=1&b=2 就在服务器进程中直接计算，不再启动 CGI 进程
+#include <string>
+#include <sstream>
+#include "plugin.h"
+#include "util.hpp"
+
+using namespace http_server;
+
+class AddHandler : public HttpHandler{
+public:
+  virtual int Handle(const Request& req,Response* resp){
+    //1.GET请求的参数在 query_string 中，POST请求的参数在 body 中
+    StringUtil::UrlParam params;
+    if(req.method == "GET"){
+      StringUtil::ParseUrlParam(req.query_string,&params);
+    }else if(req.method == "POST"){
+      StringUtil::ParseUrlParam(req.body,&params);
+    }else {
+      return -1;
+    }
+    //2.根据业务进行计算，参数不对的时候返回 400
+    //  和 cgi_main.cc 的校验完全一样，整个参数都必须是 int 范围内的整数
+    long a = 0;
+    long b = 0;
+    if(StringUtil::ParseInt(params["a"],&a) < 0 || StringUtil::ParseInt(params["b"],&b) < 0){
+      resp->code = 400;
+      resp->desc = "Bad Request";
+      resp->body = "<h1>invalid a or b</h1>";
+      return 0;
+    }
+    //3.根据计算结果，构造响应数据，两个 int 相加用 long 不会溢出
+    std::stringstream ss;
+    ss << "<h1> result = " << a + b << "</h1>";
+    resp->body = ss.str();
+    resp->header["Content-Type"] = "text/html; charset=utf-8";
+    return 0;
+  }
+};
+
+extern "C" int HTTP_SERVER_PLUGIN_INIT(PluginRegistry* registry){
+  return registry->Register("/plugin/add",new AddHandler());
+}
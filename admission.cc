@@ -0,0 +1,127 @@
+#include "admission.h"
+#include "util.hpp"
+#include <math.h>
+#include <algorithm>
+
+namespace http_server{
+
+//自适应上限每 100ms 调整一次
+static const int64_t kWindowNS = 100 * 1000 * 1000;
+//每 10 秒把最短耗时放宽 1/8，文件变大之类的原因让空闲时的耗时变长了之后能重新学习
+static const int64_t kBaselineNS = 10LL * 1000 * 1000 * 1000;
+//耗时的比值用定点数累加，1024 表示 1 倍
+static const uint64_t kRatioScale = 1024;
+//单个请求的比值最多按 64 倍算，避免个别特别慢的请求把上限一下子拉到最低
+static const uint64_t kMaxRatio = 64 * kRatioScale;
+//处理耗时本身有波动，平均不超过最短耗时的 2 倍都认为没有排队
+static const double kTolerance = 2.0;
+//最短耗时低于 20us 的按 20us 算，这么短的耗时波动的比例太大
+static const int64_t kMinBaselineNS = 20 * 1000;
+//一个窗口内的样本太少就不调整
+static const uint64_t kMinSamples = 8;
+//自适应上限的范围，没有配置 max_requests 的时候最大是 kDefaultMaxLimit
+static const uint64_t kMinLimit = 4;
+static const uint64_t kDefaultMaxLimit = 1024;
+
+AdmissionControl::AdmissionControl(const AdmissionLimits& limits)
+  :limits_(limits),connections_(0),requests_(0),cgi_(0),request_limit_(limits.max_requests),
+   window_ratio_(0),window_samples_(0),window_end_(0),baseline_end_(0){
+  if(limits_.adaptive && limits_.max_requests == 0){
+    limits_.max_requests = kDefaultMaxLimit;
+    request_limit_.store(kDefaultMaxLimit);
+  }
+  for(int i = 0;i < STAGE_NUM;++i){
+    min_ns_[i].store(0);
+  }
+  int64_t now = TimeUtil::MonotonicNS();
+  window_end_.store(now + kWindowNS);
+  baseline_end_.store(now + kBaselineNS);
+}
+
+bool AdmissionControl::TryAcquire(std::atomic<uint64_t>* count,uint64_t limit){
+  uint64_t value = count->fetch_add(1,std::memory_order_relaxed) + 1;
+  if(limit != 0 && value > limit){
+    count->fetch_sub(1,std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+bool AdmissionControl::AcquireConnection(){
+  return TryAcquire(&connections_,limits_.max_connections);
+}
+
+void AdmissionControl::ReleaseConnection(){
+  connections_.fetch_sub(1,std::memory_order_relaxed);
+}
+
+bool AdmissionControl::AcquireRequest(){
+  return TryAcquire(&requests_,request_limit_.load(std::memory_order_relaxed));
+}
+
+void AdmissionControl::ReleaseRequest(Stage stage,int64_t handle_ns){
+  requests_.fetch_sub(1,std::memory_order_relaxed);
+  //错误页面、统计信息这些请求的耗时说明不了什么
+  if(!limits_.adaptive || stage == STAGE_OTHER || handle_ns <= 0){
+    return;
+  }
+  //1.更新这一类请求的最短耗时，大部分时候只有一次 load
+  std::atomic<int64_t>& min_ns = min_ns_[stage];
+  int64_t base = min_ns.load(std::memory_order_relaxed);
+  while((base == 0 || handle_ns < base)
+        && !min_ns.compare_exchange_weak(base,handle_ns,std::memory_order_relaxed)){
+  }
+  base = std::max(std::min(base == 0 ? handle_ns : base,handle_ns),kMinBaselineNS);
+  //2.这个请求的排队程度累加到当前窗口中
+  uint64_t ratio = std::min(static_cast<uint64_t>(handle_ns) * kRatioScale / base,kMaxRatio);
+  window_ratio_.fetch_add(ratio,std::memory_order_relaxed);
+  window_samples_.fetch_add(1,std::memory_order_relaxed);
+  //3.窗口结束了，抢到的那一个线程负责调整上限
+  int64_t now = TimeUtil::MonotonicNS();
+  int64_t end = window_end_.load(std::memory_order_relaxed);
+  if(now >= end && window_end_.compare_exchange_strong(end,now + kWindowNS,
+                                                       std::memory_order_relaxed)){
+    UpdateLimit(now);
+  }
+}
+
+void AdmissionControl::UpdateLimit(int64_t now_ns){
+  if(now_ns >= baseline_end_.load(std::memory_order_relaxed)){
+    baseline_end_.store(now_ns + kBaselineNS,std::memory_order_relaxed);
+    for(int i = 0;i < STAGE_NUM;++i){
+      int64_t base = min_ns_[i].load(std::memory_order_relaxed);
+      min_ns_[i].store(base + base / 8,std::memory_order_relaxed);
+    }
+  }
+  uint64_t samples = window_samples_.load(std::memory_order_relaxed);
+  if(samples < kMinSamples){
+    return;
+  }
+  //这里和其他线程的累加之间没有加锁，两次 exchange 之间加进来的样本最多让比值偏一点点
+  samples = window_samples_.exchange(0,std::memory_order_relaxed);
+  uint64_t sum = window_ratio_.exchange(0,std::memory_order_relaxed);
+  if(samples == 0){
+    return;
+  }
+  //梯度：平均比值在容忍范围之内是1，排队越严重越小，一次最多减半
+  double ratio = static_cast<double>(sum) / samples / kRatioScale;
+  double gradient = std::max(0.5,std::min(1.0,kTolerance / ratio));
+  double limit = static_cast<double>(request_limit_.load(std::memory_order_relaxed));
+  //sqrt(limit) 是允许的排队长度，没有排队的时候上限按照它慢慢升高
+  double next = limit * gradient + sqrt(limit);
+  //平滑一下，避免一个窗口的波动让上限大起大落，向上取整保证上限很小的时候也能升高
+  next = ceil(limit * 0.8 + next * 0.2);
+  next = std::max(static_cast<double>(kMinLimit),
+                  std::min(static_cast<double>(limits_.max_requests),next));
+  request_limit_.store(static_cast<uint64_t>(next),std::memory_order_relaxed);
+}
+
+bool AdmissionControl::AcquireCgi(){
+  return TryAcquire(&cgi_,limits_.max_cgi);
+}
+
+void AdmissionControl::ReleaseCgi(){
+  cgi_.fetch_sub(1,std::memory_order_relaxed);
+}
+
+}//end of http_server
@@ -0,0 +1,67 @@
+#pragma once
+//准入控制：过载的时候尽早拒绝，而不是把所有连接和请求都接下来，最后耗尽内存或者让所有请求都超时
+//三个维度分别限制：同时打开的连接数、正在处理的请求数、同时执行的 CGI 数，
+//超过限制的直接返回 503 和 Retry-After，客户端过一会儿再来。
+//正在处理的请求数还可以使用自适应的上限：每个请求处理完之后，用它的处理耗时和同一类请求
+//(静态文件、CGI、插件)在空闲时的最短耗时比较，比值变大说明请求开始排队了(CPU、磁盘、CGI 工作进程)，
+//就按比例降低上限；比值正常的时候上限慢慢升高，这样上限会停在刚好不排队的并发数附近
+//所有计数都是原子变量，不加锁，多个线程(reuseport 的各个分片)可以同时使用
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "stats.h"
+
+namespace http_server{
+
+struct AdmissionLimits{
+  size_t max_connections; //同时打开的连接数，0表示不限制
+  size_t max_requests; //正在处理的请求数(从开始处理到响应写完)，0表示不限制
+  size_t max_cgi; //同时执行的 CGI 请求数(包括在等待工作进程的)，0表示不限制
+  bool adaptive; //正在处理的请求数的上限根据排队的情况自动调整，不超过 max_requests
+  int retry_after; //503 响应中的 Retry-After，单位是秒
+  AdmissionLimits()
+    :max_connections(0),max_requests(0),max_cgi(0),adaptive(false),retry_after(1){
+  }
+};
+
+class AdmissionControl{
+public:
+  explicit AdmissionControl(const AdmissionLimits& limits);
+  //下面的 Acquire 返回 false 表示已经到上限了，调用方应该返回 503；返回 true 的之后必须 Release
+  bool AcquireConnection();
+  void ReleaseConnection();
+  bool AcquireRequest();
+  //stage 是请求由哪一类处理函数处理的，handle_ns 是处理函数的耗时，用来调整自适应的上限
+  void ReleaseRequest(Stage stage,int64_t handle_ns);
+  bool AcquireCgi();
+  void ReleaseCgi();
+
+  //当前的值，统计信息中使用
+  uint64_t Connections() const{ return connections_.load(std::memory_order_relaxed); }
+  uint64_t Requests() const{ return requests_.load(std::memory_order_relaxed); }
+  uint64_t Cgi() const{ return cgi_.load(std::memory_order_relaxed); }
+  //正在处理的请求数当前的上限，0表示不限制
+  uint64_t RequestLimit() const{ return request_limit_.load(std::memory_order_relaxed); }
+private:
+  AdmissionControl(const AdmissionControl&);
+  AdmissionControl& operator=(const AdmissionControl&);
+
+  //计数加1，超过 limit 的时候减回去并且返回 false，limit 为0表示不限制
+  static bool TryAcquire(std::atomic<uint64_t>* count,uint64_t limit);
+  //一个统计窗口结束，根据窗口内的平均排队程度计算新的上限
+  void UpdateLimit(int64_t now_ns);
+
+  AdmissionLimits limits_;
+  std::atomic<uint64_t> connections_;
+  std::atomic<uint64_t> requests_;
+  std::atomic<uint64_t> cgi_;
+  std::atomic<uint64_t> request_limit_;
+  //自适应上限使用的数据
+  std::atomic<int64_t> min_ns_[STAGE_NUM]; //每一类请求见过的最短处理耗时，0表示还没有样本
+  std::atomic<uint64_t> window_ratio_; //窗口内每个请求的 耗时/最短耗时 之和，定点数
+  std::atomic<uint64_t> window_samples_;
+  std::atomic<int64_t> window_end_; //当前窗口结束的时间，单调时钟的纳秒数
+  std::atomic<int64_t> baseline_end_; //到这个时间之后最短耗时放宽一些，重新学习
+};
+
+}//end of http_server
@@ -0,0 +1,80 @@
+///////////////////////////////////////
+//每个连接的内存池(arena)
+//解析请求的时候，首行、header、body 都复制到这里，Request 中的字段只是指向这里的 StringView，
+//不再为每个字段单独分配 std::string。
+//一个请求处理完之后 Reset，内存块留着给下一个请求使用，长连接上稳定之后解析请求不再分配堆内存
+//和 buffer.hpp 一样，声明和实现都放在 .hpp 中
+///////////////////////////////////////
+#pragma once
+#include <stddef.h>
+#include <string.h>
+#include <memory>
+#include <vector>
+
+class Arena{
+public:
+  static const size_t kBlockSize = 4096;
+  //Reset 之后最多保留这么多字节的内存块，收过大 body 的连接把多出来的还回去
+  static const size_t kKeepSize = 64 * 1024;
+
+  Arena():current_(0),used_(0){}
+
+  //分配 size 个字节，Reset 之前一直有效
+  char* Allocate(size_t size){
+    while(current_ < blocks_.size()){
+      Block& block = blocks_[current_];
+      if(block.size - used_ >= size){
+        char* result = block.data.get() + used_;
+        used_ += size;
+        return result;
+      }
+      //当前块剩下的空间不够，换下一块，剩下的一点空间浪费掉
+      ++current_;
+      used_ = 0;
+    }
+    Block block;
+    block.size = size > kBlockSize ? size : kBlockSize;
+    block.data.reset(new char[block.size]);
+    blocks_.push_back(std::move(block));
+    current_ = blocks_.size() - 1;
+    used_ = size;
+    return blocks_.back().data.get();
+  }
+
+  //复制一段数据，返回复制之后的地址
+  const char* Copy(const char* data,size_t size){
+    char* result = Allocate(size);
+    memcpy(result,data,size);
+    return result;
+  }
+
+  //之前分配的内存全部失效
+  void Reset(){
+    size_t total = 0;
+    size_t keep = 0;
+    while(keep < blocks_.size() && total + blocks_[keep].size <= kKeepSize){
+      total += blocks_[keep].size;
+      ++keep;
+    }
+    blocks_.resize(keep);
+    current_ = 0;
+    used_ = 0;
+  }
+
+  //已经从堆上申请的内存块数，基准测试中用来观察是否还有分配
+  size_t BlockCount() const{
+    return blocks_.size();
+  }
+private:
+  Arena(const Arena&);
+  Arena& operator=(const Arena&);
+
+  struct Block{
+    std::unique_ptr<char[]> data;
+    size_t size;
+    Block():size(0){}
+  };
+  std::vector<Block> blocks_;
+  size_t current_; //正在使用的块
+  size_t used_; //当前块中已经分配出去的字节数
+};
@@ -0,0 +1,69 @@
+#!/bin/bash
+#性能测试：先跑微基准测试，再启动服务器用 http_bench 对 wwwroot 中的静态文件、CGI 和插件发压
+#所有结果汇总成一个 JSON 文件，文件中记录了当前的提交，不同提交之间可以直接比较
+#可以通过环境变量调整：
+#  BENCH_MODE      服务器的运行模式 thread|epoll|pool|reuseport|uring，默认 epoll
+#  BENCH_DURATION  每一组压测的秒数，默认 3
+#  BENCH_PORT      服务器监听的端口，默认 19090，HTTPS 使用下一个端口
+#  BENCH_OUTPUT    结果文件，默认 bench_result.json
+cd "$(dirname "$0")"
+MODE=${BENCH_MODE:-epoll}
+DURATION=${BENCH_DURATION:-3}
+PORT=${BENCH_PORT:-19090}
+OUTPUT=${BENCH_OUTPUT:-bench_result.json}
+
+echo "== micro benchmarks" >&2
+MICRO=$(./micro_bench) || exit 1
+
+#HTTPS 使用临时生成的自签名证书，没有 openssl 命令的环境下跳过 TLS 的压测
+TLS_PORT=$((PORT + 1))
+TLS_DIR=$(mktemp -d)
+TLS_ARGS=""
+if openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes -days 1 \
+    -subj /CN=localhost -keyout "$TLS_DIR/key.pem" -out "$TLS_DIR/cert.pem" >/dev/null 2>&1; then
+  TLS_ARGS="--tls_port=$TLS_PORT --tls_cert=$TLS_DIR/cert.pem --tls_key=$TLS_DIR/key.pem"
+fi
+
+#长连接上的请求数不设上限，避免压测过程中连接被周期性地关闭
+./http_server 127.0.0.1 $PORT --mode=$MODE --log_level=error \
+  --keepalive_requests=100000000 --plugin=./add_plugin.so $TLS_ARGS >/dev/null 2>&1 &
+SERVER_PID=$!
+trap 'kill $SERVER_PID 2>/dev/null; wait $SERVER_PID 2>/dev/null; rm -rf "$TLS_DIR"' EXIT
+for i in $(seq 50); do
+  curl -s -o /dev/null http://127.0.0.1:$PORT/index.html 2>/dev/null && break
+  #没有 curl 的环境下直接等待
+  command -v curl >/dev/null || { sleep 1; break; }
+  sleep 0.1
+done
+
+LOAD=""
+run(){
+  echo "== $1" >&2
+  local result
+  result=$(./http_bench --port=$PORT --duration=$DURATION --name="$@") || exit 1
+  LOAD="$LOAD${LOAD:+,}$result"
+}
+run_tls(){
+  [ -n "$TLS_ARGS" ] && run "$@" --port=$TLS_PORT --tls=on
+}
+run static_small_keepalive --path=/index.html --connections=16
+run static_small_close --path=/index.html --connections=16 --keepalive=off
+run static_large_keepalive --path=/css/bootstrap.min.css --connections=16
+run static_open_loop --path=/index.html --connections=64 --rate=2000
+run cgi_get --path="/add?a=1&b=2" --connections=4
+run cgi_post --path=/add --method=POST --body="a=1&b=2" --connections=4
+run plugin_get --path="/plugin/add?a=1&b=2" --connections=16
+#每个请求一个新连接：握手的速率，完整握手和恢复会话的握手分开测
+run_tls tls_handshake_full --path=/index.html --connections=16 --keepalive=off
+run_tls tls_handshake_resumed --path=/index.html --connections=16 --keepalive=off --tls_resume=on
+#长连接：加密之后的吞吐
+run_tls tls_static_small_keepalive --path=/index.html --connections=16
+run_tls tls_static_large_keepalive --path=/css/bootstrap.min.css --connections=16
+
+COMMIT=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+cat > "$OUTPUT" <<EOF
+{"commit":"$COMMIT","date":"$(date -u +%Y-%m-%dT%H:%M:%SZ)","mode":"$MODE","duration_s":$DURATION,
+"micro":$MICRO,
+"load":[$LOAD]}
+EOF
+echo "== results written to $OUTPUT" >&2
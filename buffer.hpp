@@ -0,0 +1,105 @@
+///////////////////////////////////////
+//每个连接的读缓冲区
+//和 util.hpp 一样，声明和实现都放在 .hpp 中
+///////////////////////////////////////
+#pragma once
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <vector>
+
+//一块连续的内存，[read_index_,write_index_) 之间是还没有被解析的数据
+//  +-------------------+------------------+------------------+
+//  |  已经解析过的数据  |   可读(未解析)    |      可写空间     |
+//  +-------------------+------------------+------------------+
+//  0            read_index_        write_index_           size
+//从 socket 读数据的时候一次读尽可能多的数据，而不是一个字节一个字节地 recv
+class Buffer{
+public:
+  static const size_t kInitialSize = 4096;
+  static const size_t kShrinkSize = 256 * 1024;
+
+  Buffer()
+    :buf_(kInitialSize),read_index_(0),write_index_(0){
+  }
+  size_t ReadableBytes() const{
+    return write_index_ - read_index_;
+  }
+  //可读数据的起始位置
+  const char* Peek() const{
+    return buf_.data() + read_index_;
+  }
+  //从 Peek() + start 开始查找换行符，找不到返回 NULL
+  const char* FindEOL(size_t start) const{
+    if(start >= ReadableBytes()){
+      return NULL;
+    }
+    const void* eol = memchr(Peek() + start,'\n',ReadableBytes() - start);
+    return static_cast<const char*>(eol);
+  }
+  //标记前 len 个字节已经解析完了
+  void Retrieve(size_t len){
+    if(len >= ReadableBytes()){
+      RetrieveAll();
+      return;
+    }
+    read_index_ += len;
+  }
+  void RetrieveAll(){
+    read_index_ = 0;
+    write_index_ = 0;
+    //收过大请求之后把多开辟的空间还回去，避免长连接一直占着大块内存
+    if(buf_.size() > kShrinkSize){
+      std::vector<char>(kInitialSize).swap(buf_);
+    }
+  }
+  void Append(const char* data,size_t len){
+    MakeSpace(len);
+    memcpy(buf_.data() + write_index_,data,len);
+    write_index_ += len;
+  }
+  //从文件描述符中读取数据，返回值和 read 的含义一样
+  //除了缓冲区剩余的空间外，再借助栈上 64k 的空间，一次系统调用尽量多读一些数据，
+  //这样缓冲区的初始大小不用很大，连接多的时候也不会占用太多内存
+  ssize_t ReadFd(int fd){
+    char extra_buf[65536];
+    iovec vec[2];
+    size_t writable = buf_.size() - write_index_;
+    vec[0].iov_base = buf_.data() + write_index_;
+    vec[0].iov_len = writable;
+    vec[1].iov_base = extra_buf;
+    vec[1].iov_len = sizeof(extra_buf);
+    ssize_t n = readv(fd,vec,2);
+    if(n <= 0){
+      return n;
+    }
+    if(static_cast<size_t>(n) <= writable){
+      write_index_ += n;
+    }else {
+      write_index_ = buf_.size();
+      Append(extra_buf,n - writable);
+    }
+    return n;
+  }
+private:
+  void MakeSpace(size_t len){
+    if(buf_.size() - write_index_ >= len){
+      return;
+    }
+    //先把已经解析过的数据占用的空间挪出来，还不够再扩容
+    size_t readable = ReadableBytes();
+    if(read_index_ > 0){
+      memmove(buf_.data(),Peek(),readable);
+      read_index_ = 0;
+      write_index_ = readable;
+    }
+    if(buf_.size() - write_index_ < len){
+      buf_.resize(std::max(buf_.size() * 2,write_index_ + len));
+    }
+  }
+
+  std::vector<char> buf_;
+  size_t read_index_;
+  size_t write_index_;
+};
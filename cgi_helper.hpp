@@ -0,0 +1,162 @@
+///////////////////////////////////////
+//给 CGI 程序使用的辅助库
+//CGI 程序只需要实现一个处理函数，然后在 main 中调用 CgiHelper::Run，
+//同一个程序既可以被服务器常驻启动(通过 cgi_protocol.hpp 中的协议一次处理很多个请求)，
+//也可以按照传统 CGI 的方式运行(从环境变量和标准输入读取一个请求)
+///////////////////////////////////////
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <exception>
+#include <functional>
+#include <unordered_map>
+#include "cgi_protocol.hpp"
+
+struct CgiRequest{
+  std::string method;
+  std::string query_string;
+  std::string path;
+  std::string body;
+  //服务器传过来的所有元数据，例如 REQUEST_METHOD
+  std::unordered_map<std::string,std::string> params;
+
+  std::string Param(const std::string& name) const{
+    auto it = params.find(name);
+    return it == params.end() ? "" : it->second;
+  }
+};
+
+//把 CGI 程序的输出发给服务器，每次 Write 都会马上发出去，服务器收到之后马上转发给客户端
+//常驻的工作进程中按帧发送，传统 CGI 方式下直接写到标准输出
+class CgiWriter{
+public:
+  CgiWriter(int fd,bool framed):fd_(fd),framed_(framed){}
+  //返回0表示成功，返回小于0表示服务器已经不要后面的数据了(例如客户端已经断开)
+  int Write(const char* data,size_t size){
+    if(size == 0){
+      return 0;
+    }
+    if(framed_){
+      return CgiProtocol::WriteFrame(fd_,CGI_STDOUT,data,size);
+    }
+    return CgiProtocol::WriteN(fd_,data,size);
+  }
+  int Write(const std::string& data){
+    return Write(data.data(),data.size());
+  }
+private:
+  int fd_;
+  bool framed_;
+};
+
+//处理一个请求，把 header + 空行 + body 写到 output 中
+//返回0表示成功，返回其他值表示失败，服务器会返回 502
+typedef std::function<int (const CgiRequest& req,std::string* output)> CgiHandler;
+//输出比较大或者要很久才能算完的程序，可以一边计算一边通过 writer 输出
+//先输出 header + 空行，之后的 body 可以分很多次输出，没有 Content-Length 的话服务器会用 chunked 编码转发
+typedef std::function<int (const CgiRequest& req,CgiWriter* writer)> CgiStreamHandler;
+
+class CgiHelper{
+public:
+  //CGI 程序的主循环，返回值可以直接作为 main 函数的返回值
+  static int Run(const CgiHandler& handler){
+    return RunStream([&handler](const CgiRequest& req,CgiWriter* writer){
+      std::string output;
+      int ret = handler(req,&output);
+      if(ret == 0 && writer->Write(output) < 0){
+        return 1;
+      }
+      return ret;
+    });
+  }
+
+  static int RunStream(const CgiStreamHandler& handler){
+    const char* worker_fd = getenv(CGI_WORKER_ENV);
+    if(worker_fd != NULL){
+      return RunWorker(atoi(worker_fd),handler);
+    }
+    return RunOnce(handler);
+  }
+
+  //把一个 body 包装成最简单的 CGI 输出，status 不为空的时候通过 Status 头部指定状态码，例如 "400 Bad Request"
+  static void Response(const std::string& body,std::string* output,const std::string& status = ""){
+    *output = status.empty() ? "" : "Status: " + status + "\n";
+    *output += "Content-Length: " + std::to_string(body.size()) + "\n";
+    *output += "\n"; //这个\n是HTTP协议中的空行
+    *output += body;
+  }
+
+private:
+  static void FillRequest(CgiRequest* req){
+    req->method = req->Param("REQUEST_METHOD");
+    req->query_string = req->Param("QUERY_STRING");
+    req->path = req->Param("PATH_INFO");
+  }
+
+  //处理函数抛出的异常也当作失败，不能让常驻的工作进程因为一个坏请求就退出
+  static int Call(const CgiStreamHandler& handler,const CgiRequest& req,CgiWriter* writer){
+    try{
+      return handler(req,writer);
+    }catch(const std::exception& e){
+      fprintf(stderr,"cgi handler error: %s\n",e.what());
+      return 1;
+    }
+  }
+
+  //传统 CGI：请求的元数据在环境变量中，body 从标准输入读取
+  static int RunOnce(const CgiStreamHandler& handler){
+    CgiRequest req;
+    const char* names[] = {"REQUEST_METHOD","QUERY_STRING","CONTENT_LENGTH","SCRIPT_NAME","PATH_INFO"};
+    for(size_t i = 0;i < sizeof(names) / sizeof(names[0]);++i){
+      const char* value = getenv(names[i]);
+      if(value != NULL){
+        req.params[names[i]] = value;
+      }
+    }
+    FillRequest(&req);
+    size_t content_length = atol(req.Param("CONTENT_LENGTH").c_str());
+    if(content_length > 0){
+      req.body.resize(content_length);
+      if(CgiProtocol::ReadN(0,&req.body[0],content_length) < 0){
+        return 1;
+      }
+    }
+    CgiWriter writer(1,false);
+    return Call(handler,req,&writer);
+  }
+
+  //常驻的工作进程：循环地读取请求帧，处理之后写回响应帧，服务器关闭连接之后退出
+  static int RunWorker(int fd,const CgiStreamHandler& handler){
+    while(true){
+      CgiRequest req;
+      int type = 0;
+      std::string payload;
+      if(CgiProtocol::ReadFrame(fd,&type,&payload) < 0){
+        return 0;
+      }
+      if(type != CGI_PARAMS){
+        return 1;
+      }
+      CgiProtocol::DecodeParams(payload,&req.params);
+      FillRequest(&req);
+      //长度为0的 CGI_STDIN 表示 body 结束
+      while(true){
+        if(CgiProtocol::ReadFrame(fd,&type,&payload) < 0 || type != CGI_STDIN){
+          return 1;
+        }
+        if(payload.empty()){
+          break;
+        }
+        req.body += payload;
+      }
+      CgiWriter writer(fd,true);
+      int ret = Call(handler,req,&writer);
+      uint32_t status = htonl(static_cast<uint32_t>(ret));
+      if(CgiProtocol::WriteFrame(fd,CGI_END,reinterpret_cast<const char*>(&status),
+                                 sizeof(status)) < 0){
+        return 1;
+      }
+    }
+  }
+};
@@ -14,53 +14,47 @@
 //5.to_string(C++11)
 /////////////////////////////////////////
 
-#include <iostream>
 #include <string>
 #include "util.hpp"
+#include "cgi_helper.hpp"
 #include <sstream>
 
-void HttpResponse(const std::string& body){
-  std::cout << "Content-Length: " << body.size() << "\n";
-  std::cout << "\n"; //这个\n是HTTP协议中的空行
-  std::cout << body;
-  return;
-}
-
-
-
 //生成的是CGI程序，通过这个CGI程序完成不同的业务。
 //不同的业务有不同的CGI程序
 //这个CGI程序是完成两个数的相加运算
-int main(){
+//请求的元数据和 body 由 CgiHelper 准备好，不管是常驻的工作进程还是传统的 CGI 方式都是一样的
+static int Add(const CgiRequest& req,std::string* output){
   //1.获取方法method
-  const char* method = getenv("REQUEST_METHOD");
-  if(method == NULL){
-    HttpResponse("No env REQUEST_METHOD!");
-    return 1; 
+  if(req.method == ""){
+    CgiHelper::Response("No env REQUEST_METHOD!",output);
+    return 0;
   }
   //2.如果是GET请求，从QUERY_STRING中读取请求参数
-  //std::string(method)构造的是匿名对象，用来取出字符串内容和GET比较
   StringUtil::UrlParam params;
-  if(std::string(method) == "GET"){
-    const char* query_string = getenv("QUERY_STRING");
-    StringUtil::ParseUrlParam(query_string,&params);
-  }else if(std::string(method) == "POST"){
-    //3.如果是POST请求，从CONTENT_LENGTH中读取body的长度，
-    //  根据body的长度从标准输入中读取请求的body(重定向是生效的，所以是从管道中标准输入的读取数据)
-    //const char* content_length = getenv("CONTENT_LENGTH");
-   //4.解析query_string或者body的数据
-    char buf[1024 * 10] = {0};
-    read(0,buf,sizeof(buf)-1);
-    StringUtil::ParseUrlParam(buf,&params);
+  if(req.method == "GET"){
+    StringUtil::ParseUrlParam(req.query_string,&params);
+  }else if(req.method == "POST"){
+    //3.如果是POST请求，参数在请求的body中
+    //4.解析query_string或者body的数据
+    StringUtil::ParseUrlParam(req.body,&params);
   }
 
   //5.根据业务进行计算，此处计算是a+b的值
-  int a = std::stoi(params["a"]);
-  int b = std::stoi(params["b"]);
-  int result = a + b;
-  //6.根据计算结果，构造响应数据，写回到标准输出中
+  //参数不对的时候返回 400，不能用 stoi：抛出的异常会让这个请求变成 502
+  long a = 0;
+  long b = 0;
+  if(StringUtil::ParseInt(params["a"],&a) < 0 || StringUtil::ParseInt(params["b"],&b) < 0){
+    CgiHelper::Response("<h1>invalid a or b</h1>",output,"400 Bad Request");
+    return 0;
+  }
+  long result = a + b;
+  //6.根据计算结果，构造响应数据
   std::stringstream ss;
   ss << "<h1> result = " << result << "</h1>";
-  HttpResponse(ss.str());
+  CgiHelper::Response(ss.str(),output);
   return 0;
 }
+
+int main(){
+  return CgiHelper::Run(Add);
+}
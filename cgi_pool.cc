@@ -0,0 +1,406 @@
+#include "cgi_pool.h"
+#include "cgi_protocol.hpp"
+#include "util.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+namespace http_server{
+
+//工作进程中和服务器通信的 socket 固定放在这个文件描述符上
+static const int kWorkerFd = 3;
+
+CgiPool::CgiPool(size_t max_workers,int timeout)
+  :max_workers_(max_workers),timeout_(timeout){
+}
+
+CgiPool::~CgiPool(){
+  for(auto& item : programs_){
+    for(size_t i = 0;i < item.second->idle.size();++i){
+      Discard(item.first,item.second->idle[i]);
+    }
+  }
+}
+
+CgiPool::Program* CgiPool::GetProgram(const std::string& program){
+  std::unique_ptr<Program>& result = programs_[program];
+  if(!result){
+    result.reset(new Program());
+  }
+  return result.get();
+}
+
+int CgiPool::Execute(const std::string& program,const CgiParams& params,const std::string& body,
+                     bool wait,const CgiOutputFunc& on_output,CgiCall* call){
+  if(max_workers_ == 0){
+    if(Fork(program,params,body,call) < 0){
+      return -1;
+    }
+    call->wait = wait;
+    return Complete(call,ReadOutput(call,on_output));
+  }
+  for(int attempt = 0;attempt < 2;++attempt){
+    Worker worker;
+    int ret = Acquire(program,wait,&worker);
+    if(ret < 0){
+      return ret;
+    }
+    if(Send(worker,params,body) < 0){
+      //请求还没有发出去工作进程就已经退出了，换一个新的工作进程再试一次
+      //请求已经发出去之后出错的话不能重试，工作进程可能已经处理了一部分
+      Discard(program,worker);
+      LOG(WARNING) << "CGI worker gone, retry! program=" << program << "\n";
+      continue;
+    }
+    call->program = program;
+    call->pid = worker.pid;
+    call->fd = worker.fd;
+    call->pooled = true;
+    call->wait = wait;
+    return Complete(call,ReadOutput(call,on_output));
+  }
+  return -1;
+}
+
+int CgiPool::Resume(CgiCall* call,const CgiOutputFunc& on_output){
+  return Complete(call,ReadOutput(call,on_output));
+}
+
+void CgiPool::Abort(CgiCall* call){
+  if(call->Active()){
+    Complete(call,-1);
+  }
+}
+
+int CgiPool::Complete(CgiCall* call,int ret){
+  if(ret == 1 || ret == 2){
+    return ret;
+  }
+  if(call->pooled){
+    Worker worker;
+    worker.pid = call->pid;
+    worker.fd = call->fd;
+    if(ret >= 0){
+      Release(call->program,worker);
+    }else {
+      Discard(call->program,worker);
+    }
+  }else {
+    //fork 出来的进程：客户端已经不要了或者超时的时候，子进程没有必要再算下去
+    close(call->fd);
+    if(ret < 0){
+      kill(call->pid,SIGKILL);
+    }
+    //只等待自己的子进程，wait(NULL) 可能会回收掉常驻的 CGI 工作进程
+    waitpid(call->pid,NULL,0);
+  }
+  call->Clear();
+  return ret == 3 ? -1 : ret;
+}
+
+int CgiPool::Acquire(const std::string& program,bool wait,Worker* worker){
+  std::unique_lock<std::mutex> lock(mutex_);
+  Program* p = GetProgram(program);
+  while(true){
+    while(!p->idle.empty()){
+      Worker idle = p->idle.back();
+      p->idle.pop_back();
+      if(waitpid(idle.pid,NULL,WNOHANG) == 0){
+        *worker = idle;
+        return 0;
+      }
+      //空闲的时候已经退出了(例如崩溃)，回收掉，后面会启动新的
+      LOG(WARNING) << "CGI worker exited! program=" << program << " pid=" << idle.pid << "\n";
+      close(idle.fd);
+      --p->total;
+    }
+    if(p->total < max_workers_){
+      ++p->total;
+      //fork 比较慢，不要持有锁
+      lock.unlock();
+      if(Spawn(program,worker) < 0){
+        lock.lock();
+        --p->total;
+        p->cond.notify_one();
+        return -1;
+      }
+      return 0;
+    }
+    if(!wait){
+      return -3;
+    }
+    p->cond.wait(lock);
+  }
+}
+
+void CgiPool::Release(const std::string& program,const Worker& worker){
+  std::lock_guard<std::mutex> lock(mutex_);
+  Program* p = GetProgram(program);
+  p->idle.push_back(worker);
+  p->cond.notify_one();
+}
+
+void CgiPool::Discard(const std::string& program,const Worker& worker){
+  close(worker.fd);
+  kill(worker.pid,SIGKILL);
+  waitpid(worker.pid,NULL,0);
+  std::lock_guard<std::mutex> lock(mutex_);
+  Program* p = GetProgram(program);
+  --p->total;
+  p->cond.notify_one();
+}
+
+int CgiPool::Spawn(const std::string& program,Worker* worker){
+  int sv[2];
+  if(socketpair(AF_UNIX,SOCK_STREAM | SOCK_CLOEXEC,0,sv) < 0){
+    LOG(ERROR) << "socketpair error! errno=" << errno << "\n";
+    return -1;
+  }
+  //exec 要用到的参数在 fork 之前准备好，多线程程序 fork 出来的子进程中不能再分配内存
+  //请求的元数据通过协议传递，这里的环境变量只用来告诉程序它是常驻的工作进程
+  std::string env = std::string(CGI_WORKER_ENV) + "=" + std::to_string(kWorkerFd);
+  char* argv[] = {const_cast<char*>(program.c_str()),NULL};
+  char* envp[] = {const_cast<char*>(env.c_str()),NULL};
+  pid_t pid = fork();
+  if(pid < 0){
+    LOG(ERROR) << "fork error! errno=" << errno << "\n";
+    close(sv[0]);
+    close(sv[1]);
+    return -1;
+  }
+  if(pid == 0){
+    //子进程：通信用的 socket 放到固定的位置上，标准输入不再使用
+    if(sv[1] == kWorkerFd){
+      fcntl(kWorkerFd,F_SETFD,0);
+    }else {
+      dup2(sv[1],kWorkerFd);
+    }
+    int null_fd = open("/dev/null",O_RDONLY);
+    if(null_fd >= 0){
+      dup2(null_fd,0);
+    }
+    //服务器的监听 socket 和其他连接不能留给工作进程
+#ifdef SYS_close_range
+    if(syscall(SYS_close_range,kWorkerFd + 1,~0U,0) < 0)
+#endif
+    {
+      for(int fd = kWorkerFd + 1;fd < 1024;++fd){
+        close(fd);
+      }
+    }
+    execve(program.c_str(),argv,envp);
+    //程序替换失败，子进程必须直接退出，不能回到服务器的代码中继续执行
+    _exit(127);
+  }
+  close(sv[1]);
+  worker->pid = pid;
+  worker->fd = sv[0];
+  LOG(INFO) << "CGI worker start! program=" << program << " pid=" << pid << "\n";
+  return 0;
+}
+
+int CgiPool::Send(const Worker& worker,const CgiParams& params,const std::string& body){
+  //body 全部发出去之后工作进程才开始处理，所以这里不会和工作进程互相等待
+  if(CgiProtocol::WriteFrame(worker.fd,CGI_PARAMS,CgiProtocol::EncodeParams(params)) < 0
+      || (!body.empty() && CgiProtocol::WriteFrame(worker.fd,CGI_STDIN,body) < 0)
+      || CgiProtocol::WriteFrame(worker.fd,CGI_STDIN,"",0) < 0){
+    return -1;
+  }
+  return 0;
+}
+
+int CgiPool::Fork(const std::string& program,const CgiParams& params,const std::string& body,
+                  CgiCall* call){
+  //1.创建一对 socket，子进程的标准输入和标准输出都是其中的一端
+  //  只用一个文件描述符，等待的时候可以同时等可读(有输出)和可写(body 还没写完)，
+  //  写完 body 之后 shutdown 写的一端，CGI 程序照样读到文件结束
+  //  SOCK_CLOEXEC 避免其他线程同时 fork 出来的子进程继承这些 socket
+  int sv[2];
+  if(socketpair(AF_UNIX,SOCK_STREAM | SOCK_CLOEXEC,0,sv) < 0){
+    LOG(ERROR) << "socketpair error! errno=" << errno << "\n";
+    return -1;
+  }
+  int father_fd = sv[0];
+  int child_fd = sv[1];
+  //2.环境变量放在子进程自己的 envp 中，exec 用到的参数都在 fork 之前准备好
+  std::vector<std::string> envs;
+  for(size_t i = 0;i < params.size();++i){
+    envs.push_back(params[i].first + "=" + params[i].second);
+  }
+  std::vector<char*> envp;
+  for(size_t i = 0;i < envs.size();++i){
+    envp.push_back(const_cast<char*>(envs[i].c_str()));
+  }
+  envp.push_back(NULL);
+  char* argv[] = {const_cast<char*>(program.c_str()),NULL};
+  //3.fork,父子进程
+  pid_t pid = fork();
+  if(pid < 0){
+    LOG(ERROR) << "fork error! errno=" << errno << "\n";
+    close(father_fd);
+    close(child_fd);
+    return -1;
+  }
+  if(pid == 0){
+    //子进程流程
+    //  a)把标准输入和标准输出重定向到 socket
+    dup2(child_fd,0);
+    dup2(child_fd,1);
+    //  b)进行进程的程序替换
+    execve(program.c_str(),argv,envp.data());
+    //  c)程序替换失败，子进程必须直接退出，不能回到服务器的代码中继续执行
+    _exit(127);
+  }
+  //父进程流程
+  close(child_fd);
+  //设置成非阻塞的，body 写不进去或者没有输出的时候 ReadOutput 自己决定要不要等待
+  //body 比 socket 的缓冲区大的时候先写完再读输出会死锁：CGI 程序的输出写满了缓冲区，
+  //阻塞在写输出上，不再读 body
+  fcntl(father_fd,F_SETFL,fcntl(father_fd,F_GETFL,0) | O_NONBLOCK);
+  call->pid = pid;
+  call->fd = father_fd;
+  call->pooled = false;
+  call->input.assign(body);
+  call->input_pos = 0;
+  WriteInput(call);
+  return 0;
+}
+
+bool CgiPool::WriteInput(CgiCall* call){
+  bool progress = false;
+  while(call->Writing()){
+    //CGI 程序可能不读 body 就退出了，MSG_NOSIGNAL 避免 SIGPIPE
+    ssize_t write_size = send(call->fd,call->input.data() + call->input_pos,
+                              call->input.size() - call->input_pos,MSG_DONTWAIT | MSG_NOSIGNAL);
+    if(write_size > 0){
+      call->input_pos += write_size;
+      progress = true;
+      continue;
+    }
+    if(write_size < 0 && errno == EINTR){
+      continue;
+    }
+    if(write_size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+      return progress;
+    }
+    //CGI 程序已经不读了，剩下的 body 丢掉，输出还是照常读取
+    LOG(WARNING) << "CGI write body error! pid=" << call->pid << " errno=" << errno << "\n";
+    break;
+  }
+  call->input.clear();
+  call->input_pos = 0;
+  shutdown(call->fd,SHUT_WR);
+  return progress;
+}
+
+int CgiPool::ReadOutput(CgiCall* call,const CgiOutputFunc& on_output){
+  //超时用单调时钟计算，修改系统时间不会让请求提前超时
+  const int64_t timeout_ns = static_cast<int64_t>(timeout_) * 1000 * 1000 * 1000;
+  int64_t deadline = TimeUtil::MonotonicNS() + timeout_ns;
+  while(true){
+    //1.常驻的工作进程的输出按帧处理，暂停之前已经读到的帧还在 call->output 中，继续的时候先处理它们
+    while(call->pooled && call->output.size() - call->output_pos >= CgiProtocol::kHeaderSize){
+      const char* frame = call->output.data() + call->output_pos;
+      uint32_t net_len = 0;
+      memcpy(&net_len,frame + 1,sizeof(net_len));
+      size_t len = ntohl(net_len);
+      int type = static_cast<unsigned char>(frame[0]);
+      if(len > CgiProtocol::kMaxFrameSize){
+        LOG(ERROR) << "CGI worker protocol error! pid=" << call->pid << " len=" << len << "\n";
+        return -1;
+      }
+      if(call->output.size() - call->output_pos < CgiProtocol::kHeaderSize + len){
+        break;
+      }
+      const char* payload = frame + CgiProtocol::kHeaderSize;
+      call->output_pos += CgiProtocol::kHeaderSize + len;
+      if(type == CGI_END && len == sizeof(uint32_t)){
+        uint32_t status = 0;
+        memcpy(&status,payload,sizeof(status));
+        return ntohl(status) == 0 ? 0 : 3;
+      }
+      if(type != CGI_STDOUT){
+        LOG(ERROR) << "CGI worker protocol error! pid=" << call->pid << " type=" << type << "\n";
+        return -1;
+      }
+      //客户端接收得慢的时候 on_output 要求暂停，这里也就不再读取，
+      //CGI 程序的输出积压在缓冲区中，写满之后 CGI 程序自己也会阻塞
+      int ret = on_output(payload,len);
+      if(ret < 0){
+        return -1;
+      }
+      if(ret == 1){
+        return 1;
+      }
+      //超时是指多久没有任何输出，一直在输出的程序可以运行很久
+      deadline = TimeUtil::MonotonicNS() + timeout_ns;
+    }
+    //处理过的数据占的空间挪出来，缓冲区中最多只有不到一帧
+    call->output.erase(0,call->output_pos);
+    call->output_pos = 0;
+    //2.fork 出来的进程先把能写进去的 body 写进去，写了 body 也算有进展
+    if(call->Writing() && WriteInput(call)){
+      deadline = TimeUtil::MonotonicNS() + timeout_ns;
+    }
+    //3.读取新的输出，没有数据的时候不阻塞
+    char buf[64 * 1024];
+    ssize_t read_size = call->pooled ? recv(call->fd,buf,sizeof(buf),MSG_DONTWAIT)
+                                     : read(call->fd,buf,sizeof(buf));
+    if(read_size > 0){
+      if(call->pooled){
+        call->output.append(buf,read_size);
+        continue;
+      }
+      //fork 出来的进程直接输出到 socket，输出中可以有 '\0'
+      int ret = on_output(buf,read_size);
+      if(ret < 0){
+        return -1;
+      }
+      if(ret == 1){
+        return 1;
+      }
+      deadline = TimeUtil::MonotonicNS() + timeout_ns;
+      continue;
+    }
+    if(read_size < 0 && errno == EINTR){
+      continue;
+    }
+    if(!call->pooled && (read_size == 0 || errno == ECONNRESET)){
+      //fork 出来的进程读到文件结束就是处理完了
+      //CGI 程序没有读完 body 就退出的时候，输出读完之后得到的是 ECONNRESET 而不是文件结束
+      return 0;
+    }
+    if(read_size == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)){
+      LOG(ERROR) << "CGI worker crashed! pid=" << call->pid << "\n";
+      return -1;
+    }
+    //4.暂时没有输出，反应堆的线程不在这里等待，调用方等 fd 可读(或者可写)之后再调用 Resume
+    if(!call->wait){
+      return 2;
+    }
+    int64_t remaining = (deadline - TimeUtil::MonotonicNS()) / (1000 * 1000);
+    pollfd pfd;
+    pfd.fd = call->fd;
+    pfd.events = call->Writing() ? POLLIN | POLLOUT : POLLIN;
+    int ret = remaining > 0 ? poll(&pfd,1,remaining) : 0;
+    if(ret < 0 && errno == EINTR){
+      continue;
+    }
+    if(ret == 0){
+      LOG(ERROR) << "CGI worker timeout! pid=" << call->pid << "\n";
+      return -2;
+    }
+    if(ret < 0){
+      LOG(ERROR) << "CGI poll error! errno=" << errno << "\n";
+      return -1;
+    }
+  }
+}
+
+}//end of http_server
@@ -0,0 +1,125 @@
+#pragma once
+//常驻的 CGI 工作进程池
+//每个 CGI 程序第一次被请求的时候才启动工作进程，之后一直保留，最多 max_workers 个，
+//请求通过 cgi_protocol.hpp 中的帧发给空闲的工作进程，所有工作进程都在忙的时候就等待。
+//工作进程崩溃或者超时之后会被回收，下一个请求到来的时候再启动一个新的
+//max_workers 为0的时候不使用常驻的工作进程，每个请求 fork + exec 一次(传统的 CGI)
+//客户端接收得慢的时候可以暂停读取 CGI 的输出(见 CgiOutputFunc)，反应堆的线程不需要阻塞等待客户端，
+//暂停的请求保存在 CgiCall 中，连接可写之后调用 Resume 从暂停的地方继续
+//反应堆的线程也不等待 CGI 程序的输出，暂时没有输出的时候同样返回，调用方等 CgiCall::fd 可读之后再 Resume
+//fork 出来的 CGI 程序的 body 和输出交替读写，body 比缓冲区大的时候也不会和 CGI 程序互相等待
+#include <sys/types.h>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace http_server{
+
+//传给 CGI 程序的请求元数据，例如 ("REQUEST_METHOD","GET")
+typedef std::vector<std::pair<std::string,std::string> > CgiParams;
+//CGI 程序的输出每到一段就调用一次，返回0表示继续，返回1表示客户端暂时写不进去了，暂停读取后面的输出，
+//返回小于0表示不再需要后面的输出(例如客户端已经断开)
+typedef std::function<int (const char* data,size_t size)> CgiOutputFunc;
+
+//一个已经交给 CGI 程序、输出还没有读完的请求
+//暂停期间 CGI 程序的输出积压在 socket 或者管道的缓冲区中，写满之后 CGI 程序自己会阻塞
+struct CgiCall{
+  std::string program;
+  pid_t pid;
+  int fd; //读取 CGI 程序输出的文件描述符，-1表示没有正在执行的请求
+  bool pooled; //常驻的工作进程，输出按帧读取；否则是为这个请求 fork 出来的进程，输入输出都是 fd 这个 socket
+  bool wait; //没有输出的时候阻塞等待(最多 timeout 秒)，否则返回让调用方等 fd 可读
+  //常驻的工作进程已经读到、还没有处理的数据，一帧可能分几次才能收完整
+  std::string output;
+  size_t output_pos;
+  //fork 出来的进程还没有写进去的 body，input_pos 之前的已经写完了
+  std::string input;
+  size_t input_pos;
+  CgiCall():pid(-1),fd(-1),pooled(false),wait(true),output_pos(0),input_pos(0){}
+  bool Active() const{
+    return fd >= 0;
+  }
+  //body 还没有写完，等待的时候除了等 fd 可读还要等 fd 可写
+  bool Writing() const{
+    return input_pos < input.size();
+  }
+  //请求结束，output 的容量留着给下一个请求
+  void Clear(){
+    program.clear();
+    pid = -1;
+    fd = -1;
+    pooled = false;
+    wait = true;
+    output.clear();
+    output_pos = 0;
+    input.clear();
+    input_pos = 0;
+  }
+};
+
+class CgiPool{
+public:
+  //max_workers 是每个 CGI 程序最多的工作进程数，timeout 是 CGI 程序最多多少秒没有输出
+  CgiPool(size_t max_workers,int timeout);
+  ~CgiPool();
+  //把请求交给 program 的一个工作进程处理，CGI 程序输出的 header + 空行 + body 陆续交给 on_output
+  //wait 为 false 的时候什么都不等待(反应堆的线程)：
+  //  工作进程都在忙就返回-3，暂停的请求占着工作进程，只有这个线程能让它们继续，在这里等待就再也等不到了
+  //  CGI 程序暂时没有输出就返回2，超时由调用方计算，超时之后调用 Abort
+  //  call->Writing() 的时候 body 还没有写完，除了 fd 可读，fd 可写的时候也要 Resume
+  //返回0表示成功，返回1表示 on_output 要求暂停，返回2表示在等 CGI 程序的输出，
+  //这两种情况请求保存在 call 中，之后必须调用 Resume 或者 Abort，
+  //返回-2表示超时，返回-3表示工作进程都在忙，返回其他小于0的值表示工作进程启动失败、崩溃、处理失败
+  //或者 on_output 返回了失败
+  int Execute(const std::string& program,const CgiParams& params,const std::string& body,
+              bool wait,const CgiOutputFunc& on_output,CgiCall* call);
+  //继续读取暂停的请求的输出，返回值和 Execute 一样
+  int Resume(CgiCall* call,const CgiOutputFunc& on_output);
+  //放弃暂停的请求，CGI 程序还没有输出完，进程不能再用了
+  void Abort(CgiCall* call);
+private:
+  struct Worker{
+    pid_t pid;
+    int fd; //和工作进程通信的 socket
+    Worker():pid(-1),fd(-1){}
+  };
+  struct Program{
+    std::vector<Worker> idle; //空闲的工作进程
+    size_t total; //已经启动的工作进程数，包括正在处理请求的
+    std::condition_variable cond; //有工作进程空闲下来或者退出的时候通知
+    Program():total(0){}
+  };
+  //拿到一个可以使用的工作进程，没有空闲的就启动一个新的，已经到上限了就等待(wait 为 false 的时候返回-3)
+  int Acquire(const std::string& program,bool wait,Worker* worker);
+  //请求处理完，工作进程放回空闲列表
+  void Release(const std::string& program,const Worker& worker);
+  //工作进程已经不能用了，杀掉并且回收
+  void Discard(const std::string& program,const Worker& worker);
+  int Spawn(const std::string& program,Worker* worker);
+  //把请求发给工作进程，返回小于0表示工作进程已经退出了
+  int Send(const Worker& worker,const CgiParams& params,const std::string& body);
+  //fork 一个进程处理这一个请求，标准输入和标准输出是同一个 socket，body 放在 call->input 中边读输出边写
+  int Fork(const std::string& program,const CgiParams& params,const std::string& body,CgiCall* call);
+  //把 call->input 中剩下的 body 写进去，写不进去就返回，全部写完之后关闭写的一端让 CGI 程序读到文件结束
+  //返回 true 表示这次写进去了一些
+  bool WriteInput(CgiCall* call);
+  //读取 CGI 程序的输出交给 on_output，返回0表示 CGI 程序处理成功，返回1表示暂停，
+  //返回2表示暂时没有输出(只在 call->wait 为 false 的时候)，返回3表示 CGI 程序处理失败但是工作进程还可以继续使用，
+  //返回-2表示超时，返回-1表示进程已经崩溃或者 on_output 失败(进程还没处理完，也不能再用了)
+  int ReadOutput(CgiCall* call,const CgiOutputFunc& on_output);
+  //根据 ReadOutput 的结果回收进程，没有暂停或者等待的时候清空 call，返回值是 Execute 的返回值
+  int Complete(CgiCall* call,int ret);
+  Program* GetProgram(const std::string& program);
+
+  size_t max_workers_;
+  int timeout_;
+  std::mutex mutex_;
+  std::unordered_map<std::string,std::unique_ptr<Program> > programs_;
+};
+
+}//end of http_server
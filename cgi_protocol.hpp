@@ -0,0 +1,138 @@
+///////////////////////////////////////
+//服务器和常驻的 CGI 工作进程之间的通信协议
+//服务器为每个 CGI 程序预先启动几个工作进程，通过 socketpair 和它们通信，
+//一个工作进程依次处理很多个请求，不再每个请求都 fork + exec 一次。
+//
+//所有数据都按照帧来发送，每一帧是 1 字节的类型 + 4 字节的长度(网络字节序) + 内容
+//一个请求的交互过程：
+//  服务器 -> 工作进程：CGI_PARAMS(请求的元数据，形如 KEY=VALUE\0KEY=VALUE\0)
+//  服务器 -> 工作进程：若干个 CGI_STDIN(请求的 body)，最后一个长度为0表示 body 结束
+//  工作进程 -> 服务器：若干个 CGI_STDOUT(和传统 CGI 写到标准输出的内容一样，header + 空行 + body)
+//  工作进程 -> 服务器：CGI_END(内容是4字节的退出码，0表示成功)
+///////////////////////////////////////
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+//工作进程通过这个环境变量知道自己是被服务器常驻启动的，值是和服务器通信的文件描述符
+#define CGI_WORKER_ENV "HTTP_SERVER_CGI_FD"
+
+enum CgiFrameType{
+  CGI_PARAMS = 1,
+  CGI_STDIN = 2,
+  CGI_STDOUT = 3,
+  CGI_END = 4,
+};
+
+class CgiProtocol{
+public:
+  //一帧的最大长度，更长的数据拆成多帧发送
+  static const size_t kMaxFrameSize = 64 * 1024;
+  static const size_t kHeaderSize = 5;
+
+  //发送一帧，长度超过 kMaxFrameSize 的数据会被拆成多帧
+  //返回0表示成功，返回小于0表示对端已经关闭或者出错
+  static int WriteFrame(int fd,int type,const char* data,size_t size){
+    do{
+      size_t len = size < kMaxFrameSize ? size : kMaxFrameSize;
+      char header[kHeaderSize];
+      header[0] = static_cast<char>(type);
+      uint32_t net_len = htonl(static_cast<uint32_t>(len));
+      memcpy(header + 1,&net_len,sizeof(net_len));
+      if(WriteN(fd,header,kHeaderSize) < 0 || WriteN(fd,data,len) < 0){
+        return -1;
+      }
+      data += len;
+      size -= len;
+    }while(size > 0);
+    return 0;
+  }
+
+  static int WriteFrame(int fd,int type,const std::string& data){
+    return WriteFrame(fd,type,data.data(),data.size());
+  }
+
+  //读取一帧，返回0表示成功，返回小于0表示对端已经关闭或者数据格式不对
+  static int ReadFrame(int fd,int* type,std::string* payload){
+    char header[kHeaderSize];
+    if(ReadN(fd,header,kHeaderSize) < 0){
+      return -1;
+    }
+    uint32_t net_len = 0;
+    memcpy(&net_len,header + 1,sizeof(net_len));
+    size_t len = ntohl(net_len);
+    if(len > kMaxFrameSize){
+      return -1;
+    }
+    *type = static_cast<unsigned char>(header[0]);
+    payload->resize(len);
+    if(len > 0 && ReadN(fd,&(*payload)[0],len) < 0){
+      return -1;
+    }
+    return 0;
+  }
+
+  //把请求的元数据编码成 KEY=VALUE\0 的形式，和 execve 的环境变量是一样的写法
+  static std::string EncodeParams(const std::vector<std::pair<std::string,std::string> >& params){
+    std::string output;
+    for(size_t i = 0;i < params.size();++i){
+      output += params[i].first;
+      output += '=';
+      output += params[i].second;
+      output += '\0';
+    }
+    return output;
+  }
+
+  static void DecodeParams(const std::string& input,
+                           std::unordered_map<std::string,std::string>* params){
+    size_t start = 0;
+    while(start < input.size()){
+      size_t end = input.find('\0',start);
+      if(end == std::string::npos){
+        end = input.size();
+      }
+      size_t eq = input.find('=',start);
+      if(eq != std::string::npos && eq < end){
+        (*params)[input.substr(start,eq - start)] = input.substr(eq + 1,end - eq - 1);
+      }
+      start = end + 1;
+    }
+  }
+
+  static int WriteN(int fd,const char* data,size_t size){
+    while(size > 0){
+      ssize_t write_size = write(fd,data,size);
+      if(write_size < 0 && errno == EINTR){
+        continue;
+      }
+      if(write_size <= 0){
+        return -1;
+      }
+      data += write_size;
+      size -= write_size;
+    }
+    return 0;
+  }
+
+  static int ReadN(int fd,char* data,size_t size){
+    while(size > 0){
+      ssize_t read_size = read(fd,data,size);
+      if(read_size < 0 && errno == EINTR){
+        continue;
+      }
+      if(read_size <= 0){
+        return -1;
+      }
+      data += read_size;
+      size -= read_size;
+    }
+    return 0;
+  }
+};
@@ -0,0 +1,34 @@
+#pragma once
+//响应内容的压缩编码
+//静态文件优先使用预先压缩好的同名 .br/.gz 文件，没有的话可以在第一次请求的时候压缩，
+//压缩结果放在文件缓存中，之后的请求直接使用
+#include <string>
+
+namespace http_server{
+
+//用位来表示编码，方便表示客户端接受哪些编码以及文件有哪些压缩版本
+enum ContentEncoding{
+  ENCODING_IDENTITY = 0,
+  ENCODING_GZIP = 1,
+  ENCODING_BR = 2,
+};
+
+class EncodingUtil{
+public:
+  //解析 Accept-Encoding 头部，返回客户端接受的编码组成的位掩码
+  //例如 "gzip, deflate, br;q=0" 返回 ENCODING_GZIP
+  static int ParseAcceptEncoding(const std::string& accept_encoding);
+  //在 available 和 accepted 都包含的编码中选一个最好的，都没有返回 ENCODING_IDENTITY
+  static ContentEncoding Choose(int available,int accepted);
+  //Content-Encoding 头部中的名字，例如 gzip
+  static const char* Name(ContentEncoding encoding);
+  //预先压缩好的文件的扩展名，例如 .gz
+  static const char* Suffix(ContentEncoding encoding);
+  //文本类型的内容压缩效果好，图片这种已经压缩过的内容就不再压缩了
+  static bool IsCompressible(const std::string& content_type);
+  //压缩 input，结果放到 output 中，返回0表示成功，返回小于0表示失败
+  //用于现场压缩，br 使用速度较快的压缩级别
+  static int Compress(ContentEncoding encoding,const std::string& input,std::string* output);
+};
+
+}//end of http_server
@@ -0,0 +1,112 @@
+#include "file_cache.h"
+#include "util.hpp"
+#include <sys/stat.h>
+#include <sstream>
+
+namespace http_server{
+
+FileCache::FileCache(size_t capacity,int check_interval,size_t shard_num)
+  :shard_capacity_(capacity / shard_num),check_interval_(check_interval),
+   hits_(0),misses_(0),evictions_(0),invalidations_(0),bytes_(0){
+  for(size_t i = 0;i < shard_num;++i){
+    shards_.push_back(std::unique_ptr<Shard>(new Shard()));
+  }
+}
+
+FileCache::Shard* FileCache::GetShard(const std::string& key){
+  return shards_[std::hash<std::string>()(key) % shards_.size()].get();
+}
+
+std::shared_ptr<const FileEntry> FileCache::Lookup(const std::string& key){
+  Shard* shard = GetShard(key);
+  std::shared_ptr<const FileEntry> entry;
+  {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    auto it = shard->index.find(key);
+    if(it == shard->index.end()){
+      misses_.fetch_add(1,std::memory_order_relaxed);
+      return NULL;
+    }
+    //命中之后挪到链表头部
+    shard->lru.splice(shard->lru.begin(),shard->lru,it->second);
+    entry = it->second->second;
+  }
+  //stat 是系统调用，放在锁外面做
+  if(IsFresh(*entry)){
+    hits_.fetch_add(1,std::memory_order_relaxed);
+    return entry;
+  }
+  //文件已经被修改或者删除了，缓存中的内容不能再用
+  {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    auto it = shard->index.find(key);
+    if(it != shard->index.end() && it->second->second == entry){
+      Erase(shard,it->second);
+    }
+  }
+  invalidations_.fetch_add(1,std::memory_order_relaxed);
+  misses_.fetch_add(1,std::memory_order_relaxed);
+  return NULL;
+}
+
+bool FileCache::IsFresh(const FileEntry& entry){
+  int64_t now = TimeUtil::TimeStamp();
+  //检查间隔之内认为文件没有变化，避免每个请求都 stat 一次
+  if(now - entry.checked_at.load(std::memory_order_relaxed) < check_interval_){
+    return true;
+  }
+  struct stat st;
+  if(stat(entry.file_path.c_str(),&st) < 0){
+    return false;
+  }
+  if(st.st_mtime != entry.mtime || st.st_size != entry.size || st.st_ino != entry.ino){
+    return false;
+  }
+  entry.checked_at.store(now,std::memory_order_relaxed);
+  return true;
+}
+
+void FileCache::Insert(const std::string& key,const std::shared_ptr<const FileEntry>& entry){
+  size_t charge = entry->Charge() + key.size();
+  if(charge > shard_capacity_){
+    //单个文件比一个分片还大，就不缓存了
+    return;
+  }
+  Shard* shard = GetShard(key);
+  std::lock_guard<std::mutex> lock(shard->mutex);
+  auto it = shard->index.find(key);
+  if(it != shard->index.end()){
+    Erase(shard,it->second);
+  }
+  shard->lru.push_front(Node(key,entry));
+  shard->index[key] = shard->lru.begin();
+  shard->bytes += charge;
+  bytes_.fetch_add(charge,std::memory_order_relaxed);
+  //超过容量就从链表尾部(最久没有使用的)开始淘汰
+  while(shard->bytes > shard_capacity_){
+    Erase(shard,--shard->lru.end());
+    evictions_.fetch_add(1,std::memory_order_relaxed);
+  }
+}
+
+//调用者需要持有分片的锁
+void FileCache::Erase(Shard* shard,std::list<Node>::iterator it){
+  size_t charge = it->second->Charge() + it->first.size();
+  shard->bytes -= charge;
+  bytes_.fetch_sub(charge,std::memory_order_relaxed);
+  shard->index.erase(it->first);
+  shard->lru.erase(it);
+}
+
+std::string FileCache::Report() const{
+  std::stringstream ss;
+  ss << "hits=" << hits_.load(std::memory_order_relaxed)
+    << " misses=" << misses_.load(std::memory_order_relaxed)
+    << " evictions=" << evictions_.load(std::memory_order_relaxed)
+    << " invalidations=" << invalidations_.load(std::memory_order_relaxed)
+    << " bytes=" << bytes_.load(std::memory_order_relaxed)
+    << " capacity=" << shard_capacity_ * shards_.size();
+  return ss.str();
+}
+
+}//end of http_server
@@ -0,0 +1,87 @@
+#pragma once
+//静态文件缓存
+//热点文件(css，js，字体，图片)的内容、预先拼好的 header 以及元数据都放在内存中，
+//命中的时候不需要再 open/read 文件，也不需要再判断路径是不是目录。
+//缓存按照 key 的哈希值分成多个分片，每个分片一把锁，一个 LRU 链表，
+//总的内存占用不超过配置的字节数。
+//文件被修改之后通过 stat 比较 mtime/size/inode 发现，并且从缓存中删除
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace http_server{
+
+struct FileEntry{
+  std::string file_path; //真正的文件路径，目录已经被换成了目录下的 index.html
+  std::string data; //文件的完整内容
+  std::string header; //预先拼好的 header 行，例如 Content-Type 和 Content-Length
+  std::string etag; //根据 inode/size/mtime 生成的 ETag，压缩版本会带上编码的后缀
+  const char* content_type; //原始文件的 Content-Type，压缩版本也是一样的
+  time_t last_modified; //响应中的 Last-Modified，压缩版本用的是原始文件的修改时间
+  off_t size;
+  time_t mtime;
+  ino_t ino;
+  int encoding; //data 的压缩编码，取值见 ContentEncoding
+  int variants; //原始文件还有哪些压缩版本可以使用，ContentEncoding 的位掩码，不为0的时候需要 Vary
+  //上一次用 stat 检查文件有没有被修改的时间，多个线程会同时更新
+  mutable std::atomic<int64_t> checked_at;
+
+  FileEntry()
+    :content_type(NULL),last_modified(0),
+     size(0),mtime(0),ino(0),encoding(0),variants(0),checked_at(0){
+  }
+  //缓存中占用的字节数
+  size_t Charge() const{
+    return file_path.size() + data.size() + header.size() + etag.size() + sizeof(FileEntry);
+  }
+};
+
+class FileCache{
+public:
+  //capacity 是缓存的总字节数，check_interval 是多少秒之后重新检查文件是否被修改
+  FileCache(size_t capacity,int check_interval,size_t shard_num = 16);
+  //查找 key 对应的文件，没有找到或者文件已经被修改都返回 NULL
+  std::shared_ptr<const FileEntry> Lookup(const std::string& key);
+  //放入缓存，超过容量的时候按照 LRU 淘汰
+  void Insert(const std::string& key,const std::shared_ptr<const FileEntry>& entry);
+  //缓存的统计信息，例如 hits=10 misses=2 ...
+  std::string Report() const;
+
+  uint64_t Hits() const{ return hits_.load(std::memory_order_relaxed); }
+  uint64_t Misses() const{ return misses_.load(std::memory_order_relaxed); }
+  uint64_t Evictions() const{ return evictions_.load(std::memory_order_relaxed); }
+  uint64_t Invalidations() const{ return invalidations_.load(std::memory_order_relaxed); }
+private:
+  typedef std::pair<std::string,std::shared_ptr<const FileEntry> > Node;
+  struct Shard{
+    std::mutex mutex;
+    std::list<Node> lru; //链表头部是最近使用的
+    std::unordered_map<std::string,std::list<Node>::iterator> index;
+    size_t bytes;
+    Shard():bytes(0){}
+  };
+  Shard* GetShard(const std::string& key);
+  //文件的 mtime/size/inode 和缓存中的是否一致
+  bool IsFresh(const FileEntry& entry);
+  void Erase(Shard* shard,std::list<Node>::iterator it);
+
+  size_t shard_capacity_;
+  int check_interval_;
+  std::vector<std::unique_ptr<Shard> > shards_;
+
+  std::atomic<uint64_t> hits_;
+  std::atomic<uint64_t> misses_;
+  std::atomic<uint64_t> evictions_;
+  std::atomic<uint64_t> invalidations_;
+  std::atomic<uint64_t> bytes_;
+};
+
+}//end of http_server
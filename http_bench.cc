@@ -0,0 +1,700 @@
+//HTTP 压测工具
+//单线程 + epoll 同时驱动很多个连接，支持两种发压方式：
+//  闭环(默认)：每个连接收到响应之后马上发下一个请求，测的是服务器的最大吞吐
+//  开环(--rate=N)：按照固定的速率发请求，和服务器处理得快慢无关，
+//      所有连接都在忙的时候请求排队，延迟从计划发送的时间算起，
+//      这样服务器变慢的时候不会因为少发请求而把延迟掩盖掉
+//--keepalive=off 的时候每个请求新建一个连接，延迟中包含了建立连接的时间
+//--tls=on 的时候通过 HTTPS 发压(不校验证书，可以用自签名的证书)，
+//  和 --keepalive=off 一起使用测的是 TLS 握手的速率，--tls_resume=on 的时候新连接恢复上一次的会话；
+//  和 --keepalive=on 一起使用测的是加密之后的吞吐
+//结果以 JSON 的格式输出到标准输出，标准错误中输出一份便于阅读的摘要
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include "stats.h"
+#include "util.hpp"
+
+using namespace http_server;
+
+struct Options{
+  std::string host;
+  int port;
+  std::string path;
+  std::string method;
+  std::string body;
+  int connections; //最多同时有多少个连接
+  double duration; //压测持续的秒数
+  uint64_t requests; //发完这么多请求就结束，0表示按照 duration 结束
+  bool keepalive;
+  double rate; //开环模式下每秒发出的请求数，0表示闭环
+  std::string name; //这组压测的名字，原样写到结果中
+  bool tls;
+  bool tls_resume; //新连接使用之前的连接拿到的会话
+  Options()
+    :host("127.0.0.1"),port(9090),path("/"),method("GET"),connections(16),
+     duration(5),requests(0),keepalive(true),rate(0),tls(false),tls_resume(false){
+  }
+};
+
+enum ConnState{
+  CONN_IDLE,       //没有请求，keep-alive 的连接还保持着
+  CONN_CONNECTING, //正在建立连接，建立完成之后发送请求
+  CONN_HANDSHAKE,  //正在进行 TLS 握手，完成之后发送请求
+  CONN_SENDING,
+  CONN_RECEIVING,
+};
+
+struct Conn{
+  int fd;
+  SSL* ssl; //不是 TLS 连接的时候为 NULL
+  ConnState state;
+  size_t out_pos; //请求已经发送的字节数
+  std::string in; //收到的响应
+  int64_t start; //这个请求开始的时间，开环模式下是计划发送的时间
+  //响应的解析状态
+  size_t header_len; //header 加上空行的长度，0表示 header 还没收完整
+  int status;
+  int64_t content_length; //-1 表示没有 Content-Length
+  bool chunked;
+  size_t chunk_pos; //chunked 编码的 body 已经解析到的位置
+  bool close_after; //服务器要关闭连接
+  Conn():fd(-1),ssl(NULL),state(CONN_IDLE),out_pos(0),start(0),header_len(0),status(0),
+         content_length(-1),chunked(false),chunk_pos(0),close_after(false){}
+  void ResetResponse(){
+    in.clear();
+    out_pos = 0;
+    header_len = 0;
+    status = 0;
+    content_length = -1;
+    chunked = false;
+    chunk_pos = 0;
+    close_after = false;
+  }
+};
+
+class LoadGenerator{
+public:
+  explicit LoadGenerator(const Options& options)
+    :options_(options),epoll_fd_(-1),ssl_ctx_(NULL),session_(NULL),sent_(0),completed_(0),
+     errors_(0),bytes_(0),handshakes_(0),resumed_(0){
+  }
+  ~LoadGenerator();
+  int Run();
+  void Report(int64_t elapsed);
+private:
+  int Resolve();
+  //开始一个请求，conn 还没有连接的话先建立连接
+  void StartRequest(Conn* conn,int64_t start);
+  int Connect(Conn* conn);
+  int InitTls();
+  //返回0表示握手完成，返回1表示继续等待，返回小于0表示出错
+  int HandleHandshake(Conn* conn);
+  //和 send/recv 一样的返回值，TLS 连接需要等待 socket 就绪的时候返回-1，errno 为 EAGAIN
+  ssize_t Send(Conn* conn,const char* data,size_t size);
+  ssize_t Recv(Conn* conn,char* buf,size_t size);
+  void CloseConn(Conn* conn);
+  void OnEvent(Conn* conn,uint32_t events);
+  //返回0表示继续等待，返回1表示响应已经完整，返回小于0表示出错
+  int HandleSend(Conn* conn);
+  int HandleRecv(Conn* conn);
+  int ParseResponse(Conn* conn,bool eof);
+  void OnComplete(Conn* conn);
+  void OnError(Conn* conn);
+  //请求成功之后，闭环模式下马上开始下一个，开环模式下从队列中取
+  void Next(Conn* conn);
+  bool CanStart() const;
+
+  Options options_;
+  sockaddr_in addr_;
+  std::string request_;
+  int epoll_fd_;
+  SSL_CTX* ssl_ctx_;
+  SSL_SESSION* session_; //最近一个连接上拿到的可以恢复的会话
+  std::vector<Conn> conns_;
+  std::deque<int64_t> pending_; //开环模式下已经到了计划时间但是还没有空闲连接的请求
+  Histogram latency_;
+  std::map<int,uint64_t> status_;
+  uint64_t sent_;
+  uint64_t completed_;
+  uint64_t errors_;
+  uint64_t bytes_;
+  uint64_t handshakes_; //完成的 TLS 握手
+  uint64_t resumed_; //其中恢复了会话的
+};
+
+LoadGenerator::~LoadGenerator(){
+  if(session_ != NULL){
+    SSL_SESSION_free(session_);
+  }
+  if(ssl_ctx_ != NULL){
+    SSL_CTX_free(ssl_ctx_);
+  }
+}
+
+int LoadGenerator::InitTls(){
+  ssl_ctx_ = SSL_CTX_new(TLS_client_method());
+  if(ssl_ctx_ == NULL){
+    fprintf(stderr,"SSL_CTX_new failed\n");
+    return -1;
+  }
+  //压测用的是自签名的证书，不校验；服务器不发 close_notify 直接关闭连接当作正常的关闭
+  SSL_CTX_set_verify(ssl_ctx_,SSL_VERIFY_NONE,NULL);
+  SSL_CTX_set_min_proto_version(ssl_ctx_,TLS1_2_VERSION);
+  SSL_CTX_set_options(ssl_ctx_,SSL_OP_IGNORE_UNEXPECTED_EOF);
+  SSL_CTX_set_mode(ssl_ctx_,SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+  return 0;
+}
+
+int LoadGenerator::Resolve(){
+  memset(&addr_,0,sizeof(addr_));
+  addr_.sin_family = AF_INET;
+  addr_.sin_port = htons(options_.port);
+  if(inet_pton(AF_INET,options_.host.c_str(),&addr_.sin_addr) == 1){
+    return 0;
+  }
+  addrinfo hints;
+  memset(&hints,0,sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* result = NULL;
+  if(getaddrinfo(options_.host.c_str(),NULL,&hints,&result) != 0 || result == NULL){
+    fprintf(stderr,"resolve %s failed\n",options_.host.c_str());
+    return -1;
+  }
+  addr_.sin_addr = reinterpret_cast<sockaddr_in*>(result->ai_addr)->sin_addr;
+  freeaddrinfo(result);
+  return 0;
+}
+
+int LoadGenerator::Run(){
+  if(Resolve() < 0){
+    return -1;
+  }
+  request_ = options_.method + " " + options_.path + " HTTP/1.1\r\n"
+    + "Host: " + options_.host + "\r\n"
+    + (options_.keepalive ? "" : "Connection: close\r\n");
+  if(!options_.body.empty() || options_.method == "POST"){
+    request_ += "Content-Length: " + std::to_string(options_.body.size()) + "\r\n";
+  }
+  request_ += "\r\n" + options_.body;
+  if(options_.tls && InitTls() < 0){
+    return -1;
+  }
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if(epoll_fd_ < 0){
+    perror("epoll_create1");
+    return -1;
+  }
+  conns_.resize(options_.connections);
+  const int64_t begin = TimeUtil::MonotonicNS();
+  const int64_t end = begin + static_cast<int64_t>(options_.duration * 1e9);
+  const int64_t interval = options_.rate > 0 ? static_cast<int64_t>(1e9 / options_.rate) : 0;
+  int64_t next_send = begin;
+  std::vector<epoll_event> events(conns_.size() + 1);
+  while(true){
+    int64_t now = TimeUtil::MonotonicNS();
+    if(now >= end || (options_.requests > 0 && completed_ + errors_ >= options_.requests)){
+      break;
+    }
+    //开环模式：到了计划时间的请求先放进队列
+    if(interval > 0){
+      while(next_send <= now && CanStart()){
+        pending_.push_back(next_send);
+        next_send += interval;
+        ++sent_;
+      }
+    }
+    //刚开始的时候以及出错之后，空闲的连接在这里开始新的请求
+    bool retry = false;
+    for(size_t i = 0;i < conns_.size();++i){
+      if(conns_[i].state != CONN_IDLE){
+        continue;
+      }
+      if(interval > 0 && !pending_.empty()){
+        int64_t start = pending_.front();
+        pending_.pop_front();
+        StartRequest(&conns_[i],start);
+      }else if(interval == 0 && CanStart()){
+        StartRequest(&conns_[i],now);
+      }
+      retry = retry || conns_[i].state == CONN_IDLE;
+    }
+    int64_t wait_ns = std::min(end - now,interval > 0 ? next_send - now : end - now);
+    int timeout = static_cast<int>(std::max<int64_t>(wait_ns / (1000 * 1000),0));
+    //有连接刚刚失败了，稍等一会儿再重试
+    if(retry && interval == 0 && CanStart()){
+      timeout = std::min(timeout,10);
+    }
+    int n = epoll_wait(epoll_fd_,events.data(),events.size(),timeout);
+    if(n < 0 && errno != EINTR){
+      perror("epoll_wait");
+      return -1;
+    }
+    for(int i = 0;i < n;++i){
+      OnEvent(&conns_[events[i].data.u32],events[i].events);
+    }
+  }
+  Report(TimeUtil::MonotonicNS() - begin);
+  for(size_t i = 0;i < conns_.size();++i){
+    CloseConn(&conns_[i]);
+  }
+  close(epoll_fd_);
+  return 0;
+}
+
+bool LoadGenerator::CanStart() const{
+  return options_.requests == 0 || sent_ < options_.requests;
+}
+
+void LoadGenerator::StartRequest(Conn* conn,int64_t start){
+  //闭环模式下在这里计数，开环模式下进队列的时候已经计过了
+  if(options_.rate <= 0){
+    ++sent_;
+  }
+  conn->ResetResponse();
+  conn->start = start;
+  if(conn->fd < 0){
+    if(Connect(conn) < 0){
+      OnError(conn);
+    }
+    return;
+  }
+  conn->state = CONN_SENDING;
+  int ret = HandleSend(conn);
+  if(ret < 0){
+    OnError(conn);
+  }
+}
+
+int LoadGenerator::Connect(Conn* conn){
+  conn->fd = socket(AF_INET,SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,0);
+  if(conn->fd < 0){
+    return -1;
+  }
+  int opt = 1;
+  setsockopt(conn->fd,IPPROTO_TCP,TCP_NODELAY,&opt,sizeof(opt));
+  epoll_event ev;
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  ev.data.u64 = 0;
+  ev.data.u32 = static_cast<uint32_t>(conn - &conns_[0]);
+  if(epoll_ctl(epoll_fd_,EPOLL_CTL_ADD,conn->fd,&ev) < 0){
+    return -1;
+  }
+  if(connect(conn->fd,reinterpret_cast<sockaddr*>(&addr_),sizeof(addr_)) < 0
+      && errno != EINPROGRESS){
+    return -1;
+  }
+  conn->state = CONN_CONNECTING;
+  return 0;
+}
+
+void LoadGenerator::CloseConn(Conn* conn){
+  if(conn->ssl != NULL){
+    SSL_free(conn->ssl);
+    conn->ssl = NULL;
+  }
+  if(conn->fd >= 0){
+    close(conn->fd);
+    conn->fd = -1;
+  }
+  conn->state = CONN_IDLE;
+}
+
+void LoadGenerator::OnEvent(Conn* conn,uint32_t events){
+  if(conn->state == CONN_IDLE){
+    //空闲的 keep-alive 连接被服务器关闭了，下次使用的时候重新连接
+    if(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
+      CloseConn(conn);
+    }
+    return;
+  }
+  if(conn->state == CONN_CONNECTING){
+    if(!(events & EPOLLOUT)){
+      return;
+    }
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if(getsockopt(conn->fd,SOL_SOCKET,SO_ERROR,&err,&len) < 0 || err != 0){
+      OnError(conn);
+      return;
+    }
+    conn->state = CONN_SENDING;
+    if(ssl_ctx_ != NULL){
+      conn->ssl = SSL_new(ssl_ctx_);
+      if(conn->ssl == NULL || SSL_set_fd(conn->ssl,conn->fd) != 1){
+        OnError(conn);
+        return;
+      }
+      SSL_set_tlsext_host_name(conn->ssl,options_.host.c_str());
+      if(session_ != NULL){
+        SSL_set_session(conn->ssl,session_);
+      }
+      SSL_set_connect_state(conn->ssl);
+      conn->state = CONN_HANDSHAKE;
+    }
+  }
+  int ret = 0;
+  if(conn->state == CONN_HANDSHAKE){
+    ret = HandleHandshake(conn);
+    if(ret != 0){
+      if(ret < 0){
+        OnError(conn);
+      }
+      return;
+    }
+  }
+  if(conn->state == CONN_SENDING){
+    ret = HandleSend(conn);
+  }
+  //ET 模式下这次通知可能同时带着响应的数据，发送完之后接着读
+  if(ret == 0 && conn->state == CONN_RECEIVING){
+    ret = HandleRecv(conn);
+  }
+  if(ret < 0){
+    OnError(conn);
+  }
+}
+
+int LoadGenerator::HandleHandshake(Conn* conn){
+  int ret = SSL_connect(conn->ssl);
+  if(ret == 1){
+    ++handshakes_;
+    if(SSL_session_reused(conn->ssl)){
+      ++resumed_;
+    }
+    conn->state = CONN_SENDING;
+    return 0;
+  }
+  int err = SSL_get_error(conn->ssl,ret);
+  if(err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE){
+    return 1;
+  }
+  ERR_clear_error();
+  return -1;
+}
+
+ssize_t LoadGenerator::Send(Conn* conn,const char* data,size_t size){
+  if(conn->ssl == NULL){
+    return send(conn->fd,data,size,MSG_NOSIGNAL);
+  }
+  int n = SSL_write(conn->ssl,data,static_cast<int>(size));
+  if(n > 0){
+    return n;
+  }
+  int err = SSL_get_error(conn->ssl,n);
+  ERR_clear_error();
+  errno = (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) ? EAGAIN : EPIPE;
+  return -1;
+}
+
+ssize_t LoadGenerator::Recv(Conn* conn,char* buf,size_t size){
+  if(conn->ssl == NULL){
+    return recv(conn->fd,buf,size,0);
+  }
+  int n = SSL_read(conn->ssl,buf,static_cast<int>(size));
+  if(n > 0){
+    return n;
+  }
+  int err = SSL_get_error(conn->ssl,n);
+  ERR_clear_error();
+  if(err == SSL_ERROR_ZERO_RETURN){
+    return 0;
+  }
+  errno = (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) ? EAGAIN : ECONNRESET;
+  return -1;
+}
+
+int LoadGenerator::HandleSend(Conn* conn){
+  while(conn->out_pos < request_.size()){
+    ssize_t n = Send(conn,request_.data() + conn->out_pos,request_.size() - conn->out_pos);
+    if(n > 0){
+      conn->out_pos += n;
+      continue;
+    }
+    if(n < 0 && errno == EINTR){
+      continue;
+    }
+    if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+      return 0;
+    }
+    return -1;
+  }
+  //响应到达的时候会有新的可读通知，这里不直接读，
+  //否则 收到响应->发送下一个请求->收到响应 会一直递归下去
+  conn->state = CONN_RECEIVING;
+  return 0;
+}
+
+int LoadGenerator::HandleRecv(Conn* conn){
+  char buf[65536];
+  while(true){
+    ssize_t n = Recv(conn,buf,sizeof(buf));
+    if(n > 0){
+      conn->in.append(buf,n);
+      bytes_ += n;
+      continue;
+    }
+    if(n < 0 && errno == EINTR){
+      continue;
+    }
+    bool eof = (n == 0);
+    if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK){
+      return -1;
+    }
+    int ret = ParseResponse(conn,eof);
+    if(ret < 0){
+      return ret;
+    }
+    if(ret == 1){
+      if(eof){
+        conn->close_after = true;
+      }
+      OnComplete(conn);
+      return 0;
+    }
+    //还没收完整对端就关闭了
+    return eof ? -1 : 0;
+  }
+}
+
+int LoadGenerator::ParseResponse(Conn* conn,bool eof){
+  const std::string& in = conn->in;
+  if(conn->header_len == 0){
+    //header 和 body 之间的空行，兼容 \r\n 和 \n 两种换行
+    size_t pos = 0;
+    size_t end = std::string::npos;
+    while((pos = in.find('\n',pos)) != std::string::npos){
+      if(pos + 1 < in.size() && in[pos + 1] == '\n'){
+        end = pos + 2;
+        break;
+      }
+      if(pos + 2 < in.size() && in[pos + 1] == '\r' && in[pos + 2] == '\n'){
+        end = pos + 3;
+        break;
+      }
+      ++pos;
+    }
+    if(end == std::string::npos){
+      return 0;
+    }
+    conn->header_len = end;
+    std::string header = in.substr(0,end);
+    if(header.compare(0,5,"HTTP/") != 0 || header.find(' ') == std::string::npos){
+      return -1;
+    }
+    conn->status = atoi(header.c_str() + header.find(' ') + 1);
+    std::vector<std::string> lines;
+    StringUtil::Split(header,"\r\n",&lines);
+    for(size_t i = 1;i < lines.size();++i){
+      size_t colon = lines[i].find(':');
+      if(colon == std::string::npos){
+        continue;
+      }
+      std::string name = lines[i].substr(0,colon);
+      std::string value = boost::algorithm::trim_copy(lines[i].substr(colon + 1));
+      if(boost::iequals(name,"Content-Length")){
+        conn->content_length = atoll(value.c_str());
+      }else if(boost::iequals(name,"Transfer-Encoding") && boost::iequals(value,"chunked")){
+        conn->chunked = true;
+      }else if(boost::iequals(name,"Connection") && boost::iequals(value,"close")){
+        conn->close_after = true;
+      }
+    }
+    if(options_.method == "HEAD" || conn->status == 204 || conn->status == 304
+        || conn->status < 200){
+      conn->content_length = 0;
+      conn->chunked = false;
+    }
+    conn->chunk_pos = end;
+  }
+  if(conn->chunked){
+    //每个 chunk 是 十六进制长度\r\n 数据\r\n，长度为0的 chunk 后面再跟一个空行表示结束
+    while(true){
+      size_t eol = in.find("\r\n",conn->chunk_pos);
+      if(eol == std::string::npos){
+        return 0;
+      }
+      size_t size = strtoul(in.c_str() + conn->chunk_pos,NULL,16);
+      if(size == 0){
+        return in.size() >= eol + 4 ? 1 : 0;
+      }
+      if(in.size() < eol + 2 + size + 2){
+        return 0;
+      }
+      conn->chunk_pos = eol + 2 + size + 2;
+    }
+  }
+  if(conn->content_length >= 0){
+    return in.size() >= conn->header_len + conn->content_length ? 1 : 0;
+  }
+  //既没有 Content-Length 也不是 chunked，body 到连接关闭为止
+  return eof ? 1 : 0;
+}
+
+void LoadGenerator::OnComplete(Conn* conn){
+  ++completed_;
+  latency_.Record(TimeUtil::MonotonicNS() - conn->start);
+  ++status_[conn->status];
+  //TLS 1.3 的 session ticket 在握手之后才发过来，收到响应的时候已经读到了
+  if(options_.tls_resume && conn->ssl != NULL){
+    SSL_SESSION* session = SSL_get1_session(conn->ssl);
+    if(session != NULL && SSL_SESSION_is_resumable(session)){
+      if(session_ != NULL){
+        SSL_SESSION_free(session_);
+      }
+      session_ = session;
+    }else if(session != NULL){
+      SSL_SESSION_free(session);
+    }
+  }
+  if(conn->close_after || !options_.keepalive){
+    //没有发 close_notify 就释放的 SSL，OpenSSL 会把它的会话标记成不能恢复
+    if(conn->ssl != NULL && SSL_shutdown(conn->ssl) < 0){
+      ERR_clear_error();
+    }
+    CloseConn(conn);
+  }
+  conn->state = CONN_IDLE;
+  Next(conn);
+}
+
+//出错之后不马上重试，服务器没有启动的时候不会陷入 连接->失败->连接 的递归
+void LoadGenerator::OnError(Conn* conn){
+  ++errors_;
+  CloseConn(conn);
+}
+
+void LoadGenerator::Next(Conn* conn){
+  if(options_.rate > 0){
+    if(!pending_.empty()){
+      int64_t start = pending_.front();
+      pending_.pop_front();
+      StartRequest(conn,start);
+    }
+    return;
+  }
+  if(CanStart()){
+    StartRequest(conn,TimeUtil::MonotonicNS());
+  }
+}
+
+static std::string Micros(uint64_t ns){
+  char buf[64];
+  snprintf(buf,sizeof(buf),"%.1f",ns / 1e3);
+  return buf;
+}
+
+void LoadGenerator::Report(int64_t elapsed){
+  HistogramSnapshot h;
+  h.Merge(latency_);
+  double seconds = elapsed / 1e9;
+  fprintf(stderr,"%s: %llu requests in %.2fs, %.0f req/s, %llu errors, "
+          "latency p50=%sus p99=%sus max=%sus\n",
+          options_.name.c_str(),static_cast<unsigned long long>(completed_),seconds,
+          completed_ / seconds,static_cast<unsigned long long>(errors_),
+          Micros(h.Percentile(0.5)).c_str(),Micros(h.Percentile(0.99)).c_str(),
+          Micros(h.max).c_str());
+  if(options_.tls){
+    fprintf(stderr,"%s: %llu TLS handshakes, %llu resumed\n",options_.name.c_str(),
+            static_cast<unsigned long long>(handshakes_),static_cast<unsigned long long>(resumed_));
+  }
+  printf("{\"name\":\"%s\",\"method\":\"%s\",\"path\":\"%s\",\"mode\":\"%s\",\"keepalive\":%s,"
+         "\"tls\":%s,\"tls_resume\":%s,\"handshakes\":{\"total\":%llu,\"resumed\":%llu,\"per_s\":%.1f},"
+         "\"connections\":%d,\"rate\":%.0f,\"duration_s\":%.3f,\"requests\":%llu,"
+         "\"errors\":%llu,\"backlog\":%llu,\"rps\":%.1f,\"bytes\":%llu,\"status\":{",
+         options_.name.c_str(),options_.method.c_str(),options_.path.c_str(),
+         options_.rate > 0 ? "open" : "closed",options_.keepalive ? "true" : "false",
+         options_.tls ? "true" : "false",options_.tls_resume ? "true" : "false",
+         static_cast<unsigned long long>(handshakes_),static_cast<unsigned long long>(resumed_),
+         handshakes_ / seconds,
+         options_.connections,options_.rate,seconds,
+         static_cast<unsigned long long>(completed_),static_cast<unsigned long long>(errors_),
+         static_cast<unsigned long long>(pending_.size()),completed_ / seconds,
+         static_cast<unsigned long long>(bytes_));
+  for(auto it = status_.begin();it != status_.end();++it){
+    printf("%s\"%d\":%llu",it == status_.begin() ? "" : ",",it->first,
+           static_cast<unsigned long long>(it->second));
+  }
+  printf("},\"latency_us\":{\"mean\":%s,\"p50\":%s,\"p90\":%s,\"p99\":%s,\"p999\":%s,\"max\":%s}}\n",
+         Micros(h.count == 0 ? 0 : h.sum / h.count).c_str(),
+         Micros(h.Percentile(0.5)).c_str(),Micros(h.Percentile(0.9)).c_str(),
+         Micros(h.Percentile(0.99)).c_str(),Micros(h.Percentile(0.999)).c_str(),
+         Micros(h.max).c_str());
+}
+
+static void Usage(const char* name){
+  fprintf(stderr,"Usage: %s [--host=IP] [--port=N] [--path=URL] [--method=GET|POST]"
+          " [--body=DATA] [--connections=N] [--duration=SEC] [--requests=N]"
+          " [--keepalive=on|off] [--rate=REQ_PER_SEC] [--name=LABEL]"
+          " [--tls=on|off] [--tls_resume=on|off]\n",name);
+}
+
+int main(int argc,char* argv[]){
+  Options options;
+  for(int i = 1;i < argc;++i){
+    std::string arg = argv[i];
+    size_t pos = arg.find('=');
+    if(arg.compare(0,2,"--") != 0 || pos == std::string::npos){
+      Usage(argv[0]);
+      return 1;
+    }
+    std::string key = arg.substr(2,pos - 2);
+    std::string value = arg.substr(pos + 1);
+    if(key == "host"){
+      options.host = value;
+    }else if(key == "port"){
+      options.port = atoi(value.c_str());
+    }else if(key == "path"){
+      options.path = value;
+    }else if(key == "method"){
+      options.method = value;
+    }else if(key == "body"){
+      options.body = value;
+    }else if(key == "connections"){
+      options.connections = atoi(value.c_str());
+    }else if(key == "duration"){
+      options.duration = atof(value.c_str());
+    }else if(key == "requests"){
+      options.requests = atoll(value.c_str());
+    }else if(key == "keepalive"){
+      options.keepalive = (value == "on");
+    }else if(key == "rate"){
+      options.rate = atof(value.c_str());
+    }else if(key == "name"){
+      options.name = value;
+    }else if(key == "tls"){
+      options.tls = (value == "on");
+    }else if(key == "tls_resume"){
+      options.tls_resume = (value == "on");
+    }else {
+      Usage(argv[0]);
+      return 1;
+    }
+  }
+  if(options.connections <= 0 || options.duration <= 0){
+    Usage(argv[0]);
+    return 1;
+  }
+  if(options.name.empty()){
+    options.name = options.method + " " + options.path;
+  }
+  LoadGenerator generator(options);
+  return generator.Run() < 0 ? 1 : 0;
+}
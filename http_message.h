@@ -0,0 +1,260 @@
+#pragma once 
+//请求和响应的数据结构，解析模块和服务器模块都会用到
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/utility/string_view.hpp>
+
+namespace http_server{
+
+//指向一段已有数据的字符串，不拥有内存
+typedef boost::string_view StringView;
+
+//常用 header 的编号，按名字的字母顺序排列
+//解析的时候不区分大小写地把名字映射成编号，之后查找这些 header 只需要比较整数
+enum HeaderId{
+  HEADER_OTHER = 0, //不在下面列表中的 header，只能按名字查找
+  HEADER_ACCEPT,
+  HEADER_ACCEPT_ENCODING,
+  HEADER_ACCEPT_LANGUAGE,
+  HEADER_ACCEPT_RANGES,
+  HEADER_AUTHORIZATION,
+  HEADER_CACHE_CONTROL,
+  HEADER_CONNECTION,
+  HEADER_CONTENT_ENCODING,
+  HEADER_CONTENT_LENGTH,
+  HEADER_CONTENT_RANGE,
+  HEADER_CONTENT_TYPE,
+  HEADER_COOKIE,
+  HEADER_DATE,
+  HEADER_ETAG,
+  HEADER_EXPECT,
+  HEADER_HOST,
+  HEADER_IF_MODIFIED_SINCE,
+  HEADER_IF_NONE_MATCH,
+  HEADER_IF_RANGE,
+  HEADER_KEEP_ALIVE,
+  HEADER_LAST_MODIFIED,
+  HEADER_LOCATION,
+  HEADER_RANGE,
+  HEADER_REFERER,
+  HEADER_SERVER,
+  HEADER_SET_COOKIE,
+  HEADER_TRANSFER_ENCODING,
+  HEADER_UPGRADE,
+  HEADER_USER_AGENT,
+  HEADER_VARY,
+  HEADER_NUM,
+};
+
+//编号对应的标准写法，生成响应的时候用这个名字
+constexpr const char* kHeaderNames[HEADER_NUM] = {
+  "",
+  "Accept","Accept-Encoding","Accept-Language","Accept-Ranges","Authorization",
+  "Cache-Control","Connection","Content-Encoding","Content-Length","Content-Range",
+  "Content-Type","Cookie","Date","ETag","Expect","Host","If-Modified-Since",
+  "If-None-Match","If-Range","Keep-Alive","Last-Modified","Location","Range",
+  "Referer","Server","Set-Cookie","Transfer-Encoding","Upgrade","User-Agent","Vary",
+};
+
+//名字到编号的完美哈希：只用到长度和首尾两个字符(转成小写)，上面的名字两两不冲突
+//增加新的 header 之后如果冲突，需要重新挑选系数并更新 kHeaderSlots，否则下面的 static_assert 编译不过
+constexpr char HeaderLower(char c){
+  return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+constexpr size_t HeaderHash(const char* name,size_t size){
+  return (size + 5 * static_cast<unsigned char>(HeaderLower(name[0]))
+          + 47 * static_cast<unsigned char>(HeaderLower(name[size - 1]))) & 63;
+}
+
+constexpr HeaderId kHeaderSlots[64] = {
+  HEADER_COOKIE,HEADER_OTHER,HEADER_OTHER,HEADER_DATE,
+  HEADER_OTHER,HEADER_LAST_MODIFIED,HEADER_CONTENT_TYPE,HEADER_CONTENT_RANGE,
+  HEADER_OTHER,HEADER_VARY,HEADER_RANGE,HEADER_EXPECT,
+  HEADER_OTHER,HEADER_OTHER,HEADER_OTHER,HEADER_ACCEPT_RANGES,
+  HEADER_CACHE_CONTROL,HEADER_OTHER,HEADER_OTHER,HEADER_OTHER,
+  HEADER_SET_COOKIE,HEADER_CONTENT_LENGTH,HEADER_LOCATION,HEADER_OTHER,
+  HEADER_HOST,HEADER_OTHER,HEADER_OTHER,HEADER_UPGRADE,
+  HEADER_OTHER,HEADER_ACCEPT_ENCODING,HEADER_OTHER,HEADER_USER_AGENT,
+  HEADER_IF_RANGE,HEADER_OTHER,HEADER_OTHER,HEADER_OTHER,
+  HEADER_AUTHORIZATION,HEADER_OTHER,HEADER_ETAG,HEADER_OTHER,
+  HEADER_CONTENT_ENCODING,HEADER_IF_MODIFIED_SINCE,HEADER_OTHER,HEADER_CONNECTION,
+  HEADER_KEEP_ALIVE,HEADER_OTHER,HEADER_OTHER,HEADER_REFERER,
+  HEADER_OTHER,HEADER_OTHER,HEADER_IF_NONE_MATCH,HEADER_SERVER,
+  HEADER_OTHER,HEADER_OTHER,HEADER_OTHER,HEADER_ACCEPT,
+  HEADER_OTHER,HEADER_OTHER,HEADER_OTHER,HEADER_OTHER,
+  HEADER_OTHER,HEADER_OTHER,HEADER_TRANSFER_ENCODING,HEADER_ACCEPT_LANGUAGE,
+};
+
+//编译期检查每个名字都落在自己的槽里，也就保证了没有冲突
+constexpr size_t HeaderNameSize(const char* name){
+  return *name == '\0' ? 0 : 1 + HeaderNameSize(name + 1);
+}
+constexpr bool CheckHeaderSlots(int id){
+  return id == HEADER_NUM
+      || (kHeaderSlots[HeaderHash(kHeaderNames[id],HeaderNameSize(kHeaderNames[id]))] == id
+          && CheckHeaderSlots(id + 1));
+}
+static_assert(CheckHeaderSlots(HEADER_OTHER + 1),"kHeaderSlots does not match HeaderHash");
+
+//不区分大小写地比较两个 header 名字(只转换 ASCII 字母，不依赖 locale)
+inline bool HeaderNameEqual(StringView a,StringView b){
+  if(a.size() != b.size()){
+    return false;
+  }
+  //客户端基本都用标准写法，先整体比较一次
+  if(memcmp(a.data(),b.data(),a.size()) == 0){
+    return true;
+  }
+  for(size_t i = 0;i < a.size();++i){
+    if(HeaderLower(a[i]) != HeaderLower(b[i])){
+      return false;
+    }
+  }
+  return true;
+}
+
+//常用的 header 返回对应的编号，其他的返回 HEADER_OTHER
+inline HeaderId LookupHeaderId(StringView name){
+  if(name.empty()){
+    return HEADER_OTHER;
+  }
+  HeaderId id = kHeaderSlots[HeaderHash(name.data(),name.size())];
+  if(id != HEADER_OTHER && HeaderNameEqual(name,kHeaderNames[id])){
+    return id;
+  }
+  return HEADER_OTHER;
+}
+
+//一组 header，用一个小数组顺序存放，保持收到或者添加的顺序
+//常用 header 额外记录第一次出现的位置，按编号查找是 O(1) 的；其他 header 不区分大小写地顺序查找
+//请求的 header 用 StringView 指向解析器的内存池，响应的 header 用 std::string 保存自己的副本
+template<typename String>
+class BasicHeader{
+public:
+  struct Field{
+    HeaderId id;
+    String name;
+    String value;
+  };
+  typedef typename std::vector<Field>::iterator iterator;
+  typedef typename std::vector<Field>::const_iterator const_iterator;
+
+  BasicHeader(){
+    memset(index_,0,sizeof(index_));
+  }
+
+  void Add(StringView name,StringView value){
+    Add(LookupHeaderId(name),name,value);
+  }
+  //同名的 header 出现多次的时候返回第一个
+  const_iterator find(HeaderId id) const{
+    return index_[id] == 0 ? fields_.end() : fields_.begin() + (index_[id] - 1);
+  }
+  const_iterator find(StringView name) const{
+    HeaderId id = LookupHeaderId(name);
+    if(id != HEADER_OTHER){
+      return find(id);
+    }
+    for(const_iterator it = fields_.begin();it != fields_.end();++it){
+      if(it->id == HEADER_OTHER && HeaderNameEqual(it->name,name)){
+        return it;
+      }
+    }
+    return fields_.end();
+  }
+  //设置一个 header 的值，已经有的话覆盖第一个，没有的话添加到最后
+  String& operator[](HeaderId id){
+    if(index_[id] == 0){
+      Add(id,kHeaderNames[id],StringView());
+    }
+    return fields_[index_[id] - 1].value;
+  }
+  String& operator[](StringView name){
+    const_iterator it = find(name);
+    if(it == fields_.end()){
+      Add(LookupHeaderId(name),name,StringView());
+      return fields_.back().value;
+    }
+    return fields_[it - fields_.begin()].value;
+  }
+  const_iterator begin() const{ return fields_.begin(); }
+  const_iterator end() const{ return fields_.end(); }
+  size_t size() const{ return fields_.size(); }
+  bool empty() const{ return fields_.empty(); }
+  //清空但是保留 vector 的容量，下一个请求不用重新分配
+  void clear(){
+    fields_.clear();
+    memset(index_,0,sizeof(index_));
+  }
+private:
+  void Add(HeaderId id,StringView name,StringView value){
+    Field field;
+    field.id = id;
+    field.name = String(name.data(),name.size());
+    field.value = String(value.data(),value.size());
+    fields_.push_back(std::move(field));
+    if(id != HEADER_OTHER && index_[id] == 0){
+      index_[id] = static_cast<uint32_t>(fields_.size());
+    }
+  }
+
+  std::vector<Field> fields_;
+  uint32_t index_[HEADER_NUM]; //常用 header 第一次出现的位置加 1，0 表示没有
+};
+
+//请求的 header，名字和值都指向解析器的内存池
+typedef BasicHeader<StringView> HeaderList;
+//响应的 header，名字和值都是自己的副本
+typedef BasicHeader<std::string> Header;
+
+//请求结构
+//所有字段都指向解析器的内存池(RequestParser::Reset 之前有效)，解析的时候不再分配 std::string
+struct Request{
+  StringView method; //表示方法
+  StringView url; //表示地址
+  //例如:url形如 http://www.baidu.com/index.html?kwd="cpp"
+  StringView url_path; //url路径名 /index.html
+  StringView query_string; //url键值对参数 kwd="cpp"
+  StringView version; //版本号 HTTP/1.0 或 HTTP/1.1，决定默认是否保持连接
+  HeaderList header; //一组字符串键值对
+  StringView body; //表示内容实体
+
+  //长连接上处理下一个请求之前清空，header 的容量留着复用
+  void Clear(){
+    method.clear();
+    url.clear();
+    url_path.clear();
+    query_string.clear();
+    version.clear();
+    header.clear();
+    body.clear();
+  }
+};  
+
+//响应结构
+struct Response{
+  int code; // 状态码
+  std::string desc; //状态码的描述
+  //std::string version; //版本号
+  
+  Header header; //响应报文中的header 数据
+  std::string header_lines; //已经拼好的 header 行，原样输出，例如文件缓存中预先生成的 header
+  std::string body; // 响应报文中的body 数据
+  //CGI 程序的输出不放在这里，一边读取一边直接转发给客户端
+
+  Response():code(0){}
+  //长连接上处理下一个请求之前清空，字符串和 header 数组的容量留着复用
+  void Clear(){
+    code = 0;
+    desc.clear();
+    header.clear();
+    header_lines.clear();
+    body.clear();
+  }
+};
+
+}//end of http_server
+
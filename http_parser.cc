@@ -0,0 +1,338 @@
+#include "http_parser.h"
+#include "buffer.hpp"
+#include "util.hpp"
+#include <stdlib.h>
+#include <algorithm>
+
+namespace http_server{
+
+int RequestParser::Parse(Buffer* buf,Request* req){
+  StringView line;
+  while(1){
+    switch(state_){
+      case PARSE_REQUEST_LINE:{
+        //1.解析首行，获取到请求的方法method，url 和版本号
+        int ret = ReadLine(buf,&line,414);
+        if(ret != 0){
+          return ret;
+        }
+        //兼容请求之间多余的空行
+        if(line.empty()){
+          break;
+        }
+        if(ParseFirstLine(line,&req->method,&req->url,&req->version) < 0){
+          return SetError(400);
+        }
+        //2.解析url，获取到url_path和query_string 
+        if(ParseUrl(req->url,&req->url_path,&req->query_string) < 0
+            || DecodeUrlPath(&req->url_path) < 0){
+          return SetError(400);
+        }
+        state_ = PARSE_HEADER;
+        break;
+      }
+      case PARSE_HEADER:{
+        //3.按行解析 header，读到空行说明 header 解析完毕
+        int ret = ReadLine(buf,&line,431);
+        if(ret != 0){
+          return ret;
+        }
+        if(line.empty()){
+          ret = OnHeaderComplete(req);
+          if(ret < 0){
+            return ret;
+          }
+          break;
+        }
+        if(ParseHeader(line,&req->header) < 0){
+          return SetError(400);
+        }
+        break;
+      }
+      case PARSE_BODY:{
+        //4.body 到齐之后一次性拷贝到内存池中
+        if(buf->ReadableBytes() < content_length_){
+          return 1;
+        }
+        req->body = StringView(arena_.Copy(buf->Peek(),content_length_),content_length_);
+        buf->Retrieve(content_length_);
+        state_ = PARSE_DONE;
+        break;
+      }
+      case PARSE_DONE:
+        return 0;
+      case PARSE_ERROR:
+        return -1;
+    }
+  }
+}
+
+void RequestParser::Reset(){
+  state_ = PARSE_REQUEST_LINE;
+  scan_pos_ = 0;
+  header_size_ = 0;
+  content_length_ = 0;
+  error_code_ = 0;
+  arena_.Reset();
+}
+
+//一行的界定标识是 \n 或者 \r\n，返回的 line 中不包含界定标识
+//一行太长或者 header 总长度太长的时候返回 too_long_code 对应的错误
+int RequestParser::ReadLine(Buffer* buf,StringView* line,int too_long_code){
+  const char* eol = buf->FindEOL(scan_pos_);
+  if(eol == NULL){
+    scan_pos_ = buf->ReadableBytes();
+    if(scan_pos_ > limits_.max_line_size){
+      return SetError(too_long_code);
+    }
+    if(header_size_ + scan_pos_ > limits_.max_header_size){
+      return SetError(431);
+    }
+    return 1;
+  }
+  size_t len = eol - buf->Peek();
+  if(len > limits_.max_line_size){
+    return SetError(too_long_code);
+  }
+  header_size_ += len + 1;
+  if(header_size_ > limits_.max_header_size){
+    return SetError(431);
+  }
+  if(len > 0 && buf->Peek()[len - 1] == '\r'){
+    --len;
+  }
+  //缓冲区中的数据之后会被覆盖，复制到内存池中
+  *line = StringView(arena_.Copy(buf->Peek(),len),len);
+  buf->Retrieve(eol - buf->Peek() + 1);
+  scan_pos_ = 0;
+  return 0;
+}
+
+int RequestParser::DecodeUrlPath(StringView* url_path){
+  const char* begin = url_path->data();
+  const char* end = begin + url_path->size();
+  //1.%XX 解码
+  if(ScanUtil::FindChar(begin,end,'%') != end){
+    //解码之后只会变短，直接在内存池中分配同样大小的空间
+    char* output = arena_.Allocate(url_path->size());
+    size_t size = 0;
+    if(ScanUtil::PercentDecode(begin,url_path->size(),false,output,&size) < 0){
+      LOG(ERROR) << "DecodeUrlPath error! url_path=" << *url_path << "\n";
+      return -1;
+    }
+    *url_path = StringView(output,size);
+  }
+  //2.规范化，/a//b/./c 和 /a/b/c 是同一个路径，路由和文件路径只需要处理规范的形式
+  //  %2e%2e 解码之后也是 ..，不能让请求访问到根目录之外的文件
+  if(ScanUtil::NeedNormalize(url_path->data(),url_path->size())){
+    char* output = arena_.Allocate(url_path->size());
+    size_t size = 0;
+    if(ScanUtil::NormalizePath(url_path->data(),url_path->size(),output,&size) < 0){
+      LOG(ERROR) << "DecodeUrlPath error! path traversal url_path=" << *url_path << "\n";
+      return -1;
+    }
+    *url_path = StringView(output,size);
+  }
+  return 0;
+}
+
+int RequestParser::OnHeaderComplete(Request* req){
+  //请求体使用 chunked 编码的情况暂时不支持
+  if(req->header.find(HEADER_TRANSFER_ENCODING) != req->header.end()){
+    LOG(ERROR) << "Transfer-Encoding request body is not supported!\n";
+    return SetError(501);
+  }
+  // 5. 如果是POST 请求，但是没有Content-Length字段，认为这次请求失败，直接返回错误
+  HeaderList::const_iterator it = req->header.find(HEADER_CONTENT_LENGTH);
+  if(it == req->header.end()){
+    if(req->method == "POST"){
+      LOG(ERROR) << "POST Request has no Content-Length!\n";
+      return SetError(411);
+    }
+    //  如果是GET请求，就不用 读 body
+    state_ = PARSE_DONE;
+    return 0;
+  }
+  //  继续读取 socket，获取到 body 内容；  
+  unsigned long long length = 0;
+  if(StringUtil::ParseUint(it->value,&length) < 0){
+    LOG(ERROR) << "Invalid Content-Length! Content-Length=" << it->value << "\n";
+    return SetError(400);
+  }
+  //出现多个 Content-Length 的时候必须完全一致，否则前面的代理和我们对 body 的长度理解不同，
+  //多出来的数据会被当成下一个请求(请求走私)
+  for(HeaderList::const_iterator other = it + 1;other != req->header.end();++other){
+    unsigned long long other_length = 0;
+    if(other->id == HEADER_CONTENT_LENGTH
+        && (StringUtil::ParseUint(other->value,&other_length) < 0 || other_length != length)){
+      LOG(ERROR) << "Conflicting Content-Length! " << it->value << " vs " << other->value << "\n";
+      return SetError(400);
+    }
+  }
+  if(length > limits_.max_body_size){
+    LOG(ERROR) << "Request body too large! Content-Length=" << length << "\n";
+    return SetError(413);
+  }
+  content_length_ = length;
+  state_ = PARSE_BODY;
+  return 0;
+}
+
+int RequestParser::SetError(int code){
+  state_ = PARSE_ERROR;
+  error_code_ = code;
+  return -1;
+}
+
+//首行由空格分隔的三部分组成，例如 GET /index.html HTTP/1.1，中间多个连续的空格也可以
+int RequestParser::ParseFirstLine(StringView first_line,
+                                  StringView* method,
+                                  StringView* url,
+                                  StringView* version){
+  StringView tokens[3];
+  StringView rest = first_line;
+  for(int i = 0;i < 3;++i){
+    size_t pos = rest.find(' ');
+    tokens[i] = rest.substr(0,pos);
+    rest = pos == StringView::npos ? StringView() : rest.substr(pos);
+    while(!rest.empty() && rest.front() == ' '){
+      rest.remove_prefix(1);
+    }
+    //少了一部分或者多了一部分(包括末尾多余的空格)
+    if(tokens[i].empty() || (i < 2 && rest.empty()) || (i == 2 && pos != StringView::npos)){
+      //首行的格式不对
+      LOG(ERROR) <<  "ParseFirstLine error! split error! first_line=" << first_line << "\n";
+      return -1;
+    }
+  }
+  //如果版本号不包含 HTTP 关键字，也认为出错
+  if(tokens[2].find("HTTP") == StringView::npos){
+    //首行格式不对，版本信息中不包含HTTP关键字
+    LOG(ERROR) << "ParseFirstLine error! version error! first_line=" << first_line << "\n";
+    return -1;
+  }
+  *method = tokens[0];
+  *url = tokens[1];
+  *version = tokens[2];
+  return 0;
+}
+
+//解析一个标准url，其实比较复杂，核心思路是以？作为分割，从？左边
+//来查找url_path，从？右边来查找query_string
+//我们此处只实现一个简化版本，只考虑不包含域名和协议的情况
+//只是单纯的以？作为分割，左边为path，右边为query_string
+//如果是/path/index.html
+int RequestParser::ParseUrl(StringView url,
+                            StringView* url_path,
+                            StringView* query_string){
+  const char* begin = url.data();
+  const char* end = begin + url.size();
+  const char* invalid = ScanUtil::FindInvalidUrlByte(begin,end);
+  if(invalid != end){
+    LOG(ERROR) << "ParseUrl error! invalid byte at " << invalid - begin << " url=" << url << "\n";
+    return -1;
+  }
+  const char* pos = ScanUtil::FindChar(begin,end,'?');
+  if(pos == end){
+    //没找到
+    *url_path = url;
+    *query_string = StringView();
+    return 0;
+  }
+  //找到了
+  *url_path = url.substr(0,pos - begin);
+  *query_string = url.substr(pos - begin + 1);
+  return 0;
+}
+
+//header 的格式是 name: value，冒号后面和行尾可以有任意个空格或者 \t(RFC 7230 中的 OWS)，
+//value 中不包含这些空白；name 和冒号之间不允许有空白，否则前后的代理可能把它当成不同的 header
+int RequestParser::ParseHeader(StringView header_line,HeaderList* header){
+  const char* begin = header_line.data();
+  const char* colon = ScanUtil::FindChar(begin,begin + header_line.size(),':');
+  size_t pos = colon - begin;
+  if(pos == header_line.size()){
+    //找不到： 说明header格式有问题
+    LOG(ERROR) << "ParseHeader error! has no : header_line=" << header_line << "\n";
+    return -1;
+  }
+  StringView name = header_line.substr(0,pos);
+  if(name.empty() || name.back() == ' ' || name.back() == '\t'
+      || name.front() == ' ' || name.front() == '\t'){
+    LOG(ERROR) << "ParseHeader error! invalid name! header_line=" << header_line << "\n";
+    return -1;
+  }
+  StringView value = header_line.substr(pos + 1);
+  while(!value.empty() && (value.front() == ' ' || value.front() == '\t')){
+    value.remove_prefix(1);
+  }
+  while(!value.empty() && (value.back() == ' ' || value.back() == '\t')){
+    value.remove_suffix(1);
+  }
+  header->Add(name,value);
+  return 0;
+}
+
+//一个请求中最多接受多少个范围，太多的话直接忽略 Range 返回完整内容
+static const size_t kMaxRanges = 16;
+
+//支持三种写法：
+//  bytes=0-499   从0到499
+//  bytes=500-    从500到结尾
+//  bytes=-500    最后500个字节
+//多个范围用逗号分隔
+int RequestParser::ParseRange(StringView range,off_t size,std::vector<ByteRange>* ranges){
+  ranges->clear();
+  if(!range.starts_with("bytes=")){
+    return 1;
+  }
+  range.remove_prefix(6);
+  if(static_cast<size_t>(std::count(range.begin(),range.end(),',')) + 1 > kMaxRanges){
+    return 1;
+  }
+  while(!range.empty()){
+    size_t comma = range.find(',');
+    StringView spec = StringUtil::Trim(range.substr(0,comma));
+    range = comma == StringView::npos ? StringView() : range.substr(comma + 1);
+    if(spec.empty()){
+      continue;
+    }
+    size_t dash = spec.find('-');
+    if(dash == StringView::npos){
+      return 1;
+    }
+    StringView first = spec.substr(0,dash);
+    StringView last = spec.substr(dash + 1);
+    unsigned long long first_value = 0;
+    unsigned long long last_value = 0;
+    if((first.empty() && last.empty())
+        || (!first.empty() && StringUtil::ParseUint(first,&first_value) < 0)
+        || (!last.empty() && StringUtil::ParseUint(last,&last_value) < 0)){
+      return 1;
+    }
+    //解析出来的值可能超过 off_t 能表示的范围，先按照无符号数和 size 比较，
+    //截断到 size 以内之后再转换成 off_t，否则转换之后会变成负数
+    const unsigned long long limit = static_cast<unsigned long long>(size);
+    if(first.empty()){
+      //最后 N 个字节
+      if(last_value > 0 && size > 0){
+        ranges->push_back(ByteRange(last_value >= limit ? 0 : size - static_cast<off_t>(last_value),
+                                    size - 1));
+      }
+      continue;
+    }
+    if(!last.empty() && last_value < first_value){
+      return 1;
+    }
+    //起始位置超过了内容的长度，这个范围无法满足
+    if(first_value >= limit){
+      continue;
+    }
+    off_t begin = static_cast<off_t>(first_value);
+    off_t end = (last.empty() || last_value >= limit) ? size - 1 : static_cast<off_t>(last_value);
+    ranges->push_back(ByteRange(begin,end));
+  }
+  return ranges->empty() ? -1 : 0;
+}
+
+}//end of http_server
@@ -0,0 +1,98 @@
+#pragma once
+//增量式的 HTTP 请求解析器
+//数据先整块地读到连接的 Buffer 中，解析器只处理缓冲区中已经有的数据，
+//数据不够的时候记住自己解析到了哪一步，下次数据到了接着解析。
+//阻塞 socket 和非阻塞 socket 都是同样的用法
+//解析出来的每一行都复制到解析器自己的内存池中，Request 中的字段指向内存池，
+//所以 Request 只在下一次 Reset 之前有效
+#include <stddef.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+#include "http_message.h"
+#include "arena.hpp"
+
+class Buffer;
+
+namespace http_server{
+
+//解析器的各种限制，超过限制直接返回对应的错误码
+struct ParserLimits{
+  size_t max_line_size;   //请求首行和每一行 header 的最大长度
+  size_t max_header_size; //首行加上所有 header 的最大长度
+  size_t max_body_size;   //body 的最大长度
+  ParserLimits()
+    :max_line_size(8 * 1024),max_header_size(64 * 1024),
+     max_body_size(8 * 1024 * 1024){
+  }
+};
+
+//Range 头部中的一个范围，first 和 last 都包含在内，例如 bytes=0-499 表示 [0,499]
+struct ByteRange{
+  off_t first;
+  off_t last;
+  ByteRange(off_t f,off_t l):first(f),last(l){}
+  off_t Length() const{ return last - first + 1; }
+};
+
+class RequestParser{
+public:
+  RequestParser()
+    :state_(PARSE_REQUEST_LINE),scan_pos_(0),header_size_(0),
+     content_length_(0),error_code_(0){
+  }
+  void SetLimits(const ParserLimits& limits){
+    limits_ = limits;
+  }
+  //从 buf 中解析请求，解析过的数据会从 buf 中移除
+  //返回0表示解析出了完整的请求，返回1表示数据还不完整，返回小于0表示请求有错误
+  //出错之后可以通过 ErrorCode() 拿到应该返回给客户端的状态码
+  int Parse(Buffer* buf,Request* req);
+  //准备解析同一个连接上的下一个请求，之前解析出来的 Request 不能再使用
+  void Reset();
+  int ErrorCode() const{
+    return error_code_;
+  }
+  //header 已经解析完，正在等 body 的数据
+  bool InBody() const{
+    return state_ == PARSE_BODY;
+  }
+
+  //下面几个函数只负责解析一行已经完整的数据
+  //返回0表示成功，返回小于0表示执行失败
+  //输出的字段都指向输入的数据，不复制
+  static int ParseFirstLine(StringView first_line,StringView* method,
+                            StringView* url,StringView* version);
+  //url 中出现空格、控制字符或者非 ASCII 字节的时候返回小于0
+  static int ParseUrl(StringView url,StringView* url_path,StringView* query_string);
+  //value 去掉冒号后面和行尾的空格、\t；name 和冒号之间有空白的时候返回小于0
+  static int ParseHeader(StringView header_line,HeaderList* header);
+  //解析 Range 头部的值，size 是完整内容的长度，结果中的范围都已经截断到 size 以内
+  //返回0表示成功，返回1表示格式不对或者范围太多需要忽略 Range，返回小于0表示所有范围都无法满足
+  static int ParseRange(StringView range,off_t size,std::vector<ByteRange>* ranges);
+private:
+  enum ParseState{
+    PARSE_REQUEST_LINE,
+    PARSE_HEADER,
+    PARSE_BODY,
+    PARSE_DONE,
+    PARSE_ERROR,
+  };
+  //从 buf 中取出一行(不包含 \r\n)复制到内存池中，返回1表示这一行还不完整
+  int ReadLine(Buffer* buf,StringView* line,int too_long_code);
+  //url_path 中有 %XX 的时候解码到内存池中，解码失败或者出现 .. 这样的路径段返回小于0
+  int DecodeUrlPath(StringView* url_path);
+  //所有 header 解析完之后，根据 Content-Length 决定要不要继续读 body
+  int OnHeaderComplete(Request* req);
+  int SetError(int code);
+
+  ParserLimits limits_;
+  ParseState state_;
+  size_t scan_pos_; //当前行已经查找过换行符的位置，避免数据分多次到达时重复查找
+  size_t header_size_; //已经解析过的首行和 header 的总长度
+  size_t content_length_;
+  int error_code_;
+  Arena arena_; //当前请求的首行、header 和 body
+};
+
+}//end of http_server
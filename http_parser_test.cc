@@ -0,0 +1,164 @@
+//请求解析器的单元测试，不需要启动服务器
+//每个 CHECK 失败的时候输出所在的行，最后返回失败的个数，make test 会运行它
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "http_parser.h"
+#include "buffer.hpp"
+
+using namespace http_server;
+
+static int g_failed = 0;
+
+#define CHECK(cond) do{ \
+  if(!(cond)){ \
+    fprintf(stderr,"%s:%d: CHECK failed: %s\n",__FILE__,__LINE__,#cond); \
+    ++g_failed; \
+  } \
+}while(0)
+
+static std::string HeaderValue(const Request& req,StringView name){
+  HeaderList::const_iterator it = req.header.find(name);
+  return it == req.header.end() ? "<none>" : std::string(it->value.data(),it->value.size());
+}
+
+//把 data 一次性交给一个新的解析器，返回 Parse 的结果
+static int ParseAll(const std::string& data,Buffer* buf,RequestParser* parser,Request* req){
+  buf->Append(data.data(),data.size());
+  return parser->Parse(buf,req);
+}
+
+static void TestParseHeader(){
+  HeaderList header;
+  CHECK(RequestParser::ParseHeader("Host: x",&header) == 0);
+  CHECK(RequestParser::ParseHeader("Connection:close",&header) == 0);
+  CHECK(RequestParser::ParseHeader("Content-Length: \t 17 \t",&header) == 0);
+  CHECK(RequestParser::ParseHeader("X-Empty:",&header) == 0);
+  CHECK(RequestParser::ParseHeader("X-Inner:  a  b ",&header) == 0);
+  Request req;
+  req.header = header;
+  CHECK(HeaderValue(req,"host") == "x");
+  CHECK(HeaderValue(req,"Connection") == "close");
+  CHECK(HeaderValue(req,"Content-Length") == "17");
+  CHECK(HeaderValue(req,"X-Empty") == "");
+  CHECK(HeaderValue(req,"X-Inner") == "a  b");
+
+  CHECK(RequestParser::ParseHeader("Host x",&header) < 0);
+  CHECK(RequestParser::ParseHeader(": x",&header) < 0);
+  CHECK(RequestParser::ParseHeader("Content-Length : 5",&header) < 0);
+  CHECK(RequestParser::ParseHeader(" Host: x",&header) < 0);
+}
+
+static void TestParseFirstLine(){
+  StringView method,url,version;
+  CHECK(RequestParser::ParseFirstLine("GET /index.html HTTP/1.1",&method,&url,&version) == 0);
+  CHECK(method == "GET" && url == "/index.html" && version == "HTTP/1.1");
+  CHECK(RequestParser::ParseFirstLine("GET  /a   HTTP/1.0",&method,&url,&version) == 0);
+  CHECK(url == "/a" && version == "HTTP/1.0");
+  CHECK(RequestParser::ParseFirstLine("GET /a",&method,&url,&version) < 0);
+  CHECK(RequestParser::ParseFirstLine("GET /a FTP/1.0",&method,&url,&version) < 0);
+
+  StringView path,query;
+  CHECK(RequestParser::ParseUrl("/add?a=1&b=2",&path,&query) == 0);
+  CHECK(path == "/add" && query == "a=1&b=2");
+  CHECK(RequestParser::ParseUrl("/a b",&path,&query) < 0);
+}
+
+static void TestParseRequest(){
+  //冒号后面没有空格的 Content-Length 也要按 25 读 body，不能把 body 的后半段当成下一个请求
+  {
+    Buffer buf;
+    RequestParser parser;
+    Request req;
+    CHECK(ParseAll("POST /add HTTP/1.1\r\nHost:x\r\nContent-Length:25\r\n\r\n"
+                   "a=1&b=2GET / HTTP/1.1\r\n\r\n",&buf,&parser,&req) == 0);
+    CHECK(req.body.size() == 25);
+    CHECK(HeaderValue(req,"Host") == "x");
+    CHECK(buf.ReadableBytes() == 0);
+  }
+  {
+    Buffer buf;
+    RequestParser parser;
+    Request req;
+    CHECK(ParseAll("GET / HTTP/1.1\r\nConnection:close\r\n\r\n",&buf,&parser,&req) == 0);
+    CHECK(HeaderValue(req,"Connection") == "close");
+  }
+  //数据分多次到达
+  {
+    Buffer buf;
+    RequestParser parser;
+    Request req;
+    CHECK(ParseAll("POST /add HTTP/1.1\r\nContent-Le",&buf,&parser,&req) == 1);
+    CHECK(ParseAll("ngth: 3\r\n\r\nab",&buf,&parser,&req) == 1);
+    CHECK(ParseAll("c",&buf,&parser,&req) == 0);
+    CHECK(req.body == "abc");
+  }
+  //多个 Content-Length 一致的时候可以接受，不一致的时候返回 400
+  {
+    Buffer buf;
+    RequestParser parser;
+    Request req;
+    CHECK(ParseAll("POST / HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 3\r\n\r\nabc",
+                   &buf,&parser,&req) == 0);
+  }
+  {
+    Buffer buf;
+    RequestParser parser;
+    Request req;
+    CHECK(ParseAll("POST / HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 30\r\n\r\nabc",
+                   &buf,&parser,&req) < 0);
+    CHECK(parser.ErrorCode() == 400);
+  }
+  {
+    Buffer buf;
+    RequestParser parser;
+    Request req;
+    CHECK(ParseAll("POST / HTTP/1.1\r\nContent-Length: 3, 3\r\n\r\nabc",&buf,&parser,&req) < 0);
+    CHECK(parser.ErrorCode() == 400);
+  }
+  {
+    Buffer buf;
+    RequestParser parser;
+    Request req;
+    CHECK(ParseAll("POST / HTTP/1.1\r\nHost: x\r\n\r\n",&buf,&parser,&req) < 0);
+    CHECK(parser.ErrorCode() == 411);
+  }
+  {
+    Buffer buf;
+    RequestParser parser;
+    Request req;
+    CHECK(ParseAll("GET /../etc/passwd HTTP/1.1\r\n\r\n",&buf,&parser,&req) < 0);
+    CHECK(parser.ErrorCode() == 400);
+  }
+}
+
+static void TestParseRange(){
+  std::vector<ByteRange> ranges;
+  CHECK(RequestParser::ParseRange("bytes=0-499",1000,&ranges) == 0);
+  CHECK(ranges.size() == 1 && ranges[0].first == 0 && ranges[0].last == 499);
+  CHECK(RequestParser::ParseRange("bytes=500-",1000,&ranges) == 0);
+  CHECK(ranges.size() == 1 && ranges[0].first == 500 && ranges[0].last == 999);
+  CHECK(RequestParser::ParseRange("bytes=-100, 0-0",1000,&ranges) == 0);
+  CHECK(ranges.size() == 2 && ranges[0].first == 900 && ranges[1].last == 0);
+  //超过 off_t 范围的值截断到内容长度以内
+  CHECK(RequestParser::ParseRange("bytes=0-18446744073709551615",1000,&ranges) == 0);
+  CHECK(ranges.size() == 1 && ranges[0].last == 999);
+  CHECK(RequestParser::ParseRange("bytes=-9223372036854775808",1000,&ranges) == 0);
+  CHECK(ranges.size() == 1 && ranges[0].first == 0);
+  CHECK(RequestParser::ParseRange("bytes=9223372036854775808-",1000,&ranges) < 0);
+  CHECK(RequestParser::ParseRange("bytes=5-1",1000,&ranges) == 1);
+  CHECK(RequestParser::ParseRange("items=0-1",1000,&ranges) == 1);
+}
+
+int main(){
+  TestParseHeader();
+  TestParseFirstLine();
+  TestParseRequest();
+  TestParseRange();
+  if(g_failed > 0){
+    fprintf(stderr,"%d checks failed\n",g_failed);
+    return 1;
+  }
+  printf("http_parser_test passed\n");
+  return 0;
+}
@@ -5,19 +5,147 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <pthread.h>
 #include <sstream>
 #include <sys/wait.h>
+#include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <algorithm>
+#include <thread>
+#include "reactor.h"
+#include "uring_reactor.h"
+#include "thread_pool.hpp"
+#include "encoding.h"
+#include "cgi_protocol.hpp"
 
 typedef struct sockaddr sockaddr;
 typedef struct sockaddr_in sockaddr_in;
 
 namespace http_server{
 
+HttpServer::HttpServer(const ServerConfig& config)
+  :config_(config),cache_report_time_(TimeUtil::TimeStamp()),admission_(config.admission){
+  overload_response_ = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: "
+    + std::to_string(config_.admission.retry_after)
+    + "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+  if(config_.file_cache_size > 0){
+    file_cache_.reset(new FileCache(config_.file_cache_size,config_.file_cache_check_interval));
+  }
+  cgi_pool_.reset(new CgiPool(config_.cgi_workers,config_.cgi_timeout));
+}
+
 //建立socket
 int HttpServer::Start(const std::string& ip,short port){
-  int listen_sock = socket(AF_INET,SOCK_STREAM,0);
+  //日志的后台线程最先启动，之后所有的日志都是异步写的
+  if(Logger::Instance().Start(config_.log) < 0){
+    return -1;
+  }
+  //插件要在处理请求之前全部加载完
+  for(size_t i = 0;i < config_.plugins.size();++i){
+    if(plugins_.Load(config_.plugins[i]) < 0){
+      return -1;
+    }
+  }
+  //路由表中的插件路由要用到插件注册的处理函数
+  if(BuildRouter() < 0){
+    return -1;
+  }
+  //证书有问题的话在开始接受连接之前就报错
+  if(config_.tls.port > 0 && tls_.Init(config_.tls) < 0){
+    return -1;
+  }
+  //对端关闭连接之后继续 write 会收到 SIGPIPE，默认行为是终止进程
+  signal(SIGPIPE,SIG_IGN);
+  if(config_.mode == MODE_REUSEPORT){
+    return RunReuseportMode(ip,port);
+  }
+  int listen_sock = CreateListenSocket(ip,port,false);
+  if(listen_sock < 0){
+    return -1;
+  }
+  //HTTPS 使用单独的端口，同一个地址上 HTTP 和 HTTPS 同时提供服务
+  int tls_sock = -1;
+  if(config_.tls.port > 0){
+    tls_sock = CreateListenSocket(ip,config_.tls.port,false);
+    if(tls_sock < 0){
+      close(listen_sock);
+      return -1;
+    }
+  }
+  //printf("ServerStart ok!\n");
+  LOG(INFO) << "ServerStart ok!\n";
+  int ret = 0;
+  if(config_.mode == MODE_EPOLL){
+    EpollReactor reactor(this,listen_sock,tls_sock);
+    ret = reactor.Run();
+  }else if(config_.mode == MODE_URING){
+    ret = RunUringMode(listen_sock,tls_sock);
+  }else if(config_.mode == MODE_POOL){
+    ret = RunPoolMode(listen_sock,tls_sock);
+  }else {
+    //HTTPS 连接由另一个线程 accept，之后的处理流程完全一样
+    if(tls_sock >= 0){
+      std::thread(&HttpServer::RunThreadMode,this,tls_sock,true).detach();
+    }
+    ret = RunThreadMode(listen_sock,false);
+  }
+  close(listen_sock);
+  return ret;
+}
+
+int HttpServer::BuildRouter(){
+  std::vector<RouteConfig> routes = config_.routes;
+  if(routes.empty()){
+    routes.push_back(RouteConfig("/",ROUTE_STATIC,"./wwwroot"));
+    routes.push_back(RouteConfig("/add",ROUTE_CGI,"./wwwroot/add"));
+  }
+  //统计信息和插件注册的路径只匹配完整的路径，插件不区分请求方法
+  //配置中已经给插件指定了路由的，就按照配置的来
+  if(!config_.stats_path.empty()){
+    RouteConfig stats(config_.stats_path,ROUTE_STATS,"");
+    stats.exact = true;
+    routes.push_back(stats);
+  }
+  std::vector<std::string> paths;
+  plugins_.Paths(&paths);
+  for(size_t i = 0;i < paths.size();++i){
+    bool configured = false;
+    for(size_t j = 0;j < config_.routes.size();++j){
+      if(config_.routes[j].type == ROUTE_NATIVE && config_.routes[j].target == paths[i]){
+        configured = true;
+      }
+    }
+    if(!configured){
+      RouteConfig native(paths[i],ROUTE_NATIVE,paths[i]);
+      native.exact = true;
+      routes.push_back(native);
+    }
+  }
+  for(size_t i = 0;i < routes.size();++i){
+    HttpHandler* handler = NULL;
+    if(routes[i].type == ROUTE_NATIVE){
+      handler = plugins_.Find(routes[i].target);
+      if(handler == NULL){
+        LOG(ERROR) << "Plugin handler not found! target=" << routes[i].target << "\n";
+        return -1;
+      }
+    }
+    if(router_.Add(routes[i],handler) < 0){
+      return -1;
+    }
+  }
+  LOG(INFO) << "Router ok! routes=" << router_.Size() << "\n";
+  return 0;
+}
+
+int HttpServer::CreateListenSocket(const std::string& ip,short port,bool reuseport){
+  int listen_sock = socket(AF_INET,SOCK_STREAM | SOCK_CLOEXEC,0);
   if(listen_sock < 0){
     perror("socket");
     return -1;
@@ -26,6 +154,12 @@ int HttpServer::Start(const std::string& ip,short port){
   //要给socket加上一个选项，能够重用连接
   int opt = 1;
   setsockopt(listen_sock,SOL_SOCKET,SO_REUSEADDR,&opt,sizeof(opt));
+  //多个 socket 绑定同一个地址和端口，内核在这些 socket 之间分配新连接
+  if(reuseport && setsockopt(listen_sock,SOL_SOCKET,SO_REUSEPORT,&opt,sizeof(opt)) < 0){
+    perror("setsockopt SO_REUSEPORT");
+    close(listen_sock);
+    return -1;
+  }
 
   sockaddr_in addr;
   addr.sin_family = AF_INET;
@@ -35,75 +169,352 @@ int HttpServer::Start(const std::string& ip,short port){
   int ret = bind(listen_sock,(sockaddr*)&addr,sizeof(addr));
   if(ret < 0){
     perror("bind");
+    close(listen_sock);
     return -1;
   }
-  //监听
-  ret = listen(listen_sock,5);
+  //监听，backlog 太小的话突发的连接会被丢掉 SYN，客户端要等1秒之后重传
+  ret = listen(listen_sock,config_.listen_backlog);
   if(ret < 0){
     perror("listen");
+    close(listen_sock);
     return -1;
   }
-  //printf("ServerStart ok!\n");
-  LOG(INFO) << "ServerStart ok!\n";
+  return listen_sock;
+}
+
+int HttpServer::RunReuseportMode(const std::string& ip,short port){
+  std::vector<int> cpus;
+  if(CpuUtil::AllowedCpus(config_.numa,&cpus) < 0){
+    perror("sched_getaffinity");
+    return -1;
+  }
+  size_t shard_num = config_.worker_threads == 0 ? cpus.size() : config_.worker_threads;
+  //所有监听 socket 先创建好，端口被占用之类的错误在启动线程之前就能发现
+  //开启了 HTTPS 的话每个分片再多一个 HTTPS 端口的监听 socket
+  std::vector<int> socks;
+  std::vector<int> tls_socks;
+  for(size_t i = 0;i < shard_num;++i){
+    int sock = CreateListenSocket(ip,port,true);
+    int tls_sock = -1;
+    if(sock >= 0 && config_.tls.port > 0){
+      tls_sock = CreateListenSocket(ip,config_.tls.port,true);
+      if(tls_sock < 0){
+        close(sock);
+        sock = -1;
+      }
+    }
+    if(sock < 0){
+      for(size_t j = 0;j < socks.size();++j){
+        close(socks[j]);
+        if(tls_socks[j] >= 0){
+          close(tls_socks[j]);
+        }
+      }
+      return -1;
+    }
+    socks.push_back(sock);
+    tls_socks.push_back(tls_sock);
+  }
+  LOG(INFO) << "ServerStart ok! reuseport shard_num=" << shard_num
+    << " backlog=" << config_.listen_backlog << "\n";
+  std::vector<std::thread> threads;
+  for(size_t i = 0;i < shard_num;++i){
+    //分片比 CPU 多的时候从头开始轮流分配
+    int cpu = cpus[i % cpus.size()];
+    int sock = socks[i];
+    int tls_sock = tls_socks[i];
+    threads.push_back(std::thread([this,i,cpu,sock,tls_sock](){
+      if(CpuUtil::PinCurrentThread(cpu) < 0){
+        LOG(WARNING) << "PinCurrentThread failed! shard=" << i << " cpu=" << cpu << "\n";
+      }
+      ThreadStats& stats = Stats::Local();
+      stats.shard = static_cast<int>(i);
+      stats.cpu = cpu;
+      LOG(INFO) << "Shard start! shard=" << i << " cpu=" << cpu << "\n";
+      //连接、缓冲区这些内存都由这个线程自己分配，NUMA 机器上会分配在这个 CPU 所在的节点
+      EpollReactor reactor(this,sock,tls_sock);
+      reactor.Run();
+      close(sock);
+      if(tls_sock >= 0){
+        close(tls_sock);
+      }
+    }));
+  }
+  for(size_t i = 0;i < threads.size();++i){
+    threads[i].join();
+  }
+  return 0;
+}
+
+int HttpServer::RunUringMode(int listen_sock,int tls_sock){
+  UringReactor reactor(this,listen_sock);
+  if(reactor.Init() == 0){
+    //TLS 的记录要经过 OpenSSL 加解密，不能直接用 io_uring 收发，HTTPS 连接由单独的 epoll 反应堆处理
+    if(tls_sock >= 0){
+      std::thread([this,tls_sock](){
+        EpollReactor tls_reactor(this,-1,tls_sock);
+        tls_reactor.Run();
+      }).detach();
+    }
+    return reactor.Run();
+  }
+  //内核太老或者被 seccomp 禁止了 io_uring，行为和 epoll 模式完全一样
+  LOG(WARNING) << "io_uring not available, fall back to epoll\n";
+  EpollReactor epoll_reactor(this,listen_sock,tls_sock);
+  return epoll_reactor.Run();
+}
+
+int HttpServer::RunThreadMode(int listen_sock,bool tls){
   while(1){
    //基于多线程来实现一个TCP服务器
    sockaddr_in peer;
    socklen_t len = sizeof(peer);
-   int new_sock = accept(listen_sock,(sockaddr*)&peer,&len);
+   //非阻塞 socket，读写都通过 poll 等待，每个阶段都有超时
+   int new_sock = accept4(listen_sock,(sockaddr*)&peer,&len,SOCK_NONBLOCK | SOCK_CLOEXEC);
    if(new_sock < 0){
      perror("accept");
      continue;
   }
  //如果成功后，创建新线程，使用新线程完成此次请求的计算
+ //连接数到上限的时候不再创建线程，线程数不会随着连接无限增长
+  Context* context = NewContext(new_sock,tls);
+  if(context == NULL){
+    continue;
+  }
   pthread_t tid;
-  Context* context = new Context();
-  context->new_sock = new_sock;
-  context->server = this; // 使用this指针调用类成员函数
   pthread_create(&tid,NULL,ThreadEntry,reinterpret_cast<void*>(context));
   pthread_detach(tid);
   }
-  close(listen_sock);
   return 0;
 }
 
+int HttpServer::RunPoolMode(int listen_sock,int tls_sock){
+  size_t thread_num = config_.worker_threads;
+  if(thread_num == 0){
+    thread_num = ThreadPool<Context*>::DefaultThreadNum();
+  }
+  ThreadPool<Context*> pool(thread_num,config_.queue_size,
+      [this](Context* context){ ProcessConnection(context); });
+  pool.Start();
+  LOG(INFO) << "ThreadPool start! thread_num=" << thread_num
+    << " queue_size=" << config_.queue_size << "\n";
+  auto accept_loop = [this,&pool](int sock,bool tls){
+    while(1){
+      int new_sock = accept4(sock,NULL,NULL,SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if(new_sock < 0){
+        perror("accept");
+        continue;
+      }
+      Context* context = NewContext(new_sock,tls);
+      if(context == NULL){
+        continue;
+      }
+      //队列满了说明工作线程已经处理不过来了，直接返回 503，而不是让连接在队列和 backlog 中越积越多
+      if(!pool.TryPush(context)){
+        Stats::Local().Count(COUNTER_SHED_CONNECTIONS);
+        if(!tls){
+          SendOverload(new_sock);
+        }
+        DeleteContext(context);
+      }
+    }
+  };
+  //HTTPS 连接由另一个线程 accept，放进同一个线程池
+  if(tls_sock >= 0){
+    std::thread(accept_loop,tls_sock,true).detach();
+  }
+  accept_loop(listen_sock,false);
+  return 0;
+}
+
+Context* HttpServer::NewContext(int new_sock,bool tls){
+  if(!admission_.AcquireConnection()){
+    Stats::Local().Count(COUNTER_SHED_CONNECTIONS);
+    if(!tls){
+      SendOverload(new_sock);
+    }
+    close(new_sock);
+    return NULL;
+  }
+  Context* context = new Context();
+  context->new_sock = new_sock;
+  context->server = this; // 使用this指针调用类成员函数
+  context->parser.SetLimits(config_.limits);
+  //一个响应的 header 和 body 已经合并成一次写，关掉 Nagle 算法，
+  //CGI 边生成边发送的数据块和流水线上的后续响应不用等客户端的确认
+  int opt = 1;
+  setsockopt(new_sock,IPPROTO_TCP,TCP_NODELAY,&opt,sizeof(opt));
+  if(tls){
+    context->tls.reset(tls_.NewConnection(new_sock));
+    if(!context->tls){
+      DeleteContext(context);
+      return NULL;
+    }
+    //握手和读 header 使用同一个超时，从接受连接开始算
+    context->state = STATE_HANDSHAKE;
+    context->request_start = TimeUtil::MonotonicNS();
+  }
+  return context;
+}
+
+void HttpServer::DeleteContext(Context* context){
+  //响应还没写完连接就关闭了，名额也要还回去
+  if(context->admitted){
+    admission_.ReleaseRequest(STAGE_OTHER,0);
+  }
+  //CGI 暂停的时候连接超时或者出错了，CGI 程序还没有输出完，不能再用了
+  if(context->cgi.Active()){
+    cgi_pool_->Abort(&context->cgi);
+    admission_.ReleaseCgi();
+  }
+  admission_.ReleaseConnection();
+  if(context->tls){
+    context->tls->Shutdown();
+  }
+  close(context->new_sock);
+  delete context;
+}
+
+void HttpServer::SendOverload(int sock){
+  send(sock,overload_response_.data(),overload_response_.size(),MSG_DONTWAIT | MSG_NOSIGNAL);
+  //客户端发过来的请求还没读，直接 close 会发 RST，可能把 503 也冲掉，先关闭写方向
+  shutdown(sock,SHUT_WR);
+}
 
 //线程入口函数
 //static只需要在声明的时候加上，不用在定义的时候加static
 void* HttpServer::ThreadEntry(void* arg){
-  //准备工作
   Context* context = reinterpret_cast<Context*>(arg);
-  HttpServer* server = context->server;
-  //1.从文件描述符中读取数据，转换成Request 对象
-  int ret = 0;
-  ret = context->server->ReadOneRequest(context);
+  context->server->ProcessConnection(context);
+  return NULL;
+}
+
+int HttpServer::TlsHandshake(Context* context){
+  int64_t start = TimeUtil::MonotonicNS();
+  int ret = context->tls->Handshake();
+  context->handshake_ns += TimeUtil::MonotonicNS() - start;
+  ThreadStats& stats = Stats::Local();
   if(ret < 0){
-    LOG(ERROR) << "ReadOneRequest error!" << "\n";
-    //用这个函数构造404的HTTP响应对象
-    server->Process404(context);
-    goto END;
+    stats.Count(COUNTER_TLS_FAILED);
+    return -1;
+  }
+  if(ret == 1){
+    return 1;
+  }
+  stats.RecordStage(STAGE_HANDSHAKE,context->handshake_ns);
+  stats.Count(context->tls->Resumed() ? COUNTER_TLS_RESUMED : COUNTER_TLS_FULL);
+  if(context->tls->KtlsSend()){
+    stats.Count(COUNTER_TLS_KTLS);
+  }
+  //握手的时间不算在第一个请求中
+  context->state = STATE_READING;
+  context->request_start = 0;
+  return 0;
+}
+
+void HttpServer::ProcessConnection(Context* context){
+  //HTTPS 连接先完成握手，等待的时候和读 header 一样有超时
+  if(context->tls){
+    int ret = TlsHandshake(context);
+    while(ret == 1 && WaitSocket(context,context->tls->WantEvents()) == 0){
+      ret = TlsHandshake(context);
+    }
+    if(ret != 0){
+      DeleteContext(context);
+      return;
+    }
+  }
+  while(1){
+    //1.从文件描述符中读取数据，转换成Request 对象
+    //  socket 是非阻塞的，数据还没到就等待，等多久取决于现在是空闲、读 header 还是读 body
+    //  客户端流水线发送的请求可能已经读到缓冲区中了，这时候不需要等待
+    int ret = ReadOneRequest(context);
+    while(ret == 1 && WaitSocket(context,POLLIN) == 0){
+      ret = ReadOneRequest(context);
+    }
+    if(ret == 1 || (ret < 0 && context->parser.ErrorCode() == 0)){
+      //超时、还没读到完整的请求对端就关闭了，或者读 socket 出错，没有办法再返回响应
+      break;
+    }
+    //2.把Request 对象计算生成 Response 对象
+    BuildResponse(context,ret == 0);
+    //3.把Response 对象进行序列化，写回到客户端
+    if(WriteOneResponse(context) < 0 || !context->keep_alive){
+      break;
+    }
+    //流水线发送过来的后续请求还在 socket 缓冲区中，下一轮循环直接读取
+    context->Reset();
   }
+  //收尾工作,当前连接处理完成，主动关闭
+  DeleteContext(context);
+}
 
+void HttpServer::BuildResponse(Context* context,bool request_ok){
+  ++context->request_count;
+  ThreadStats& stats = Stats::Local();
+  stats.Count(COUNTER_REQUESTS);
+  //统计信息不受准入控制的限制，过载的时候也能看到
+  bool limited = request_ok && context->req.url_path != config_.stats_path;
+  if(!request_ok){
+    //请求格式有错误，缓冲区中剩下的数据已经没法继续解析了，只能关闭连接
+    ProcessError(context,context->parser.ErrorCode());
+    context->keep_alive = false;
+  }else if(limited && !admission_.AcquireRequest()){
+    //正在处理的请求已经到上限了，不再处理
+    stats.Count(COUNTER_SHED_REQUESTS);
+    ProcessOverload(context);
+  }else {
+    context->admitted = limited;
+    //TEST测试 通过以下函数将一个解析出来的请求打印出来
+    PrintRequest(context->req);
+    //先决定是否保持连接，边生成边发送的响应需要在处理请求的过程中就发出 header
+    context->keep_alive = IsKeepAlive(context->req)
+      && context->request_count < config_.keepalive_requests;
+    int64_t start = TimeUtil::MonotonicNS();
+    if(HandlerRequest(context) < 0){
+      LOG(ERROR) << "HandlerRequest error!" << "\n";
+      //用这个函数构造404的HTTP响应对象
+      Process404(context);
+    }
+    context->handle_ns = TimeUtil::MonotonicNS() - start;
+    //反应堆模式下 CGI 还没有结束，耗时和状态码等 CGI 结束之后在 EndAsyncCGI 中记录
+    if(context->cgi.Active()){
+      return;
+    }
+    stats.RecordStage(context->handle_stage,context->handle_ns);
+  }
+  stats.CountStatus(context->resp.code);
+  if(!context->streamed){
+    SetConnectionHeader(context);
+  }
+}
 
-  //TEST测试 通过以下函数将一个解析出来的请求打印出来
-  server->PrintRequest(context->req); 
-  
-  //2.把Request 对象计算生成 Response 对象
-  ret = server->HandlerRequest(context);
-  if(ret < 0){
-    LOG(ERROR) << "HandlerRequest error!" << "\n";
-    //用这个函数构造404的HTTP响应对象
-    server->Process404(context);
-    goto END;
+void HttpServer::SetConnectionHeader(Context* context){
+  Response* resp = &context->resp;
+  if(context->keep_alive){
+    resp->header[HEADER_CONNECTION] = "keep-alive";
+    std::string& value = resp->header[HEADER_KEEP_ALIVE];
+    value = "timeout=";
+    ResponseWriter::AppendUint(config_.keepalive_timeout,&value);
+    value += ", max=";
+    ResponseWriter::AppendUint(config_.keepalive_requests - context->request_count,&value);
+  }else {
+    resp->header[HEADER_CONNECTION] = "close";
   }
+}
 
-END:
-  //3.把Response 对象进行序列化，写回到客户端
-  server->WriteOneResponse(context);
-  //处理失败的情况
-  //收尾工作,当前请求处理完成，主动关闭
-  close(context->new_sock);
-  delete context;
-  return NULL;
+//HTTP/1.1 默认保持连接，HTTP/1.0 默认关闭连接，Connection 头部可以改变默认行为
+bool HttpServer::IsKeepAlive(const Request& req){
+  HeaderList::const_iterator it = req.header.find(HEADER_CONNECTION);
+  if(it != req.header.end()){
+    if(boost::iequals(it->value,"close")){
+      return false;
+    }
+    if(boost::iequals(it->value,"keep-alive")){
+      return true;
+    }
+  }
+  return req.version == "HTTP/1.1";
 }
 
 //构造一个404响应对象函数
@@ -113,322 +524,1234 @@ int HttpServer::Process404(Context* context){
   resp->desc = "NOT FOUND";
   resp->body = "<head><meta http-equiv=\"content-type\""
                      "content=\"text/html;charset=utf-8\"></head><h1>404!您的页面坏掉了(＾－＾)</h1>";
-  std::stringstream ss;
-  ss << resp->body.size();
-  std::string size;
-  ss >> size;
-  resp->header["Content-Length"] = size;
+  std::string& length = resp->header[HEADER_CONTENT_LENGTH];
+  ResponseWriter::AppendUint(resp->body.size(),&length);
+  return 0;
+}
+
+//构造一个错误响应对象
+int HttpServer::ProcessError(Context* context,int code){
+  Response* resp = &context->resp;
+  resp->code = code;
+  switch(code){
+    case 400: resp->desc = "Bad Request"; break;
+    case 405: resp->desc = "Method Not Allowed"; break;
+    case 411: resp->desc = "Length Required"; break;
+    case 413: resp->desc = "Payload Too Large"; break;
+    case 414: resp->desc = "URI Too Long"; break;
+    case 431: resp->desc = "Request Header Fields Too Large"; break;
+    case 501: resp->desc = "Not Implemented"; break;
+    case 502: resp->desc = "Bad Gateway"; break;
+    case 503: resp->desc = "Service Unavailable"; break;
+    case 504: resp->desc = "Gateway Timeout"; break;
+    default:
+      resp->code = 500;
+      resp->desc = "Internal Server Error";
+      break;
+  }
+  resp->body = "<h1>" + std::to_string(resp->code) + " " + resp->desc + "</h1>";
+  resp->header[HEADER_CONTENT_LENGTH] = std::to_string(resp->body.size());
+  return 0;
+}
+
+int HttpServer::ProcessOverload(Context* context){
+  ProcessError(context,503);
+  //拒绝的请求耗时很短，不能算到 CGI 之类的阶段中，否则会把自适应上限学到的最短耗时拉低
+  context->handle_stage = STAGE_OTHER;
+  context->resp.header_lines += "Retry-After: " + std::to_string(config_.admission.retry_after) + "\r\n";
+  context->keep_alive = false;
+  return 0;
+}
+
+int HttpServer::Process405(Context* context,unsigned allowed){
+  ProcessError(context,405);
+  context->resp.header_lines += "Allow: " + Router::MethodNames(allowed) + "\r\n";
+  return 0;
+}
+
+int HttpServer::ProcessRedirect(Context* context,const RouteMatch& match){
+  const Request& req = context->req;
+  Response* resp = &context->resp;
+  resp->code = match.route->redirect_code;
+  switch(resp->code){
+    case 302: resp->desc = "Found"; break;
+    case 303: resp->desc = "See Other"; break;
+    case 307: resp->desc = "Temporary Redirect"; break;
+    case 308: resp->desc = "Permanent Redirect"; break;
+    default: resp->desc = "Moved Permanently"; break;
+  }
+  std::string& location = resp->header[HEADER_LOCATION];
+  GetFilePath(match,&location);
+  if(!req.query_string.empty()){
+    location += "?";
+    location.append(req.query_string.data(),req.query_string.size());
+  }
+  resp->header[HEADER_CONTENT_LENGTH] = "0";
+  return 0;
+}
+
+//统计信息是读取的时候才把所有线程的数据累加起来，请求线程记录的时候不加锁
+int HttpServer::ProcessStats(Context* context){
+  StatsSnapshot snapshot;
+  Stats::Instance().Collect(&snapshot);
+  if(file_cache_){
+    snapshot.extra.push_back(std::make_pair("file_cache_hits",file_cache_->Hits()));
+    snapshot.extra.push_back(std::make_pair("file_cache_misses",file_cache_->Misses()));
+    snapshot.extra.push_back(std::make_pair("file_cache_evictions",file_cache_->Evictions()));
+    snapshot.extra.push_back(std::make_pair("file_cache_invalidations",
+                                            file_cache_->Invalidations()));
+  }
+  snapshot.gauges.push_back(std::make_pair("admission_connections",admission_.Connections()));
+  snapshot.gauges.push_back(std::make_pair("admission_requests",admission_.Requests()));
+  snapshot.gauges.push_back(std::make_pair("admission_cgi",admission_.Cgi()));
+  snapshot.gauges.push_back(std::make_pair("admission_request_limit",admission_.RequestLimit()));
+  Response* resp = &context->resp;
+  if(context->req.query_string.find("format=json") != StringView::npos){
+    resp->body = snapshot.ToJson();
+    resp->header[HEADER_CONTENT_TYPE] = "application/json";
+  }else {
+    resp->body = snapshot.ToPrometheus();
+    resp->header[HEADER_CONTENT_TYPE] = "text/plain; version=0.0.4";
+  }
+  resp->header[HEADER_CACHE_CONTROL] = "no-store";
+  resp->header[HEADER_CONTENT_LENGTH] = std::to_string(resp->body.size());
   return 0;
 }
 
 //从socket读取字符串，构造生成 Request 对象
+//返回0表示读到了完整的请求，返回1表示非阻塞 socket 暂时没有数据了，返回小于0表示出错
+//解析失败的时候 context->parser.ErrorCode() 不为0，读 socket 失败或者对端关闭的时候为0
 int HttpServer::ReadOneRequest(Context* context){
-  Request* req = &context->req;
-  //1.从socket中读取一行数据作物Request 的首行
-  //  按行读取的分割符应该是  \n  \r \r\n
-  std::string first_line;
-  //右值引用，避免拷贝
-  //1.如果参数用于输入，const T&
-  //2.如果参数用于输出，T*
-  FileUtil::ReadLine(context->new_sock,&first_line);
-  //2.解析首行，获取到请求的方法method 和 url
-  int ret = ParseFirstLine(first_line,&req->method,&req->url);
-  if(ret < 0){
-    LOG(ERROR) << "ParseFirstLine error! first_line=" << first_line << "\n";
+  while(1){
+    //1.先看缓冲区中已经有的数据能不能解析出一个完整的请求
+    int ret = ParseRequest(context);
+    if(ret != 1){
+      return ret;
+    }
+    //2.数据还不够，一次性从 socket 中读尽可能多的数据
+    ssize_t read_size = ReadSocket(context);
+    if(read_size > 0){
+      continue;
+    }
+    if(read_size < 0 && errno == EINTR){
+      continue;
+    }
+    if(read_size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+      return 1;
+    }
+    //对端关闭或者出错，请求不可能完整了
     return -1;
   }
-  //3.解析url，获取到url_path和query_string 
-  ret = ParseUrl(req->url,&req->url_path,&req->query_string);
+}
+
+ssize_t HttpServer::ReadSocket(Context* context){
+  int64_t start = TimeUtil::MonotonicNS();
+  ssize_t read_size = context->tls ? context->tls->Read(&context->read_buf)
+                                   : context->read_buf.ReadFd(context->new_sock);
+  ThreadStats& stats = Stats::Local();
+  stats.RecordStage(STAGE_READ,TimeUtil::MonotonicNS() - start);
+  if(read_size > 0){
+    stats.Count(COUNTER_BYTES_IN,read_size);
+    if(context->request_start == 0 && context->state == STATE_READING){
+      context->request_start = start;
+    }
+  }
+  return read_size;
+}
+
+int HttpServer::ParseRequest(Context* context){
+  int64_t start = TimeUtil::MonotonicNS();
+  //流水线发送的请求在上一个请求处理完的时候已经在缓冲区中了，从开始解析算起
+  if(context->request_start == 0 && context->read_buf.ReadableBytes() > 0){
+    context->request_start = start;
+  }
+  int ret = context->parser.Parse(&context->read_buf,&context->req);
+  context->parse_ns += TimeUtil::MonotonicNS() - start;
+  if(ret != 1){
+    Stats::Local().RecordStage(STAGE_PARSE,context->parse_ns);
+  }
   if(ret < 0){
-    LOG(ERROR) << "ParseUrl error! first_line=" << req->url << "\n";
-    return -1;
+    LOG(ERROR) << "Parse request error! code=" << context->parser.ErrorCode() << "\n";
   }
-  //4.循环的按行读取数据，每次读取到一行数据，就进行一次解析header,读到空行说明header解析完毕
-  std::string header_line;
-  while(1){
-    FileUtil::ReadLine(context->new_sock,&header_line);
-    // 如果是header_line 是空行，就退出循环
-    // 由于ReadLine返回的header_line不包含\n等分隔符，所以读到空行的时候header_line返回的其实是空字符串
-    if(header_line == ""){
+  return ret;
+}
+
+//实现序列化，把Response 对象转换成一个string 
+//写回到 socket中
+//此函数完全按照http协议要求来构造响应数据
+//我们实现这个函数的细节可能有很大差异，但是只要能遵守http协议就都是可以的
+int HttpServer::WriteOneResponse(Context* context){
+  //1.只序列化首行和 header，body 不复制，发送的时候和 header 一起交给 sendmsg
+  //  静态文件的内容直接从缓存或者文件发送到 socket，CGI 的响应在处理请求的时候已经发送过了
+  if(!context->streamed){
+    SerializeResponse(context->resp,&context->write_buf);
+    context->write_pos = 0;
+  }
+  //2.将序列化的结果写到socket 中，发送缓冲区满了就等待，客户端一直不读的话写超时
+  context->state = STATE_WRITING;
+  while(true){
+    int ret = FlushResponse(context);
+    if(ret == 0){
       break;
     }
-    ret = ParseHeader(header_line,&req->header);
-    if(ret < 0){
-      LOG(ERROR) << "ParseHeader error! first_line=" << header_line << "\n";
+    if(ret < 0 || WaitSocket(context,POLLOUT) < 0){
       return -1;
     }
   }
-  // 5. 如果是POST 请求，但是没有Content-Length字段，认为这次请求失败，直接返回错误
-  Header::iterator it = req->header.find("Context-Length");
-  if(req->method == "POST" && it == req->header.end()){
-    LOG(ERROR) << "POST Request has no Context-Length!\n";
-    return -1;
+  FinishResponse(context);
+  return 0;
+}
+
+TimeoutPhase HttpServer::GetTimeoutPhase(const Context* context){
+  if(context->state == STATE_HANDSHAKE){
+    return TIMEOUT_HEADER;
   }
-  //  如果是GET请求，就不用 读 body
-  if(req->method == "GET"){
-    return 0;
+  if(context->state == STATE_WRITING){
+    return TIMEOUT_WRITE;
   }
-  //如果是POST请求，并且header中包含了Content-Length字段
-  //  继续读取 socket，获取到 body 内容；  
-  int content_length = atoi(it->second.c_str());
-  //从文件描述符中读指定长度
-  ret = FileUtil::ReadN(context->new_sock,content_length,&req->body); 
-  if(ret < 0){
-    LOG(ERROR) << "ReadN error! context_length=" << content_length << "\n";
-    return -1;
+  if(context->state == STATE_CGI){
+    return TIMEOUT_CGI;
   }
-  return 0;
+  if(context->parser.InBody()){
+    return TIMEOUT_BODY;
+  }
+  if(context->request_start != 0 || context->read_buf.ReadableBytes() > 0){
+    return TIMEOUT_HEADER;
+  }
+  return TIMEOUT_IDLE;
 }
 
-int HttpServer::ParseFirstLine(const std::string& first_line,
-                               std::string* method,
-                               std::string* url){
-  std::vector<std::string> tokens;
-  StringUtil::Split(first_line," ",&tokens);
-  if(tokens.size() != 3){
-    //首行的格式不对
-    LOG(ERROR) <<  "ParseFirstLine error! split error! first_line=" << first_line << "\n";
-    return -1;
+int64_t HttpServer::Deadline(const Context* context,TimeoutPhase phase,int64_t now_ms){
+  switch(phase){
+    case TIMEOUT_HEADER:{
+      //从收到第一个字节开始算，客户端一个字节一个字节地慢慢发也不会延长
+      int64_t start = context->request_start == 0 ? now_ms : context->request_start / (1000 * 1000);
+      return start + config_.header_timeout * 1000LL;
+    }
+    case TIMEOUT_BODY:
+      return now_ms + config_.body_timeout * 1000LL;
+    case TIMEOUT_WRITE:
+      return now_ms + config_.write_timeout * 1000LL;
+    case TIMEOUT_CGI:
+      return now_ms + config_.cgi_timeout * 1000LL;
+    default:
+      return now_ms + config_.keepalive_timeout * 1000LL;
   }
-  //如果版本号不包含 HTTP 关键字，也认为出错
-  if(tokens[2].find("HTTP") == std::string::npos){
-    //首行格式不对，版本信息中不包含HTTP关键字
-    LOG(ERROR) << "ParseFirstLine error! version error! first_line=" << first_line << "\n";
-    return -1;
+}
+
+void HttpServer::OnTimeout(const Context* context,TimeoutPhase phase){
+  Stats::Local().Count(static_cast<Counter>(COUNTER_TIMEOUT_IDLE + phase));
+  //空闲超时是长连接的正常结束，其他阶段超时说明客户端太慢或者已经失去响应
+  if(phase != TIMEOUT_IDLE){
+    LOG(INFO) << "Connection timeout! phase=" << phase << " request_count="
+      << context->request_count << "\n";
   }
-  *method = tokens[0];
-  *url = tokens[1];
-  return 0;
 }
 
-//解析一个标准url，其实比较复杂，核心思路是以？作为分割，从？左边
-//来查找url_path，从？右边来查找query_string
-//我们此处只实现一个简化版本，只考虑不包含域名和协议的情况
-//只是单纯的以？作为分割，左边为path，右边为query_string
-//如果是/path/index.html
-int HttpServer::ParseUrl(const std::string& url,
-             std::string* url_path,
-             std::string* query_string){
-  size_t pos = url.find("?");
-  if(pos == std::string::npos){
-    //没找到
-    *url_path = url;
-    *query_string = "";
-    return 0;
+int HttpServer::WaitSocket(Context* context,short events){
+  //等待可写的时候总是按照写超时，CGI 的输出是在处理请求的过程中写出去的
+  TimeoutPhase phase = (events & POLLOUT) ? TIMEOUT_WRITE : GetTimeoutPhase(context);
+  int64_t now = TimeUtil::MonotonicMS();
+  int64_t deadline = Deadline(context,phase,now);
+  while(true){
+    if(now >= deadline){
+      OnTimeout(context,phase);
+      return -1;
+    }
+    pollfd pfd;
+    pfd.fd = context->new_sock;
+    pfd.events = events;
+    int ret = poll(&pfd,1,static_cast<int>(deadline - now));
+    if(ret > 0){
+      return 0;
+    }
+    if(ret < 0 && errno != EINTR){
+      return -1;
+    }
+    now = TimeUtil::MonotonicMS();
   }
-  //找到了
-  *url_path = url.substr(0,pos);
-  *query_string = url.substr(pos+1);
-  return 0;
 }
 
-int HttpServer::ParseHeader(const std::string& header_line,Header* header){
-  size_t pos = header_line.find(":");
-  if(pos == std::string::npos){
-    //找不到： 说明header格式有问题
-    LOG(ERROR) << "ParseHeader error! has no : header_line=" << header_line << "\n";
-    return -1;
+void HttpServer::FinishResponse(Context* context){
+  ThreadStats& stats = Stats::Local();
+  stats.RecordStage(STAGE_WRITE,context->write_ns);
+  if(context->request_start != 0){
+    stats.RecordStage(STAGE_REQUEST,TimeUtil::MonotonicNS() - context->request_start);
   }
-  //这个header格式还是不正确，没有value
-  if(pos + 2 >= header_line.size()){
-    LOG(ERROR) << "ParseHeader error! has no value! header_line=" << header_line << "\n";
+  if(context->admitted){
+    admission_.ReleaseRequest(context->handle_stage,context->handle_ns);
+    context->admitted = false;
+  }
+}
+
+int HttpServer::FlushResponse(Context* context){
+  int64_t start = TimeUtil::MonotonicNS();
+  int ret = SendPending(context);
+  context->write_ns += TimeUtil::MonotonicNS() - start;
+  return ret;
+}
+
+int HttpServer::SendPending(Context* context){
+  ThreadStats& stats = Stats::Local();
+  //1.header 和内存中的 body(错误页面、命中文件缓存的内容)用一次 sendmsg 写出去，可能只写出去一部分
+  //  后面还要 sendfile 的时候带上 MSG_MORE，header 和文件内容的开头合并成完整的报文
+  bool more = context->file_fd >= 0 && context->file_remaining > 0;
+  while(true){
+    iovec iov[2];
+    int iovcnt = PendingIov(context,iov);
+    if(iovcnt == 0){
+      break;
+    }
+    ssize_t write_size = context->tls ? context->tls->WriteV(iov,iovcnt)
+                                      : ResponseWriter::WriteV(context->new_sock,iov,iovcnt,more);
+    if(write_size < 0){
+      return -1;
+    }
+    if(write_size == 0){
+      //非阻塞 socket 的发送缓冲区满了
+      return 1;
+    }
+    stats.Count(COUNTER_BYTES_OUT,write_size);
+    ConsumeIov(context,write_size);
+  }
+  //3.静态文件的 body 通过 sendfile 在内核中直接从文件拷贝到 socket，不经过用户态
+  //  HTTPS 连接开启了 kTLS 的话也是 sendfile，由内核加密
+  while(context->file_fd >= 0 && context->file_remaining > 0){
+    ssize_t write_size = context->tls
+      ? context->tls->SendFile(context->file_fd,&context->file_offset,context->file_remaining)
+      : sendfile(context->new_sock,context->file_fd,&context->file_offset,context->file_remaining);
+    if(write_size > 0){
+      context->file_remaining -= write_size;
+      stats.Count(COUNTER_BYTES_OUT,write_size);
+      continue;
+    }
+    if(write_size < 0 && errno == EINTR){
+      continue;
+    }
+    if(write_size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+      return 1;
+    }
+    //返回0说明文件在发送过程中被截断了，已经没法按照 Content-Length 发完
+    LOG(ERROR) << "sendfile error! remaining=" << context->file_remaining << "\n";
     return -1;
-  } 
-  //查找最后一个，使用最后一次更改的
-  (*header)[header_line.substr(0,pos)] = header_line.substr(pos + 2);
+  }
+  context->CloseFile();
   return 0;
 }
 
+int HttpServer::PendingIov(Context* context,iovec* iov){
+  int iovcnt = 0;
+  size_t header_left = context->write_buf.size() - context->write_pos;
+  if(header_left > 0){
+    iov[iovcnt].iov_base = const_cast<char*>(context->write_buf.data()) + context->write_pos;
+    iov[iovcnt].iov_len = header_left;
+    ++iovcnt;
+  }
+  const char* body = NULL;
+  size_t body_left = 0;
+  if(context->file_entry && context->entry_pos < context->entry_end){
+    body = context->file_entry->data.data() + context->entry_pos;
+    body_left = context->entry_end - context->entry_pos;
+  }else if(context->body_pos < context->resp.body.size()){
+    body = context->resp.body.data() + context->body_pos;
+    body_left = context->resp.body.size() - context->body_pos;
+  }
+  if(body_left > 0){
+    iov[iovcnt].iov_base = const_cast<char*>(body);
+    iov[iovcnt].iov_len = body_left;
+    ++iovcnt;
+  }
+  return iovcnt;
+}
 
-//实现序列化，把Response 对象转换成一个string 
-//写回到 socket中
-//此函数完全按照http协议要求来构造响应数据
-//我们实现这个函数的细节可能有很大差异，但是只要能遵守http协议就都是可以的
-int HttpServer::WriteOneResponse(Context* context){
-  //定义100k的缓冲区
-  //char buf[1024 * 100];
-  //sprintf(buf,"",context->resp);
-  
-  //iostream 和 stringstream 之间的关系类似于
-  //printf 和 sprintf 之间的关系
-  //stringstream会动态分配缓冲区，函数内部自动管理
-  //但是重新开辟空间以及拷贝，但是也可以提前分配好空间，是比较灵活的，但是灵活也不一定是好事
-  //1.序列化字符串
-  const Response& resp = context->resp;
-  std::stringstream ss;
-  //ss中插入的的首行数据
-  ss << "HTTP/1.1 " << resp.code << " " << resp.desc << "\n"; 
-  //c++基于区间的循环auto
-  if(resp.cgi_resp == ""){
-    for(auto item : resp.header){
-    ss << item.first << ": " << item.second << "\n";
-    }
-    //普通的静态页面情况生成的界面内容有header和body
-    ss << "\n";
-    ss << resp.body;
+void HttpServer::ConsumeIov(Context* context,size_t write_size){
+  size_t header_left = context->write_buf.size() - context->write_pos;
+  size_t header_written = std::min(header_left,write_size);
+  context->write_pos += header_written;
+  size_t body_written = write_size - header_written;
+  if(context->file_entry && context->entry_pos < context->entry_end){
+    context->entry_pos += body_written;
   }else {
-    //当前是在处理CGI生成的界面
-    //cgi_resp同时包含了响应数据的header空行和body
-    ss << resp.cgi_resp;
-  } 
-  //header和body之间还有一个空行
-  //2.将序列化的结果写到socket 中
-  const std::string& str = ss.str();//获取到ss对象的内部的string对象使用引用拿出来，没有发生拷贝
-  write(context->new_sock,str.c_str(),str.size());
-  return 0;
+    context->body_pos += body_written;
+  }
+}
+
+void HttpServer::SerializeResponse(const Response& resp,std::string* output){
+  //首行和常用的 header 名字都是预先编码好的，整个过程只有追加，output 的容量在长连接上复用
+  output->clear();
+  ResponseWriter::SerializeHeader(resp,output);
 }
 
 //通过输入的request 对象计算生成response对象
-//1.静态页面
-// a)GET请求没有query_string作为参数
-//2.动态页面生成(使用CGI的方式动态生成,效率较低)
-// a)GET请求并且存在 query_string 作为参数
-// b)POST请求，带有body
+//按照路径前缀和请求方法在路由表中找到处理方式：
+//1.静态页面，路由的目标是根目录
+//2.动态页面生成(使用CGI的方式动态生成,效率较低)，路由的目标是 CGI 程序
+//3.插件注册的处理函数、重定向、服务器自己的统计信息
 int HttpServer::HandlerRequest(Context* context){
   const Request& req = context->req;
   Response* resp = &context->resp;
   resp->code = 200;
   resp->desc = "OK";
-  //判定当前的处理方式是按照静态文件处理还是动态生成
-  if(req.method == "GET" && req.query_string == ""){
-    return context->server->ProcessStaticFile(context);
-  }else if((req.method == "GET" && req.query_string != "")
-      || req.method == "POST"){
-    return context->server->ProcessCGI(context);
-  }else {
-    LOG(ERROR) << "Unsupport Method! method=" << req.method << "\n";
+  RouteMatch match;
+  int ret = router_.Match(req.method,req.url_path,&match);
+  if(ret > 0){
+    return Process405(context,match.allowed);
+  }
+  if(ret < 0){
+    LOG(ERROR) << "No route! method=" << req.method << " url_path=" << req.url_path << "\n";
     return -1;
   }
-  return -1;
+  switch(match.route->type){
+    case ROUTE_STATS:
+      return ProcessStats(context);
+    case ROUTE_REDIRECT:
+      return ProcessRedirect(context,match);
+    case ROUTE_NATIVE:
+      context->handle_stage = STAGE_PLUGIN;
+      return ProcessPlugin(context,match.route->handler);
+    case ROUTE_CGI:
+      context->handle_stage = STAGE_CGI;
+      return ProcessCGI(context,match);
+    default:
+      context->handle_stage = STAGE_STATIC;
+      return ProcessStaticFile(context,match);
+  }
+}
+
+//静态文件响应中和 body 长度无关的 header 行，完整响应和 206 响应都要带上
+static std::string FileMetaHeader(int encoding,bool vary,const std::string& etag,time_t mtime){
+  std::string header = "ETag: " + etag + "\r\n";
+  header += "Last-Modified: " + TimeUtil::HttpDate(mtime) + "\r\n";
+  if(encoding != ENCODING_IDENTITY){
+    header += std::string("Content-Encoding: ")
+      + EncodingUtil::Name(static_cast<ContentEncoding>(encoding)) + "\r\n";
+  }
+  //同一个 url 会根据 Accept-Encoding 返回不同的内容，需要告诉中间的缓存
+  if(vary){
+    header += "Vary: Accept-Encoding\r\n";
+  }
+  header += "Accept-Ranges: bytes\r\n";
+  return header;
+}
+
+//拼接静态文件完整响应的 header 行
+static std::string FileHeader(const char* content_type,size_t length,
+                              int encoding,bool vary,
+                              const std::string& etag,time_t mtime){
+  std::string header = std::string("Content-Type: ") + content_type + "\r\n";
+  header += "Content-Length: " + std::to_string(length) + "\r\n";
+  header += FileMetaHeader(encoding,vary,etag,mtime);
+  return header;
 }
 
 //1.通过Request中的url_path字段，计算出文件在磁盘上的路径是什么
 //    例如：url_path /index.html,想要得到的磁盘上的文件 ./wwwroot/index.html
-int HttpServer::ProcessStaticFile(Context* context){
+int HttpServer::ProcessStaticFile(Context* context,const RouteMatch& match){
   const Request& req = context->req;
   Response* resp = &context->resp;
-  //1.获取到静态文件完整路径
-  std::string file_path;
-  GetFilePath(req.url_path,&file_path);
-  //2.打开并读取完整的文件
-  int ret = FileUtil::ReadAll(file_path,&resp->body);
+  //客户端能够接受哪些压缩编码
+  int accepted = ENCODING_IDENTITY;
+  HeaderList::const_iterator it = req.header.find(HEADER_ACCEPT_ENCODING);
+  if(it != req.header.end()){
+    accepted = EncodingUtil::ParseAcceptEncoding(it->value.to_string());
+  }
+  //按照路径前缀配置的缓存策略
+  const std::string* cache_control = GetCacheControl(req.url_path);
+  if(cache_control != NULL){
+    resp->header[HEADER_CACHE_CONTROL] = *cache_control;
+  }
+  //0.先查文件缓存，命中的话连路径是不是目录都不用再判断了
+  //  key 是路由的根目录拼接上路径之后，还没有处理目录的路径，目录对应的 index.html 也缓存在这个 key 下面
+  std::string key;
+  GetFilePath(match,&key);
+  std::shared_ptr<const FileEntry> entry;
+  if(file_cache_){
+    ReportCacheStats();
+    entry = file_cache_->Lookup(key);
+  }
+  if(!entry){
+    //1.打开文件，拿到文件的元数据，是目录的话打开其中的 index.html
+    std::string file_path = key;
+    struct stat st;
+    int fd = OpenStaticFile(&file_path,&st);
+    if(fd < 0){
+      return -1;
+    }
+    //3.先根据元数据判断客户端的缓存是否还有效，有效的话文件内容都不用读
+    int variants = FileVariants(file_path,st.st_size);
+    ContentEncoding encoding = EncodingUtil::Choose(variants,accepted);
+    std::string etag = FileETag(st,encoding);
+    if(IsNotModified(req,etag,st.st_mtime)){
+      close(fd);
+      return ProcessNotModified(context,etag,st.st_mtime,variants != 0);
+    }
+    //4.大文件只打开不读取，写响应的时候用 sendfile 直接发送
+    if(!file_cache_ || static_cast<size_t>(st.st_size) > config_.file_cache_max_file){
+      return ProcessLargeFile(context,file_path,fd,st,variants,encoding);
+    }
+    //5.小文件读到内存中放进缓存，之后的请求直接从缓存中发送
+    entry = LoadFileEntry(file_path,fd,st,variants);
+    if(!entry){
+      return -1;
+    }
+    file_cache_->Insert(key,entry);
+  }
+  //6.缓存中有元数据，同样先判断客户端的缓存是否还有效
+  ContentEncoding encoding = EncodingUtil::Choose(entry->variants,accepted);
+  std::string etag = ETagWithEncoding(entry->etag,encoding);
+  if(IsNotModified(req,etag,entry->last_modified)){
+    return ProcessNotModified(context,etag,entry->last_modified,entry->variants != 0);
+  }
+  //7.客户端接受压缩并且文件有压缩版本，就换成压缩版本
+  if(encoding != ENCODING_IDENTITY){
+    std::shared_ptr<const FileEntry> encoded = GetEncodedEntry(key,*entry,encoding);
+    if(encoded){
+      entry = encoded;
+    }
+  }
+  //8.客户端只要其中的一段或者几段
+  std::vector<ByteRange> ranges;
+  int ret = CheckRange(context,entry->data.size(),entry->etag,entry->last_modified,&ranges);
   if(ret < 0){
-    LOG(ERROR) << "ReadAll error! file_path=" << file_path << "\n";  
-    return -1;
+    return 0;
+  }
+  context->file_entry = entry;
+  context->entry_pos = 0;
+  context->entry_end = entry->data.size();
+  if(ret == 0){
+    resp->header_lines = entry->header;
+    return 0;
+  }
+  return ProcessRange(context,ranges,entry->data.size(),entry->content_type,
+                      FileMetaHeader(entry->encoding,entry->variants != 0,
+                                     entry->etag,entry->last_modified),-1);
+}
+
+//ETag 由 inode、文件大小和修改时间组成，文件变化之后 ETag 一定会变
+//同一个文件不同的压缩版本内容不一样，ETag 也要不一样
+std::string HttpServer::FileETag(const struct stat& st,ContentEncoding encoding){
+  char buf[64];
+  snprintf(buf,sizeof(buf),"\"%lx-%lx-%lx\"",
+           static_cast<unsigned long>(st.st_ino),
+           static_cast<unsigned long>(st.st_size),
+           static_cast<unsigned long>(st.st_mtime));
+  return ETagWithEncoding(buf,encoding);
+}
+
+std::string HttpServer::ETagWithEncoding(const std::string& etag,ContentEncoding encoding){
+  if(encoding == ENCODING_IDENTITY || etag.size() < 2){
+    return etag;
+  }
+  return etag.substr(0,etag.size() - 1) + "-" + EncodingUtil::Name(encoding) + "\"";
+}
+
+//If-None-Match 优先于 If-Modified-Since，两个都没有的时候返回 false
+bool HttpServer::IsNotModified(const Request& req,const std::string& etag,time_t mtime){
+  HeaderList::const_iterator it = req.header.find(HEADER_IF_NONE_MATCH);
+  if(it != req.header.end()){
+    if(StringUtil::Trim(it->value) == "*"){
+      return true;
+    }
+    //可能是多个 ETag 用逗号分隔，弱比较的时候忽略 W/ 前缀
+    std::vector<std::string> tags;
+    StringUtil::Split(it->value,",",&tags);
+    for(size_t i = 0;i < tags.size();++i){
+      StringView tag = StringUtil::Trim(tags[i]);
+      if(tag.starts_with("W/")){
+        tag.remove_prefix(2);
+      }
+      if(tag == etag){
+        return true;
+      }
+    }
+    return false;
+  }
+  it = req.header.find(HEADER_IF_MODIFIED_SINCE);
+  if(it != req.header.end()){
+    time_t since = 0;
+    if(TimeUtil::ParseHttpDate(it->value.to_string(),&since) == 0 && mtime <= since){
+      return true;
+    }
+  }
+  return false;
+}
+
+//304 响应没有 body，但是要带上和 200 响应一样的校验信息
+int HttpServer::ProcessNotModified(Context* context,const std::string& etag,
+                                   time_t mtime,bool vary){
+  Response* resp = &context->resp;
+  resp->code = 304;
+  resp->desc = "Not Modified";
+  resp->header[HEADER_ETAG] = etag;
+  resp->header[HEADER_LAST_MODIFIED] = TimeUtil::HttpDate(mtime);
+  if(vary){
+    resp->header[HEADER_VARY] = "Accept-Encoding";
   }
   return 0;
 }
 
-//通过 url_path找到对应的文件路径
-//例如 请求url可能是 http://192.168.47.128:9090
-//这种情况下 url_path 是 /
-//此时等价于请求 /index.html
-//例如 请求url 可能是 http://192.168.47.128:9090/image
-//这种情况下 url_path 是 /
-//如果 url_path指向的是一个目录，就尝试在这个目录访问一个叫做index.html 的文件（这也是一种简单约定）
-void HttpServer::GetFilePath(const std::string& url_path,std::string* file_path){
-  *file_path = "./wwwroot" + url_path;
-  //判定一个路径是普通文件还是目录文件
-  //1.linux 的 stat 函数，可以帮助查看文件类型
-  //2.通过 boost filesystem 模块来进行判定
-  if(FileUtil::IsDir(*file_path)){
-    //1./image/
-    //2./image
+//路径前缀最长的那一条缓存策略生效，没有匹配的返回 NULL
+const std::string* HttpServer::GetCacheControl(StringView url_path){
+  const std::string* result = NULL;
+  size_t longest = 0;
+  for(size_t i = 0;i < config_.cache_control.size();++i){
+    const std::string& prefix = config_.cache_control[i].first;
+    if(url_path.starts_with(prefix) && (result == NULL || prefix.size() > longest)){
+      result = &config_.cache_control[i].second;
+      longest = prefix.size();
+    }
+  }
+  return result;
+}
+
+int HttpServer::OpenRegularFile(const std::string& file_path,struct stat* st){
+  int fd = open(file_path.c_str(),O_RDONLY | O_CLOEXEC);
+  if(fd < 0){
+    LOG(ERROR) << "Open file error! file_path=" << file_path << "\n";  
+    return -1;
+  }
+  if(fstat(fd,st) < 0 || !S_ISREG(st->st_mode)){
+    LOG(ERROR) << "Not a regular file! file_path=" << file_path << "\n";  
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+//url_path /image/ 和 /image 指向的都是目录，尝试访问这个目录中叫做 index.html 的文件（这也是一种简单约定）
+//先打开再用 fstat 判断是不是目录，目录就用 openat 在已经打开的目录中找 index.html，不用单独 stat 一次
+int HttpServer::OpenStaticFile(std::string* file_path,struct stat* st){
+  int fd = open(file_path->c_str(),O_RDONLY | O_CLOEXEC);
+  if(fd < 0){
+    LOG(ERROR) << "Open file error! file_path=" << *file_path << "\n";
+    return -1;
+  }
+  if(fstat(fd,st) == 0 && S_ISDIR(st->st_mode)){
+    int index_fd = openat(fd,"index.html",O_RDONLY | O_CLOEXEC);
+    close(fd);
     if(file_path->back() != '/'){
       file_path->push_back('/');
     }
     (*file_path) += "index.html";
+    if(index_fd < 0){
+      LOG(ERROR) << "Open file error! file_path=" << *file_path << "\n";
+      return -1;
+    }
+    fd = index_fd;
+    if(fstat(fd,st) < 0){
+      st->st_mode = 0;
+    }
+  }
+  if(!S_ISREG(st->st_mode)){
+    LOG(ERROR) << "Not a regular file! file_path=" << *file_path << "\n";
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+//文件有没有预先压缩好的同名文件，或者能不能在第一次请求的时候压缩
+//大文件不做现场压缩，只看有没有预先压缩好的文件
+int HttpServer::FileVariants(const std::string& file_path,off_t size){
+  int variants = ENCODING_IDENTITY;
+  bool compressible = config_.compress_on_the_fly
+    && static_cast<size_t>(size) >= config_.compress_min_size
+    && static_cast<size_t>(size) <= config_.file_cache_max_file
+    && file_cache_
+    && EncodingUtil::IsCompressible(FileUtil::ContentType(file_path));
+  const ContentEncoding encodings[] = {ENCODING_GZIP,ENCODING_BR};
+  for(size_t i = 0;i < sizeof(encodings) / sizeof(encodings[0]);++i){
+    struct stat st;
+    std::string path = file_path + EncodingUtil::Suffix(encodings[i]);
+    if(compressible || (stat(path.c_str(),&st) == 0 && S_ISREG(st.st_mode))){
+      variants |= encodings[i];
+    }
   }
-  return;
+  return variants;
 }
 
-int HttpServer::ProcessCGI(Context* context){
+std::shared_ptr<const FileEntry> HttpServer::LoadFileEntry(const std::string& file_path,
+                                                           int fd,const struct stat& st,
+                                                           int variants){
+  std::shared_ptr<FileEntry> entry = std::make_shared<FileEntry>();
+  int ret = FileUtil::ReadAll(fd,st.st_size,&entry->data);
+  close(fd);
+  if(ret < 0){
+    LOG(ERROR) << "ReadAll error! file_path=" << file_path << "\n";  
+    return NULL;
+  }
+  entry->file_path = file_path;
+  entry->size = st.st_size;
+  entry->mtime = st.st_mtime;
+  entry->ino = st.st_ino;
+  entry->checked_at = TimeUtil::TimeStamp();
+  entry->variants = variants;
+  entry->etag = FileETag(st,ENCODING_IDENTITY);
+  entry->content_type = FileUtil::ContentType(file_path);
+  entry->last_modified = st.st_mtime;
+  entry->header = FileHeader(entry->content_type,entry->data.size(),ENCODING_IDENTITY,
+                             entry->variants != 0,entry->etag,entry->last_modified);
+  return entry;
+}
+
+//压缩版本在缓存中的 key 是原始的 key 加上原始文件的 ETag 和编码的名字
+//预先压缩好的文件在缓存中只检查它自己有没有被修改，原始文件改了之后 ETag 跟着变，
+//key 也就变了，不会再用到和旧内容对应的压缩版本
+std::shared_ptr<const FileEntry> HttpServer::GetEncodedEntry(const std::string& key,
+                                                             const FileEntry& entry,
+                                                             ContentEncoding encoding){
+  std::string encoded_key = key + "\n" + entry.etag + "\n" + EncodingUtil::Name(encoding);
+  std::shared_ptr<const FileEntry> encoded = file_cache_->Lookup(encoded_key);
+  if(encoded){
+    return encoded;
+  }
+  std::shared_ptr<FileEntry> result = std::make_shared<FileEntry>();
+  //1.优先使用预先压缩好的同名文件，这样压缩率可以做到最高
+  //  比原始文件旧的说明原始文件改过之后没有重新压缩，不能用
+  std::string path = entry.file_path + EncodingUtil::Suffix(encoding);
+  struct stat st;
+  int fd = -1;
+  bool compressed = false;
+  if(stat(path.c_str(),&st) == 0 && st.st_mtime >= entry.mtime
+     && (fd = OpenRegularFile(path,&st)) >= 0){
+    if(FileUtil::ReadAll(fd,st.st_size,&result->data) < 0){
+      close(fd);
+      return NULL;
+    }
+    close(fd);
+    result->file_path = path;
+    result->size = st.st_size;
+    result->mtime = st.st_mtime;
+    result->ino = st.st_ino;
+  }else if(config_.compress_on_the_fly){
+    //2.没有的话就现在压缩，压缩结果的有效性跟着原始文件走
+    //  其他线程正在压缩同一个版本的时候等它压缩完，缓存中有了就直接用，避免同时压缩好几遍
+    {
+      std::unique_lock<std::mutex> lock(compress_mutex_);
+      bool waited = false;
+      while(compressing_.count(encoded_key) != 0){
+        compress_cond_.wait(lock);
+        waited = true;
+      }
+      if(waited && (encoded = file_cache_->Lookup(encoded_key))){
+        return encoded;
+      }
+      compressing_.insert(encoded_key);
+    }
+    compressed = true;
+    if(EncodingUtil::Compress(encoding,entry.data,&result->data) < 0){
+      LOG(ERROR) << "Compress error! file_path=" << entry.file_path << "\n";
+      EndCompress(encoded_key);
+      return NULL;
+    }
+    result->file_path = entry.file_path;
+    result->size = entry.size;
+    result->mtime = entry.mtime;
+    result->ino = entry.ino;
+  }else {
+    return NULL;
+  }
+  result->checked_at = TimeUtil::TimeStamp();
+  result->encoding = encoding;
+  //ETag 和 Last-Modified 跟着原始文件走，这样判断客户端缓存的时候不需要先拿到压缩版本
+  result->etag = ETagWithEncoding(entry.etag,encoding);
+  result->last_modified = entry.last_modified;
+  result->variants = entry.variants;
+  //压缩文件的类型还是原始文件的类型
+  result->content_type = entry.content_type;
+  result->header = FileHeader(result->content_type,result->data.size(),encoding,true,
+                              result->etag,result->last_modified);
+  file_cache_->Insert(encoded_key,result);
+  if(compressed){
+    EndCompress(encoded_key);
+  }
+  return result;
+}
+
+void HttpServer::EndCompress(const std::string& encoded_key){
+  std::lock_guard<std::mutex> lock(compress_mutex_);
+  compressing_.erase(encoded_key);
+  compress_cond_.notify_all();
+}
+
+//不放进缓存的大文件，用 sendfile 发送，有预先压缩好的同名文件就发送压缩文件
+int HttpServer::ProcessLargeFile(Context* context,const std::string& file_path,
+                                 int fd,const struct stat& st,
+                                 int variants,ContentEncoding encoding){
+  Response* resp = &context->resp;
+  off_t size = st.st_size;
+  if(encoding != ENCODING_IDENTITY){
+    struct stat encoded_st;
+    int encoded_fd = OpenRegularFile(file_path + EncodingUtil::Suffix(encoding),&encoded_st);
+    //和缓存中的一样，比原始文件旧的压缩文件不用
+    if(encoded_fd >= 0 && encoded_st.st_mtime < st.st_mtime){
+      close(encoded_fd);
+      encoded_fd = -1;
+    }
+    if(encoded_fd >= 0){
+      close(fd);
+      fd = encoded_fd;
+      size = encoded_st.st_size;
+    }else {
+      encoding = ENCODING_IDENTITY;
+    }
+  }
+  const char* content_type = FileUtil::ContentType(file_path);
+  bool vary = encoding != ENCODING_IDENTITY || variants != 0;
+  std::string etag = FileETag(st,encoding);
+  std::vector<ByteRange> ranges;
+  int ret = CheckRange(context,size,etag,st.st_mtime,&ranges);
+  if(ret < 0){
+    close(fd);
+    return 0;
+  }
+  if(ret > 0){
+    return ProcessRange(context,ranges,size,content_type,
+                        FileMetaHeader(encoding,vary,etag,st.st_mtime),fd);
+  }
+  context->file_fd = fd;
+  context->file_offset = 0;
+  context->file_remaining = size;
+  resp->header_lines = FileHeader(content_type,size,encoding,vary,etag,st.st_mtime);
+  return 0;
+}
+
+//If-Range 中的 ETag 或者时间和当前的文件一致，Range 才生效
+//只能用强比较，弱 ETag 永远不匹配
+static bool IfRangeMatch(const Request& req,const std::string& etag,time_t mtime){
+  HeaderList::const_iterator it = req.header.find(HEADER_IF_RANGE);
+  if(it == req.header.end()){
+    return true;
+  }
+  StringView value = StringUtil::Trim(it->value);
+  if(value.starts_with("W/")){
+    return false;
+  }
+  if(!value.empty() && value[0] == '"'){
+    return value == etag;
+  }
+  time_t date = 0;
+  return TimeUtil::ParseHttpDate(value.to_string(),&date) == 0 && date == mtime;
+}
+
+//多个范围的时候 body 要在内存中拼出来，太大的话就直接返回完整的内容
+static const off_t kMaxMultiRangeBytes = 16 * 1024 * 1024;
+
+int HttpServer::CheckRange(Context* context,off_t size,const std::string& etag,time_t mtime,
+                           std::vector<ByteRange>* ranges){
   const Request& req = context->req;
   Response* resp = &context->resp;
-  //1.创建一对匿名管道（父子进程要双向通信）
-  int fd1[2],fd2[2];
-  pipe(fd1);
-  pipe(fd2);
-  //父进程用来写的
-  int father_write = fd1[1];
-  int child_read = fd1[0];
-  int father_read = fd2[0];
-  int child_write = fd2[1];
-
-  //2.设置环境变量
-  //  a)METHOD请求方法
-  //设置环境变量
-  std::string env = "REQUEST_METHOD=" + req.method;
-  putenv(const_cast<char*>(env.c_str()));
-  if(req.method == "GET"){
-    //  b)GET方法，QUERY_STRING请求参数
-    env = "QUERY_STRING=" + req.query_string;
-    putenv(const_cast<char*>(env.c_str()));
-  }else if(req.method == "POST"){
-    //  c)POST方法，就设置CONTENT_LENGTH
-    //为什么要用常量迭代器？？？
-    //迭代器不应该修改request中的数据，handler request不应该修改，所以使用const迭代器
-    //Header::const_iterator pos = req.header.find("Content-Length");
-    auto pos = req.header.find("Content-Length");
-    env = "CONTENT_LENGTH=" + pos->second;
-    putenv(const_cast<char*>(env.c_str()));
-  }
-  //3.fork,父子进程
-  pid_t ret = fork();
+  HeaderList::const_iterator it = req.header.find(HEADER_RANGE);
+  if(it == req.header.end() || resp->code != 200){
+    return 0;
+  }
+  //客户端手里的内容已经过期了，需要返回完整的新内容
+  if(!IfRangeMatch(req,etag,mtime)){
+    return 0;
+  }
+  int ret = RequestParser::ParseRange(it->value,size,ranges);
   if(ret < 0){
-    perror("fork");
-    goto END;
+    resp->code = 416;
+    resp->desc = "Range Not Satisfiable";
+    resp->header[HEADER_CONTENT_RANGE] = "bytes */" + std::to_string(size);
+    resp->header[HEADER_CONTENT_LENGTH] = "0";
+    return -1;
   }
   if(ret > 0){
-    //父进程流程
-    close(child_read);
-    close(child_write);
-    // a)如果是POST请求，父进程就要把body写入到管道中
-    if(req.method == "POST"){
-     write(father_write,req.body.c_str(),req.body.size());
-    }
-    // b)阻塞式的读取管道，尝试吧子进程的结果读取出来，并且放到Response对象中
-    FileUtil::ReadAll(father_read,&resp->cgi_resp);
-    // c)对子进程进行进程等待（为了避免僵尸进程）
-    wait(NULL);//表示只关注回收子进程资源
+    return 0;
+  }
+  if(ranges->size() > 1){
+    off_t total = 0;
+    for(size_t i = 0;i < ranges->size();++i){
+      total += (*ranges)[i].Length();
+    }
+    if(total > kMaxMultiRangeBytes){
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static std::string ContentRange(const ByteRange& range,off_t size){
+  return "bytes " + std::to_string(range.first) + "-" + std::to_string(range.last)
+    + "/" + std::to_string(size);
+}
+
+int HttpServer::ProcessRange(Context* context,const std::vector<ByteRange>& ranges,off_t size,
+                             const char* content_type,const std::string& meta,int fd){
+  Response* resp = &context->resp;
+  resp->code = 206;
+  resp->desc = "Partial Content";
+  //1.只有一个范围，body 还是直接从缓存或者文件发送，只是起止位置变了
+  if(ranges.size() == 1){
+    const ByteRange& range = ranges[0];
+    resp->header_lines = std::string("Content-Type: ") + content_type + "\r\n" + meta
+      + "Content-Range: " + ContentRange(range,size) + "\r\n"
+      + "Content-Length: " + std::to_string(range.Length()) + "\r\n";
+    if(context->file_entry){
+      context->entry_pos = range.first;
+      context->entry_end = range.last + 1;
+    }else {
+      context->file_fd = fd;
+      context->file_offset = range.first;
+      context->file_remaining = range.Length();
+    }
+    return 0;
+  }
+  //2.多个范围要用 multipart/byteranges 把每一段分开，每一段有自己的 header
+  static std::atomic<uint64_t> boundary_seq(0);
+  char boundary[40];
+  snprintf(boundary,sizeof(boundary),"%08lx%016lx",
+           static_cast<unsigned long>(TimeUtil::TimeStamp()),
+           static_cast<unsigned long>(boundary_seq.fetch_add(1,std::memory_order_relaxed)));
+  std::string& body = resp->body;
+  for(size_t i = 0;i < ranges.size();++i){
+    body += std::string("--") + boundary + "\r\n";
+    body += std::string("Content-Type: ") + content_type + "\r\n";
+    body += "Content-Range: " + ContentRange(ranges[i],size) + "\r\n\r\n";
+    if(context->file_entry){
+      body.append(context->file_entry->data,ranges[i].first,ranges[i].Length());
+    }else if(FileUtil::ReadAt(fd,ranges[i].first,ranges[i].Length(),&body) < 0){
+      LOG(ERROR) << "ReadAt error! offset=" << ranges[i].first << "\n";
+      close(fd);
+      return -1;
+    }
+    body += "\r\n";
+  }
+  body += std::string("--") + boundary + "--\r\n";
+  if(fd >= 0){
+    close(fd);
+  }
+  //body 已经在内存中了，不再从缓存项中发送
+  context->CloseFile();
+  resp->header_lines = std::string("Content-Type: multipart/byteranges; boundary=") + boundary + "\r\n"
+    + meta + "Content-Length: " + std::to_string(body.size()) + "\r\n";
+  return 0;
+}
+
+//每隔一分钟打印一次缓存的命中情况
+void HttpServer::ReportCacheStats(){
+  int64_t now = TimeUtil::TimeStamp();
+  int64_t last = cache_report_time_.load(std::memory_order_relaxed);
+  if(now - last < 60){
+    return;
+  }
+  //多个线程同时走到这里的时候只有一个打印
+  if(cache_report_time_.compare_exchange_strong(last,now)){
+    LOG(INFO) << "FileCache " << file_cache_->Report() << "\n";
+  }
+}
+
+//通过路由找到 url_path 对应的文件路径
+//例如 路由 / 的根目录是 ./wwwroot，url_path /index.html 对应 ./wwwroot/index.html
+//路由 /img 的根目录是 ./images，url_path /img/a.png 对应 ./images/a.png
+//以 / 结尾的前缀匹配的时候不包含最后的 /，这里补回来
+void HttpServer::GetFilePath(const RouteMatch& match,std::string* file_path){
+  const Route* route = match.route;
+  *file_path = route->target;
+  if(route->prefix.back() == '/' && (file_path->empty() || file_path->back() != '/')){
+    file_path->push_back('/');
+  }
+  file_path->append(match.rest.data(),match.rest.size());
+}
+
+int HttpServer::ProcessPlugin(Context* context,HttpHandler* handler){
+  Response* resp = &context->resp;
+  if(handler->Handle(context->req,resp) < 0){
+    LOG(ERROR) << "Plugin handler error! url_path=" << context->req.url_path << "\n";
+    *resp = Response();
+    return ProcessError(context,500);
+  }
+  if(resp->header.find(HEADER_CONTENT_LENGTH) == resp->header.end()){
+    resp->header[HEADER_CONTENT_LENGTH] = std::to_string(resp->body.size());
+  }
+  return 0;
+}
+
+int HttpServer::ProcessCGI(Context* context,const RouteMatch& match){
+  const Request& req = context->req;
+  Response* resp = &context->resp;
+  //1.要执行的 CGI 程序是路由的目标，必须是可以执行的普通文件
+  const std::string& file_path = match.route->target;
+  struct stat st;
+  if(stat(file_path.c_str(),&st) < 0 || !S_ISREG(st.st_mode) || access(file_path.c_str(),X_OK) < 0){
+    LOG(ERROR) << "CGI program not found! file_path=" << file_path << "\n";
+    return -1;
+  }
+  //2.请求的元数据每个请求单独传给 CGI 程序
+  //  服务器是多线程的，不能再用 putenv 修改整个进程共享的环境变量
+  CgiParams params;
+  params.push_back(std::make_pair("REQUEST_METHOD",req.method.to_string()));
+  params.push_back(std::make_pair("QUERY_STRING",req.query_string.to_string()));
+  params.push_back(std::make_pair("CONTENT_LENGTH",std::to_string(req.body.size())));
+  //SCRIPT_NAME 是匹配的路由前缀，PATH_INFO 是路径中前缀之后的部分
+  params.push_back(std::make_pair("SCRIPT_NAME",match.route->prefix));
+  params.push_back(std::make_pair("PATH_INFO",match.rest.to_string()));
+  params.push_back(std::make_pair("SERVER_PROTOCOL",req.version.to_string()));
+  //3.交给常驻的工作进程处理，没有开启的话就 fork 一个新进程
+  //  CGI 程序的输出不等程序结束，收到一段就转发一段
+  //CGI 进程是最贵的资源，工作进程都在忙的时候与其让请求排队等到超时，不如马上告诉客户端稍后再试
+  if(!admission_.AcquireCgi()){
+    Stats::Local().Count(COUNTER_SHED_CGI);
+    return ProcessOverload(context);
+  }
+  //body 只在 parser 的内存池中，这里复制一份交给 CGI
+  const std::string body = req.body.to_string();
+  CgiOutputFunc on_output = [this,context](const char* data,size_t size){
+    return StreamCgiOutput(context,&context->cgi_stream,data,size);
+  };
+  //反应堆的线程不能等待工作进程空闲下来，暂停的 CGI 请求占着工作进程，只有这个线程能让它们继续
+  //也不能等待 CGI 程序的输出，一个慢的 CGI 程序会卡住这个线程上的所有连接
+  context->cgi_stream.start = TimeUtil::MonotonicNS();
+  int ret = cgi_pool_->Execute(file_path,params,body,!context->reactor,on_output,&context->cgi);
+  if(ret == -3){
+    admission_.ReleaseCgi();
+    Stats::Local().Count(COUNTER_SHED_CGI);
+    return ProcessOverload(context);
+  }
+  if(ret < 0){
+    LOG(ERROR) << "CGI error! file_path=" << file_path << " ret=" << ret << "\n";
+  }
+  return FinishCGI(context,ret);
+}
+
+int HttpServer::FinishCGI(Context* context,int ret){
+  if(ret == 1 || ret == 2){
+    //客户端接收得慢或者 CGI 程序暂时没有输出，CGI 暂停了，之后在 ResumeCGI 中继续
+    //header 还没有发出去的时候也不能让反应堆按照 resp 序列化响应
+    context->streamed = true;
+    return 0;
+  }
+  admission_.ReleaseCgi();
+  if(ret == -2){
+    Stats::Local().Count(COUNTER_TIMEOUT_CGI);
+  }
+  if(ret == 0){
+    ret = FinishCgiOutput(context,&context->cgi_stream);
+  }
+  if(ret < 0){
+    if(!context->cgi_stream.header_sent){
+      //还没有发出任何数据，可以换成错误页面
+      context->streamed = false;
+      context->write_buf.clear();
+      context->write_pos = 0;
+      context->resp = Response();
+      return ProcessError(context,ret == -2 ? 504 : 502);
+    }
+    //响应已经发出去一部分了，只能关闭连接让客户端知道响应不完整
+    LOG(ERROR) << "CGI error after header sent! ret=" << ret << "\n";
+    context->keep_alive = false;
+  }
+  return 0;
+}
+
+int HttpServer::ResumeCGI(Context* context){
+  //暂停之前的输出已经写完了，缓冲区清空之后再接着转发
+  context->write_buf.clear();
+  context->write_pos = 0;
+  CgiOutputFunc on_output = [this,context](const char* data,size_t size){
+    return StreamCgiOutput(context,&context->cgi_stream,data,size);
+  };
+  int ret = cgi_pool_->Resume(&context->cgi,on_output);
+  if(ret < 0){
+    LOG(ERROR) << "CGI error! ret=" << ret << "\n";
+  }
+  FinishCGI(context,ret);
+  if(!context->cgi.Active()){
+    int flush = EndAsyncCGI(context);
+    if(flush != 0){
+      return flush;
+    }
+  }
+  if(context->write_pos < context->write_buf.size()){
+    return 1;
+  }
+  //写客户端失败的时候也是 keep_alive 为 false，调用方写完之后关闭连接
+  return ret == 2 ? 2 : 0;
+}
+
+int HttpServer::TimeoutCGI(Context* context){
+  LOG(ERROR) << "CGI timeout! program=" << context->cgi.program << "\n";
+  cgi_pool_->Abort(&context->cgi);
+  FinishCGI(context,-2);
+  int ret = EndAsyncCGI(context);
+  if(ret != 0){
+    return ret;
+  }
+  return context->write_pos < context->write_buf.size() ? 1 : 0;
+}
+
+int HttpServer::EndAsyncCGI(Context* context){
+  //BuildResponse 返回的时候 CGI 还没有结束，这里补上处理请求的耗时和状态码
+  context->handle_ns = TimeUtil::MonotonicNS() - context->cgi_stream.start;
+  ThreadStats& stats = Stats::Local();
+  stats.RecordStage(context->handle_stage,context->handle_ns);
+  stats.CountStatus(context->resp.code);
+  if(context->streamed){
+    return 0;
+  }
+  //header 还没有发出去 CGI 就失败了，FinishCGI 已经换成了错误页面，序列化之后能写多少先写多少
+  SetConnectionHeader(context);
+  SerializeResponse(context->resp,&context->write_buf);
+  context->write_pos = 0;
+  return FlushResponse(context);
+}
+
+int HttpServer::StreamCgiOutput(Context* context,CgiStream* stream,const char* data,size_t size){
+  //1.CGI 的 header 可能分几次才能收完整，header 太长说明输出的格式不对
+  if(!stream->header_sent){
+    stream->header.append(data,size);
+    size_t lf = stream->header.find("\n\n");
+    size_t crlf = stream->header.find("\r\n\r\n");
+    size_t header_end = std::min(lf,crlf);
+    if(header_end == std::string::npos){
+      if(stream->header.size() > config_.limits.max_header_size){
+        LOG(ERROR) << "CGI header too large!" << "\n";
+        return -1;
+      }
+      return 0;
+    }
+    size_t body_start = header_end + (header_end == lf ? 2 : 4);
+    std::string body = stream->header.substr(body_start);
+    stream->header.resize(header_end);
+    int ret = SendCgiHeader(context,stream,stream->header);
+    if(ret < 0){
+      return -1;
+    }
+    stream->header.clear();
+    return body.empty() ? ret : StreamCgiOutput(context,stream,body.data(),body.size());
+  }
+  //2.header 之后的数据都是 body，原样转发，二进制数据中的 '\0' 也不影响
+  if(size == 0){
+    return 0;
+  }
+  if(stream->chunked){
+    char chunk_size[32];
+    snprintf(chunk_size,sizeof(chunk_size),"%zx\r\n",size);
+    context->write_buf += chunk_size;
+    context->write_buf.append(data,size);
+    context->write_buf += "\r\n";
   }else {
-    //子进程流程
-    close(father_read);
-    close(father_write);
-    //  a)把标准输入和标准输出进行重定向(dup)，重定向是忘new写数据就相当于往old写数据，
-    //  期望往标准输出写数据相当于往管道写数据
-    dup2(child_read,0);//从标准输入读数据 
-    dup2(child_write,1);//从标准输出写数据
-    //  b)先获取到要替换的可执行文件是哪个（通过url_path来获取）
-    std::string file_path;
-    GetFilePath(req.url_path,&file_path);
-    //  c)进行进程的程序替换
-    execl(file_path.c_str(),file_path.c_str(),NULL);
-    //  d)有我们的CGI可执行程序完成动态页面的计算，并且写回数据到管道中
-    //这部分需要单独的文件来实现，根据该文件编译生成CGI可执行程序
-    
-  }
-END:
-  //统一处理收尾工作，如果不释放就会文件描述符泄漏的问题
-  close(father_read);
-  close(father_write);
-  close(child_read);
-  close(child_write);
-  return 0; 
+    context->write_buf.append(data,size);
+  }
+  stream->body_size += size;
+  return FlushStream(context);
+}
+
+int HttpServer::SendCgiHeader(Context* context,CgiStream* stream,const std::string& cgi_header){
+  const Request& req = context->req;
+  Response* resp = &context->resp;
+  std::vector<std::string> lines;
+  StringUtil::Split(cgi_header,"\n",&lines);
+  for(size_t i = 0;i < lines.size();++i){
+    std::string line = lines[i];
+    if(!line.empty() && line.back() == '\r'){
+      line.pop_back();
+    }
+    size_t pos = line.find(":");
+    if(pos == std::string::npos){
+      continue;
+    }
+    std::string name = boost::algorithm::trim_copy(line.substr(0,pos));
+    std::string value = boost::algorithm::trim_copy(line.substr(pos + 1));
+    if(boost::iequals(name,"Status")){
+      //CGI 程序通过 Status 头部指定状态码，例如 Status: 404 Not Found
+      int code = atoi(value.c_str());
+      if(code < 100 || code > 999){
+        return -1;
+      }
+      resp->code = code;
+      size_t space = value.find(" ");
+      resp->desc = space == std::string::npos ? "" : value.substr(space + 1);
+      continue;
+    }
+    HeaderId id = LookupHeaderId(name);
+    if(id == HEADER_CONTENT_LENGTH){
+      stream->content_length = atoll(value.c_str());
+    }
+    //连接管理相关的头部由服务器自己决定
+    if(id == HEADER_CONNECTION || id == HEADER_KEEP_ALIVE || id == HEADER_TRANSFER_ENCODING){
+      continue;
+    }
+    resp->header_lines += name + ": " + value + "\r\n";
+  }
+  //没有 Content-Length 的时候，HTTP/1.1 用 chunked 编码，HTTP/1.0 只能靠关闭连接表示结束
+  if(stream->content_length < 0){
+    if(req.version == "HTTP/1.1"){
+      stream->chunked = true;
+      resp->header_lines += "Transfer-Encoding: chunked\r\n";
+    }else {
+      context->keep_alive = false;
+    }
+  }
+  SetConnectionHeader(context);
+  context->streamed = true;
+  SerializeResponse(*resp,&context->write_buf);
+  context->write_pos = 0;
+  stream->header_sent = true;
+  return FlushStream(context);
+}
+
+int HttpServer::FinishCgiOutput(Context* context,CgiStream* stream){
+  if(!stream->header_sent){
+    LOG(ERROR) << "CGI output has no header!" << "\n";
+    return -1;
+  }
+  if(stream->chunked){
+    context->write_buf += "0\r\n\r\n";
+    return FlushStream(context);
+  }
+  //实际的 body 长度和 Content-Length 不一致，客户端已经没法判断这个连接上后面的数据了
+  if(stream->content_length >= 0 && stream->body_size != stream->content_length){
+    LOG(ERROR) << "CGI body size mismatch! content_length=" << stream->content_length
+      << " body_size=" << stream->body_size << "\n";
+    context->keep_alive = false;
+  }
+  return 0;
+}
+
+int HttpServer::FlushStream(Context* context){
+  while(true){
+    int ret = FlushResponse(context);
+    if(ret == 0){
+      //写完之后清空，缓冲区中最多只有一段 CGI 输出
+      context->write_buf.clear();
+      context->write_pos = 0;
+      return 0;
+    }
+    if(ret < 0){
+      return -1;
+    }
+    //反应堆模式下不能在这里等待，否则一个接收得慢的客户端会卡住这个线程上的所有连接，
+    //返回1让 CGI 暂停，连接进入写阶段，可写之后在 ResumeCGI 中继续
+    if(context->reactor){
+      return 1;
+    }
+    //线程模式下客户端接收得慢就在这里等待，
+    //不再读取 CGI 的输出，积压的数据不会无限增长
+    if(WaitSocket(context,POLLOUT) < 0){
+      LOG(ERROR) << "Client write timeout!" << "\n";
+      return -1;
+    }
+  }
 }
 
 ////////////////////////////////////////////////////
 //以下为测试函数
 ////////////////////////////////////////////////////
 void HttpServer::PrintRequest(const Request& req){
+  //每个请求都会调用，没有开启 DEBUG 的时候连 header 都不用遍历
+  if(!LOG_ENABLED(DEBUG)){
+    return;
+  }
   LOG(DEBUG) << "Request:" << "\n" << req.method << " " << req.url << "\n" 
     << req.url_path << " " << req.query_string << "\n";
   //for(Header::const_iterator it = req.header.begin();it != req.header.end();++it){
-  // LOG(DEBUG) << it->first << ":" << it->second << "\n";
+  // LOG(DEBUG) << it->first << ":" << it->value << "\n";
   //}
   //c++11  range  based  for
-  for(auto it : req.header){
-    LOG(DEBUG) << it.first << ":" << it.second << "\n";
+  for(const auto& it : req.header){
+    LOG(DEBUG) << it.name << ":" << it.value << "\n";
   }
   LOG(DEBUG) << "\n";
   LOG(DEBUG) << req.body << "\n";
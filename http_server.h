@@ -1,67 +1,283 @@
 #pragma once 
-//基于哈希表来实现的
-//增删查改的时间复杂度是O(1)
-#include <unordered_map>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <string>
+#include <vector>
+#include <utility>
+#include "http_message.h"
+#include "http_parser.h"
+#include "buffer.hpp"
+#include "file_cache.h"
+#include "encoding.h"
+#include "cgi_pool.h"
+#include "plugin_manager.h"
+#include "logger.hpp"
+#include "stats.h"
+#include "response_writer.h"
+#include "timer_wheel.hpp"
+#include "admission.h"
+#include "router.h"
+#include "tls.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_set>
  
 namespace http_server{
 
-typedef std::unordered_map<std::string,std::string> Header;
-
 //前置声明
 class HttpServer;
 
-//请求结构
-struct Request{
-  std::string method; //表示方法
-  std::string url; //表示地址
-  //例如:url形如 http://www.baidu.com/index.html?kwd="cpp"
-  std::string url_path; //url路径名 /index.html
-  std::string query_string; //url键值对参数 kwd="cpp"
-  //std::string version; //版本号，暂时先不考虑
-  Header header; //一组字符串键值对
-  std::string body; //表示内容实体
-};  
-
-//响应结构
-struct Response{
-  int code; // 状态码
-  std::string desc; //状态码的描述
-  //std::string version; //版本号
-  
-  //下面这连个变量专门给静态页面使用的
-  //当前请求如果是请求静态页面，这两个字段就被填充
-  //并且 cgi_resp字段为空
-  Header header; //响应报文中的header 数据
-  std::string body; // 响应报文中的body 数据
-  
-  //这个变量专门给CGI使用，如果当前请求是CGI的话，cgi_resp就会被 CGI程序进行填充，header和body两个字段为空
-  //表示CGI程序返回给父进程的内容，包含了部分header和body，
-  //引入这个变量是避免解析 CGI 程序返回的内容，
-  //因为这部分内容可以直接返回 到socket 中
-  std::string cgi_resp;
+//服务器的运行模式
+enum ServerMode{
+  MODE_THREAD, //每个连接创建一个线程(最初的实现方式)
+  MODE_EPOLL,  //基于 epoll 边缘触发的单线程反应堆，不为连接创建线程
+  MODE_POOL,   //固定大小的工作线程池，accept 线程把连接放进有界队列
+  MODE_REUSEPORT, //每个 CPU 一个 epoll 反应堆线程，各自有一个 SO_REUSEPORT 的监听 socket
+  MODE_URING,  //基于 io_uring 的单线程反应堆，内核不支持的时候退回到 epoll
+};
+
+//服务器的配置项，main 函数中根据命令行参数进行填充
+struct ServerConfig{
+  ServerMode mode;
+  size_t worker_threads; //线程池模式下的工作线程数(reuseport 模式下是分片数)，0表示和CPU核数一致
+  size_t queue_size; //线程池模式下等待处理的连接队列长度，队列满了新连接直接返回 503 + Retry-After 并关闭
+  int keepalive_timeout; //长连接空闲多少秒没有新请求就关闭
+  int header_timeout; //收到请求的第一个字节之后，多少秒之内必须收完首行和 header
+  int body_timeout; //读 body 的时候，多少秒没有收到新的数据就关闭
+  int write_timeout; //写响应的时候，多少秒没有写出去任何数据(客户端不读)就关闭
+  int keepalive_requests; //一个长连接上最多处理多少个请求
+  ParserLimits limits; //请求行、header 和 body 的长度限制
+  size_t file_cache_size; //静态文件缓存的总字节数，0表示不使用缓存
+  size_t file_cache_max_file; //超过这个大小的文件不放进缓存，直接用 sendfile 发送
+  int file_cache_check_interval; //缓存的文件多少秒之后重新检查是否被修改
+  bool compress_on_the_fly; //没有预先压缩的文件时，是否在第一次请求的时候压缩并缓存
+  size_t compress_min_size; //小于这个大小的文件压缩没有意义
+  //按照 url 路径前缀配置的 Cache-Control，例如 ("/images/","max-age=86400")
+  //多个前缀都匹配的时候最长的那个生效
+  std::vector<std::pair<std::string,std::string> > cache_control;
+  size_t cgi_workers; //每个 CGI 程序常驻的工作进程数上限，0表示每个请求 fork + exec 一次
+  int cgi_timeout; //CGI 程序最多多少秒没有任何输出，超时返回 504
+  std::vector<std::string> plugins; //启动的时候加载的插件动态库
+  LogConfig log; //日志文件、级别、缓冲区满了之后的处理方式
+  std::string stats_path; //返回统计信息的 url 路径，为空表示不提供
+  int listen_backlog; //已经完成握手、等待 accept 的连接队列长度，内核会截断到 net.core.somaxconn
+  bool numa; //reuseport 模式下按 NUMA 节点分组分配 CPU，相邻的分片在同一个节点上
+  AdmissionLimits admission; //连接数、请求数、CGI 数的上限，超过的返回 503
+  //按照 url 路径前缀把请求分给静态文件、CGI、插件、重定向，为空的时候使用默认的路由：
+  //  / 是 ./wwwroot 下的静态文件，/add 是 CGI 程序 ./wwwroot/add
+  //统计信息和插件注册的路径在启动的时候自动加进来，不需要配置
+  std::vector<RouteConfig> routes;
+  TlsConfig tls; //HTTPS 监听的端口、证书，以及会话恢复和 kTLS 的开关
+  ServerConfig()
+    :mode(MODE_THREAD),worker_threads(0),queue_size(1024),
+     keepalive_timeout(15),header_timeout(10),body_timeout(30),write_timeout(30),
+     keepalive_requests(100),
+     file_cache_size(64 * 1024 * 1024),file_cache_max_file(1024 * 1024),
+     file_cache_check_interval(1),compress_on_the_fly(true),compress_min_size(256),
+     cgi_workers(4),cgi_timeout(30),stats_path("/stats"),listen_backlog(SOMAXCONN),numa(false){
+  }
 };
 
 //当前请求的上下文，包含了这次请求的所有需要的中间数据
 //最大的好处：方便进行扩展,整个处理请求的过程中，每个环节都能拿到所有和这次请求相关的数据
 
 
+//连接当前所处的阶段，epoll 模式下用来驱动每个连接的状态机
+enum ConnState{
+  STATE_HANDSHAKE, //HTTPS 连接正在进行 TLS 握手，完成之后开始读取请求
+  STATE_READING, //正在读取请求
+  STATE_WRITING, //请求已经处理完，正在写响应
+  STATE_CGI, //CGI 程序暂时没有输出，CGI 的文件描述符注册在反应堆上，可读之后回到写阶段继续转发
+};
+
+//连接在不同阶段的超时，超时时间按照阶段计算，和统计信息中的超时计数一一对应
+enum TimeoutPhase{
+  TIMEOUT_IDLE,   //等待下一个请求的第一个字节，keepalive_timeout
+  TIMEOUT_HEADER, //首行和 header 从第一个字节开始必须在 header_timeout 之内收完，中间收到数据也不延长
+  TIMEOUT_BODY,   //读 body 时两次收到数据的间隔，body_timeout
+  TIMEOUT_WRITE,  //写响应时两次写出数据的间隔，write_timeout
+  TIMEOUT_CGI,    //反应堆模式下等 CGI 程序输出的时间，cgi_timeout
+};
+
+//CGI 输出转发到客户端的过程中的状态
+struct CgiStream{
+  std::string header; //还没有收完整的 CGI header
+  bool header_sent; //响应的首行和 header 已经发出去了，之后出错也没法再返回错误页面
+  bool chunked; //CGI 没有给出 Content-Length，body 按照 chunked 编码发送
+  int64_t content_length; //CGI 给出的 Content-Length，没有的话为-1
+  int64_t body_size; //已经转发的 body 字节数
+  int64_t start; //开始执行 CGI 的时间，反应堆模式下 CGI 结束的时候才记录处理请求的耗时
+  CgiStream():header_sent(false),chunked(false),content_length(-1),body_size(0),start(0){}
+};
+
 struct Context{
   Request req;
   Response resp;
   int new_sock;
-  int file_fd;
+  int file_fd; //静态文件的文件描述符，响应的 body 通过 sendfile 从这里发送
+  off_t file_offset; //下一次 sendfile 从文件的哪个位置开始
+  size_t file_remaining; //文件中还剩多少字节没有发送
+  //命中文件缓存的时候，响应的 body 直接从缓存的内容中发送，不需要拷贝
+  std::shared_ptr<const FileEntry> file_entry;
+  size_t entry_pos; //缓存的文件内容中下一个要发送的字节
+  size_t entry_end; //缓存的文件内容发送到哪里结束，Range 请求只发送其中的一段
+  size_t body_pos; //resp.body 中已经写出去的字节数
   HttpServer* server;
+  bool keep_alive; //当前响应写完之后是否保持连接
+  bool streamed; //响应已经在处理请求的过程中边生成边写出去了(CGI 的输出)，不需要再序列化
+  int request_count; //这个连接上已经处理过的请求数
+  Buffer read_buf; //从 socket 中读到的还没有解析的数据
+  RequestParser parser; //记录当前请求解析到了哪一步
+
+  //下面的字段只在 epoll/io_uring 模式下使用
+  ConnState state;
+  bool read_paused; //read_buf 中积压的数据太多，暂停从 socket 读取
+  std::string write_buf; //序列化好的响应首行和 header(CGI 的输出也先放在这里)
+  size_t write_pos; //write_buf 中已经写出去的字节数
+  bool peer_closed; //对端已经关闭了写方向，处理完缓冲区中的请求就关闭
+  TimerNode timer; //挂在反应堆的时间轮上，到期的时候关闭连接
+  bool reactor; //由反应堆驱动的连接，处理请求的过程中不能阻塞等待 socket
+
+  //HTTPS 连接的 TLS 状态，普通的 HTTP 连接为 NULL
+  std::unique_ptr<TlsConnection> tls;
+  int64_t handshake_ns; //握手分多次完成的时候，每次的耗时累加起来
+
+  //CGI 的响应：反应堆模式下客户端接收得慢或者 CGI 程序暂时没有输出的时候，请求暂停在 cgi 中，
+  //连接进入写阶段等 socket 可写，或者进入 STATE_CGI 等 CGI 的输出
+  CgiStream cgi_stream;
+  CgiCall cgi;
+
+  //下面的字段用来统计当前请求各个阶段的耗时，单位是纳秒
+  int64_t request_start; //开始读取或者解析当前请求的时间，0表示还没有开始
+  int64_t parse_ns; //请求分多次到达的时候，每次解析的耗时累加起来
+  int64_t write_ns; //非阻塞 socket 分多次写的时候，每次写的耗时累加起来
+  Stage handle_stage; //HandlerRequest 的耗时记到哪个阶段
+  int64_t handle_ns; //HandlerRequest 的耗时，响应写完之后交给准入控制调整上限
+  bool admitted; //当前请求占用了准入控制中的一个名额，响应写完或者连接关闭的时候归还
+
+  Context()
+    :new_sock(-1),file_fd(-1),file_offset(0),file_remaining(0),entry_pos(0),entry_end(0),body_pos(0),server(NULL),keep_alive(false),streamed(false),request_count(0),
+     state(STATE_READING),read_paused(false),write_pos(0),peer_closed(false),reactor(false),
+     handshake_ns(0),request_start(0),parse_ns(0),write_ns(0),handle_stage(STAGE_OTHER),handle_ns(0),admitted(false){
+    Stats::Local().Count(COUNTER_CONNECTIONS);
+  }
+  ~Context(){
+    CloseFile();
+    Stats::Local().Count(COUNTER_CONNECTIONS_CLOSED);
+  }
+  void CloseFile(){
+    if(file_fd >= 0){
+      close(file_fd);
+      file_fd = -1;
+    }
+    file_offset = 0;
+    file_remaining = 0;
+    file_entry.reset();
+    entry_pos = 0;
+    entry_end = 0;
+  }
+  //长连接上处理下一个请求之前，清空上一个请求的数据
+  //read_buf 不能清空，里面可能已经有客户端流水线发送过来的下一个请求
+  void Reset(){
+    req.Clear();
+    resp.Clear();
+    keep_alive = false;
+    streamed = false;
+    CloseFile();
+    parser.Reset();
+    state = STATE_READING;
+    write_buf.clear();
+    write_pos = 0;
+    cgi_stream = CgiStream();
+    body_pos = 0;
+    request_start = 0;
+    parse_ns = 0;
+    write_ns = 0;
+    handle_stage = STAGE_OTHER;
+    handle_ns = 0;
+  }
 };
 
 //实现核心流程的类
 class HttpServer{
   //以下的几个函数，返回0表示成功，返回小于0表示执行失败
 public:
+  explicit HttpServer(const ServerConfig& config = ServerConfig());
   //初始化模块
   //表示服务器启动
   //什么是const 引用？引用是别名，对应同一个对象同一块内存
   int Start(const std::string& ip,short port);
+  //把 Response 对象的首行和 header 序列化到 output 中，body 发送的时候直接引用，不复制
+  //不依赖服务器的状态，基准测试中也会单独调用
+  static void SerializeResponse(const Response& resp,std::string* output);
 private:
+  //反应堆需要调用下面的请求处理函数
+  friend class EpollReactor;
+  friend class UringReactor;
+
+  //下面几个模式中 tls_sock 是 HTTPS 的监听 socket，没有开启的时候为-1
+  //每个连接一个线程的模式，tls 表示 listen_sock 上接受的是 HTTPS 连接
+  int RunThreadMode(int listen_sock,bool tls);
+  //io_uring 反应堆的模式，内核不支持的时候使用 epoll 反应堆
+  //io_uring 直接收发 socket 上的数据，HTTPS 连接交给另一个线程中的 epoll 反应堆
+  int RunUringMode(int listen_sock,int tls_sock);
+  //固定大小线程池的模式
+  int RunPoolMode(int listen_sock,int tls_sock);
+  //SO_REUSEPORT 模式：每个分片一个监听 socket 和一个绑定 CPU 的反应堆线程，
+  //内核按照四元组的哈希把新连接分给某个分片，之后这个连接的所有处理都在这个线程中完成
+  int RunReuseportMode(const std::string& ip,short port);
+  //创建监听 socket，返回文件描述符，返回小于0表示失败
+  int CreateListenSocket(const std::string& ip,short port,bool reuseport);
+  //为新连接创建上下文，连接数已经到上限的时候返回 503 并且关闭 socket，返回 NULL
+  //tls 为 true 的是 HTTPS 连接，还没有握手，过载的时候没法返回 503，直接关闭
+  Context* NewContext(int new_sock,bool tls = false);
+  //关闭连接并且释放上下文，归还准入控制的名额
+  void DeleteContext(Context* context);
+  //过载的时候不读请求，直接尽量写一个预先拼好的 503 响应，写不进去就算了
+  void SendOverload(int sock);
+  //在当前线程中完整地处理一个连接：循环地读请求，处理请求，写响应，直到连接关闭
+  void ProcessConnection(Context* context);
+  //推进 HTTPS 连接的握手，返回0表示完成，返回1表示要等待 context->tls->WantEvents()，返回小于0表示失败
+  int TlsHandshake(Context* context);
+  //请求读取完成之后，计算出响应并决定是否保持连接
+  //request_ok 为 false 表示请求解析失败，根据 context->parser.ErrorCode() 返回错误页面
+  void BuildResponse(Context* context,bool request_ok);
+  //根据 Connection 头部和协议版本判断客户端是否希望保持连接
+  bool IsKeepAlive(const Request& req);
+  //根据 context->keep_alive 设置 Connection 和 Keep-Alive 头部
+  void SetConnectionHeader(Context* context);
+  //从 context->read_buf 中尝试解析出一个完整的请求，不会读 socket
+  //返回0表示解析成功，返回1表示数据还不完整，返回小于0表示请求格式错误
+  int ParseRequest(Context* context);
+  //把 write_buf 中剩下的数据以及 file_fd 中剩下的文件内容发送出去
+  //返回0表示全部发送完，返回1表示非阻塞 socket 的发送缓冲区满了，返回小于0表示出错
+  int FlushResponse(Context* context);
+  int SendPending(Context* context);
+  //write_buf 中还没有写出去的 header 和内存中的 body 填到 iov 中(最多两段)，返回段数
+  int PendingIov(Context* context,iovec* iov);
+  //PendingIov 给出的数据写出去了 write_size 个字节
+  void ConsumeIov(Context* context,size_t write_size);
+  //从 socket 读一次数据追加到 read_buf 中，返回值和 read 一样
+  ssize_t ReadSocket(Context* context);
+  //响应全部写完，记录写响应和整个请求的耗时
+  void FinishResponse(Context* context);
+  //连接当前所处的超时阶段，由读写状态和解析进度决定
+  TimeoutPhase GetTimeoutPhase(const Context* context);
+  //连接在 phase 阶段的超时时间(单调时钟的毫秒数)，now_ms 是最近一次有读写进展的时间
+  int64_t Deadline(const Context* context,TimeoutPhase phase,int64_t now_ms);
+  //连接在 phase 阶段超时了，记录统计信息
+  void OnTimeout(const Context* context,TimeoutPhase phase);
+  //线程和线程池模式下等待 socket 可读(POLLIN)或可写(POLLOUT)
+  //返回0表示就绪，到了当前阶段的超时时间还没有就绪或者出错返回小于0
+  int WaitSocket(Context* context,short events);
+
   //根据HTTP请求字符串，进行反序列化，从socket中读取一个字符串，输出Request 对象
   int ReadOneRequest(Context* context);
   //根据Response 对象，拼接成一个字符串，写回到客户端
@@ -69,19 +285,110 @@ private:
   //根据 Request 对象，构造Response 对象
   int HandlerRequest(Context* context);
   int Process404(Context* context);
-  int ProcessStaticFile(Context* context);
-  int ProcessCGI(Context* context);
-  void GetFilePath(const std::string& url_path,std::string* file_path);
+  //构造一个除了404之外的错误响应，例如请求格式不对的时候返回400
+  int ProcessError(Context* context,int code);
+  //路径有路由但是方法都不允许，返回 405，Allow 中是允许的方法
+  int Process405(Context* context,unsigned allowed);
+  //返回 3xx，Location 是路由的目标加上前缀之后的路径和 query_string
+  int ProcessRedirect(Context* context,const RouteMatch& match);
+  //过载的时候构造 503 响应，带上 Retry-After，并且关闭连接
+  int ProcessOverload(Context* context);
+  //返回统计信息，默认是 Prometheus 的文本格式，?format=json 返回 JSON
+  int ProcessStats(Context* context);
+  int ProcessStaticFile(Context* context,const RouteMatch& match);
+  //打开一个普通文件，返回文件描述符，失败返回小于0
+  int OpenRegularFile(const std::string& file_path,struct stat* st);
+  //和 OpenRegularFile 一样，但是 file_path 是目录的时候打开其中的 index.html，file_path 也改成 index.html 的路径
+  int OpenStaticFile(std::string* file_path,struct stat* st);
+  //读取文件内容并且生成缓存项，fd 会被关闭
+  std::shared_ptr<const FileEntry> LoadFileEntry(const std::string& file_path,
+                                                 int fd,const struct stat& st,
+                                                 int variants);
+  //返回文件可以使用的压缩版本，ContentEncoding 的位掩码
+  int FileVariants(const std::string& file_path,off_t size);
+  //得到文件的压缩版本，先查缓存，没有的话读取预先压缩的文件或者现场压缩
+  //同一个压缩版本同时只有一个线程在现场压缩，其他线程等它压缩完之后直接用缓存中的结果
+  std::shared_ptr<const FileEntry> GetEncodedEntry(const std::string& key,
+                                                   const FileEntry& entry,
+                                                   ContentEncoding encoding);
+  //现场压缩结束(不管成功还是失败)，唤醒等待同一个 key 的线程
+  void EndCompress(const std::string& encoded_key);
+  //不放进缓存的大文件通过 sendfile 发送
+  int ProcessLargeFile(Context* context,const std::string& file_path,
+                       int fd,const struct stat& st,
+                       int variants,ContentEncoding encoding);
+  std::string FileETag(const struct stat& st,ContentEncoding encoding);
+  std::string ETagWithEncoding(const std::string& etag,ContentEncoding encoding);
+  //根据 If-None-Match 和 If-Modified-Since 判断客户端缓存的内容是否还有效
+  bool IsNotModified(const Request& req,const std::string& etag,time_t mtime);
+  //构造 304 响应
+  int ProcessNotModified(Context* context,const std::string& etag,time_t mtime,bool vary);
+  //处理 Range 和 If-Range 头部，size 是要发送的内容的长度
+  //返回0表示发送完整的内容，返回1表示 ranges 中是要发送的范围，返回小于0表示已经构造好了 416 响应
+  int CheckRange(Context* context,off_t size,const std::string& etag,time_t mtime,
+                 std::vector<ByteRange>* ranges);
+  //构造 206 响应，body 来自 context->file_entry，没有的话来自 fd(fd 会被关闭或者交给 context)
+  //meta 是和 body 长度无关的 header 行，例如 ETag
+  int ProcessRange(Context* context,const std::vector<ByteRange>& ranges,off_t size,
+                   const char* content_type,const std::string& meta,int fd);
+  //url_path 对应的 Cache-Control，没有配置的时候返回 NULL
+  const std::string* GetCacheControl(StringView url_path);
+  void ReportCacheStats();
+  //交给插件注册的处理函数，在当前线程中直接完成
+  int ProcessPlugin(Context* context,HttpHandler* handler);
+  int ProcessCGI(Context* context,const RouteMatch& match);
+  //CGI 执行结束或者暂停之后的处理，ret 是 CgiPool::Execute/Resume 的返回值
+  int FinishCGI(Context* context,int ret);
+  //反应堆模式下暂停的 CGI 请求：write_buf 写完或者 CGI 的文件描述符可读之后继续读取并转发 CGI 的输出
+  //返回0表示 CGI 已经结束并且输出全部写完，返回1表示要等待 socket 可写，
+  //返回2表示要等待 context->cgi.fd 可读(cgi.Writing() 的时候还有可写)，返回小于0表示出错
+  //CGI 结束的时候 header 还没有发出去的话换成错误页面，放在 write_buf 中，返回1
+  int ResumeCGI(Context* context);
+  //反应堆模式下等 CGI 的输出超时了，放弃这个 CGI 请求，之后和 ResumeCGI 一样继续写 write_buf
+  //调用之前反应堆要先把 CGI 的文件描述符注销掉
+  int TimeoutCGI(Context* context);
+  //反应堆模式下的 CGI 结束之后补上处理请求的统计，错误页面序列化到 write_buf 中
+  int EndAsyncCGI(Context* context);
+  //收到一段 CGI 输出，header 收完整之后先发送响应的首行和 header，之后的 body 收到多少转发多少
+  //返回0表示成功，返回1表示客户端暂时写不进去(只在反应堆模式下)，返回小于0表示 CGI 的输出格式不对或者写客户端失败
+  int StreamCgiOutput(Context* context,CgiStream* stream,const char* data,size_t size);
+  int SendCgiHeader(Context* context,CgiStream* stream,const std::string& cgi_header);
+  //CGI 程序正常结束，发送 chunked 编码的结束标记
+  int FinishCgiOutput(Context* context,CgiStream* stream);
+  //把 write_buf 中的数据全部写到客户端，非阻塞 socket 写不进去的时候等待
+  //反应堆模式下不等待，返回1让 CGI 暂停
+  int FlushStream(Context* context);
+  //静态文件路由的根目录拼接上路径中前缀之后的部分
+  void GetFilePath(const RouteMatch& match,std::string* file_path);
+  //根据配置建立路由表，在插件加载完之后调用
+  int BuildRouter();
 
   //静态成员函数，把这个类也当作命名空间
   static void* ThreadEntry(void* arg);
-  int ParseFirstLine(const std::string& first_line,std::string* method,std::string* url);
-  int ParseUrl(const std::string& url,std::string* url_path,std::string* query_string);
-  
-  int ParseHeader(const std::string& header_line,Header* header);
  
   //下面为测试函数
   void PrintRequest(const Request& req);
+
+  ServerConfig config_;
+  //静态文件缓存，没有开启的时候为 NULL
+  std::unique_ptr<FileCache> file_cache_;
+  //正在现场压缩的缓存 key，压缩完放进缓存之后删除并唤醒等待的线程
+  std::mutex compress_mutex_;
+  std::condition_variable compress_cond_;
+  std::unordered_set<std::string> compressing_;
+  //上一次打印缓存统计信息的时间
+  std::atomic<int64_t> cache_report_time_;
+  //CGI 程序的工作进程，没有开启常驻的工作进程的时候每个请求 fork 一次
+  std::unique_ptr<CgiPool> cgi_pool_;
+  //插件注册的处理函数，开始接受连接之后只读
+  PluginManager plugins_;
+  //开始接受连接之前建好，之后只读
+  Router router_;
+  AdmissionControl admission_;
+  //连接数到上限的时候直接写给客户端的响应
+  std::string overload_response_;
+  //所有 HTTPS 连接共用的证书和会话缓存
+  TlsContext tls_;
 };
 
 }//end of http_server 
@@ -1,14 +1,292 @@
 #include "http_server.h"
 #include <iostream>
+#include <stdlib.h>
 
 using namespace http_server;
 
+//解析形如 --key=value 的可选参数，填充到配置中
+//返回0表示成功，返回小于0表示参数不认识
+static int ParseOption(const char* arg,ServerConfig* config){
+  std::string option = arg;
+  size_t pos = option.find("=");
+  if(option.compare(0,2,"--") != 0 || pos == std::string::npos){
+    return -1;
+  }
+  std::string key = option.substr(2,pos - 2);
+  std::string value = option.substr(pos + 1);
+  if(key == "mode"){
+    if(value == "thread"){
+      config->mode = MODE_THREAD;
+    }else if(value == "epoll"){
+      config->mode = MODE_EPOLL;
+    }else if(value == "pool"){
+      config->mode = MODE_POOL;
+    }else if(value == "reuseport"){
+      config->mode = MODE_REUSEPORT;
+    }else if(value == "uring"){
+      config->mode = MODE_URING;
+    }else {
+      return -1;
+    }
+    return 0;
+  }
+  if(key == "workers"){
+    config->worker_threads = atoi(value.c_str());
+    return 0;
+  }
+  if(key == "queue_size"){
+    int size = atoi(value.c_str());
+    if(size <= 0){
+      return -1;
+    }
+    config->queue_size = size;
+    return 0;
+  }
+  if(key == "keepalive_timeout"){
+    config->keepalive_timeout = atoi(value.c_str());
+    return 0;
+  }
+  if(key == "header_timeout" || key == "body_timeout" || key == "write_timeout"){
+    int timeout = atoi(value.c_str());
+    if(timeout <= 0){
+      return -1;
+    }
+    if(key == "header_timeout"){
+      config->header_timeout = timeout;
+    }else if(key == "body_timeout"){
+      config->body_timeout = timeout;
+    }else {
+      config->write_timeout = timeout;
+    }
+    return 0;
+  }
+  if(key == "keepalive_requests"){
+    config->keepalive_requests = atoi(value.c_str());
+    return 0;
+  }
+  if(key == "max_line_size"){
+    config->limits.max_line_size = atoi(value.c_str());
+    return 0;
+  }
+  if(key == "max_header_size"){
+    config->limits.max_header_size = atoi(value.c_str());
+    return 0;
+  }
+  if(key == "max_body_size"){
+    config->limits.max_body_size = atoi(value.c_str());
+    return 0;
+  }
+  if(key == "file_cache_size"){
+    config->file_cache_size = atol(value.c_str());
+    return 0;
+  }
+  if(key == "file_cache_max_file"){
+    config->file_cache_max_file = atol(value.c_str());
+    return 0;
+  }
+  if(key == "file_cache_check_interval"){
+    config->file_cache_check_interval = atoi(value.c_str());
+    return 0;
+  }
+  if(key == "compress"){
+    if(value != "on" && value != "off"){
+      return -1;
+    }
+    config->compress_on_the_fly = (value == "on");
+    return 0;
+  }
+  if(key == "cache_control"){
+    //形如 --cache_control=/images/=max-age=86400
+    size_t sep = value.find("=");
+    if(value.empty() || value[0] != '/' || sep == std::string::npos){
+      return -1;
+    }
+    config->cache_control.push_back(std::make_pair(value.substr(0,sep),value.substr(sep + 1)));
+    return 0;
+  }
+  if(key == "cgi_workers"){
+    config->cgi_workers = atoi(value.c_str());
+    return 0;
+  }
+  if(key == "cgi_timeout"){
+    int timeout = atoi(value.c_str());
+    if(timeout <= 0){
+      return -1;
+    }
+    config->cgi_timeout = timeout;
+    return 0;
+  }
+  if(key == "plugin"){
+    config->plugins.push_back(value);
+    return 0;
+  }
+  if(key == "route"){
+    //形如 --route=/img/=static:./images 或者 --route=/add=cgi:./wwwroot/add@GET,POST
+    RouteConfig route;
+    if(RouteConfig::Parse(value,&route) < 0){
+      return -1;
+    }
+    config->routes.push_back(route);
+    return 0;
+  }
+  if(key == "log_file"){
+    config->log.path = value;
+    return 0;
+  }
+  if(key == "log_level"){
+    const char* names[] = {"debug","info","warning","error","critical"};
+    for(int i = 0;i < 5;++i){
+      if(value == names[i]){
+        config->log.level = static_cast<LogLevel>(i);
+        return 0;
+      }
+    }
+    return -1;
+  }
+  if(key == "log_max_size"){
+    config->log.max_file_size = atol(value.c_str());
+    return 0;
+  }
+  if(key == "log_max_files"){
+    config->log.max_files = atoi(value.c_str());
+    return 0;
+  }
+  if(key == "log_buffer_size"){
+    config->log.ring_size = atol(value.c_str());
+    return 0;
+  }
+  if(key == "log_overflow"){
+    //缓冲区满了之后丢掉日志还是等待
+    if(value != "drop" && value != "block"){
+      return -1;
+    }
+    config->log.block_on_full = (value == "block");
+    return 0;
+  }
+  if(key == "stats_path"){
+    //为空表示不提供统计信息
+    if(!value.empty() && value[0] != '/'){
+      return -1;
+    }
+    config->stats_path = value;
+    return 0;
+  }
+  if(key == "compress_min_size"){
+    config->compress_min_size = atol(value.c_str());
+    return 0;
+  }
+  if(key == "backlog"){
+    int backlog = atoi(value.c_str());
+    if(backlog <= 0){
+      return -1;
+    }
+    config->listen_backlog = backlog;
+    return 0;
+  }
+  if(key == "numa"){
+    if(value != "on" && value != "off"){
+      return -1;
+    }
+    config->numa = (value == "on");
+    return 0;
+  }
+  if(key == "max_connections"){
+    config->admission.max_connections = atol(value.c_str());
+    return 0;
+  }
+  if(key == "max_requests"){
+    config->admission.max_requests = atol(value.c_str());
+    return 0;
+  }
+  if(key == "max_cgi"){
+    config->admission.max_cgi = atol(value.c_str());
+    return 0;
+  }
+  if(key == "adaptive_limit"){
+    if(value != "on" && value != "off"){
+      return -1;
+    }
+    config->admission.adaptive = (value == "on");
+    return 0;
+  }
+  if(key == "retry_after"){
+    int seconds = atoi(value.c_str());
+    if(seconds <= 0){
+      return -1;
+    }
+    config->admission.retry_after = seconds;
+    return 0;
+  }
+  if(key == "tls_port"){
+    int port = atoi(value.c_str());
+    if(port <= 0 || port > 65535){
+      return -1;
+    }
+    config->tls.port = port;
+    return 0;
+  }
+  if(key == "tls_cert"){
+    config->tls.cert_file = value;
+    return 0;
+  }
+  if(key == "tls_key"){
+    config->tls.key_file = value;
+    return 0;
+  }
+  if(key == "tls_tickets"){
+    if(value != "on" && value != "off"){
+      return -1;
+    }
+    config->tls.tickets = (value == "on");
+    return 0;
+  }
+  if(key == "tls_session_cache"){
+    config->tls.session_cache_size = atol(value.c_str());
+    return 0;
+  }
+  if(key == "ktls"){
+    if(value != "on" && value != "off"){
+      return -1;
+    }
+    config->tls.ktls = (value == "on");
+    return 0;
+  }
+  return -1;
+}
+
 int main(int argc,char* argv[]){
-  if(argc != 3){
-    std::cout << "Usage ./server [ip] [port]" << std::endl;
+  if(argc < 3){
+    std::cout << "Usage ./server [ip] [port] [--mode=thread|epoll|pool|reuseport|uring] [--workers=N] [--queue_size=N]"
+      << " [--backlog=N] [--numa=on|off]"
+      << " [--keepalive_timeout=SEC] [--keepalive_requests=N]"
+      << " [--header_timeout=SEC] [--body_timeout=SEC] [--write_timeout=SEC]"
+      << " [--max_line_size=N] [--max_header_size=N] [--max_body_size=N]"
+      << " [--file_cache_size=BYTES] [--file_cache_max_file=BYTES] [--file_cache_check_interval=SEC]"
+      << " [--compress=on|off] [--compress_min_size=BYTES]"
+      << " [--cache_control=PREFIX=VALUE ...]"
+      << " [--cgi_workers=N] [--cgi_timeout=SEC] [--plugin=SO_PATH ...]"
+      << " [--route=PREFIX=static|cgi|native|redirect|stats:TARGET[@METHOD,...] ...]"
+      << " [--max_connections=N] [--max_requests=N] [--max_cgi=N] [--adaptive_limit=on|off]"
+      << " [--retry_after=SEC]"
+      << " [--tls_port=N --tls_cert=PEM --tls_key=PEM] [--tls_tickets=on|off] [--tls_session_cache=N] [--ktls=on|off]"
+      << " [--log_file=PATH] [--log_level=debug|info|warning|error|critical]"
+      << " [--log_max_size=BYTES] [--log_max_files=N] [--log_buffer_size=BYTES]"
+      << " [--log_overflow=drop|block] [--stats_path=PATH]" << std::endl;
+    return -1;
+  }
+  ServerConfig config;
+  for(int i = 3;i < argc;++i){
+    if(ParseOption(argv[i],&config) < 0){
+      std::cout << "Unknown option: " << argv[i] << std::endl;
+      return -1;
+    }
+  }
+  //开启 HTTPS 必须同时给出证书和私钥
+  if(config.tls.port > 0 && (config.tls.cert_file.empty() || config.tls.key_file.empty())){
+    std::cout << "--tls_port requires --tls_cert and --tls_key" << std::endl;
     return -1;
   }
-  HttpServer server;
+  HttpServer server(config);
   server.Start(argv[1],atoi(argv[2]));
   return 0;
 }
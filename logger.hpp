@@ -0,0 +1,365 @@
+///////////////////////////////////////
+//异步日志
+//请求线程只负责把格式化好的日志写到自己线程的环形缓冲区中(单生产者单消费者，不加锁)，
+//后台线程定期把所有线程的缓冲区取出来，批量写到日志文件中，文件太大的时候滚动。
+//低于最低级别的 LOG 连参数都不会计算：
+//  编译期用 -DLOG_MIN_LEVEL=INFO 可以把 DEBUG 日志整个去掉，
+//  运行期用 Logger::Instance().SetLevel(WARNING) 调整
+//
+//和工具类一样，声明和实现都放在 .hpp 中，CGI 程序这种没有启动后台线程的进程，
+//日志直接同步写到标准错误(标准输出是 CGI 的响应，不能写)
+///////////////////////////////////////
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+enum LogLevel{
+  DEBUG,
+  INFO,
+  WARNING,
+  ERROR,
+  CRITIAL,
+};
+
+//编译期的最低级别，低于这个级别的 LOG 语句会被编译器直接优化掉
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL DEBUG
+#endif
+
+struct LogConfig{
+  std::string path; //日志文件路径，为空表示写到标准输出
+  size_t max_file_size; //单个日志文件的最大字节数，超过之后滚动成 path.1 path.2 ...
+  int max_files; //最多保留多少个滚动出去的文件
+  LogLevel level; //运行期的最低级别
+  size_t ring_size; //每个线程的缓冲区字节数
+  bool block_on_full; //缓冲区满了的时候等待后台线程取走(true)，还是丢掉这条日志(false)
+  LogConfig()
+    :max_file_size(100 * 1024 * 1024),max_files(5),level(INFO),
+     ring_size(64 * 1024),block_on_full(false){
+  }
+};
+
+//单个线程的日志缓冲区，请求线程写，后台线程读
+//每条日志在缓冲区中是 4 字节的长度 + 内容，head 和 tail 一直增长，对容量取模得到位置
+class LogRing{
+public:
+  explicit LogRing(size_t capacity)
+    :buf_(new char[capacity]),capacity_(capacity),head_(0),tail_(0),
+     closed_(false),dropped_(0){
+  }
+  //返回 false 表示空间不够
+  bool TryPush(const char* data,uint32_t size){
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    uint64_t tail = tail_.load(std::memory_order_acquire);
+    if(capacity_ - (head - tail) < sizeof(size) + size){
+      return false;
+    }
+    Copy(head,reinterpret_cast<const char*>(&size),sizeof(size));
+    Copy(head + sizeof(size),data,size);
+    head_.store(head + sizeof(size) + size,std::memory_order_release);
+    return true;
+  }
+  //把缓冲区中所有的日志追加到 output 中
+  void Drain(std::string* output){
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    uint64_t head = head_.load(std::memory_order_acquire);
+    while(tail < head){
+      uint32_t size = 0;
+      Read(tail,reinterpret_cast<char*>(&size),sizeof(size));
+      size_t start = output->size();
+      output->resize(start + size);
+      Read(tail + sizeof(size),&(*output)[start],size);
+      tail += sizeof(size) + size;
+    }
+    tail_.store(tail,std::memory_order_release);
+  }
+  bool Empty() const{
+    return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+  }
+  size_t Capacity() const{ return capacity_; }
+  //所属的线程已经退出，后台线程取完之后释放
+  void Close(){ closed_.store(true,std::memory_order_release); }
+  bool Closed() const{ return closed_.load(std::memory_order_acquire); }
+  void AddDropped(){ dropped_.fetch_add(1,std::memory_order_relaxed); }
+  uint64_t TakeDropped(){ return dropped_.exchange(0,std::memory_order_relaxed); }
+private:
+  void Copy(uint64_t pos,const char* data,size_t size){
+    size_t offset = pos % capacity_;
+    size_t first = std::min(size,capacity_ - offset);
+    memcpy(buf_.get() + offset,data,first);
+    memcpy(buf_.get(),data + first,size - first);
+  }
+  void Read(uint64_t pos,char* data,size_t size){
+    size_t offset = pos % capacity_;
+    size_t first = std::min(size,capacity_ - offset);
+    memcpy(data,buf_.get() + offset,first);
+    memcpy(data + first,buf_.get(),size - first);
+  }
+
+  std::unique_ptr<char[]> buf_;
+  size_t capacity_;
+  std::atomic<uint64_t> head_; //只有所属的线程修改
+  std::atomic<uint64_t> tail_; //只有后台线程修改
+  std::atomic<bool> closed_;
+  std::atomic<uint64_t> dropped_; //缓冲区满了被丢掉的日志条数
+};
+
+class Logger{
+public:
+  static Logger& Instance(){
+    static Logger logger;
+    return logger;
+  }
+
+  //运行期的级别判断，只是读一个原子变量
+  static bool Enabled(LogLevel level){
+    return level >= LOG_MIN_LEVEL
+      && level >= Instance().level_.load(std::memory_order_relaxed);
+  }
+
+  void SetLevel(LogLevel level){
+    level_.store(level,std::memory_order_relaxed);
+  }
+
+  //启动后台线程，返回0表示成功，返回小于0表示日志文件打不开
+  int Start(const LogConfig& config){
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(running_){
+      return 0;
+    }
+    config_ = config;
+    if(config_.ring_size < 1024){
+      config_.ring_size = 1024;
+    }
+    SetLevel(config_.level);
+    if(OpenFile() < 0){
+      return -1;
+    }
+    running_ = true;
+    started_.store(true,std::memory_order_release);
+    writer_ = std::thread([this](){ WriterLoop(); });
+    return 0;
+  }
+
+  //把缓冲区中剩下的日志全部写出去，然后停止后台线程
+  void Stop(){
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if(!running_){
+        return;
+      }
+      running_ = false;
+    }
+    //之后的日志直接写到标准错误
+    started_.store(false,std::memory_order_release);
+    cond_.notify_all();
+    writer_.join();
+  }
+
+  //写入一条已经格式化好的日志
+  void Append(const char* data,size_t size){
+    if(!started_.load(std::memory_order_acquire)){
+      //后台线程还没有启动，直接写到标准错误
+      fwrite(data,1,size,stderr);
+      return;
+    }
+    LogRing* ring = ThreadRing();
+    //一条日志最多占缓冲区的一半，太长的截断
+    size_t max_size = ring->Capacity() / 2 - sizeof(uint32_t);
+    if(size > max_size){
+      size = max_size;
+    }
+    while(!ring->TryPush(data,size)){
+      if(!config_.block_on_full){
+        ring->AddDropped();
+        return;
+      }
+      //等待后台线程取走，只有缓冲区满的时候才会走到这里
+      cond_.notify_one();
+      std::this_thread::yield();
+    }
+  }
+
+  ~Logger(){
+    Stop();
+    if(fd_ > STDERR_FILENO){
+      close(fd_);
+    }
+  }
+private:
+  Logger()
+    :level_(LOG_MIN_LEVEL > INFO ? LOG_MIN_LEVEL : INFO),started_(false),
+     running_(false),fd_(STDOUT_FILENO),file_size_(0){
+  }
+  Logger(const Logger&);
+  Logger& operator=(const Logger&);
+
+  //线程退出的时候把缓冲区标记为关闭，由后台线程取完之后释放
+  struct RingHolder{
+    LogRing* ring;
+    RingHolder():ring(NULL){}
+    ~RingHolder(){
+      if(ring != NULL){
+        ring->Close();
+      }
+    }
+  };
+
+  LogRing* ThreadRing(){
+    static thread_local RingHolder holder;
+    if(holder.ring == NULL){
+      //每个线程只在第一次写日志的时候加一次锁
+      holder.ring = new LogRing(config_.ring_size);
+      std::lock_guard<std::mutex> lock(mutex_);
+      rings_.push_back(holder.ring);
+    }
+    return holder.ring;
+  }
+
+  void WriterLoop(){
+    std::string batch;
+    while(true){
+      bool running = true;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait_for(lock,std::chrono::milliseconds(100));
+        running = running_;
+        for(auto it = rings_.begin();it != rings_.end();){
+          LogRing* ring = *it;
+          //先看是否关闭再取数据，关闭之后就不会再有新的日志了
+          bool closed = ring->Closed();
+          ring->Drain(&batch);
+          uint64_t dropped = ring->TakeDropped();
+          if(dropped > 0){
+            batch += "[W logger] dropped " + std::to_string(dropped) + " log lines\n";
+          }
+          if(closed){
+            delete ring;
+            it = rings_.erase(it);
+          }else {
+            ++it;
+          }
+        }
+      }
+      Write(batch);
+      batch.clear();
+      if(!running){
+        return;
+      }
+    }
+  }
+
+  int OpenFile(){
+    if(config_.path.empty()){
+      fd_ = STDOUT_FILENO;
+      return 0;
+    }
+    int fd = open(config_.path.c_str(),O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,0644);
+    if(fd < 0){
+      perror("open log file");
+      return -1;
+    }
+    if(fd_ > STDERR_FILENO){
+      close(fd_);
+    }
+    fd_ = fd;
+    struct stat st;
+    file_size_ = fstat(fd_,&st) == 0 ? st.st_size : 0;
+    return 0;
+  }
+
+  //path.1 是最近滚动出去的文件，最旧的一个被删除
+  void Rotate(){
+    for(int i = config_.max_files - 1;i >= 1;--i){
+      std::string from = config_.path + "." + std::to_string(i);
+      std::string to = config_.path + "." + std::to_string(i + 1);
+      rename(from.c_str(),to.c_str());
+    }
+    if(config_.max_files > 0){
+      rename(config_.path.c_str(),(config_.path + ".1").c_str());
+    }else {
+      unlink(config_.path.c_str());
+    }
+    OpenFile();
+  }
+
+  void Write(const std::string& batch){
+    size_t pos = 0;
+    while(pos < batch.size()){
+      ssize_t write_size = write(fd_,batch.data() + pos,batch.size() - pos);
+      if(write_size < 0 && errno == EINTR){
+        continue;
+      }
+      if(write_size <= 0){
+        return;
+      }
+      pos += write_size;
+    }
+    file_size_ += batch.size();
+    if(!config_.path.empty() && file_size_ >= config_.max_file_size){
+      Rotate();
+    }
+  }
+
+  std::atomic<int> level_;
+  std::atomic<bool> started_;
+  LogConfig config_;
+  bool running_;
+  std::mutex mutex_; //保护 rings_ 和 running_
+  std::condition_variable cond_;
+  std::list<LogRing*> rings_;
+  std::thread writer_;
+  int fd_;
+  size_t file_size_;
+};
+
+//一条日志，先在对象中拼好，析构的时候一次性交给 Logger
+class LogMessage{
+public:
+  LogMessage(LogLevel level,const char* file,int line){
+    static const char prefix[] = {'D','I','W','E','C'};
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE,&ts);
+    stream_ << "[" << prefix[level] << ts.tv_sec << " " << file << ":" << line << "]";
+  }
+  ~LogMessage(){
+    //每条日志单独一行，没有换行的补上
+    std::string message = stream_.str();
+    if(message.empty() || message.back() != '\n'){
+      message += '\n';
+    }
+    Logger::Instance().Append(message.data(),message.size());
+  }
+  std::ostream& stream(){
+    return stream_;
+  }
+private:
+  std::ostringstream stream_;
+};
+
+//文件名和行号的出处
+//为什么要定义宏不定义函数来替换？？？
+//如果定义函数返回文件名和行号，永远都返回的是util.hpp，行号也是固定的，不会替换的
+//__FILE__ __LINE__
+//用 if else 包起来，级别不够的时候 << 后面的表达式都不会执行
+//LOG(INFO) << "hehe"
+#define LOG_ENABLED(level) Logger::Enabled(level)
+#define LOG(level) \
+  if(!LOG_ENABLED(level)) ; \
+  else LogMessage(level,__FILE__,__LINE__).stream()
@@ -0,0 +1,280 @@
+//解析和序列化相关函数的微基准测试
+//每个测试先预热，然后成倍地增加循环次数，直到总耗时超过 min_time_ms，
+//结果以 JSON 的格式输出到标准输出，方便和之前提交的结果比较；标准错误中输出一份便于阅读的表格
+//替换了全局的 operator new，同时统计平均每次操作的堆内存分配次数
+//用法：./micro_bench [--filter=名字中包含的字符串] [--min_time_ms=N]
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "http_server.h"
+#include "http_parser.h"
+#include "buffer.hpp"
+#include "util.hpp"
+#include "scan.hpp"
+
+using namespace http_server;
+
+//基准测试是单线程的，计数不需要原子操作
+static uint64_t g_alloc_count = 0;
+
+void* operator new(size_t size){
+  ++g_alloc_count;
+  void* p = malloc(size == 0 ? 1 : size);
+  if(p == NULL){
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept{
+  free(p);
+}
+
+//阻止编译器把没有被使用的计算结果优化掉
+template<typename T>
+static void DoNotOptimize(const T& value){
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct BenchResult{
+  std::string name;
+  uint64_t iterations;
+  double ns_per_op;
+  double allocs_per_op;
+};
+
+static std::string g_filter;
+static int64_t g_min_time_ns = 200 * 1000 * 1000;
+static std::vector<BenchResult> g_results;
+
+template<typename Func>
+static void RunBench(const char* name,Func func){
+  if(!g_filter.empty() && std::string(name).find(g_filter) == std::string::npos){
+    return;
+  }
+  for(int i = 0;i < 1000;++i){
+    func();
+  }
+  uint64_t iterations = 1000;
+  int64_t elapsed = 0;
+  uint64_t allocs = 0;
+  while(true){
+    allocs = g_alloc_count;
+    int64_t start = TimeUtil::MonotonicNS();
+    for(uint64_t i = 0;i < iterations;++i){
+      func();
+    }
+    elapsed = TimeUtil::MonotonicNS() - start;
+    allocs = g_alloc_count - allocs;
+    if(elapsed >= g_min_time_ns){
+      break;
+    }
+    iterations *= 2;
+  }
+  BenchResult result;
+  result.name = name;
+  result.iterations = iterations;
+  result.ns_per_op = static_cast<double>(elapsed) / iterations;
+  result.allocs_per_op = static_cast<double>(allocs) / iterations;
+  fprintf(stderr,"%-40s %12llu %12.1f ns/op %8.2f allocs/op\n",name,
+          static_cast<unsigned long long>(iterations),result.ns_per_op,result.allocs_per_op);
+  g_results.push_back(result);
+}
+
+//浏览器发出的一个典型请求
+static const char kRequest[] =
+  "GET /css/bootstrap.min.css?v=3.3.7 HTTP/1.1\r\n"
+  "Host: 127.0.0.1:9090\r\n"
+  "Connection: keep-alive\r\n"
+  "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+  "Chrome/68.0.3440.106 Safari/537.36\r\n"
+  "Accept: text/css,*/*;q=0.1\r\n"
+  "Referer: http://127.0.0.1:9090/index.html\r\n"
+  "Accept-Encoding: gzip, deflate, br\r\n"
+  "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+  "If-None-Match: \"5b7e8f2a-1bb5e\"\r\n"
+  "\r\n";
+
+static void BenchParser(){
+  RunBench("ParseFirstLine",[](){
+    StringView method,url,version;
+    RequestParser::ParseFirstLine("GET /index.html?a=1&b=2 HTTP/1.1",&method,&url,&version);
+    DoNotOptimize(url);
+  });
+  const StringView url = "/cgi/add?a=10&b=20&name=hello";
+  RunBench("ParseUrl",[&url](){
+    StringView url_path,query_string;
+    RequestParser::ParseUrl(url,&url_path,&query_string);
+    DoNotOptimize(query_string);
+  });
+  const StringView header_line = "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36";
+  HeaderList header;
+  RunBench("ParseHeader",[&header_line,&header](){
+    header.clear();
+    RequestParser::ParseHeader(header_line,&header);
+    DoNotOptimize(header);
+  });
+  const std::string query = "a=10&b=20&name=hello&lang=zh-CN";
+  RunBench("StringUtil::Split",[&query](){
+    std::vector<std::string> output;
+    StringUtil::Split(query,"&",&output);
+    DoNotOptimize(output);
+  });
+  RunBench("StringUtil::ParseUrlParam",[&query](){
+    StringUtil::UrlParam output;
+    StringUtil::ParseUrlParam(query,&output);
+    DoNotOptimize(output);
+  });
+  //完整地解析一个请求，包括从缓冲区中按行切分，每次都是新的连接
+  RunBench("RequestParser::Parse",[](){
+    Buffer buf;
+    buf.Append(kRequest,sizeof(kRequest) - 1);
+    RequestParser parser;
+    Request req;
+    int ret = parser.Parse(&buf,&req);
+    DoNotOptimize(ret);
+    DoNotOptimize(req);
+  });
+  //长连接上的情况：parser、缓冲区和 Request 都复用，稳定之后不应该再有堆内存分配
+  Buffer keepalive_buf;
+  RequestParser keepalive_parser;
+  Request keepalive_req;
+  RunBench("RequestParser::Parse/keepalive",[&](){
+    keepalive_parser.Reset();
+    keepalive_req.Clear();
+    keepalive_buf.Append(kRequest,sizeof(kRequest) - 1);
+    int ret = keepalive_parser.Parse(&keepalive_buf,&keepalive_req);
+    DoNotOptimize(ret);
+    DoNotOptimize(keepalive_req);
+  });
+  //在一个完整请求的 header 中查找，常用 header 按编号查找，其他的按名字不区分大小写地查找
+  RunBench("HeaderList::find/id",[&keepalive_req](){
+    HeaderList::const_iterator it = keepalive_req.header.find(HEADER_IF_NONE_MATCH);
+    DoNotOptimize(it);
+  });
+  RunBench("HeaderList::find/name",[&keepalive_req](){
+    HeaderList::const_iterator it = keepalive_req.header.find("if-none-match");
+    DoNotOptimize(it);
+  });
+}
+
+//字符扫描的几种实现分别测一遍，CPU 不支持的级别跳过
+static void BenchScan(){
+  //典型的表单提交，需要解码的字符比较少
+  const std::string form = "username=zhangsan&password=123456&remember=on&redirect=%2Findex.html"
+    "&comment=hello+world&lang=zh-CN&tz=Asia%2FShanghai&ts=1534999999";
+  const std::string long_url = "/static/js/vendor/jquery-3.3.1/dist/jquery.min.js?v=1534999999"
+    "&cache=false&callback=jQuery331012345678901234567_1534999999999";
+  std::string decoded;
+  for(int level = ScanUtil::LEVEL_SCALAR;level <= ScanUtil::DetectLevel();++level){
+    ScanUtil::SetLevel(level);
+    const std::string suffix = std::string("/") + ScanUtil::LevelName(level);
+    RunBench(("ScanUtil::FindAny" + suffix).c_str(),[&form](){
+      const char* pos = ScanUtil::FindAny(form.data(),form.data() + form.size(),"%+",2);
+      DoNotOptimize(pos);
+    });
+    RunBench(("ScanUtil::FindInvalidUrlByte" + suffix).c_str(),[&long_url](){
+      const char* pos = ScanUtil::FindInvalidUrlByte(long_url.data(),long_url.data() + long_url.size());
+      DoNotOptimize(pos);
+    });
+    RunBench(("ScanUtil::PercentDecode" + suffix).c_str(),[&form,&decoded](){
+      int ret = ScanUtil::PercentDecode(form,true,&decoded);
+      DoNotOptimize(ret);
+      DoNotOptimize(decoded);
+    });
+    RunBench(("StringUtil::ParseUrlParam/form" + suffix).c_str(),[&form](){
+      StringUtil::UrlParam output;
+      StringUtil::ParseUrlParam(form,&output);
+      DoNotOptimize(output);
+    });
+  }
+  ScanUtil::SetLevel(ScanUtil::DetectLevel());
+  //之前 StringUtil::Split 的实现，作为对比
+  const std::string query = "a=10&b=20&name=hello&lang=zh-CN";
+  RunBench("boost::split",[&query](){
+    std::vector<std::string> output;
+    boost::split(output,query,boost::is_any_of("&"),boost::token_compress_on);
+    DoNotOptimize(output);
+  });
+}
+
+//之前基于 stringstream 的序列化，作为对比
+static void SerializeWithStream(const Response& resp,std::string* output){
+  std::stringstream ss;
+  ss << "HTTP/1.1 " << resp.code << " " << resp.desc << "\n";
+  for(const auto& item : resp.header){
+    ss << item.name << ": " << item.value << "\n";
+  }
+  ss << resp.header_lines;
+  ss << "\n";
+  ss << resp.body;
+  *output = ss.str();
+}
+
+static void BenchSerialize(){
+  //命中文件缓存的静态文件：header 行是预先拼好的，body 直接从缓存发送
+  Response file_resp;
+  file_resp.code = 200;
+  file_resp.desc = "OK";
+  file_resp.header[HEADER_CONNECTION] = "keep-alive";
+  file_resp.header[HEADER_KEEP_ALIVE] = "timeout=15, max=99";
+  file_resp.header_lines = "Content-Type: text/css\r\nContent-Length: 113502\r\n"
+    "ETag: \"5b7e8f2a-1bb5e\"\r\nLast-Modified: Thu, 23 Aug 2018 08:00:00 GMT\r\n"
+    "Accept-Ranges: bytes\r\n";
+  //连接上的写缓冲区是复用的
+  std::string output;
+  RunBench("SerializeResponse/static",[&file_resp,&output](){
+    HttpServer::SerializeResponse(file_resp,&output);
+    DoNotOptimize(output);
+  });
+  RunBench("SerializeResponse/static/stringstream",[&file_resp,&output](){
+    SerializeWithStream(file_resp,&output);
+    DoNotOptimize(output);
+  });
+  //body 在内存中的小响应，例如错误页面，body 发送的时候直接引用，不复制到 output 中
+  Response error_resp;
+  error_resp.code = 404;
+  error_resp.desc = "NOT FOUND";
+  error_resp.header[HEADER_CONNECTION] = "close";
+  error_resp.body = "<h1>404 NOT FOUND</h1>";
+  error_resp.header[HEADER_CONTENT_LENGTH] = std::to_string(error_resp.body.size());
+  RunBench("SerializeResponse/error",[&error_resp,&output](){
+    HttpServer::SerializeResponse(error_resp,&output);
+    DoNotOptimize(output);
+  });
+  RunBench("SerializeResponse/error/stringstream",[&error_resp,&output](){
+    SerializeWithStream(error_resp,&output);
+    DoNotOptimize(output);
+  });
+}
+
+int main(int argc,char* argv[]){
+  for(int i = 1;i < argc;++i){
+    std::string arg = argv[i];
+    if(arg.compare(0,9,"--filter=") == 0){
+      g_filter = arg.substr(9);
+    }else if(arg.compare(0,14,"--min_time_ms=") == 0){
+      g_min_time_ns = atoll(arg.c_str() + 14) * 1000 * 1000;
+    }else {
+      fprintf(stderr,"Usage: %s [--filter=NAME] [--min_time_ms=N]\n",argv[0]);
+      return 1;
+    }
+  }
+  //解析出错的时候会打日志，基准测试中只关心耗时
+  Logger::Instance().SetLevel(ERROR);
+  BenchParser();
+  BenchScan();
+  BenchSerialize();
+  printf("{\"benchmarks\":[");
+  for(size_t i = 0;i < g_results.size();++i){
+    printf("%s{\"name\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.1f,\"allocs_per_op\":%.2f}",
+           i == 0 ? "" : ",",g_results[i].name.c_str(),
+           static_cast<unsigned long long>(g_results[i].iterations),g_results[i].ns_per_op,
+           g_results[i].allocs_per_op);
+  }
+  printf("]}\n");
+  return 0;
+}
@@ -0,0 +1,42 @@
+#pragma once
+//在服务器进程中直接运行的请求处理插件
+//简单的动态页面(例如 a+b 计算器)不值得为它启动一个进程，
+//可以写成一个 HttpHandler，编译成动态库，启动服务器的时候用 --plugin=xxx.so 加载。
+//处理请求的线程就是正在服务这个连接的线程，没有进程切换和数据拷贝。
+//
+//插件中需要导出一个 C 函数作为入口，在里面注册自己处理的 url 路径，例如：
+//  extern "C" int HTTP_SERVER_PLUGIN_INIT(http_server::PluginRegistry* registry){
+//    registry->Register("/plugin/add",new AddHandler());
+//    return 0;
+//  }
+//插件直接使用服务器的 Request/Response 结构，所以必须和服务器使用同一个编译器和同样的头文件编译
+#include "http_message.h"
+
+//插件入口函数的名字
+#define HTTP_SERVER_PLUGIN_INIT http_server_plugin_init
+#define HTTP_SERVER_PLUGIN_INIT_NAME "http_server_plugin_init"
+
+namespace http_server{
+
+class HttpHandler{
+public:
+  virtual ~HttpHandler(){}
+  //根据 req 填充 resp，resp 中的 code 已经被设置为 200
+  //body 放在 resp->body 中，没有设置 Content-Length 的话服务器会根据 body 的长度补上
+  //多个工作线程会同时调用，实现必须是线程安全的
+  //返回0表示成功，返回小于0表示失败，服务器会返回 500
+  virtual int Handle(const Request& req,Response* resp) = 0;
+};
+
+class PluginRegistry{
+public:
+  virtual ~PluginRegistry(){}
+  //注册 url_path 的处理函数，handler 的所有权交给服务器
+  //返回0表示成功，返回小于0表示 url_path 已经被注册过了
+  virtual int Register(const std::string& url_path,HttpHandler* handler) = 0;
+};
+
+//插件入口函数的类型，返回0表示成功，返回小于0表示插件初始化失败
+typedef int (*PluginInitFunc)(PluginRegistry* registry);
+
+}//end of http_server
@@ -0,0 +1,51 @@
+#include "plugin_manager.h"
+#include "util.hpp"
+#include <dlfcn.h>
+
+namespace http_server{
+
+PluginManager::~PluginManager(){
+  //handler 的代码在动态库中，必须在 dlclose 之前析构
+  handlers_.clear();
+  for(size_t i = 0;i < libs_.size();++i){
+    dlclose(libs_[i]);
+  }
+}
+
+int PluginManager::Load(const std::string& so_path){
+  //dlopen 的路径中没有 / 的话会去系统的库目录中查找，相对路径要加上 ./
+  std::string path = so_path;
+  if(path.find('/') == std::string::npos){
+    path = "./" + path;
+  }
+  void* lib = dlopen(path.c_str(),RTLD_NOW | RTLD_LOCAL);
+  if(lib == NULL){
+    LOG(ERROR) << "dlopen error! " << dlerror() << "\n";
+    return -1;
+  }
+  PluginInitFunc init = reinterpret_cast<PluginInitFunc>(dlsym(lib,HTTP_SERVER_PLUGIN_INIT_NAME));
+  if(init == NULL){
+    LOG(ERROR) << "Plugin has no " << HTTP_SERVER_PLUGIN_INIT_NAME << "! path=" << path << "\n";
+    dlclose(lib);
+    return -1;
+  }
+  libs_.push_back(lib);
+  if(init(this) < 0){
+    LOG(ERROR) << "Plugin init error! path=" << path << "\n";
+    return -1;
+  }
+  LOG(INFO) << "Plugin loaded! path=" << path << "\n";
+  return 0;
+}
+
+int PluginManager::Register(const std::string& url_path,HttpHandler* handler){
+  std::unique_ptr<HttpHandler> holder(handler);
+  if(handlers_.find(url_path) != handlers_.end()){
+    LOG(ERROR) << "Handler already registered! url_path=" << url_path << "\n";
+    return -1;
+  }
+  handlers_[url_path] = std::move(holder);
+  return 0;
+}
+
+}//end of http_server
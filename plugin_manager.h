@@ -0,0 +1,46 @@
+#pragma once
+//加载插件动态库，根据 url 路径找到对应的 HttpHandler
+//所有插件都在服务器开始接受连接之前加载完，之后只读，查找的时候不需要加锁
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "plugin.h"
+
+namespace http_server{
+
+class PluginManager : public PluginRegistry{
+public:
+  PluginManager(){}
+  ~PluginManager();
+  //加载一个插件动态库并调用它的入口函数，返回0表示成功，返回小于0表示失败
+  int Load(const std::string& so_path);
+  virtual int Register(const std::string& url_path,HttpHandler* handler);
+  //url_path 对应的处理函数，没有注册的返回 NULL
+  //插件的数量很少，直接顺序比较，查找的时候不用为 url_path 构造 std::string
+  HttpHandler* Find(StringView url_path) const{
+    for(auto it = handlers_.begin();it != handlers_.end();++it){
+      if(it->first == url_path){
+        return it->second.get();
+      }
+    }
+    return NULL;
+  }
+  bool Empty() const{
+    return handlers_.empty();
+  }
+  //所有注册过的 url_path，启动的时候加到路由表中
+  void Paths(std::vector<std::string>* paths) const{
+    for(auto it = handlers_.begin();it != handlers_.end();++it){
+      paths->push_back(it->first);
+    }
+  }
+private:
+  PluginManager(const PluginManager&);
+  PluginManager& operator=(const PluginManager&);
+
+  std::unordered_map<std::string,std::unique_ptr<HttpHandler> > handlers_;
+  std::vector<void*> libs_; //dlopen 返回的句柄，析构的时候先删除 handler 再 dlclose
+};
+
+}//end of http_server
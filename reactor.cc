@@ -0,0 +1,369 @@
+#include "reactor.h"
+#include "http_server.h"
+#include "util.hpp"
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+namespace http_server{
+
+//一次 epoll_wait 最多拿到的事件个数
+static const int kMaxEvents = 1024;
+//时间轮的刻度，超时最多晚这么久被发现
+static const int64_t kTimerTickMS = 100;
+//CGI 的文件描述符注册的时候 data 是 Context 的地址加上这个标记，Context 的地址至少按8字节对齐，
+//最低位一定是0，用来和连接 socket 的事件区分开；只有标记没有地址的事件已经失效了，直接跳过
+static const uint64_t kCgiTag = 1;
+
+static int SetNonBlock(int fd){
+  int flags = fcntl(fd,F_GETFL,0);
+  if(flags < 0){
+    return -1;
+  }
+  return fcntl(fd,F_SETFL,flags | O_NONBLOCK);
+}
+
+EpollReactor::EpollReactor(HttpServer* server,int listen_sock,int tls_sock)
+  :server_(server),listen_sock_(listen_sock),tls_listen_sock_(tls_sock),epoll_fd_(-1),
+   events_(NULL),event_index_(0),event_count_(0),cgi_watches_(0),
+   timers_(kTimerTickMS,TimeUtil::MonotonicMS()){
+}
+
+EpollReactor::~EpollReactor(){
+  if(epoll_fd_ >= 0){
+    close(epoll_fd_);
+  }
+}
+
+int EpollReactor::Run(){
+  //EPOLL_CLOEXEC 避免 CGI 子进程继承 epoll 文件描述符
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if(epoll_fd_ < 0){
+    perror("epoll_create1");
+    return -1;
+  }
+  //监听 socket 的 data.ptr 设置为 NULL，用来和连接区分开
+  //HTTPS 的监听 socket 的 data.ptr 指向 tls_listen_sock_，连接的 Context 不可能在这个地址上
+  int socks[] = {listen_sock_,tls_listen_sock_};
+  for(int i = 0;i < 2;++i){
+    if(socks[i] < 0){
+      continue;
+    }
+    if(SetNonBlock(socks[i]) < 0){
+      perror("fcntl");
+      return -1;
+    }
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = (i == 0 ? NULL : &tls_listen_sock_);
+    if(epoll_ctl(epoll_fd_,EPOLL_CTL_ADD,socks[i],&ev) < 0){
+      perror("epoll_ctl");
+      return -1;
+    }
+  }
+  LOG(INFO) << "EpollReactor start!\n";
+  epoll_event events[kMaxEvents];
+  while(1){
+    //等到最近的定时器可能到期的时候，没有连接的时候一直等
+    int n = epoll_wait(epoll_fd_,events,kMaxEvents,timers_.NextTimeout(TimeUtil::MonotonicMS()));
+    if(n < 0){
+      if(errno == EINTR){
+        continue;
+      }
+      perror("epoll_wait");
+      return -1;
+    }
+    //这一批事件中有 CGI 的事件的时候，关闭连接要把它的另一个事件一起作废，见 CloseConnection
+    events_ = cgi_watches_ > 0 ? events : NULL;
+    event_count_ = n;
+    for(int i = 0;i < n;++i){
+      event_index_ = i;
+      if(events[i].data.u64 & kCgiTag){
+        Context* context = reinterpret_cast<Context*>(events[i].data.u64 & ~kCgiTag);
+        if(context != NULL){
+          HandleCgi(context);
+        }
+        continue;
+      }
+      if(events[i].data.ptr == NULL){
+        HandleAccept(listen_sock_,false);
+        continue;
+      }
+      if(events[i].data.ptr == &tls_listen_sock_){
+        HandleAccept(tls_listen_sock_,true);
+        continue;
+      }
+      Context* context = reinterpret_cast<Context*>(events[i].data.ptr);
+      if(events[i].events & (EPOLLERR | EPOLLHUP)){
+        CloseConnection(context);
+        continue;
+      }
+      if(context->state == STATE_HANDSHAKE){
+        HandleHandshake(context);
+        continue;
+      }
+      //ET 模式下不管处于哪个阶段都要把数据读出来，否则之后不会再收到可读通知
+      if((events[i].events & (EPOLLIN | EPOLLRDHUP)) && HandleRead(context) < 0){
+        CloseConnection(context);
+        continue;
+      }
+      if(context->state == STATE_WRITING){
+        if(!(events[i].events & EPOLLOUT)){
+          continue;
+        }
+        int ret = HandleWrite(context);
+        if(ret != 0){
+          if(ret < 0){
+            CloseConnection(context);
+          }else {
+            UpdateTimer(context);
+          }
+          continue;
+        }
+      }
+      ProcessRequests(context);
+    }
+    events_ = NULL;
+    timers_.Advance(TimeUtil::MonotonicMS(),[this](TimerNode* node){ OnTimeout(node); });
+  }
+  return 0;
+}
+
+void EpollReactor::HandleAccept(int listen_sock,bool tls){
+  while(1){
+    //直接得到非阻塞并且带 CLOEXEC 标记的 socket，省掉额外的 fcntl
+    int new_sock = accept4(listen_sock,NULL,NULL,SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if(new_sock < 0){
+      if(errno == EAGAIN || errno == EWOULDBLOCK){
+        return;
+      }
+      if(errno == EINTR || errno == ECONNABORTED){
+        continue;
+      }
+      perror("accept4");
+      return;
+    }
+    Context* context = server_->NewContext(new_sock,tls);
+    if(context == NULL){
+      //连接数到上限，已经返回 503 并且关闭了
+      continue;
+    }
+    context->timer.data = context;
+    context->reactor = true;
+    //读写事件一次性都注册上，ET 模式下只有状态变化时才会通知，不会忙等
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = context;
+    if(epoll_ctl(epoll_fd_,EPOLL_CTL_ADD,new_sock,&ev) < 0){
+      perror("epoll_ctl");
+      server_->DeleteContext(context);
+      continue;
+    }
+    UpdateTimer(context);
+  }
+}
+
+int EpollReactor::HandleRead(Context* context){
+  //ET 模式下必须把数据一次读完，否则不会再收到通知
+  //积压的数据超过一个请求允许的最大长度就先不读了，等缓冲区中的请求处理完再继续
+  const ParserLimits& limits = server_->config_.limits;
+  size_t max_pending = limits.max_header_size + limits.max_body_size;
+  context->read_paused = false;
+  while(1){
+    if(context->read_buf.ReadableBytes() >= max_pending){
+      context->read_paused = true;
+      return 0;
+    }
+    ssize_t read_size = server_->ReadSocket(context);
+    if(read_size > 0){
+      continue;
+    }
+    if(read_size == 0){
+      context->peer_closed = true;
+      return 0;
+    }
+    if(errno == EINTR){
+      continue;
+    }
+    if(errno == EAGAIN || errno == EWOULDBLOCK){
+      return 0;
+    }
+    return -1;
+  }
+}
+
+void EpollReactor::HandleHandshake(Context* context){
+  int ret = server_->TlsHandshake(context);
+  if(ret < 0){
+    CloseConnection(context);
+    return;
+  }
+  if(ret == 1){
+    UpdateTimer(context);
+    return;
+  }
+  //客户端可能在握手的最后一个报文之后紧接着就发了请求，这次通知已经被握手用掉了，
+  //ET 模式下不会再有通知，需要主动读
+  if(HandleRead(context) < 0){
+    CloseConnection(context);
+    return;
+  }
+  ProcessRequests(context);
+}
+
+void EpollReactor::ProcessRequests(Context* context){
+  while(context->state == STATE_READING){
+    //之前因为积压暂停了读取，ET 模式下不会再有通知，需要主动读
+    if(context->read_paused && HandleRead(context) < 0){
+      CloseConnection(context);
+      return;
+    }
+    //1.尝试解析出一个完整的请求
+    int ret = server_->ParseRequest(context);
+    if(ret == 1){
+      //数据还没到齐，对端却已经关闭了，这个请求永远不会完整了
+      if(context->peer_closed){
+        CloseConnection(context);
+      }else {
+        UpdateTimer(context);
+      }
+      return;
+    }
+    //2.处理请求，构造响应，和 ProcessConnection 中的流程一致
+    server_->BuildResponse(context,ret == 0);
+    //3.序列化之后进入写阶段，能写多少先写多少
+    //  CGI 的响应在处理请求的过程中已经写出去了，客户端接收得慢的话 CGI 暂停，剩下的在 HandleWrite 中继续
+    if(!context->streamed){
+      server_->SerializeResponse(context->resp,&context->write_buf);
+      context->write_pos = 0;
+    }
+    context->state = STATE_WRITING;
+    ret = HandleWrite(context);
+    if(ret < 0){
+      CloseConnection(context);
+      return;
+    }
+    if(ret == 1){
+      //等下一次 EPOLLOUT 再继续写
+      UpdateTimer(context);
+      return;
+    }
+  }
+}
+
+int EpollReactor::HandleWrite(Context* context){
+  int ret = server_->FlushResponse(context);
+  if(ret != 0){
+    //返回1表示发送缓冲区满了，等下一次 EPOLLOUT 再继续写
+    return ret;
+  }
+  //CGI 因为客户端接收得慢暂停了，之前的输出写完之后继续读取 CGI 的输出，
+  //又写不进去的时候 CGI 再次暂停，等下一次 EPOLLOUT；CGI 程序暂时没有输出的时候等它可读
+  if(context->cgi.Active()){
+    ret = server_->ResumeCGI(context);
+    if(ret == 2){
+      return WatchCgi(context);
+    }
+    if(ret != 0){
+      return ret;
+    }
+  }
+  server_->FinishResponse(context);
+  //响应写完了，不保持连接的话就主动关闭
+  if(!context->keep_alive){
+    return -1;
+  }
+  context->Reset();
+  return 0;
+}
+
+int EpollReactor::WatchCgi(Context* context){
+  //边缘触发，ReadOutput 已经把输出读到 EAGAIN 了，body 还没写完的话也已经写到 EAGAIN 了
+  epoll_event ev;
+  ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+  if(context->cgi.Writing()){
+    ev.events |= EPOLLOUT;
+  }
+  ev.data.u64 = reinterpret_cast<uint64_t>(context) | kCgiTag;
+  if(epoll_ctl(epoll_fd_,EPOLL_CTL_ADD,context->cgi.fd,&ev) < 0){
+    perror("epoll_ctl");
+    return -1;
+  }
+  ++cgi_watches_;
+  context->state = STATE_CGI;
+  return 1;
+}
+
+void EpollReactor::UnwatchCgi(Context* context){
+  //常驻的工作进程用完之后会交给别的连接，必须在 CGI 请求结束之前注销
+  epoll_ctl(epoll_fd_,EPOLL_CTL_DEL,context->cgi.fd,NULL);
+  --cgi_watches_;
+  context->state = STATE_WRITING;
+}
+
+void EpollReactor::HandleCgi(Context* context){
+  if(context->state != STATE_CGI){
+    return;
+  }
+  UnwatchCgi(context);
+  int ret = HandleWrite(context);
+  if(ret < 0){
+    CloseConnection(context);
+    return;
+  }
+  if(ret == 1){
+    UpdateTimer(context);
+    return;
+  }
+  //响应写完了，流水线发送过来的后续请求可能已经在 read_buf 中了
+  ProcessRequests(context);
+}
+
+void EpollReactor::UpdateTimer(Context* context){
+  TimeoutPhase phase = server_->GetTimeoutPhase(context);
+  timers_.Add(&context->timer,server_->Deadline(context,phase,TimeUtil::MonotonicMS()));
+}
+
+void EpollReactor::OnTimeout(TimerNode* node){
+  Context* context = reinterpret_cast<Context*>(node->data);
+  if(context->state == STATE_CGI){
+    //CGI 程序超时，连接本身没有问题，返回 504 或者结束已经开始的响应
+    UnwatchCgi(context);
+    int ret = server_->TimeoutCGI(context);
+    if(ret == 0){
+      ret = HandleWrite(context);
+    }
+    if(ret < 0){
+      CloseConnection(context);
+    }else if(ret == 1){
+      UpdateTimer(context);
+    }else {
+      ProcessRequests(context);
+    }
+    return;
+  }
+  server_->OnTimeout(context,server_->GetTimeoutPhase(context));
+  CloseConnection(context);
+}
+
+void EpollReactor::CloseConnection(Context* context){
+  //close 会自动把 socket 从 epoll 中删除，CGI 的文件描述符还要给别的连接用，需要主动注销
+  if(context->state == STATE_CGI){
+    UnwatchCgi(context);
+  }
+  //连接 socket 和 CGI 的事件可能在同一批中，后面还没处理的那个事件不能再用这个 Context
+  if(events_ != NULL){
+    for(int i = event_index_ + 1;i < event_count_;++i){
+      if((events_[i].data.u64 & ~kCgiTag) == reinterpret_cast<uint64_t>(context)){
+        events_[i].data.u64 = kCgiTag;
+      }
+    }
+  }
+  timers_.Cancel(&context->timer);
+  server_->DeleteContext(context);
+}
+
+}//end of http_server
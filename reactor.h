@@ -0,0 +1,65 @@
+#pragma once
+//基于 epoll 边缘触发(ET)实现的反应堆
+//整个服务器只有一个线程，监听 socket 和所有连接 socket 都设置成非阻塞的，
+//每个连接对应一个 Context，Context 中的 state 字段记录了连接处于哪个阶段：
+//  读请求(STATE_READING) -> HandlerRequest -> 写响应(STATE_WRITING) -> 读下一个请求/关闭
+//HTTPS 连接在读请求之前还有一个握手阶段(STATE_HANDSHAKE)
+//CGI 的输出边读边转发，客户端接收得慢的时候 CGI 暂停，连接停在写阶段等 EPOLLOUT，
+//CGI 程序暂时没有输出的时候把 CGI 的文件描述符也注册到 epoll 上(STATE_CGI)，都不会阻塞这个线程
+//这样就不需要为每个连接创建线程了
+#include <stdint.h>
+#include "timer_wheel.hpp"
+
+struct epoll_event;
+
+namespace http_server{
+
+class HttpServer;
+struct Context;
+
+class EpollReactor{
+public:
+  //tls_sock 是 HTTPS 的监听 socket，两个都可以为-1表示没有
+  EpollReactor(HttpServer* server,int listen_sock,int tls_sock = -1);
+  ~EpollReactor();
+  //事件循环，正常情况下不会返回，返回小于0表示出错
+  int Run();
+private:
+  //监听 socket 就绪，ET 模式下需要一直 accept 到 EAGAIN 为止
+  void HandleAccept(int listen_sock,bool tls);
+  //连接 socket 可读，一直读到 EAGAIN，把数据追加到 read_buf 中，返回小于0表示出错
+  int HandleRead(Context* context);
+  //推进 HTTPS 连接的握手，完成之后接着读请求
+  void HandleHandshake(Context* context);
+  //依次处理 read_buf 中已经完整的请求(客户端可能流水线发送了多个请求)
+  void ProcessRequests(Context* context);
+  //把 write_buf 中剩下的数据写出去，暂停的 CGI 接着转发，
+  //返回0表示写完，返回1表示发送缓冲区满或者在等 CGI 的输出，返回小于0表示出错
+  int HandleWrite(Context* context);
+  //CGI 程序暂时没有输出，注册 CGI 的文件描述符，连接进入 STATE_CGI，返回1，出错返回小于0
+  int WatchCgi(Context* context);
+  //注销 CGI 的文件描述符，连接回到写阶段
+  void UnwatchCgi(Context* context);
+  //CGI 的文件描述符可读(或者 body 可以继续写)了，继续转发
+  void HandleCgi(Context* context);
+  //连接有了进展(读到数据、写出数据、进入下一个阶段)之后按照当前阶段重新设置超时
+  void UpdateTimer(Context* context);
+  //定时器到期，连接在当前阶段超时了
+  void OnTimeout(TimerNode* node);
+  void CloseConnection(Context* context);
+
+  HttpServer* server_;
+  int listen_sock_;
+  int tls_listen_sock_;
+  int epoll_fd_;
+  //正在处理的这一批事件，关闭连接的时候把同一个连接后面的事件作废；没有 CGI 事件的时候为 NULL
+  epoll_event* events_;
+  int event_index_;
+  int event_count_;
+  size_t cgi_watches_; //注册在 epoll 上的 CGI 文件描述符个数
+  //所有连接的超时，不需要每秒遍历一遍所有连接
+  TimerWheel timers_;
+};
+
+}//end of http_server
+
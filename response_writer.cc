@@ -0,0 +1,170 @@
+#include "response_writer.h"
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+
+namespace http_server{
+
+struct StatusEntry{
+  int code;
+  const char* reason;
+  const char* line;
+};
+
+//首行中的描述和单独的描述各写一份，查找的时候不用再拼接
+#define STATUS_ENTRY(code,reason) {code,reason,"HTTP/1.1 " #code " " reason "\r\n"}
+static const StatusEntry kStatusEntries[] = {
+  STATUS_ENTRY(100,"Continue"),
+  STATUS_ENTRY(101,"Switching Protocols"),
+  STATUS_ENTRY(200,"OK"),
+  STATUS_ENTRY(201,"Created"),
+  STATUS_ENTRY(202,"Accepted"),
+  STATUS_ENTRY(204,"No Content"),
+  STATUS_ENTRY(206,"Partial Content"),
+  STATUS_ENTRY(301,"Moved Permanently"),
+  STATUS_ENTRY(302,"Found"),
+  STATUS_ENTRY(303,"See Other"),
+  STATUS_ENTRY(304,"Not Modified"),
+  STATUS_ENTRY(307,"Temporary Redirect"),
+  STATUS_ENTRY(308,"Permanent Redirect"),
+  STATUS_ENTRY(400,"Bad Request"),
+  STATUS_ENTRY(401,"Unauthorized"),
+  STATUS_ENTRY(403,"Forbidden"),
+  STATUS_ENTRY(404,"Not Found"),
+  STATUS_ENTRY(405,"Method Not Allowed"),
+  STATUS_ENTRY(408,"Request Timeout"),
+  STATUS_ENTRY(411,"Length Required"),
+  STATUS_ENTRY(412,"Precondition Failed"),
+  STATUS_ENTRY(413,"Payload Too Large"),
+  STATUS_ENTRY(414,"URI Too Long"),
+  STATUS_ENTRY(415,"Unsupported Media Type"),
+  STATUS_ENTRY(416,"Range Not Satisfiable"),
+  STATUS_ENTRY(429,"Too Many Requests"),
+  STATUS_ENTRY(431,"Request Header Fields Too Large"),
+  STATUS_ENTRY(500,"Internal Server Error"),
+  STATUS_ENTRY(501,"Not Implemented"),
+  STATUS_ENTRY(502,"Bad Gateway"),
+  STATUS_ENTRY(503,"Service Unavailable"),
+  STATUS_ENTRY(504,"Gateway Timeout"),
+  STATUS_ENTRY(505,"HTTP Version Not Supported"),
+};
+#undef STATUS_ENTRY
+
+//按状态码直接下标访问，第一次使用的时候建立(函数内的静态变量初始化是线程安全的)
+static const StatusEntry* FindStatus(int code){
+  struct Table{
+    const StatusEntry* entries[600];
+    Table(){
+      memset(entries,0,sizeof(entries));
+      for(size_t i = 0;i < sizeof(kStatusEntries) / sizeof(kStatusEntries[0]);++i){
+        entries[kStatusEntries[i].code] = &kStatusEntries[i];
+      }
+    }
+  };
+  static const Table table;
+  return code >= 0 && code < 600 ? table.entries[code] : NULL;
+}
+
+//和 HeaderId 的顺序一致
+static const char* const kHeaderPrefixes[] = {
+  "",
+  "Accept: ","Accept-Encoding: ","Accept-Language: ","Accept-Ranges: ","Authorization: ",
+  "Cache-Control: ","Connection: ","Content-Encoding: ","Content-Length: ","Content-Range: ",
+  "Content-Type: ","Cookie: ","Date: ","ETag: ","Expect: ","Host: ","If-Modified-Since: ",
+  "If-None-Match: ","If-Range: ","Keep-Alive: ","Last-Modified: ","Location: ","Range: ",
+  "Referer: ","Server: ","Set-Cookie: ","Transfer-Encoding: ","Upgrade: ","User-Agent: ","Vary: ",
+};
+static_assert(sizeof(kHeaderPrefixes) / sizeof(kHeaderPrefixes[0]) == HEADER_NUM,
+              "kHeaderPrefixes does not match HeaderId");
+
+const char* ResponseWriter::ReasonPhrase(int code){
+  const StatusEntry* entry = FindStatus(code);
+  return entry == NULL ? NULL : entry->reason;
+}
+
+StringView ResponseWriter::StatusLine(int code){
+  const StatusEntry* entry = FindStatus(code);
+  return entry == NULL ? StringView() : StringView(entry->line);
+}
+
+StringView ResponseWriter::DateLine(){
+  static thread_local time_t cached_time = -1;
+  static thread_local char line[64];
+  static thread_local size_t size = 0;
+  time_t now = time(NULL);
+  if(now != cached_time){
+    struct tm tm;
+    gmtime_r(&now,&tm);
+    size = strftime(line,sizeof(line),"Date: %a, %d %b %Y %H:%M:%S GMT\r\n",&tm);
+    cached_time = now;
+  }
+  return StringView(line,size);
+}
+
+StringView ResponseWriter::HeaderPrefix(HeaderId id){
+  return StringView(kHeaderPrefixes[id]);
+}
+
+void ResponseWriter::AppendUint(uint64_t value,std::string* output){
+  char buf[24];
+  char* p = buf + sizeof(buf);
+  do{
+    *--p = static_cast<char>('0' + value % 10);
+    value /= 10;
+  }while(value != 0);
+  output->append(p,buf + sizeof(buf) - p);
+}
+
+static void Append(StringView data,std::string* output){
+  output->append(data.data(),data.size());
+}
+
+void ResponseWriter::SerializeHeader(const Response& resp,std::string* output){
+  //描述为空或者就是标准描述的时候直接用预先编码好的首行，CGI 可能通过 Status 给出自己的描述
+  const StatusEntry* entry = FindStatus(resp.code);
+  if(entry != NULL && (resp.desc.empty() || HeaderNameEqual(resp.desc,entry->reason))){
+    output->append(entry->line);
+  }else {
+    output->append("HTTP/1.1 ");
+    AppendUint(resp.code,output);
+    output->push_back(' ');
+    output->append(resp.desc);
+    output->append("\r\n");
+  }
+  Append(DateLine(),output);
+  //CGI 的响应也会带上服务器自己加的 header(例如 Connection)
+  for(const auto& item : resp.header){
+    if(item.id != HEADER_OTHER){
+      output->append(kHeaderPrefixes[item.id]);
+    }else {
+      output->append(item.name);
+      output->append(": ");
+    }
+    output->append(item.value);
+    output->append("\r\n");
+  }
+  output->append(resp.header_lines);
+  //header和body之间还有一个空行
+  output->append("\r\n");
+}
+
+ssize_t ResponseWriter::WriteV(int fd,const iovec* iov,int iovcnt,bool more){
+  msghdr msg;
+  memset(&msg,0,sizeof(msg));
+  msg.msg_iov = const_cast<iovec*>(iov);
+  msg.msg_iovlen = iovcnt;
+  //MSG_NOSIGNAL：对端已经关闭的时候返回 EPIPE，而不是产生 SIGPIPE
+  //MSG_DONTWAIT：io_uring 模式下的 socket 是阻塞的，这里同样不能等待，发送缓冲区满了就返回
+  int flags = MSG_NOSIGNAL | MSG_DONTWAIT | (more ? MSG_MORE : 0);
+  ssize_t write_size = 0;
+  do{
+    write_size = sendmsg(fd,&msg,flags);
+  }while(write_size < 0 && errno == EINTR);
+  if(write_size < 0){
+    return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+  }
+  return write_size;
+}
+
+}//end of http_server
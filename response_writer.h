@@ -0,0 +1,38 @@
+#pragma once
+//把 Response 序列化成响应首行和 header，以及把 header 和 body 一起写到 socket
+//常见状态码的首行、常用 header 的名字都预先编码好，Date 头部每秒只格式化一次，
+//序列化的时候只有 memcpy，不再经过 stringstream
+//header 和 body 通过一次 sendmsg(分散/聚集 IO)发出去，小响应只占一个 TCP 报文，
+//不会因为 Nagle 算法和客户端的延迟确认等待几十毫秒
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <string>
+#include "http_message.h"
+
+namespace http_server{
+
+class ResponseWriter{
+public:
+  //状态码的标准描述，例如 404 返回 "Not Found"，不认识的状态码返回 NULL
+  static const char* ReasonPhrase(int code);
+  //预先编码好的首行，例如 "HTTP/1.1 200 OK\r\n"，不认识的状态码返回空
+  static StringView StatusLine(int code);
+  //"Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n"，每个线程缓存一份，秒数变化的时候才重新格式化
+  static StringView DateLine();
+  //常用 header 的 "名字: "，例如 HEADER_CONTENT_LENGTH 返回 "Content-Length: "
+  static StringView HeaderPrefix(HeaderId id);
+  //十进制整数追加到 output 中
+  static void AppendUint(uint64_t value,std::string* output);
+
+  //首行 + Date + resp.header + resp.header_lines + 空行追加到 output 中，body 不包含在内
+  //output 是连接上复用的缓冲区，容量够的时候不会分配内存
+  static void SerializeHeader(const Response& resp,std::string* output);
+
+  //把 iov 中的数据用一次 sendmsg 写出去，可能只写出去一部分
+  //more 为 true 表示后面还有数据(例如 sendfile 的文件内容)，内核先攒着不单独发一个小报文
+  //不管 socket 是不是阻塞的都不会等待，返回写出去的字节数，返回0表示发送缓冲区满了，返回小于0表示出错
+  static ssize_t WriteV(int fd,const iovec* iov,int iovcnt,bool more);
+};
+
+}//end of http_server
@@ -0,0 +1,236 @@
+#include "router.h"
+#include "scan.hpp"
+#include "util.hpp"
+#include <stdlib.h>
+#include <string.h>
+
+namespace http_server{
+
+//和 MethodBit 的顺序一致
+static const char* const kMethodNames[] = {
+  "GET","HEAD","POST","PUT","DELETE","OPTIONS","PATCH",
+};
+static const int kMethodNum = sizeof(kMethodNames) / sizeof(kMethodNames[0]);
+
+//查找的时候最多记录路径上的这么多个挂着路由的节点，再多的话只保留最长的这些
+static const int kMaxMatched = 16;
+
+int RouteConfig::Parse(const std::string& spec,RouteConfig* config){
+  size_t eq = spec.find('=');
+  size_t colon = spec.find(':',eq);
+  if(eq == std::string::npos || eq == 0 || colon == std::string::npos){
+    return -1;
+  }
+  config->prefix = spec.substr(0,eq);
+  std::string type = spec.substr(eq + 1,colon - eq - 1);
+  std::string target = spec.substr(colon + 1);
+  //最后一个 @ 之后是允许的方法
+  config->methods = 0;
+  size_t at = target.rfind('@');
+  if(at != std::string::npos){
+    std::vector<std::string> names;
+    StringUtil::Split(target.substr(at + 1),",",&names);
+    for(size_t i = 0;i < names.size();++i){
+      unsigned bit = Router::MethodBit(names[i]);
+      if(bit == 0){
+        return -1;
+      }
+      config->methods |= bit;
+    }
+    target.resize(at);
+  }
+  if(type == "static"){
+    config->type = ROUTE_STATIC;
+  }else if(type == "cgi"){
+    config->type = ROUTE_CGI;
+  }else if(type == "native"){
+    config->type = ROUTE_NATIVE;
+  }else if(type == "stats"){
+    config->type = ROUTE_STATS;
+  }else if(type == "redirect"){
+    config->type = ROUTE_REDIRECT;
+    //可以在 Location 之前给出状态码，例如 302:/new/
+    config->redirect_code = 301;
+    if(target.size() > 4 && target[3] == ':'){
+      int code = atoi(target.substr(0,3).c_str());
+      if(code != 301 && code != 302 && code != 303 && code != 307 && code != 308){
+        return -1;
+      }
+      config->redirect_code = code;
+      target.erase(0,4);
+    }
+  }else {
+    return -1;
+  }
+  config->target = target;
+  return target.empty() && config->type != ROUTE_STATS ? -1 : 0;
+}
+
+Router::Router(){
+}
+
+Router::~Router(){
+}
+
+unsigned Router::MethodBit(StringView method){
+  for(int i = 0;i < kMethodNum;++i){
+    if(method == kMethodNames[i]){
+      return 1u << i;
+    }
+  }
+  return 0;
+}
+
+std::string Router::MethodNames(unsigned methods){
+  std::string result;
+  for(int i = 0;i < kMethodNum;++i){
+    if(methods & (1u << i)){
+      if(!result.empty()){
+        result += ", ";
+      }
+      result += kMethodNames[i];
+    }
+  }
+  return result;
+}
+
+unsigned Router::DefaultMethods(RouteType type){
+  switch(type){
+    case ROUTE_STATIC:
+    case ROUTE_STATS:
+      return METHOD_GET;
+    case ROUTE_CGI:
+      return METHOD_GET | METHOD_POST;
+    default:
+      return METHOD_ALL;
+  }
+}
+
+int Router::Add(const RouteConfig& config,HttpHandler* handler){
+  //前缀和请求的路径用同样的规则规范化，/img//a/ 和 /img/a/ 是同一个前缀
+  std::string prefix(config.prefix.size(),'\0');
+  size_t size = 0;
+  if(config.prefix.empty() || config.prefix[0] != '/'
+     || ScanUtil::NormalizePath(config.prefix.data(),config.prefix.size(),&prefix[0],&size) < 0){
+    LOG(ERROR) << "Invalid route prefix! prefix=" << config.prefix << "\n";
+    return -1;
+  }
+  prefix.resize(size);
+  std::unique_ptr<Route> route(new Route());
+  static_cast<RouteConfig&>(*route) = config;
+  route->prefix = prefix;
+  route->handler = handler;
+  if(route->methods == 0){
+    route->methods = DefaultMethods(route->type);
+  }
+  Node* node = Insert(prefix);
+  for(size_t i = 0;i < node->routes.size();++i){
+    const Route* other = node->routes[i];
+    if(other->exact == route->exact && (other->methods & route->methods) != 0){
+      LOG(ERROR) << "Duplicate route! prefix=" << prefix
+        << " methods=" << MethodNames(other->methods & route->methods) << "\n";
+      return -1;
+    }
+  }
+  node->routes.push_back(route.get());
+  routes_.push_back(std::move(route));
+  return 0;
+}
+
+Router::Node* Router::Insert(const std::string& prefix){
+  Node* node = &root_;
+  size_t pos = 0;
+  while(pos < prefix.size()){
+    size_t index = 0;
+    while(index < node->children.size() && node->children[index]->label[0] != prefix[pos]){
+      ++index;
+    }
+    if(index == node->children.size()){
+      //没有共同前缀的边，剩下的部分整个作为一条新边
+      std::unique_ptr<Node> child(new Node());
+      child->label = prefix.substr(pos);
+      node->children.push_back(std::move(child));
+      return node->children.back().get();
+    }
+    Node* child = node->children[index].get();
+    size_t n = 0;
+    while(n < child->label.size() && pos + n < prefix.size() && child->label[n] == prefix[pos + n]){
+      ++n;
+    }
+    if(n < child->label.size()){
+      //只有边的前 n 个字节相同，把这条边拆成两段，中间插入一个节点
+      std::unique_ptr<Node> middle(new Node());
+      middle->label = child->label.substr(0,n);
+      child->label.erase(0,n);
+      middle->children.push_back(std::move(node->children[index]));
+      node->children[index] = std::move(middle);
+      child = node->children[index].get();
+    }
+    node = child;
+    pos += n;
+  }
+  return node;
+}
+
+int Router::Match(StringView method,StringView path,RouteMatch* match) const{
+  //1.沿着路径往下走，记录经过的挂着路由的节点
+  const Node* matched[kMaxMatched];
+  size_t matched_pos[kMaxMatched];
+  int count = 0;
+  const Node* node = &root_;
+  size_t pos = 0;
+  while(true){
+    //前缀要在路径段的边界上结束：前缀以 / 结尾，或者路径到这里结束，或者下一个字符是 /
+    if(!node->routes.empty()
+       && ((pos > 0 && path[pos - 1] == '/') || pos == path.size() || path[pos] == '/')){
+      if(count == kMaxMatched){
+        memmove(matched,matched + 1,sizeof(matched[0]) * (kMaxMatched - 1));
+        memmove(matched_pos,matched_pos + 1,sizeof(matched_pos[0]) * (kMaxMatched - 1));
+        --count;
+      }
+      matched[count] = node;
+      matched_pos[count] = pos;
+      ++count;
+    }
+    if(pos == path.size()){
+      break;
+    }
+    const Node* next = NULL;
+    for(size_t i = 0;i < node->children.size();++i){
+      if(node->children[i]->label[0] == path[pos]){
+        next = node->children[i].get();
+        break;
+      }
+    }
+    if(next == NULL || path.size() - pos < next->label.size()
+       || memcmp(path.data() + pos,next->label.data(),next->label.size()) != 0){
+      break;
+    }
+    node = next;
+    pos += next->label.size();
+  }
+  //2.从最长的前缀开始找允许这个方法的路由
+  unsigned bit = MethodBit(method);
+  unsigned allowed = 0;
+  for(int i = count - 1;i >= 0;--i){
+    const std::vector<const Route*>& routes = matched[i]->routes;
+    for(size_t j = 0;j < routes.size();++j){
+      const Route* route = routes[j];
+      if(route->exact && matched_pos[i] != path.size()){
+        continue;
+      }
+      allowed |= route->methods;
+      if(route->methods & bit){
+        match->route = route;
+        match->rest = path.substr(matched_pos[i]);
+        match->allowed = route->methods;
+        return 0;
+      }
+    }
+  }
+  match->route = NULL;
+  match->allowed = allowed;
+  return allowed == 0 ? -1 : 1;
+}
+
+}//end of http_server
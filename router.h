@@ -0,0 +1,100 @@
+#pragma once
+//路由表：根据 url 路径前缀和请求方法决定由谁处理请求
+//启动的时候把配置的所有路由编译成一棵基数树(radix tree)，查找的时候沿着路径逐段比较边上的字符串，
+//开销只和路径的长度有关，和路由的条数无关。同一个前缀可以按照方法挂多条路由，
+//路径匹配的多条路由中最长的、并且允许这个方法的那一条生效；都不允许的时候返回 405。
+//前缀按路径段匹配：/img 匹配 /img 和 /img/a.png，不匹配 /imgs；以 / 结尾的前缀 /img/ 只匹配 /img/ 下面的路径。
+//请求的路径在解析的时候已经规范化(见 ScanUtil::NormalizePath)，配置的前缀在编译的时候也做同样的处理
+//路由表在开始接受连接之前建好，之后只读，查找的时候不需要加锁
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "http_message.h"
+
+namespace http_server{
+
+class HttpHandler;
+
+enum RouteType{
+  ROUTE_STATIC,   //静态文件，target 是根目录
+  ROUTE_CGI,      //CGI 程序，target 是程序的路径，前缀之后的部分作为 PATH_INFO
+  ROUTE_NATIVE,   //插件注册的处理函数，target 是插件注册时使用的路径
+  ROUTE_REDIRECT, //重定向，target 加上前缀之后的部分作为 Location
+  ROUTE_STATS,    //服务器自己的统计信息
+};
+
+//请求方法的位掩码
+enum MethodBit{
+  METHOD_GET = 1 << 0,
+  METHOD_HEAD = 1 << 1,
+  METHOD_POST = 1 << 2,
+  METHOD_PUT = 1 << 3,
+  METHOD_DELETE = 1 << 4,
+  METHOD_OPTIONS = 1 << 5,
+  METHOD_PATCH = 1 << 6,
+  METHOD_ALL = (1 << 7) - 1,
+};
+
+struct RouteConfig{
+  std::string prefix;
+  RouteType type;
+  std::string target;
+  unsigned methods; //允许的方法，0表示使用这种路由默认的方法
+  int redirect_code; //重定向使用的状态码
+  bool exact; //只匹配和前缀完全一样的路径
+  RouteConfig():type(ROUTE_STATIC),methods(0),redirect_code(301),exact(false){}
+  RouteConfig(const std::string& p,RouteType t,const std::string& tg)
+    :prefix(p),type(t),target(tg),methods(0),redirect_code(301),exact(false){}
+  //解析命令行中的一条路由，格式是 PREFIX=TYPE:TARGET[@METHOD,METHOD...]，例如
+  //  /=static:./wwwroot  /add=cgi:./wwwroot/add@GET,POST  /old/=redirect:302:/new/  /calc=native:/plugin/add
+  //返回0表示成功，返回小于0表示格式不对
+  static int Parse(const std::string& spec,RouteConfig* config);
+};
+
+struct Route : public RouteConfig{
+  HttpHandler* handler; //ROUTE_NATIVE 对应的处理函数
+  Route():handler(NULL){}
+};
+
+struct RouteMatch{
+  const Route* route;
+  StringView rest; //路径中前缀之后的部分，以 / 结尾的前缀不包含这个 /
+  unsigned allowed; //路径匹配的所有路由允许的方法，返回 405 的时候放在 Allow 中
+  RouteMatch():route(NULL),allowed(0){}
+};
+
+class Router{
+public:
+  Router();
+  ~Router();
+  //添加一条路由，ROUTE_NATIVE 需要给出 handler
+  //前缀不是以 / 开头、包含 .. 或者和已有的路由前缀相同并且方法有重叠的时候返回小于0
+  int Add(const RouteConfig& config,HttpHandler* handler = NULL);
+  //返回0表示找到了，返回1表示路径匹配但是方法都不允许(match->allowed 是允许的方法)，返回-1表示没有匹配的路由
+  int Match(StringView method,StringView path,RouteMatch* match) const;
+  size_t Size() const{
+    return routes_.size();
+  }
+
+  static unsigned MethodBit(StringView method);
+  //Allow 头部的值，例如 "GET, POST"
+  static std::string MethodNames(unsigned methods);
+  //RouteConfig::methods 为0的时候使用的方法
+  static unsigned DefaultMethods(RouteType type);
+private:
+  Router(const Router&);
+  Router& operator=(const Router&);
+
+  struct Node{
+    std::string label; //从父节点到这个节点的边上的字符串
+    std::vector<std::unique_ptr<Node> > children; //按照 label 的第一个字节区分，最多256个
+    std::vector<const Route*> routes; //前缀正好到这个节点为止的路由
+  };
+  Node* Insert(const std::string& prefix);
+
+  Node root_;
+  std::vector<std::unique_ptr<Route> > routes_;
+};
+
+}//end of http_server
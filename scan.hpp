@@ -0,0 +1,296 @@
+///////////////////////////////////////
+//解析请求时用到的字符扫描和 URL 解码
+//查找分隔符(& = % + 等)和检查 URL 中的非法字节有三种实现：AVX2 一次处理32个字节，
+//SSE4.2 一次处理16个字节，以及逐个字节的普通实现。第一次使用的时候根据 CPU 支持的指令集选择，
+//编译的时候不需要加 -mavx2，只有被选中的函数才会执行这些指令
+//和 util.hpp 一样，声明和实现都放在 .hpp 中
+///////////////////////////////////////
+#pragma once
+#include <stddef.h>
+#include <string.h>
+#include <string>
+#include <boost/utility/string_view.hpp>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define SCAN_HAVE_X86 1
+#endif
+
+class ScanUtil{
+public:
+  enum Level{
+    LEVEL_SCALAR = 0,
+    LEVEL_SSE42,
+    LEVEL_AVX2,
+  };
+
+  //当前 CPU 支持的最高级别
+  static int DetectLevel(){
+#ifdef SCAN_HAVE_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+      return LEVEL_AVX2;
+    }
+    if(__builtin_cpu_supports("sse4.2")){
+      return LEVEL_SSE42;
+    }
+#endif
+    return LEVEL_SCALAR;
+  }
+  static int GetLevel(){
+    return CurrentLevel();
+  }
+  //指定使用哪一种实现，超过 CPU 支持的级别时使用支持的最高级别，基准测试中用来比较不同的实现
+  static void SetLevel(int level){
+    int max = DetectLevel();
+    CurrentLevel() = level > max ? max : level;
+  }
+  static const char* LevelName(int level){
+    switch(level){
+      case LEVEL_AVX2: return "avx2";
+      case LEVEL_SSE42: return "sse42";
+      default: return "scalar";
+    }
+  }
+
+  //在 [begin,end) 中查找第一个属于 chars 的字符，chars 中有 n 个字符，找不到返回 end
+  static const char* FindAny(const char* begin,const char* end,const char* chars,size_t n){
+#ifdef SCAN_HAVE_X86
+    //指令一次最多比较16个候选字符
+    if(n <= 16){
+      int level = CurrentLevel();
+      if(level == LEVEL_AVX2){
+        return FindAnyAvx2(begin,end,chars,n);
+      }
+      if(level == LEVEL_SSE42){
+        return FindAnySse42(begin,end,chars,n);
+      }
+    }
+#endif
+    return FindAnyScalar(begin,end,chars,n);
+  }
+  //只找一个字符的时候直接用 memchr，glibc 本身就会按照 CPU 选择 SSE2/AVX2 的实现
+  static const char* FindChar(const char* begin,const char* end,char c){
+    const void* pos = memchr(begin,c,end - begin);
+    return pos == NULL ? end : static_cast<const char*>(pos);
+  }
+
+  //URL 中只能出现可见的 ASCII 字符，其他字符(空格、控制字符、DEL 以及 0x80 以上的字节)必须经过百分号编码
+  //返回第一个非法字节的位置，全部合法返回 end
+  static const char* FindInvalidUrlByte(const char* begin,const char* end){
+#ifdef SCAN_HAVE_X86
+    int level = CurrentLevel();
+    if(level == LEVEL_AVX2){
+      return FindInvalidUrlByteAvx2(begin,end);
+    }
+    if(level == LEVEL_SSE42){
+      return FindInvalidUrlByteSse2(begin,end);
+    }
+#endif
+    return FindInvalidUrlByteScalar(begin,end);
+  }
+
+  //百分号解码，%XX 还原成一个字节，plus_as_space 为 true 的时候 + 还原成空格(query_string 和表单)
+  //output 至少要有 size 个字节的空间，解码后的长度写到 output_size
+  //返回0表示成功，返回小于0表示 % 后面不是两个十六进制数字，或者解码出 \0
+  static int PercentDecode(const char* data,size_t size,bool plus_as_space,
+                           char* output,size_t* output_size){
+    const char* p = data;
+    const char* end = data + size;
+    char* out = output;
+    const char* special = plus_as_space ? "%+" : "%";
+    size_t special_size = plus_as_space ? 2 : 1;
+    while(true){
+      //两个需要转换的字符之间的数据整段复制
+      const char* q = FindAny(p,end,special,special_size);
+      memcpy(out,p,q - p);
+      out += q - p;
+      if(q == end){
+        break;
+      }
+      if(*q == '+'){
+        *out++ = ' ';
+        p = q + 1;
+        continue;
+      }
+      int high = end - q < 3 ? -1 : HexValue(q[1]);
+      int low = end - q < 3 ? -1 : HexValue(q[2]);
+      if(high < 0 || low < 0 || (high == 0 && low == 0)){
+        return -1;
+      }
+      *out++ = static_cast<char>(high * 16 + low);
+      p = q + 3;
+    }
+    *output_size = out - output;
+    return 0;
+  }
+  static int PercentDecode(boost::string_view input,bool plus_as_space,std::string* output){
+    output->resize(input.size());
+    size_t size = 0;
+    if(input.empty() || PercentDecode(input.data(),input.size(),plus_as_space,&(*output)[0],&size) < 0){
+      output->clear();
+      return input.empty() ? 0 : -1;
+    }
+    output->resize(size);
+    return 0;
+  }
+
+  //路径是不是需要规范化：有连续的 /，或者有 . 开头的路径段
+  static bool NeedNormalize(const char* data,size_t size){
+    boost::string_view path(data,size);
+    return path.find("//") != boost::string_view::npos || path.find("/.") != boost::string_view::npos
+      || (size > 0 && data[0] == '.');
+  }
+  //规范化解码之后的路径：连续的 / 合并成一个，去掉 . 路径段，以 / 或者 /. 结尾的保留结尾的 /
+  //.. 路径段直接返回-1，不做回退，请求访问不到根目录之外的文件
+  //output 至少要有 size 个字节，结果不会比输入长
+  static int NormalizePath(const char* data,size_t size,char* output,size_t* output_size){
+    const char* p = data;
+    const char* end = data + size;
+    char* out = output;
+    if(p < end && *p == '/'){
+      *out++ = '/';
+    }
+    bool trailing_slash = false;
+    while(p < end){
+      while(p < end && *p == '/'){
+        ++p;
+        trailing_slash = true;
+      }
+      if(p == end){
+        break;
+      }
+      const char* q = FindChar(p,end,'/');
+      size_t len = q - p;
+      if(len == 2 && p[0] == '.' && p[1] == '.'){
+        return -1;
+      }
+      //. 路径段直接跳过，后面没有别的路径段的话相当于以 / 结尾
+      trailing_slash = len == 1 && p[0] == '.';
+      if(!trailing_slash){
+        if(out > output && out[-1] != '/'){
+          *out++ = '/';
+        }
+        memcpy(out,p,len);
+        out += len;
+      }
+      p = q;
+    }
+    if(trailing_slash && out > output && out[-1] != '/'){
+      *out++ = '/';
+    }
+    *output_size = out - output;
+    return 0;
+  }
+
+  static int HexValue(char c){
+    if(c >= '0' && c <= '9'){
+      return c - '0';
+    }
+    if(c >= 'a' && c <= 'f'){
+      return c - 'a' + 10;
+    }
+    if(c >= 'A' && c <= 'F'){
+      return c - 'A' + 10;
+    }
+    return -1;
+  }
+
+  static const char* FindAnyScalar(const char* begin,const char* end,const char* chars,size_t n){
+    for(const char* p = begin;p < end;++p){
+      if(memchr(chars,*p,n) != NULL){
+        return p;
+      }
+    }
+    return end;
+  }
+  static const char* FindInvalidUrlByteScalar(const char* begin,const char* end){
+    for(const char* p = begin;p < end;++p){
+      unsigned char c = static_cast<unsigned char>(*p);
+      if(c <= 0x20 || c >= 0x7f){
+        return p;
+      }
+    }
+    return end;
+  }
+
+#ifdef SCAN_HAVE_X86
+  //PCMPESTRI 一条指令就能在16个字节中找到候选集合中的任意一个字符
+  __attribute__((target("sse4.2")))
+  static const char* FindAnySse42(const char* begin,const char* end,const char* chars,size_t n){
+    char set_bytes[16] = {0};
+    memcpy(set_bytes,chars,n);
+    const __m128i set = _mm_loadu_si128(reinterpret_cast<const __m128i*>(set_bytes));
+    const char* p = begin;
+    for(;end - p >= 16;p += 16){
+      __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      int index = _mm_cmpestri(set,static_cast<int>(n),data,16,
+                               _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+      if(index < 16){
+        return p + index;
+      }
+    }
+    //不足16个字节的尾部逐个比较，不会读到 end 之后的内存
+    return FindAnyScalar(p,end,chars,n);
+  }
+
+  //32个字节和每个候选字符分别比较，结果按位或起来，候选字符通常只有一两个
+  __attribute__((target("avx2")))
+  static const char* FindAnyAvx2(const char* begin,const char* end,const char* chars,size_t n){
+    __m256i sets[16];
+    for(size_t i = 0;i < n;++i){
+      sets[i] = _mm256_set1_epi8(chars[i]);
+    }
+    const char* p = begin;
+    for(;end - p >= 32;p += 32){
+      __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+      __m256i hit = _mm256_cmpeq_epi8(data,sets[0]);
+      for(size_t i = 1;i < n;++i){
+        hit = _mm256_or_si256(hit,_mm256_cmpeq_epi8(data,sets[i]));
+      }
+      unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hit));
+      if(mask != 0){
+        return p + __builtin_ctz(mask);
+      }
+    }
+    return FindAnySse42(p,end,chars,n);
+  }
+
+  //合法字节当作有符号数看是 (0x20,0x7f) 之间，0x80 以上的字节是负数，也不满足
+  static const char* FindInvalidUrlByteSse2(const char* begin,const char* end){
+    const __m128i low = _mm_set1_epi8(0x20);
+    const __m128i high = _mm_set1_epi8(0x7f);
+    const char* p = begin;
+    for(;end - p >= 16;p += 16){
+      __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      __m128i valid = _mm_and_si128(_mm_cmpgt_epi8(data,low),_mm_cmpgt_epi8(high,data));
+      unsigned mask = ~static_cast<unsigned>(_mm_movemask_epi8(valid)) & 0xffff;
+      if(mask != 0){
+        return p + __builtin_ctz(mask);
+      }
+    }
+    return FindInvalidUrlByteScalar(p,end);
+  }
+
+  __attribute__((target("avx2")))
+  static const char* FindInvalidUrlByteAvx2(const char* begin,const char* end){
+    const __m256i low = _mm256_set1_epi8(0x20);
+    const __m256i high = _mm256_set1_epi8(0x7f);
+    const char* p = begin;
+    for(;end - p >= 32;p += 32){
+      __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+      __m256i valid = _mm256_and_si256(_mm256_cmpgt_epi8(data,low),_mm256_cmpgt_epi8(high,data));
+      unsigned mask = ~static_cast<unsigned>(_mm256_movemask_epi8(valid));
+      if(mask != 0){
+        return p + __builtin_ctz(mask);
+      }
+    }
+    return FindInvalidUrlByteSse2(p,end);
+  }
+#endif
+
+private:
+  static int& CurrentLevel(){
+    static int level = DetectLevel();
+    return level;
+  }
+};
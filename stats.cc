@@ -0,0 +1,295 @@
+#include "stats.h"
+#include <stdio.h>
+#include <algorithm>
+#include <sstream>
+
+namespace http_server{
+
+static const char* kStageNames[STAGE_NUM] = {
+  "read","parse","static","cgi","plugin","other","write","request","tls_handshake",
+};
+
+//从 COUNTER_TIMEOUT_IDLE 开始的超时计数
+static const int kTimeoutPhaseNum = COUNTER_TIMEOUT_CGI - COUNTER_TIMEOUT_IDLE + 1;
+static const char* kTimeoutPhaseNames[kTimeoutPhaseNum] = {
+  "idle","header","body","write","cgi",
+};
+
+//从 COUNTER_SHED_CONNECTIONS 开始的过载拒绝计数
+static const int kShedReasonNum = COUNTER_SHED_CGI - COUNTER_SHED_CONNECTIONS + 1;
+static const char* kShedReasonNames[kShedReasonNum] = {
+  "connections","requests","cgi",
+};
+
+//从 COUNTER_TLS_FULL 开始的握手计数
+static const int kHandshakeResultNum = COUNTER_TLS_FAILED - COUNTER_TLS_FULL + 1;
+static const char* kHandshakeResultNames[kHandshakeResultNum] = {
+  "full","resumed","failed",
+};
+
+//Prometheus 直方图的桶边界，单位是秒
+static const double kBucketBounds[] = {
+  0.00001,0.000025,0.00005,0.0001,0.00025,0.0005,0.001,0.0025,0.005,
+  0.01,0.025,0.05,0.1,0.25,0.5,1,2.5,5,10,
+};
+
+void HistogramSnapshot::Merge(const Histogram& histogram){
+  for(int i = 0;i < Histogram::kBuckets;++i){
+    uint64_t n = histogram.counts_[i].Get();
+    counts[i] += n;
+    count += n;
+  }
+  sum += histogram.sum_.Get();
+  max = std::max(max,histogram.max_.Get());
+}
+
+void HistogramSnapshot::Merge(const HistogramSnapshot& other){
+  for(int i = 0;i < Histogram::kBuckets;++i){
+    counts[i] += other.counts[i];
+  }
+  count += other.count;
+  sum += other.sum;
+  max = std::max(max,other.max);
+}
+
+uint64_t HistogramSnapshot::Percentile(double q) const{
+  if(count == 0){
+    return 0;
+  }
+  uint64_t target = static_cast<uint64_t>(q * count);
+  if(target == 0){
+    target = 1;
+  }
+  uint64_t seen = 0;
+  for(int i = 0;i < Histogram::kBuckets;++i){
+    seen += counts[i];
+    if(seen >= target){
+      //最大值所在的桶直接返回最大值，比桶的上界更准确
+      return std::min(Histogram::BucketUpper(i),max);
+    }
+  }
+  return max;
+}
+
+uint64_t HistogramSnapshot::CountBelow(uint64_t value) const{
+  uint64_t result = 0;
+  for(int i = 0;i < Histogram::kBuckets && Histogram::BucketUpper(i) <= value;++i){
+    result += counts[i];
+  }
+  return result;
+}
+
+void StatsSnapshot::Merge(const ThreadStats& stats){
+  for(int i = 0;i < STAGE_NUM;++i){
+    stages[i].Merge(stats.stages[i]);
+  }
+  for(int i = 0;i < COUNTER_NUM;++i){
+    counters[i] += stats.counters[i].Get();
+  }
+  for(int code = 0;code < 600;++code){
+    uint64_t n = stats.status[code].Get();
+    if(n > 0){
+      status[code] += n;
+    }
+  }
+}
+
+void StatsSnapshot::Merge(const StatsSnapshot& other){
+  for(int i = 0;i < STAGE_NUM;++i){
+    stages[i].Merge(other.stages[i]);
+  }
+  for(int i = 0;i < COUNTER_NUM;++i){
+    counters[i] += other.counters[i];
+  }
+  for(auto& item : other.status){
+    status[item.first] += item.second;
+  }
+}
+
+//纳秒转换成秒，Prometheus 中时间的单位统一是秒
+static std::string Seconds(double ns){
+  char buf[64];
+  snprintf(buf,sizeof(buf),"%.9g",ns / 1e9);
+  return buf;
+}
+
+static std::string Micros(double ns){
+  char buf[64];
+  snprintf(buf,sizeof(buf),"%.3f",ns / 1e3);
+  return buf;
+}
+
+std::string StatsSnapshot::ToPrometheus() const{
+  std::stringstream ss;
+  ss << "# HELP http_server_connections_total Accepted connections.\n"
+     << "# TYPE http_server_connections_total counter\n"
+     << "http_server_connections_total " << counters[COUNTER_CONNECTIONS] << "\n"
+     << "# HELP http_server_connections_active Open connections.\n"
+     << "# TYPE http_server_connections_active gauge\n"
+     << "http_server_connections_active "
+     << counters[COUNTER_CONNECTIONS] - counters[COUNTER_CONNECTIONS_CLOSED] << "\n"
+     << "# HELP http_server_requests_total Requests by status code.\n"
+     << "# TYPE http_server_requests_total counter\n";
+  for(auto& item : status){
+    ss << "http_server_requests_total{code=\"" << item.first << "\"} " << item.second << "\n";
+  }
+  ss << "# HELP http_server_received_bytes_total Bytes read from clients.\n"
+     << "# TYPE http_server_received_bytes_total counter\n"
+     << "http_server_received_bytes_total " << counters[COUNTER_BYTES_IN] << "\n"
+     << "# HELP http_server_sent_bytes_total Bytes written to clients.\n"
+     << "# TYPE http_server_sent_bytes_total counter\n"
+     << "http_server_sent_bytes_total " << counters[COUNTER_BYTES_OUT] << "\n"
+     << "# HELP http_server_timeouts_total Connections closed (or CGI requests failed) by a timeout, by phase.\n"
+     << "# TYPE http_server_timeouts_total counter\n";
+  for(int i = 0;i < kTimeoutPhaseNum;++i){
+    ss << "http_server_timeouts_total{phase=\"" << kTimeoutPhaseNames[i] << "\"} "
+       << counters[COUNTER_TIMEOUT_IDLE + i] << "\n";
+  }
+  ss << "# HELP http_server_shed_total Connections and requests rejected with 503, by limit.\n"
+     << "# TYPE http_server_shed_total counter\n";
+  for(int i = 0;i < kShedReasonNum;++i){
+    ss << "http_server_shed_total{reason=\"" << kShedReasonNames[i] << "\"} "
+       << counters[COUNTER_SHED_CONNECTIONS + i] << "\n";
+  }
+  ss << "# HELP http_server_tls_handshakes_total TLS handshakes, by result.\n"
+     << "# TYPE http_server_tls_handshakes_total counter\n";
+  for(int i = 0;i < kHandshakeResultNum;++i){
+    ss << "http_server_tls_handshakes_total{result=\"" << kHandshakeResultNames[i] << "\"} "
+       << counters[COUNTER_TLS_FULL + i] << "\n";
+  }
+  ss << "# HELP http_server_tls_ktls_total TLS connections whose sends were offloaded to the kernel.\n"
+     << "# TYPE http_server_tls_ktls_total counter\n"
+     << "http_server_tls_ktls_total " << counters[COUNTER_TLS_KTLS] << "\n";
+  for(size_t i = 0;i < extra.size();++i){
+    const std::string name = "http_server_" + extra[i].first + "_total";
+    ss << "# TYPE " << name << " counter\n"
+       << name << " " << extra[i].second << "\n";
+  }
+  for(size_t i = 0;i < gauges.size();++i){
+    const std::string name = "http_server_" + gauges[i].first;
+    ss << "# TYPE " << name << " gauge\n"
+       << name << " " << gauges[i].second << "\n";
+  }
+  if(!shards.empty()){
+    ss << "# HELP http_server_shard_connections_total Accepted connections per reuseport shard.\n"
+       << "# TYPE http_server_shard_connections_total counter\n";
+    for(size_t i = 0;i < shards.size();++i){
+      ss << "http_server_shard_connections_total{shard=\"" << shards[i].shard << "\",cpu=\""
+         << shards[i].cpu << "\"} " << shards[i].counters[COUNTER_CONNECTIONS] << "\n";
+    }
+    ss << "# HELP http_server_shard_requests_total Requests per reuseport shard.\n"
+       << "# TYPE http_server_shard_requests_total counter\n";
+    for(size_t i = 0;i < shards.size();++i){
+      ss << "http_server_shard_requests_total{shard=\"" << shards[i].shard << "\",cpu=\""
+         << shards[i].cpu << "\"} " << shards[i].counters[COUNTER_REQUESTS] << "\n";
+    }
+  }
+  ss << "# HELP http_server_stage_duration_seconds Time spent in each processing stage.\n"
+     << "# TYPE http_server_stage_duration_seconds histogram\n";
+  for(int i = 0;i < STAGE_NUM;++i){
+    const HistogramSnapshot& h = stages[i];
+    const std::string label = std::string("stage=\"") + kStageNames[i] + "\"";
+    for(size_t j = 0;j < sizeof(kBucketBounds) / sizeof(kBucketBounds[0]);++j){
+      uint64_t bound = static_cast<uint64_t>(kBucketBounds[j] * 1e9);
+      ss << "http_server_stage_duration_seconds_bucket{" << label
+         << ",le=\"" << kBucketBounds[j] << "\"} " << h.CountBelow(bound) << "\n";
+    }
+    ss << "http_server_stage_duration_seconds_bucket{" << label << ",le=\"+Inf\"} "
+       << h.count << "\n"
+       << "http_server_stage_duration_seconds_sum{" << label << "} " << Seconds(h.sum) << "\n"
+       << "http_server_stage_duration_seconds_count{" << label << "} " << h.count << "\n";
+  }
+  return ss.str();
+}
+
+std::string StatsSnapshot::ToJson() const{
+  std::stringstream ss;
+  ss << "{\"connections\":{\"total\":" << counters[COUNTER_CONNECTIONS]
+     << ",\"active\":" << counters[COUNTER_CONNECTIONS] - counters[COUNTER_CONNECTIONS_CLOSED]
+     << "},\"requests\":{\"total\":" << counters[COUNTER_REQUESTS] << ",\"status\":{";
+  for(auto it = status.begin();it != status.end();++it){
+    ss << (it == status.begin() ? "" : ",") << "\"" << it->first << "\":" << it->second;
+  }
+  ss << "}},\"bytes\":{\"in\":" << counters[COUNTER_BYTES_IN]
+     << ",\"out\":" << counters[COUNTER_BYTES_OUT] << "},\"timeouts\":{";
+  for(int i = 0;i < kTimeoutPhaseNum;++i){
+    ss << (i == 0 ? "" : ",") << "\"" << kTimeoutPhaseNames[i] << "\":" << counters[COUNTER_TIMEOUT_IDLE + i];
+  }
+  ss << "},\"shed\":{";
+  for(int i = 0;i < kShedReasonNum;++i){
+    ss << (i == 0 ? "" : ",") << "\"" << kShedReasonNames[i] << "\":" << counters[COUNTER_SHED_CONNECTIONS + i];
+  }
+  ss << "},\"tls\":{";
+  for(int i = 0;i < kHandshakeResultNum;++i){
+    ss << "\"" << kHandshakeResultNames[i] << "\":" << counters[COUNTER_TLS_FULL + i] << ",";
+  }
+  ss << "\"ktls\":" << counters[COUNTER_TLS_KTLS] << "}";
+  for(size_t i = 0;i < extra.size();++i){
+    ss << ",\"" << extra[i].first << "\":" << extra[i].second;
+  }
+  for(size_t i = 0;i < gauges.size();++i){
+    ss << ",\"" << gauges[i].first << "\":" << gauges[i].second;
+  }
+  if(!shards.empty()){
+    ss << ",\"shards\":[";
+    for(size_t i = 0;i < shards.size();++i){
+      const uint64_t* c = shards[i].counters;
+      ss << (i == 0 ? "" : ",") << "{\"shard\":" << shards[i].shard << ",\"cpu\":" << shards[i].cpu
+         << ",\"connections\":" << c[COUNTER_CONNECTIONS]
+         << ",\"active\":" << c[COUNTER_CONNECTIONS] - c[COUNTER_CONNECTIONS_CLOSED]
+         << ",\"requests\":" << c[COUNTER_REQUESTS]
+         << ",\"bytes_in\":" << c[COUNTER_BYTES_IN] << ",\"bytes_out\":" << c[COUNTER_BYTES_OUT] << "}";
+    }
+    ss << "]";
+  }
+  //耗时的单位是微秒
+  ss << ",\"stages\":{";
+  for(int i = 0;i < STAGE_NUM;++i){
+    const HistogramSnapshot& h = stages[i];
+    ss << (i == 0 ? "" : ",") << "\"" << kStageNames[i] << "\":{\"count\":" << h.count
+       << ",\"mean_us\":" << Micros(h.count == 0 ? 0 : static_cast<double>(h.sum) / h.count)
+       << ",\"p50_us\":" << Micros(h.Percentile(0.5))
+       << ",\"p90_us\":" << Micros(h.Percentile(0.9))
+       << ",\"p99_us\":" << Micros(h.Percentile(0.99))
+       << ",\"p999_us\":" << Micros(h.Percentile(0.999))
+       << ",\"max_us\":" << Micros(h.max) << "}";
+  }
+  ss << "}}\n";
+  return ss.str();
+}
+
+ThreadStats* Stats::Register(){
+  ThreadStats* stats = new ThreadStats();
+  std::lock_guard<std::mutex> lock(mutex_);
+  threads_.push_back(stats);
+  return stats;
+}
+
+void Stats::Retire(ThreadStats* stats){
+  std::lock_guard<std::mutex> lock(mutex_);
+  retired_.Merge(*stats);
+  threads_.remove(stats);
+  delete stats;
+}
+
+void Stats::Collect(StatsSnapshot* snapshot){
+  std::lock_guard<std::mutex> lock(mutex_);
+  snapshot->Merge(retired_);
+  for(ThreadStats* stats : threads_){
+    snapshot->Merge(*stats);
+    if(stats->shard < 0){
+      continue;
+    }
+    ShardSnapshot shard;
+    shard.shard = stats->shard;
+    shard.cpu = stats->cpu;
+    for(int i = 0;i < COUNTER_NUM;++i){
+      shard.counters[i] = stats->counters[i].Get();
+    }
+    snapshot->shards.push_back(shard);
+  }
+  std::sort(snapshot->shards.begin(),snapshot->shards.end(),
+            [](const ShardSnapshot& a,const ShardSnapshot& b){ return a.shard < b.shard; });
+}
+
+}//end of http_server
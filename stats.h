@@ -0,0 +1,218 @@
+#pragma once
+//服务器内部的统计信息：每个处理阶段的耗时分布，以及连接数、请求数、流量等计数
+//请求线程只写自己线程的 ThreadStats(单个写者，不加锁，也没有原子的读改写指令)，
+//读取统计信息的时候才加锁遍历所有线程的数据并且累加起来。
+//线程退出的时候它的数据累加到 retired_ 中，连接一个线程的模式下也不会丢数据
+#include <stdint.h>
+#include <atomic>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "util.hpp"
+
+namespace http_server{
+
+//请求处理的各个阶段
+enum Stage{
+  STAGE_READ,    //一次读 socket 的系统调用
+  STAGE_PARSE,   //解析一个请求(分多次收到的请求是多次解析的耗时之和)
+  STAGE_STATIC,  //HandlerRequest 处理静态文件
+  STAGE_CGI,     //HandlerRequest 处理 CGI，CGI 的输出是边生成边发送的，包含了发送的时间
+  STAGE_PLUGIN,  //HandlerRequest 交给插件处理
+  STAGE_OTHER,   //HandlerRequest 的其他情况，例如错误页面和统计信息
+  STAGE_WRITE,   //写一个响应(非阻塞 socket 分多次写的是多次的耗时之和，不包含等待可写的时间)
+  STAGE_REQUEST, //从收到请求的第一个字节到响应写完
+  STAGE_HANDSHAKE, //TLS 握手(分多次完成的是多次的耗时之和，不包含等待对端的时间)
+  STAGE_NUM,
+};
+
+enum Counter{
+  COUNTER_CONNECTIONS,        //接受的连接数
+  COUNTER_CONNECTIONS_CLOSED, //关闭的连接数
+  COUNTER_REQUESTS,           //处理的请求数
+  COUNTER_BYTES_IN,           //从客户端读到的字节数
+  COUNTER_BYTES_OUT,          //写给客户端的字节数
+  COUNTER_TIMEOUT_IDLE,       //长连接空闲超时关闭的连接数，下面四个和 TimeoutPhase 的顺序一致
+  COUNTER_TIMEOUT_HEADER,     //没有按时收完 header 关闭的连接数
+  COUNTER_TIMEOUT_BODY,       //读 body 超时关闭的连接数
+  COUNTER_TIMEOUT_WRITE,      //客户端不读响应、写超时关闭的连接数
+  COUNTER_TIMEOUT_CGI,        //CGI 程序超时没有输出、返回 504 或者中断响应的请求数
+  COUNTER_SHED_CONNECTIONS,   //连接数到上限(或者线程池的队列满了)直接返回 503 的连接数，下面两个是请求数
+  COUNTER_SHED_REQUESTS,      //正在处理的请求数到上限返回 503 的请求数
+  COUNTER_SHED_CGI,           //同时执行的 CGI 到上限返回 503 的请求数
+  COUNTER_TLS_FULL,           //完整的 TLS 握手次数，下面两个分别是恢复会话的握手和失败的握手
+  COUNTER_TLS_RESUMED,
+  COUNTER_TLS_FAILED,
+  COUNTER_TLS_KTLS,           //发送方向交给了内核 TLS 的连接数
+  COUNTER_NUM,
+};
+
+//只有一个线程写、其他线程可以随时读的计数器
+//写的时候只是普通的 load + store，不需要带 lock 前缀的原子指令
+class LocalCounter{
+public:
+  LocalCounter():value_(0){}
+  void Add(uint64_t n){
+    value_.store(value_.load(std::memory_order_relaxed) + n,std::memory_order_relaxed);
+  }
+  void Set(uint64_t n){ value_.store(n,std::memory_order_relaxed); }
+  uint64_t Get() const{ return value_.load(std::memory_order_relaxed); }
+private:
+  std::atomic<uint64_t> value_;
+};
+
+//HDR 风格的直方图：每个2的幂次区间再均分成 16 个桶，任何值的相对误差都不超过 1/16
+//单位是纳秒，最大能记录 2^40 纳秒(大约18分钟)，更大的值记到最后一个桶中
+class Histogram{
+public:
+  static const int kSubBits = 4;
+  static const int kSubBuckets = 1 << kSubBits;
+  static const int kMaxBits = 40;
+  static const int kBuckets = (kMaxBits - kSubBits + 1) * kSubBuckets;
+
+  static int BucketIndex(uint64_t value){
+    if(value < static_cast<uint64_t>(kSubBuckets)){
+      return static_cast<int>(value);
+    }
+    int bits = 63 - __builtin_clzll(value);
+    if(bits >= kMaxBits){
+      return kBuckets - 1;
+    }
+    int sub = static_cast<int>(value >> (bits - kSubBits)) & (kSubBuckets - 1);
+    return (bits - kSubBits + 1) * kSubBuckets + sub;
+  }
+  //桶中最大的值
+  static uint64_t BucketUpper(int index){
+    if(index < kSubBuckets){
+      return index;
+    }
+    int shift = index / kSubBuckets - 1;
+    uint64_t sub = index % kSubBuckets;
+    return ((kSubBuckets + sub + 1) << shift) - 1;
+  }
+
+  void Record(uint64_t value){
+    counts_[BucketIndex(value)].Add(1);
+    sum_.Add(value);
+    if(value > max_.Get()){
+      max_.Set(value);
+    }
+  }
+private:
+  friend struct HistogramSnapshot;
+  LocalCounter counts_[kBuckets];
+  LocalCounter sum_;
+  LocalCounter max_;
+};
+
+//直方图某一时刻的数据，可以累加多个线程的直方图
+struct HistogramSnapshot{
+  std::vector<uint64_t> counts;
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  HistogramSnapshot():counts(Histogram::kBuckets,0),count(0),sum(0),max(0){}
+  void Merge(const Histogram& histogram);
+  void Merge(const HistogramSnapshot& other);
+  //q 在 0 到 1 之间，返回对应分位数所在桶的上界
+  uint64_t Percentile(double q) const;
+  //小于等于 value 的样本数，按照桶的上界判断，误差和桶的宽度一样
+  uint64_t CountBelow(uint64_t value) const;
+};
+
+//一个线程的统计数据
+struct ThreadStats{
+  Histogram stages[STAGE_NUM];
+  LocalCounter counters[COUNTER_NUM];
+  LocalCounter status[600]; //按照状态码统计的请求数
+  //reuseport 模式下这个线程负责的分片编号和绑定的 CPU，其他线程是 -1
+  int shard;
+  int cpu;
+  ThreadStats():shard(-1),cpu(-1){}
+
+  void RecordStage(Stage stage,int64_t ns){
+    stages[stage].Record(ns > 0 ? ns : 0);
+  }
+  void Count(Counter counter,uint64_t n = 1){
+    counters[counter].Add(n);
+  }
+  void CountStatus(int code){
+    if(code >= 0 && code < 600){
+      status[code].Add(1);
+    }
+  }
+};
+
+//一个分片(一个监听 socket 和对应的线程)的计数，用来观察内核是否把连接均匀地分给了各个分片
+struct ShardSnapshot{
+  int shard;
+  int cpu;
+  uint64_t counters[COUNTER_NUM];
+};
+
+//所有线程的统计数据累加之后的结果
+struct StatsSnapshot{
+  HistogramSnapshot stages[STAGE_NUM];
+  uint64_t counters[COUNTER_NUM];
+  std::map<int,uint64_t> status;
+  //其他模块提供的计数器，例如 ("file_cache_hits",10)
+  std::vector<std::pair<std::string,uint64_t> > extra;
+  //其他模块提供的当前值，例如 ("admission_requests",3)
+  std::vector<std::pair<std::string,uint64_t> > gauges;
+  std::vector<ShardSnapshot> shards; //按照分片编号排序
+  StatsSnapshot(){
+    for(int i = 0;i < COUNTER_NUM;++i){
+      counters[i] = 0;
+    }
+  }
+  void Merge(const ThreadStats& stats);
+  void Merge(const StatsSnapshot& other);
+  //Prometheus 的文本格式
+  std::string ToPrometheus() const;
+  std::string ToJson() const;
+};
+
+class Stats{
+public:
+  static Stats& Instance(){
+    static Stats stats;
+    return stats;
+  }
+  //当前线程的统计数据，第一次调用的时候加一次锁注册
+  static ThreadStats& Local(){
+    static thread_local Holder holder;
+    if(holder.stats == NULL){
+      holder.stats = Instance().Register();
+    }
+    return *holder.stats;
+  }
+  //累加所有线程的数据，只有读取统计信息的时候调用
+  void Collect(StatsSnapshot* snapshot);
+private:
+  Stats(){}
+  Stats(const Stats&);
+  Stats& operator=(const Stats&);
+
+  //线程退出的时候把数据交给 retired_
+  struct Holder{
+    ThreadStats* stats;
+    Holder():stats(NULL){}
+    ~Holder(){
+      if(stats != NULL){
+        Instance().Retire(stats);
+      }
+    }
+  };
+  ThreadStats* Register();
+  void Retire(ThreadStats* stats);
+
+  std::mutex mutex_;
+  std::list<ThreadStats*> threads_;
+  StatsSnapshot retired_; //已经退出的线程的数据
+};
+
+}//end of http_server
@@ -0,0 +1,114 @@
+///////////////////////////////////////
+//固定大小的线程池以及有界阻塞队列
+//和 util.hpp 一样，声明和实现都放在 .hpp 中
+///////////////////////////////////////
+#pragma once
+#include <stddef.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+
+//有界的多生产者多消费者队列
+//底层是一块提前开辟好的环形数组，队列满了之后生产者阻塞，
+//这样内存占用不会随着突发流量无限增长
+template<typename T>
+class BlockingQueue{
+public:
+  explicit BlockingQueue(size_t capacity)
+    :items_(capacity),head_(0),size_(0){
+  }
+  //队列满的时候阻塞，直到有消费者取走数据
+  void Push(const T& item){
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(size_ == items_.size()){
+      not_full_.wait(lock);
+    }
+    items_[(head_ + size_) % items_.size()] = item;
+    ++size_;
+    not_empty_.notify_one();
+  }
+  //队列满的时候直接返回 false，不阻塞
+  bool TryPush(const T& item){
+    std::unique_lock<std::mutex> lock(mutex_);
+    if(size_ == items_.size()){
+      return false;
+    }
+    items_[(head_ + size_) % items_.size()] = item;
+    ++size_;
+    not_empty_.notify_one();
+    return true;
+  }
+  //队列空的时候阻塞，直到有生产者放入数据
+  T Pop(){
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(size_ == 0){
+      not_empty_.wait(lock);
+    }
+    T item = items_[head_];
+    head_ = (head_ + 1) % items_.size();
+    --size_;
+    not_full_.notify_one();
+    return item;
+  }
+  size_t Size(){
+    std::unique_lock<std::mutex> lock(mutex_);
+    return size_;
+  }
+private:
+  std::vector<T> items_;
+  size_t head_; //队首元素的下标
+  size_t size_; //队列中元素的个数
+  std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+};
+
+//固定数量的工作线程，都从同一个 BlockingQueue 中取任务，取到之后交给 handler 处理
+//线程在 Start 的时候一次性创建好，处理请求的时候不会再有创建线程的开销
+template<typename T>
+class ThreadPool{
+public:
+  typedef std::function<void (T)> Handler;
+
+  ThreadPool(size_t thread_num,size_t queue_size,const Handler& handler)
+    :thread_num_(thread_num),queue_(queue_size),handler_(handler){
+  }
+  ~ThreadPool(){
+    //线程都是常驻的，和进程同生命周期
+    for(size_t i = 0;i < threads_.size();++i){
+      threads_[i].detach();
+    }
+  }
+  void Start(){
+    for(size_t i = 0;i < thread_num_;++i){
+      threads_.push_back(std::thread(&ThreadPool::WorkerLoop,this));
+    }
+  }
+  //队列满的时候会阻塞调用者，直到有工作线程取走任务
+  void Push(const T& item){
+    queue_.Push(item);
+  }
+  //队列满的时候直接返回 false，由调用者决定怎么处理这个任务
+  //accept 循环用的是这个：工作线程处理不过来的时候新连接返回 503 + Retry-After(减载)，accept 不会停下来
+  bool TryPush(const T& item){
+    return queue_.TryPush(item);
+  }
+  //默认线程数，和 CPU 核数一致
+  static size_t DefaultThreadNum(){
+    size_t n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+  }
+private:
+  void WorkerLoop(){
+    while(true){
+      handler_(queue_.Pop());
+    }
+  }
+
+  size_t thread_num_;
+  BlockingQueue<T> queue_;
+  Handler handler_;
+  std::vector<std::thread> threads_;
+};
@@ -0,0 +1,211 @@
+///////////////////////////////////////
+//分层时间轮，管理所有连接的超时
+//时间按照固定的刻度(tick)划分，第0层有256个槽，每个槽是一个 tick；
+//之后的三层每层64个槽，每个槽分别是 256、256*64、256*64*64 个 tick。
+//定时器按照离到期还有多久放进对应层的槽中，添加、删除都是 O(1) 的链表操作；
+//第0层转完一圈的时候，把上一层对应槽中的定时器重新分配到下面的层(级联)，
+//这样大部分定时器(例如长连接上每个请求都会推迟的空闲超时)在到期之前就被删除了，根本不会被级联
+//定时器节点嵌在使用者自己的结构体中，不需要分配内存
+//和 buffer.hpp 一样，声明和实现都放在 .hpp 中
+///////////////////////////////////////
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+struct TimerNode{
+  TimerNode* prev;
+  TimerNode* next;
+  uint64_t expire; //到期的 tick
+  void* data; //使用者自己的数据，例如定时器所属的连接
+  TimerNode():prev(NULL),next(NULL),expire(0),data(NULL){}
+  //是否挂在时间轮上
+  bool Pending() const{
+    return prev != NULL;
+  }
+};
+
+class TimerWheel{
+public:
+  static const int kRootBits = 8;
+  static const int kLevelBits = 6;
+  static const int kLevels = 3; //第0层之外的层数
+  static const uint64_t kRootSize = 1 << kRootBits;
+  static const uint64_t kLevelSize = 1 << kLevelBits;
+  //能表示的最远的到期时间，超过的按照这个算
+  static const uint64_t kMaxTicks = (1ULL << (kRootBits + kLevels * kLevelBits)) - 1;
+
+  //tick_ms 是一个刻度的毫秒数，now_ms 是当前的单调时钟
+  TimerWheel(int64_t tick_ms,int64_t now_ms)
+    :tick_ms_(tick_ms),current_(now_ms / tick_ms),size_(0){
+    for(uint64_t i = 0;i < kRootSize;++i){
+      InitList(&root_[i]);
+    }
+    for(int i = 0;i < kLevels;++i){
+      for(uint64_t j = 0;j < kLevelSize;++j){
+        InitList(&levels_[i][j]);
+      }
+    }
+  }
+
+  //在 expire_ms 的时候到期，已经在时间轮上的话先摘下来再重新放
+  void Add(TimerNode* node,int64_t expire_ms){
+    if(node->Pending()){
+      Unlink(node);
+    }else {
+      ++size_;
+    }
+    //向上取整，保证不会比要求的时间早到期
+    node->expire = static_cast<uint64_t>((expire_ms + tick_ms_ - 1) / tick_ms_);
+    Place(node);
+  }
+
+  void Cancel(TimerNode* node){
+    if(node->Pending()){
+      Unlink(node);
+      --size_;
+    }
+  }
+
+  //处理到 now_ms 为止到期的定时器，on_expire(TimerNode*) 被调用之前定时器已经摘下来了，
+  //回调中可以重新添加它，也可以删除别的定时器
+  //返回到期的定时器个数
+  template<typename Func>
+  size_t Advance(int64_t now_ms,Func on_expire){
+    uint64_t target = static_cast<uint64_t>(now_ms / tick_ms_);
+    size_t count = 0;
+    //没有定时器的时候直接跳过，空闲了很久之后不用一个 tick 一个 tick 地走
+    if(size_ == 0){
+      current_ = target >= current_ ? target + 1 : current_;
+      return 0;
+    }
+    while(current_ <= target){
+      uint64_t tick = current_;
+      uint64_t index = tick & (kRootSize - 1);
+      //第0层转完一圈，从上一层取下一段时间的定时器，上一层也转完一圈的话继续往上
+      if(index == 0){
+        for(int level = 0;level < kLevels;++level){
+          uint64_t slot = (tick >> (kRootBits + level * kLevelBits)) & (kLevelSize - 1);
+          Cascade(&levels_[level][slot]);
+          if(slot != 0){
+            break;
+          }
+        }
+      }
+      //先把这个槽整个换到临时链表上，再移动 current_，回调中添加的已经到期的定时器放到下一个槽，不会丢
+      TimerNode expired;
+      InitList(&expired);
+      MoveList(&root_[index],&expired);
+      ++current_;
+      while(expired.next != &expired){
+        TimerNode* node = expired.next;
+        Unlink(node);
+        --size_;
+        ++count;
+        on_expire(node);
+      }
+    }
+    return count;
+  }
+
+  //距离下一个可能到期的 tick 还有多少毫秒，给 epoll_wait 之类的等待函数作为超时，没有定时器的时候返回-1
+  //只看第0层，第0层是空的就等到下一次级联
+  int NextTimeout(int64_t now_ms) const{
+    if(size_ == 0){
+      return -1;
+    }
+    uint64_t ticks = 0;
+    //current_ 正好是一圈的开始的时候还没有级联，上层可能有马上到期的定时器，直接醒来
+    while((current_ & (kRootSize - 1)) != 0 && ticks < kRootSize){
+      uint64_t tick = current_ + ticks;
+      const TimerNode* head = &root_[tick & (kRootSize - 1)];
+      if(head->next != head){
+        break;
+      }
+      ++ticks;
+      //每一圈开始的时候要级联，这时候必须醒来
+      if(((current_ + ticks) & (kRootSize - 1)) == 0){
+        break;
+      }
+    }
+    int64_t wake_ms = static_cast<int64_t>(current_ + ticks) * tick_ms_;
+    return wake_ms <= now_ms ? 0 : static_cast<int>(wake_ms - now_ms);
+  }
+
+  size_t Size() const{
+    return size_;
+  }
+private:
+  TimerWheel(const TimerWheel&);
+  TimerWheel& operator=(const TimerWheel&);
+
+  static void InitList(TimerNode* head){
+    head->prev = head;
+    head->next = head;
+  }
+  static void Unlink(TimerNode* node){
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = NULL;
+    node->next = NULL;
+  }
+  static void Append(TimerNode* head,TimerNode* node){
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+  }
+  //from 中的节点全部移到 to 的末尾
+  static void MoveList(TimerNode* from,TimerNode* to){
+    if(from->next == from){
+      return;
+    }
+    from->next->prev = to->prev;
+    from->prev->next = to;
+    to->prev->next = from->next;
+    to->prev = from->prev;
+    InitList(from);
+  }
+
+  void Place(TimerNode* node){
+    uint64_t expire = node->expire;
+    //已经过期的放在下一个要处理的槽中
+    if(expire < current_){
+      expire = current_;
+    }
+    uint64_t delta = expire - current_;
+    if(delta < kRootSize){
+      Append(&root_[expire & (kRootSize - 1)],node);
+      return;
+    }
+    if(delta > kMaxTicks){
+      expire = current_ + kMaxTicks;
+      node->expire = expire;
+    }
+    for(int level = 0;level < kLevels;++level){
+      int shift = kRootBits + (level + 1) * kLevelBits;
+      if(level == kLevels - 1 || delta < (1ULL << shift)){
+        uint64_t slot = (expire >> (shift - kLevelBits)) & (kLevelSize - 1);
+        Append(&levels_[level][slot],node);
+        return;
+      }
+    }
+  }
+
+  //上层一个槽中的定时器按照现在离到期的时间重新放
+  void Cascade(TimerNode* head){
+    TimerNode list;
+    InitList(&list);
+    MoveList(head,&list);
+    while(list.next != &list){
+      TimerNode* node = list.next;
+      Unlink(node);
+      Place(node);
+    }
+  }
+
+  int64_t tick_ms_;
+  uint64_t current_; //下一个要处理的 tick，之前的都已经处理过了
+  size_t size_;
+  TimerNode root_[kRootSize];
+  TimerNode levels_[kLevels][kLevelSize];
+};
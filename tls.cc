@@ -0,0 +1,233 @@
+#include "tls.h"
+#include "util.hpp"
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <openssl/err.h>
+
+namespace http_server{
+
+//一个 TLS 记录最多 16k 明文，读写都按照这个大小使用栈上的缓冲区
+static const size_t kMaxRecordSize = 16 * 1024;
+//恢复会话的时候用来区分不同的服务器，同一个进程中只有一个
+static const unsigned char kSessionIdContext[] = "http_server";
+
+//OpenSSL 的错误放在线程自己的错误队列中，取出最近的一条打印出来，同时清空队列
+//不清空的话，同一个线程上另一个连接之后调用 SSL_get_error 会拿到这里遗留的错误
+static std::string LastError(){
+  char buf[256];
+  unsigned long err = ERR_peek_last_error();
+  if(err == 0){
+    snprintf(buf,sizeof(buf),"%s",strerror(errno));
+  }else {
+    ERR_error_string_n(err,buf,sizeof(buf));
+  }
+  ERR_clear_error();
+  return buf;
+}
+
+//只支持 HTTP/1.1，客户端通过 ALPN 要求 h2 之类的协议的时候不做选择，客户端会按照 HTTP/1.1 处理
+static int SelectAlpn(SSL*,const unsigned char** out,unsigned char* outlen,
+                      const unsigned char* in,unsigned int inlen,void*){
+  static const unsigned char kProtocols[] = "\x08http/1.1";
+  unsigned char* selected = NULL;
+  if(SSL_select_next_proto(&selected,outlen,kProtocols,sizeof(kProtocols) - 1,in,inlen)
+      != OPENSSL_NPN_NEGOTIATED){
+    return SSL_TLSEXT_ERR_NOACK;
+  }
+  *out = selected;
+  return SSL_TLSEXT_ERR_OK;
+}
+
+TlsContext::TlsContext():ctx_(NULL){
+}
+
+TlsContext::~TlsContext(){
+  if(ctx_ != NULL){
+    SSL_CTX_free(ctx_);
+  }
+}
+
+int TlsContext::Init(const TlsConfig& config){
+  ctx_ = SSL_CTX_new(TLS_server_method());
+  if(ctx_ == NULL){
+    LOG(ERROR) << "SSL_CTX_new error! " << LastError() << "\n";
+    return -1;
+  }
+  SSL_CTX_set_min_proto_version(ctx_,TLS1_2_VERSION);
+  //不支持重协商；客户端不发 close_notify 直接关闭连接当作正常的关闭
+  uint64_t options = SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE
+    | SSL_OP_IGNORE_UNEXPECTED_EOF;
+  if(config.ktls){
+    options |= SSL_OP_ENABLE_KTLS;
+  }
+  if(!config.tickets){
+    options |= SSL_OP_NO_TICKET;
+  }
+  SSL_CTX_set_options(ctx_,options);
+  //1.PARTIAL_WRITE：SSL_write 写出一个记录就返回，和非阻塞的 write 一样可以只写出一部分
+  //2.ACCEPT_MOVING_WRITE_BUFFER：发送缓冲区满了之后重试的时候，数据可以在另一个地址(见 WriteV)
+  //3.RELEASE_BUFFERS：连接空闲的时候释放 OpenSSL 内部的读写缓冲区，长连接多的时候省内存
+  SSL_CTX_set_mode(ctx_,SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER
+                   | SSL_MODE_RELEASE_BUFFERS);
+  if(SSL_CTX_use_certificate_chain_file(ctx_,config.cert_file.c_str()) != 1){
+    LOG(ERROR) << "Load certificate error! cert_file=" << config.cert_file
+      << " " << LastError() << "\n";
+    return -1;
+  }
+  if(SSL_CTX_use_PrivateKey_file(ctx_,config.key_file.c_str(),SSL_FILETYPE_PEM) != 1
+     || SSL_CTX_check_private_key(ctx_) != 1){
+    LOG(ERROR) << "Load private key error! key_file=" << config.key_file
+      << " " << LastError() << "\n";
+    return -1;
+  }
+  //session ticket 的密钥由 OpenSSL 在 SSL_CTX 创建的时候随机生成，所有线程共用
+  //关闭 ticket 的时候，会话保存在服务器端的缓存中，按照会话 id 恢复
+  SSL_CTX_set_session_cache_mode(ctx_,SSL_SESS_CACHE_SERVER);
+  SSL_CTX_sess_set_cache_size(ctx_,static_cast<long>(config.session_cache_size));
+  SSL_CTX_set_timeout(ctx_,config.session_timeout);
+  SSL_CTX_set_session_id_context(ctx_,kSessionIdContext,sizeof(kSessionIdContext) - 1);
+  SSL_CTX_set_alpn_select_cb(ctx_,SelectAlpn,NULL);
+  LOG(INFO) << "TLS ok! tickets=" << config.tickets << " ktls=" << config.ktls << "\n";
+  return 0;
+}
+
+TlsConnection* TlsContext::NewConnection(int fd){
+  SSL* ssl = SSL_new(ctx_);
+  if(ssl == NULL){
+    LOG(ERROR) << "SSL_new error! " << LastError() << "\n";
+    return NULL;
+  }
+  if(SSL_set_fd(ssl,fd) != 1){
+    LOG(ERROR) << "SSL_set_fd error! " << LastError() << "\n";
+    SSL_free(ssl);
+    return NULL;
+  }
+  SSL_set_accept_state(ssl);
+  return new TlsConnection(ssl);
+}
+
+TlsConnection::TlsConnection(SSL* ssl)
+  :ssl_(ssl),want_events_(POLLIN),established_(false){
+}
+
+TlsConnection::~TlsConnection(){
+  SSL_free(ssl_);
+}
+
+int TlsConnection::IoError(int ret){
+  switch(SSL_get_error(ssl_,ret)){
+    case SSL_ERROR_WANT_READ:
+      want_events_ = POLLIN;
+      errno = EAGAIN;
+      return 1;
+    case SSL_ERROR_WANT_WRITE:
+      want_events_ = POLLOUT;
+      errno = EAGAIN;
+      return 1;
+    case SSL_ERROR_ZERO_RETURN:
+      return 0;
+    case SSL_ERROR_SYSCALL:
+      //errno 是系统调用的错误，例如对端重置了连接
+      ERR_clear_error();
+      return -1;
+    default:
+      LOG(INFO) << "TLS error! " << LastError() << "\n";
+      errno = EPROTO;
+      return -1;
+  }
+}
+
+int TlsConnection::Handshake(){
+  int ret = SSL_do_handshake(ssl_);
+  if(ret == 1){
+    established_ = true;
+    return 0;
+  }
+  return IoError(ret) == 1 ? 1 : -1;
+}
+
+bool TlsConnection::Resumed() const{
+  return SSL_session_reused(ssl_) == 1;
+}
+
+bool TlsConnection::KtlsSend() const{
+  return BIO_get_ktls_send(SSL_get_wbio(ssl_)) != 0;
+}
+
+ssize_t TlsConnection::Read(Buffer* buf){
+  //和 Buffer::ReadFd 一样先读到栈上，缓冲区不用为每个连接预留一个记录的空间
+  char record[kMaxRecordSize];
+  int n = SSL_read(ssl_,record,sizeof(record));
+  if(n > 0){
+    buf->Append(record,n);
+    return n;
+  }
+  return IoError(n) == 0 ? 0 : -1;
+}
+
+ssize_t TlsConnection::WriteV(const iovec* iov,int iovcnt){
+  //SSL_write 没有 writev，header 和 body 分开写会多出一个很小的记录(多一次加密，多一个报文)
+  //header 加上 body 的开头先拼成一个完整的记录，之后的 body 直接交给 SSL_write
+  //发送缓冲区满了之后重试的时候 iov 没有变，拼出来的内容和上一次完全一样，满足 OpenSSL 重试的要求
+  const char* data = static_cast<const char*>(iov[0].iov_base);
+  size_t size = iov[0].iov_len;
+  char record[kMaxRecordSize];
+  if(iovcnt > 1 && size < sizeof(record)){
+    size = 0;
+    for(int i = 0;i < iovcnt && size < sizeof(record);++i){
+      size_t n = std::min(iov[i].iov_len,sizeof(record) - size);
+      memcpy(record + size,iov[i].iov_base,n);
+      size += n;
+    }
+    data = record;
+  }
+  int n = SSL_write(ssl_,data,static_cast<int>(std::min<size_t>(size,INT_MAX)));
+  if(n > 0){
+    return n;
+  }
+  return IoError(n) == 1 ? 0 : -1;
+}
+
+ssize_t TlsConnection::SendFile(int fd,off_t* offset,size_t count){
+  int n = 0;
+  if(KtlsSend()){
+    //加密在内核中完成，文件内容直接从页缓存发送出去
+    ossl_ssize_t sent = SSL_sendfile(ssl_,fd,*offset,count,0);
+    if(sent > 0){
+      *offset += sent;
+      return sent;
+    }
+    n = static_cast<int>(sent);
+  }else {
+    //一次最多一个记录，重试的时候从同样的位置读出同样的内容
+    char record[kMaxRecordSize];
+    ssize_t size = pread(fd,record,std::min(count,sizeof(record)),*offset);
+    if(size <= 0){
+      return size;
+    }
+    n = SSL_write(ssl_,record,static_cast<int>(size));
+    if(n > 0){
+      *offset += n;
+      return n;
+    }
+  }
+  int ret = IoError(n);
+  if(ret == 0){
+    errno = EPIPE;
+  }
+  return -1;
+}
+
+void TlsConnection::Shutdown(){
+  //只在握手完成之后发，非阻塞 socket 上发不出去就算了
+  if(established_ && SSL_shutdown(ssl_) < 0){
+    ERR_clear_error();
+  }
+}
+
+}//end of http_server
@@ -0,0 +1,84 @@
+#pragma once
+//HTTPS：用 OpenSSL 在服务器中直接终止 TLS，前面不再需要单独的 TLS 代理(少一跳，也少一次拷贝)
+//所有连接共用一个 TlsContext(SSL_CTX)，证书、会话缓存和 session ticket 的密钥都在里面，
+//reuseport 的各个分片之间也能恢复彼此的会话；每个连接一个 TlsConnection(SSL)。
+//socket 都是非阻塞的，TlsConnection 读写函数的返回值和 read/ResponseWriter::WriteV/sendfile 保持一致，
+//上层的读写流程只需要在调用的地方区分一下是不是 TLS 连接
+//会话恢复：默认发 session ticket(无状态，服务器不用保存会话)，关闭 ticket 的时候使用服务器端的会话缓存，
+//恢复的会话不需要证书签名和密钥交换之外的非对称运算，握手的 CPU 开销小很多
+//kTLS：握手完成之后对称加密交给内核，SSL_sendfile 直接调用内核的 sendfile，静态文件的内容仍然不经过用户态；
+//内核不支持(没有 tls 模块)或者算法不支持的时候，文件内容读到用户态由 OpenSSL 加密，只是多一次拷贝
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <string>
+#include <openssl/ssl.h>
+#include "buffer.hpp"
+
+namespace http_server{
+
+struct TlsConfig{
+  int port; //HTTPS 监听的端口，0表示不开启
+  std::string cert_file; //PEM 格式的证书链
+  std::string key_file; //PEM 格式的私钥
+  bool tickets; //是否发 session ticket
+  size_t session_cache_size; //服务器端会话缓存的条数
+  int session_timeout; //会话多少秒之内可以恢复
+  bool ktls; //握手完成之后尝试把加密交给内核
+  TlsConfig()
+    :port(0),tickets(true),session_cache_size(20480),session_timeout(7200),ktls(true){
+  }
+};
+
+class TlsConnection;
+
+class TlsContext{
+public:
+  TlsContext();
+  ~TlsContext();
+  //加载证书和私钥，返回0表示成功，返回小于0表示失败
+  int Init(const TlsConfig& config);
+  //为一个新连接创建 TLS 状态，失败返回 NULL
+  TlsConnection* NewConnection(int fd);
+private:
+  TlsContext(const TlsContext&);
+  TlsContext& operator=(const TlsContext&);
+
+  SSL_CTX* ctx_;
+};
+
+class TlsConnection{
+public:
+  explicit TlsConnection(SSL* ssl);
+  ~TlsConnection();
+  //返回0表示握手完成，返回1表示需要等待 socket 就绪(见 WantEvents)，返回小于0表示失败
+  int Handshake();
+  //上一次返回"需要等待"的时候要等的事件，POLLIN 或者 POLLOUT
+  short WantEvents() const{
+    return want_events_;
+  }
+  //握手恢复了之前的会话
+  bool Resumed() const;
+  //发送方向已经交给了内核
+  bool KtlsSend() const;
+  //读一段解密之后的数据追加到 buf 中，返回值和 read 一样
+  ssize_t Read(Buffer* buf);
+  //和 ResponseWriter::WriteV 一样：返回写出去的字节数，发送缓冲区满了返回0，出错返回-1
+  ssize_t WriteV(const iovec* iov,int iovcnt);
+  //和 sendfile 一样：返回发送的字节数并且移动 offset，发送缓冲区满了返回-1，errno 为 EAGAIN
+  ssize_t SendFile(int fd,off_t* offset,size_t count);
+  //发送 close_notify，不等待对端的回应
+  void Shutdown();
+private:
+  TlsConnection(const TlsConnection&);
+  TlsConnection& operator=(const TlsConnection&);
+
+  //SSL 函数返回 ret 之后的处理：返回1表示需要等待(errno 为 EAGAIN)，返回0表示对端关闭，返回-1表示出错
+  int IoError(int ret);
+
+  SSL* ssl_;
+  short want_events_;
+  bool established_;
+};
+
+}//end of http_server
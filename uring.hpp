@@ -0,0 +1,284 @@
+///////////////////////////////////////
+//io_uring 的简单封装
+//没有依赖 liburing，直接通过系统调用创建 ring，再把提交队列(SQ)和完成队列(CQ)映射到用户态：
+//  往 SQ 中填请求(SQE)，一次 io_uring_enter 把一批请求交给内核，同时等待完成；
+//  完成的结果(CQE)直接从映射的内存中读，不需要系统调用
+//另外支持内核管理的接收缓冲区(provided buffer ring)：recv 的时候不指定缓冲区，
+//数据到达的时候内核从这里挑一块，空闲连接不需要各自占着一块接收缓冲区
+//和 buffer.hpp 一样，声明和实现都放在 .hpp 中
+///////////////////////////////////////
+#pragma once
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+class IoUring{
+public:
+  IoUring()
+    :ring_fd_(-1),features_(0),sq_ring_(NULL),sq_ring_size_(0),cq_ring_(NULL),cq_ring_size_(0),
+     sqes_(NULL),sqes_size_(0),sq_entries_(0),cq_entries_(0),sq_mask_(0),cq_mask_(0),
+     sq_head_(NULL),sq_tail_(NULL),cq_head_(NULL),cq_tail_(NULL),cqes_(NULL),sqe_tail_(0),
+     buf_ring_(NULL),buf_ring_size_(0),buf_entries_(0),buf_size_(0),buf_group_(0),buf_data_(NULL){
+    memset(supported_,0,sizeof(supported_));
+  }
+  ~IoUring(){
+    if(buf_data_ != NULL){
+      munmap(buf_data_,static_cast<size_t>(buf_entries_) * buf_size_);
+    }
+    if(buf_ring_ != NULL){
+      munmap(buf_ring_,buf_ring_size_);
+    }
+    if(sqes_ != NULL){
+      munmap(sqes_,sqes_size_);
+    }
+    if(cq_ring_ != NULL && cq_ring_ != sq_ring_){
+      munmap(cq_ring_,cq_ring_size_);
+    }
+    if(sq_ring_ != NULL){
+      munmap(sq_ring_,sq_ring_size_);
+    }
+    if(ring_fd_ >= 0){
+      close(ring_fd_);
+    }
+  }
+
+  //创建 entries 个 SQE 的 ring，CQ 是 SQ 的两倍
+  //返回0表示成功，返回小于0表示内核不支持(-errno)
+  int Init(unsigned entries){
+    io_uring_params params;
+    memset(&params,0,sizeof(params));
+    //只有创建 ring 的线程提交请求，完成事件等到 io_uring_enter 的时候再处理，减少中断当前线程
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_CLAMP;
+    ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup,entries,&params));
+    if(ring_fd_ < 0 && errno == EINVAL){
+      //6.1 之前的内核不认识这两个标记
+      memset(&params,0,sizeof(params));
+      params.flags = IORING_SETUP_CLAMP;
+      ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup,entries,&params));
+    }
+    if(ring_fd_ < 0){
+      return -errno;
+    }
+    features_ = params.features;
+    //SQ 和 CQ 的头尾指针、SQE 数组都要映射到用户态
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single_mmap && cq_ring_size_ > sq_ring_size_){
+      sq_ring_size_ = cq_ring_size_;
+    }
+    sq_ring_ = Map(sq_ring_size_,IORING_OFF_SQ_RING);
+    if(sq_ring_ == NULL){
+      return -errno;
+    }
+    cq_ring_ = single_mmap ? sq_ring_ : Map(cq_ring_size_,IORING_OFF_CQ_RING);
+    if(cq_ring_ == NULL){
+      return -errno;
+    }
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe*>(Map(sqes_size_,IORING_OFF_SQES));
+    if(sqes_ == NULL){
+      return -errno;
+    }
+    char* sq = static_cast<char*>(sq_ring_);
+    char* cq = static_cast<char*>(cq_ring_);
+    sq_entries_ = params.sq_entries;
+    cq_entries_ = params.cq_entries;
+    sq_mask_ = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+    cq_mask_ = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+    sq_head_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+    cq_head_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    //SQ 中的下标数组固定成 i -> i，之后填 SQE 的时候只需要移动尾指针
+    uint32_t* array = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+    for(unsigned i = 0;i < sq_entries_;++i){
+      array[i] = i;
+    }
+    sqe_tail_ = *sq_tail_;
+    return Probe();
+  }
+
+  //内核是否有某个特性(IORING_FEAT_*)
+  bool HasFeature(unsigned feature) const{
+    return (features_ & feature) != 0;
+  }
+
+  //内核是否支持某个操作(IORING_OP_*)
+  bool Supported(int opcode) const{
+    return opcode >= 0 && opcode < kMaxOps && supported_[opcode];
+  }
+
+  //取一个空的 SQE，已经清零，SQ 满了返回 NULL(先 Submit 再取)
+  io_uring_sqe* GetSqe(){
+    uint32_t head = __atomic_load_n(sq_head_,__ATOMIC_ACQUIRE);
+    if(sqe_tail_ - head >= sq_entries_){
+      return NULL;
+    }
+    io_uring_sqe* sqe = &sqes_[sqe_tail_ & sq_mask_];
+    ++sqe_tail_;
+    memset(sqe,0,sizeof(*sqe));
+    return sqe;
+  }
+
+  //SQ 中还能放多少个 SQE，链接在一起的请求必须在同一次提交中
+  unsigned SqSpace() const{
+    return sq_entries_ - (sqe_tail_ - __atomic_load_n(sq_head_,__ATOMIC_ACQUIRE));
+  }
+
+  //把已经填好的 SQE 交给内核，wait_nr 大于0的时候等到至少有这么多个完成事件
+  //timeout_ms 不小于0的时候最多等这么久(需要 IORING_FEAT_EXT_ARG)，不用为了超时专门提交一个定时器请求
+  //返回提交的个数，返回小于0表示出错(-errno)，被信号打断返回 -EINTR，等待超时返回 -ETIME
+  int Submit(unsigned wait_nr,int timeout_ms = -1){
+    __atomic_store_n(sq_tail_,sqe_tail_,__ATOMIC_RELEASE);
+    unsigned to_submit = sqe_tail_ - __atomic_load_n(sq_head_,__ATOMIC_ACQUIRE);
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    if(to_submit == 0 && wait_nr == 0){
+      return 0;
+    }
+    const void* arg = NULL;
+    size_t arg_size = 0;
+    __kernel_timespec ts;
+    io_uring_getevents_arg ext;
+    if(wait_nr > 0 && timeout_ms >= 0){
+      ts.tv_sec = timeout_ms / 1000;
+      ts.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000 * 1000;
+      memset(&ext,0,sizeof(ext));
+      ext.ts = reinterpret_cast<uint64_t>(&ts);
+      arg = &ext;
+      arg_size = sizeof(ext);
+      flags |= IORING_ENTER_EXT_ARG;
+    }
+    int ret = static_cast<int>(syscall(__NR_io_uring_enter,ring_fd_,to_submit,wait_nr,flags,
+                                       arg,arg_size));
+    return ret < 0 ? -errno : ret;
+  }
+
+  //下一个完成事件，没有的话返回 NULL，处理完之后调用 SeenCqe
+  io_uring_cqe* PeekCqe(){
+    uint32_t head = *cq_head_;
+    if(head == __atomic_load_n(cq_tail_,__ATOMIC_ACQUIRE)){
+      return NULL;
+    }
+    return &cqes_[head & cq_mask_];
+  }
+  void SeenCqe(){
+    __atomic_store_n(cq_head_,*cq_head_ + 1,__ATOMIC_RELEASE);
+  }
+
+  //注册一组 entries 个(2的幂)、每个 size 字节的接收缓冲区，编号为 group
+  //recv 的时候带上 IOSQE_BUFFER_SELECT 和 group，完成事件的 flags 中是选中的缓冲区编号
+  //返回0表示成功，返回小于0表示内核不支持(需要 5.19 以上)
+  int SetupBufferRing(uint16_t group,unsigned entries,unsigned size){
+    buf_ring_size_ = entries * sizeof(io_uring_buf);
+    void* ring = mmap(NULL,buf_ring_size_,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+    if(ring == MAP_FAILED){
+      return -errno;
+    }
+    buf_ring_ = static_cast<io_uring_buf_ring*>(ring);
+    buf_entries_ = entries;
+    buf_size_ = size;
+    buf_group_ = group;
+    void* data = mmap(NULL,static_cast<size_t>(entries) * size,PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+    if(data == MAP_FAILED){
+      return -errno;
+    }
+    buf_data_ = static_cast<char*>(data);
+    io_uring_buf_reg reg;
+    memset(&reg,0,sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+    reg.ring_entries = entries;
+    reg.bgid = group;
+    if(syscall(__NR_io_uring_register,ring_fd_,IORING_REGISTER_PBUF_RING,&reg,1) < 0){
+      return -errno;
+    }
+    for(unsigned i = 0;i < entries;++i){
+      AddBuffer(static_cast<uint16_t>(i),i);
+    }
+    __atomic_store_n(&buf_ring_->tail,static_cast<uint16_t>(entries),__ATOMIC_RELEASE);
+    return 0;
+  }
+  //完成事件中选中的缓冲区
+  char* Buffer(uint16_t id) const{
+    return buf_data_ + static_cast<size_t>(id) * buf_size_;
+  }
+  //缓冲区中的数据用完了，还给内核
+  void RecycleBuffer(uint16_t id){
+    uint16_t tail = buf_ring_->tail;
+    AddBuffer(id,tail);
+    __atomic_store_n(&buf_ring_->tail,static_cast<uint16_t>(tail + 1),__ATOMIC_RELEASE);
+  }
+  uint16_t BufferGroup() const{
+    return buf_group_;
+  }
+  unsigned BufferSize() const{
+    return buf_size_;
+  }
+private:
+  IoUring(const IoUring&);
+  IoUring& operator=(const IoUring&);
+
+  static const int kMaxOps = 256;
+
+  void* Map(size_t size,uint64_t offset){
+    void* addr = mmap(NULL,size,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,ring_fd_,offset);
+    return addr == MAP_FAILED ? NULL : addr;
+  }
+
+  //查询内核支持哪些操作，老内核上没有这个功能就当作都不支持
+  int Probe(){
+    size_t size = sizeof(io_uring_probe) + kMaxOps * sizeof(io_uring_probe_op);
+    char buf[sizeof(io_uring_probe) + kMaxOps * sizeof(io_uring_probe_op)];
+    memset(buf,0,size);
+    io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(buf);
+    if(syscall(__NR_io_uring_register,ring_fd_,IORING_REGISTER_PROBE,probe,kMaxOps) < 0){
+      return -errno;
+    }
+    for(int i = 0;i < probe->ops_len && i < kMaxOps;++i){
+      supported_[probe->ops[i].op] = probe->ops[i].flags & IO_URING_OP_SUPPORTED;
+    }
+    return 0;
+  }
+
+  void AddBuffer(uint16_t id,unsigned index){
+    //不能用 buf_ring_->bufs：内核头文件中的 __DECLARE_FLEX_ARRAY 在 C++ 下多出一个空结构体，
+    //bufs 的偏移变成了8，和内核的布局不一致。tail 和第一个缓冲区的 resv 重叠，写缓冲区的时候不碰 resv
+    io_uring_buf* buf = reinterpret_cast<io_uring_buf*>(buf_ring_) + (index & (buf_entries_ - 1));
+    buf->addr = reinterpret_cast<uint64_t>(Buffer(id));
+    buf->len = buf_size_;
+    buf->bid = id;
+  }
+
+  int ring_fd_;
+  unsigned features_;
+  void* sq_ring_;
+  size_t sq_ring_size_;
+  void* cq_ring_;
+  size_t cq_ring_size_;
+  io_uring_sqe* sqes_;
+  size_t sqes_size_;
+  unsigned sq_entries_;
+  unsigned cq_entries_;
+  uint32_t sq_mask_;
+  uint32_t cq_mask_;
+  uint32_t* sq_head_; //内核消费 SQ 的位置
+  uint32_t* sq_tail_;
+  uint32_t* cq_head_; //用户态消费 CQ 的位置
+  uint32_t* cq_tail_;
+  io_uring_cqe* cqes_;
+  uint32_t sqe_tail_; //已经填好但是可能还没有提交的 SQE 的尾部
+  bool supported_[kMaxOps];
+
+  io_uring_buf_ring* buf_ring_;
+  size_t buf_ring_size_;
+  unsigned buf_entries_;
+  unsigned buf_size_;
+  uint16_t buf_group_;
+  char* buf_data_;
+};
@@ -0,0 +1,574 @@
+#include "uring_reactor.h"
+#include "http_server.h"
+#include "uring.hpp"
+#include "util.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+namespace http_server{
+
+//SQ 的长度，一轮事件循环中产生的请求超过这个数目的时候先提交一次
+static const unsigned kRingEntries = 4096;
+//接收缓冲区：1024块，每块16KB，所有连接共用
+static const uint16_t kBufferGroup = 0;
+static const unsigned kBufferNum = 1024;
+static const unsigned kBufferSize = 16 * 1024;
+//splice 用的管道尽量调大，一次 splice 能搬更多的文件内容
+static const int kPipeSize = 1024 * 1024;
+//时间轮的刻度，和 EpollReactor 一样
+static const int64_t kTimerTickMS = 100;
+
+//完成事件的 user_data 是 UringConn 的地址，低3位是请求的类型
+enum UringOp{
+  OP_ACCEPT = 1,
+  OP_RECV,
+  OP_SEND,
+  OP_SPLICE_IN,  //文件 -> 管道
+  OP_SPLICE_OUT, //管道 -> socket
+  OP_CANCEL,
+  OP_CGI,        //等 CGI 程序的输出(poll)
+};
+static const uint64_t kOpMask = 7;
+
+//一个连接在 io_uring 模式下额外需要的状态，Context 中的字段和 epoll 模式一样使用
+struct UringConn{
+  Context* context;
+  int pending; //已经提交、还没有收到最后一个完成事件的请求数，为0的时候才能释放
+  bool recv_armed; //有一个 recv 请求在内核中
+  bool cgi_armed; //有一个等 CGI 输出的 poll 请求在内核中
+  bool closing;
+  int pipe_fds[2]; //发送大文件的时候才创建，之后一直留着给这个连接上的其他文件用
+  int pipe_size;
+  size_t pipe_bytes; //已经从文件搬到管道中、还没有搬到 socket 的字节数
+  int splice_pending; //正在进行的 splice 请求数，都完成之后再决定下一步
+  bool splice_error;
+  //sendmsg 请求完成之前，内核会用到这里的 msghdr 和 iovec
+  msghdr msg;
+  iovec iov[2];
+
+  explicit UringConn(Context* ctx)
+    :context(ctx),pending(0),recv_armed(false),cgi_armed(false),closing(false),pipe_size(0),pipe_bytes(0),
+     splice_pending(0),splice_error(false){
+    pipe_fds[0] = -1;
+    pipe_fds[1] = -1;
+    memset(&msg,0,sizeof(msg));
+  }
+  ~UringConn(){
+    if(pipe_fds[0] >= 0){
+      close(pipe_fds[0]);
+      close(pipe_fds[1]);
+    }
+  }
+};
+
+static uint64_t UserData(UringConn* conn,int op){
+  return reinterpret_cast<uint64_t>(conn) | static_cast<uint64_t>(op);
+}
+
+UringReactor::UringReactor(HttpServer* server,int listen_sock)
+  :server_(server),listen_sock_(listen_sock),multishot_accept_(true),multishot_recv_(true),
+   timers_(kTimerTickMS,TimeUtil::MonotonicMS()){
+}
+
+UringReactor::~UringReactor(){
+  for(UringConn* conn : connections_){
+    server_->DeleteContext(conn->context);
+    delete conn;
+  }
+}
+
+int UringReactor::Init(){
+  ring_.reset(new IoUring());
+  int ret = ring_->Init(kRingEntries);
+  if(ret < 0){
+    LOG(WARNING) << "io_uring_setup failed! error=" << strerror(-ret) << "\n";
+    return -1;
+  }
+  //等待完成事件的时候要带上超时(5.11 以上)，连接的超时由时间轮管理
+  if(!ring_->HasFeature(IORING_FEAT_EXT_ARG)){
+    LOG(WARNING) << "io_uring_enter does not support timeout!\n";
+    return -1;
+  }
+  const int ops[] = {IORING_OP_ACCEPT,IORING_OP_RECV,IORING_OP_SENDMSG,
+                     IORING_OP_SPLICE,IORING_OP_ASYNC_CANCEL,IORING_OP_POLL_ADD};
+  for(size_t i = 0;i < sizeof(ops) / sizeof(ops[0]);++i){
+    if(!ring_->Supported(ops[i])){
+      LOG(WARNING) << "io_uring op not supported! op=" << ops[i] << "\n";
+      return -1;
+    }
+  }
+  //provided buffer ring 需要 5.19 以上，multishot accept/recv 在第一次使用的时候才知道支不支持
+  ret = ring_->SetupBufferRing(kBufferGroup,kBufferNum,kBufferSize);
+  if(ret < 0){
+    LOG(WARNING) << "io_uring buffer ring not supported! error=" << strerror(-ret) << "\n";
+    return -1;
+  }
+  return 0;
+}
+
+int UringReactor::Run(){
+  LOG(INFO) << "UringReactor start!\n";
+  ArmAccept();
+  while(1){
+    //上一轮产生的请求全部提交，同时等待至少一个完成事件，最多等到最近的定时器可能到期的时候
+    int ret = ring_->Submit(1,timers_.NextTimeout(TimeUtil::MonotonicMS()));
+    if(ret < 0 && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY && ret != -ETIME){
+      LOG(ERROR) << "io_uring_enter error! error=" << strerror(-ret) << "\n";
+      return -1;
+    }
+    io_uring_cqe* cqe = NULL;
+    while((cqe = ring_->PeekCqe()) != NULL){
+      //先复制出来再归还，处理的过程中可能又要提交新的请求
+      io_uring_cqe copy = *cqe;
+      ring_->SeenCqe();
+      HandleCompletion(&copy);
+    }
+    timers_.Advance(TimeUtil::MonotonicMS(),[this](TimerNode* node){ OnTimeout(node); });
+  }
+  return 0;
+}
+
+io_uring_sqe* UringReactor::GetSqe(){
+  io_uring_sqe* sqe = ring_->GetSqe();
+  if(sqe == NULL){
+    ring_->Submit(0);
+    sqe = ring_->GetSqe();
+  }
+  return sqe;
+}
+
+void UringReactor::HandleCompletion(const io_uring_cqe* cqe){
+  int op = static_cast<int>(cqe->user_data & kOpMask);
+  UringConn* conn = reinterpret_cast<UringConn*>(cqe->user_data & ~kOpMask);
+  if(op == OP_ACCEPT){
+    HandleAccept(cqe);
+    return;
+  }
+  if(op == OP_CANCEL){
+    return;
+  }
+  //multishot recv 带着 IORING_CQE_F_MORE 的时候请求还在内核中
+  bool more = cqe->flags & IORING_CQE_F_MORE;
+  if(!more){
+    --conn->pending;
+    if(op == OP_RECV){
+      conn->recv_armed = false;
+    }else if(op == OP_CGI){
+      conn->cgi_armed = false;
+    }
+  }
+  if(conn->closing){
+    if(cqe->flags & IORING_CQE_F_BUFFER){
+      ring_->RecycleBuffer(static_cast<uint16_t>(cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+    }
+    ReleaseIfDone(conn);
+    return;
+  }
+  if(op == OP_RECV){
+    HandleRecv(conn,cqe);
+  }else if(op == OP_SEND){
+    HandleSend(conn,cqe->res);
+  }else if(op == OP_CGI){
+    HandleCgi(conn);
+  }else {
+    HandleSplice(conn,op,cqe->res);
+  }
+  //处理的过程中连接可能被关闭，等处理完再释放
+  if(conn->closing){
+    ReleaseIfDone(conn);
+  }else {
+    UpdateTimer(conn);
+  }
+}
+
+void UringReactor::HandleAccept(const io_uring_cqe* cqe){
+  if(cqe->res == -EINVAL && multishot_accept_){
+    //5.19 之前的内核不支持 multishot accept，退回到每次 accept 之后重新提交
+    LOG(WARNING) << "multishot accept not supported!\n";
+    multishot_accept_ = false;
+  }
+  //没有 IORING_CQE_F_MORE 说明 accept 请求已经结束了，需要重新提交
+  if(!(cqe->flags & IORING_CQE_F_MORE)){
+    ArmAccept();
+  }
+  if(cqe->res < 0){
+    if(cqe->res != -EINVAL && cqe->res != -EINTR && cqe->res != -ECONNABORTED){
+      LOG(ERROR) << "accept error! error=" << strerror(-cqe->res) << "\n";
+    }
+    return;
+  }
+  int new_sock = cqe->res;
+  Context* context = server_->NewContext(new_sock);
+  if(context == NULL){
+    //连接数到上限，已经返回 503 并且关闭了
+    return;
+  }
+  UringConn* conn = new UringConn(context);
+  context->timer.data = conn;
+  context->reactor = true;
+  connections_.insert(conn);
+  ArmRecv(conn);
+  UpdateTimer(conn);
+}
+
+void UringReactor::HandleRecv(UringConn* conn,const io_uring_cqe* cqe){
+  Context* context = conn->context;
+  int res = cqe->res;
+  if(res > 0){
+    //数据复制到 read_buf 之后缓冲区马上还给内核，解析器还是从 read_buf 中解析
+    uint16_t id = static_cast<uint16_t>(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    context->read_buf.Append(ring_->Buffer(id),res);
+    ring_->RecycleBuffer(id);
+    Stats::Local().Count(COUNTER_BYTES_IN,res);
+    if(context->request_start == 0 && context->state == STATE_READING){
+      context->request_start = TimeUtil::MonotonicNS();
+    }
+    //积压的数据超过一个请求允许的最大长度，取消 recv，等缓冲区中的请求处理完再继续
+    const ParserLimits& limits = server_->config_.limits;
+    if(conn->recv_armed && !context->read_paused
+       && context->read_buf.ReadableBytes() >= limits.max_header_size + limits.max_body_size){
+      context->read_paused = true;
+      io_uring_sqe* sqe = GetSqe();
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->addr = UserData(conn,OP_RECV);
+      sqe->user_data = OP_CANCEL;
+    }
+  }else if(res == 0){
+    context->peer_closed = true;
+  }else if(res == -EINVAL && multishot_recv_){
+    //6.0 之前的内核不支持 multishot recv，退回到每次收到数据之后重新提交
+    LOG(WARNING) << "multishot recv not supported!\n";
+    multishot_recv_ = false;
+  }else if(res != -ENOBUFS && res != -ECANCELED){
+    //ENOBUFS 是接收缓冲区暂时用完了，ECANCELED 是上面因为积压主动取消的，都是之后重新提交
+    CloseConnection(conn);
+    return;
+  }
+  if(context->state == STATE_READING){
+    ProcessRequests(conn);
+  }
+}
+
+void UringReactor::ProcessRequests(UringConn* conn){
+  Context* context = conn->context;
+  while(context->state == STATE_READING){
+    int ret = server_->ParseRequest(context);
+    if(ret == 1){
+      //请求还不完整
+      if(context->peer_closed){
+        CloseConnection(conn);
+        return;
+      }
+      context->read_paused = false;
+      ArmRecv(conn);
+      return;
+    }
+    //处理请求，构造响应，和 EpollReactor 中的流程一致
+    server_->BuildResponse(context,ret == 0);
+    if(!context->streamed){
+      server_->SerializeResponse(context->resp,&context->write_buf);
+      context->write_pos = 0;
+    }
+    context->state = STATE_WRITING;
+    ret = ContinueSend(conn);
+    if(ret == 1){
+      //等发送请求完成之后在 AfterSend 中继续
+      return;
+    }
+    if(ret < 0 || FinishSend(conn) < 0){
+      CloseConnection(conn);
+      return;
+    }
+  }
+}
+
+int UringReactor::ContinueSend(UringConn* conn){
+  Context* context = conn->context;
+  int64_t start = TimeUtil::MonotonicNS();
+  int ret = 0;
+  int iovcnt = server_->PendingIov(context,conn->iov);
+  if(iovcnt == 0 && context->cgi.Active()){
+    //CGI 因为客户端接收得慢暂停了，之前的输出发完之后继续读取 CGI 的输出，
+    //能直接写出去的已经写出去了，写不进去的留在 write_buf 中，下面提交 sendmsg 请求，由内核等待 socket 可写
+    //CGI 程序暂时没有输出的时候提交一个 poll 请求，可读之后在 HandleCgi 中继续
+    ret = server_->ResumeCGI(context);
+    if(ret == 2){
+      ArmCgi(conn);
+      context->write_ns += TimeUtil::MonotonicNS() - start;
+      return 1;
+    }
+    if(ret < 0){
+      context->write_ns += TimeUtil::MonotonicNS() - start;
+      return -1;
+    }
+    ret = 0;
+    iovcnt = server_->PendingIov(context,conn->iov);
+  }
+  if(iovcnt > 0){
+    //header 和内存中的 body 一个 sendmsg 发出去，后面还有文件内容的时候带上 MSG_MORE
+    bool more = context->file_fd >= 0 && context->file_remaining > 0;
+    memset(&conn->msg,0,sizeof(conn->msg));
+    conn->msg.msg_iov = conn->iov;
+    conn->msg.msg_iovlen = iovcnt;
+    io_uring_sqe* sqe = GetSqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = context->new_sock;
+    sqe->addr = reinterpret_cast<uint64_t>(&conn->msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL | (more ? MSG_MORE : 0);
+    sqe->user_data = UserData(conn,OP_SEND);
+    ++conn->pending;
+    ret = 1;
+  }else if(conn->pipe_bytes > 0 || (context->file_fd >= 0 && context->file_remaining > 0)){
+    ret = StartSplice(conn);
+  }else {
+    context->CloseFile();
+  }
+  context->write_ns += TimeUtil::MonotonicNS() - start;
+  return ret;
+}
+
+int UringReactor::StartSplice(UringConn* conn){
+  Context* context = conn->context;
+  if(conn->pipe_fds[0] < 0){
+    if(pipe2(conn->pipe_fds,O_CLOEXEC) < 0){
+      LOG(ERROR) << "pipe2 error! error=" << strerror(errno) << "\n";
+      conn->pipe_fds[0] = -1;
+      return -1;
+    }
+    //调大失败的话(超过了 /proc/sys/fs/pipe-max-size)就用默认的大小
+    fcntl(conn->pipe_fds[1],F_SETPIPE_SZ,kPipeSize);
+    conn->pipe_size = fcntl(conn->pipe_fds[1],F_GETPIPE_SZ);
+    if(conn->pipe_size <= 0){
+      conn->pipe_size = 64 * 1024;
+    }
+  }
+  //两个 splice 链接在一起必须在同一次提交中
+  if(ring_->SqSpace() < 2){
+    ring_->Submit(0);
+  }
+  size_t len = conn->pipe_bytes;
+  if(len == 0){
+    //管道是空的：文件 -> 管道，成功之后内核接着执行链接在后面的 管道 -> socket
+    len = std::min(context->file_remaining,static_cast<size_t>(conn->pipe_size));
+    io_uring_sqe* sqe = GetSqe();
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->splice_fd_in = context->file_fd;
+    sqe->splice_off_in = context->file_offset;
+    sqe->fd = conn->pipe_fds[1];
+    sqe->off = static_cast<uint64_t>(-1);
+    sqe->len = len;
+    sqe->splice_flags = SPLICE_F_MOVE;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = UserData(conn,OP_SPLICE_IN);
+    ++conn->pending;
+    ++conn->splice_pending;
+  }
+  //上一次没有写完的时候管道中还有数据，先把这些写出去
+  io_uring_sqe* sqe = GetSqe();
+  sqe->opcode = IORING_OP_SPLICE;
+  sqe->splice_fd_in = conn->pipe_fds[0];
+  sqe->splice_off_in = static_cast<uint64_t>(-1);
+  sqe->fd = context->new_sock;
+  sqe->off = static_cast<uint64_t>(-1);
+  sqe->len = len;
+  sqe->splice_flags = SPLICE_F_MOVE;
+  sqe->user_data = UserData(conn,OP_SPLICE_OUT);
+  ++conn->pending;
+  ++conn->splice_pending;
+  return 1;
+}
+
+void UringReactor::HandleSend(UringConn* conn,int result){
+  if(result < 0){
+    //对端已经关闭(EPIPE、ECONNRESET)
+    CloseConnection(conn);
+    return;
+  }
+  Stats::Local().Count(COUNTER_BYTES_OUT,result);
+  server_->ConsumeIov(conn->context,result);
+  AfterSend(conn);
+}
+
+void UringReactor::HandleSplice(UringConn* conn,int op,int result){
+  Context* context = conn->context;
+  --conn->splice_pending;
+  if(op == OP_SPLICE_IN){
+    if(result > 0){
+      context->file_offset += result;
+      context->file_remaining -= result;
+      conn->pipe_bytes += result;
+    }else {
+      //返回0说明文件在发送过程中被截断了，已经没法按照 Content-Length 发完
+      LOG(ERROR) << "splice file error! result=" << result
+        << " remaining=" << context->file_remaining << "\n";
+      conn->splice_error = true;
+    }
+  }else if(result > 0){
+    conn->pipe_bytes -= result;
+    Stats::Local().Count(COUNTER_BYTES_OUT,result);
+  }else if(result != -ECANCELED){
+    //ECANCELED 是前一个 splice 读到的比预期少，链接断开了，下一轮先把管道中的数据写出去
+    conn->splice_error = true;
+  }
+  if(conn->splice_pending > 0){
+    return;
+  }
+  if(conn->splice_error){
+    conn->splice_error = false;
+    CloseConnection(conn);
+    return;
+  }
+  AfterSend(conn);
+}
+
+void UringReactor::ArmCgi(UringConn* conn){
+  Context* context = conn->context;
+  io_uring_sqe* sqe = GetSqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = context->cgi.fd;
+  //fork 出来的 CGI 程序的 body 还没写完的话也要等可写
+  sqe->poll32_events = context->cgi.Writing() ? POLLIN | POLLOUT : POLLIN;
+  sqe->user_data = UserData(conn,OP_CGI);
+  conn->cgi_armed = true;
+  ++conn->pending;
+  context->state = STATE_CGI;
+}
+
+void UringReactor::CancelCgi(UringConn* conn){
+  //poll 请求完成之前 CGI 请求不能结束，常驻的工作进程会交给别的连接
+  if(conn->cgi_armed){
+    io_uring_sqe* sqe = GetSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = UserData(conn,OP_CGI);
+    sqe->user_data = OP_CANCEL;
+  }
+}
+
+void UringReactor::HandleCgi(UringConn* conn){
+  //超时之后取消的 poll 请求，连接已经不在等 CGI 了
+  if(conn->context->state != STATE_CGI){
+    return;
+  }
+  conn->context->state = STATE_WRITING;
+  AfterSend(conn);
+}
+
+void UringReactor::AfterSend(UringConn* conn){
+  int ret = ContinueSend(conn);
+  if(ret == 1){
+    return;
+  }
+  if(ret < 0 || FinishSend(conn) < 0){
+    CloseConnection(conn);
+    return;
+  }
+  //流水线发送过来的后续请求可能已经在 read_buf 中了
+  ProcessRequests(conn);
+}
+
+int UringReactor::FinishSend(UringConn* conn){
+  Context* context = conn->context;
+  server_->FinishResponse(context);
+  //响应写完了，不保持连接的话就主动关闭
+  if(!context->keep_alive){
+    return -1;
+  }
+  context->Reset();
+  return 0;
+}
+
+void UringReactor::ArmAccept(){
+  io_uring_sqe* sqe = GetSqe();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = listen_sock_;
+  //新连接保持阻塞模式，内核在 socket 没有就绪的时候自己等待，splice 写 socket 的时候也不会返回 EAGAIN
+  //不经过 ring 的同步写(转发 CGI 的输出)带着 MSG_DONTWAIT(见 ResponseWriter::WriteV)，写不进去就让 CGI 暂停，
+  //剩下的交给 sendmsg 请求，事件循环不会阻塞在某一个客户端上
+  sqe->accept_flags = SOCK_CLOEXEC;
+  if(multishot_accept_){
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  }
+  sqe->user_data = OP_ACCEPT;
+}
+
+void UringReactor::ArmRecv(UringConn* conn){
+  Context* context = conn->context;
+  if(conn->recv_armed || conn->closing || context->peer_closed){
+    return;
+  }
+  io_uring_sqe* sqe = GetSqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = context->new_sock;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = ring_->BufferGroup();
+  if(multishot_recv_){
+    //之后每次有数据都产生一个完成事件，不需要重新提交
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+  }else {
+    sqe->len = ring_->BufferSize();
+  }
+  sqe->user_data = UserData(conn,OP_RECV);
+  conn->recv_armed = true;
+  ++conn->pending;
+}
+
+void UringReactor::UpdateTimer(UringConn* conn){
+  Context* context = conn->context;
+  TimeoutPhase phase = server_->GetTimeoutPhase(context);
+  timers_.Add(&context->timer,server_->Deadline(context,phase,TimeUtil::MonotonicMS()));
+}
+
+void UringReactor::OnTimeout(TimerNode* node){
+  UringConn* conn = reinterpret_cast<UringConn*>(node->data);
+  Context* context = conn->context;
+  if(context->state == STATE_CGI){
+    //CGI 程序超时，连接本身没有问题，返回 504 或者结束已经开始的响应
+    //取消之后 poll 请求还占着文件描述符的引用，完成事件在 HandleCgi 中被忽略
+    CancelCgi(conn);
+    context->state = STATE_WRITING;
+    if(server_->TimeoutCGI(context) < 0){
+      CloseConnection(conn);
+      ReleaseIfDone(conn);
+      return;
+    }
+    AfterSend(conn);
+    if(conn->closing){
+      ReleaseIfDone(conn);
+    }else {
+      UpdateTimer(conn);
+    }
+    return;
+  }
+  server_->OnTimeout(context,server_->GetTimeoutPhase(context));
+  CloseConnection(conn);
+  ReleaseIfDone(conn);
+}
+
+void UringReactor::CloseConnection(UringConn* conn){
+  if(conn->closing){
+    return;
+  }
+  conn->closing = true;
+  connections_.erase(conn);
+  timers_.Cancel(&conn->context->timer);
+  CancelCgi(conn);
+  //shutdown 之后内核中的 recv 马上返回0，发送也会返回 EPIPE，完成事件到齐之后再 close
+  if(conn->pending > 0){
+    shutdown(conn->context->new_sock,SHUT_RDWR);
+  }
+}
+
+void UringReactor::ReleaseIfDone(UringConn* conn){
+  if(conn->pending > 0){
+    return;
+  }
+  server_->DeleteContext(conn->context);
+  delete conn;
+}
+
+}//end of http_server
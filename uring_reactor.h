@@ -0,0 +1,79 @@
+#pragma once
+//基于 io_uring 实现的反应堆，和 EpollReactor 一样只有一个线程，连接的状态机也是同一个 Context
+//区别在于 epoll 只通知"可以读写了"，读写还要各自调用系统调用；io_uring 直接把读写操作交给内核：
+//  accept：一个 multishot accept 请求，之后每来一个连接产生一个完成事件，不需要重新提交
+//  recv：multishot recv，数据放在内核从 provided buffer ring 中挑选的缓冲区里，复制到 read_buf 之后立即归还
+//  send：header 和内存中的 body 一个 sendmsg 请求发送
+//  大文件：文件 -> 管道 -> socket 两个链接在一起(IOSQE_IO_LINK)的 splice 请求，在内核中拷贝
+//  CGI：输出在处理请求的过程中同步地写，写不进去的时候 CGI 暂停，剩下的用 sendmsg 请求发送，发完之后继续；
+//       CGI 程序暂时没有输出的时候提交一个 poll 请求等它可读
+//一轮事件循环中产生的所有请求在下一次 io_uring_enter 的时候一起提交，同时等待下一批完成事件，
+//长连接上一个请求通常只需要一次系统调用
+#include <stdint.h>
+#include <unordered_set>
+#include <memory>
+#include "timer_wheel.hpp"
+
+class IoUring;
+struct io_uring_cqe;
+struct io_uring_sqe;
+
+namespace http_server{
+
+class HttpServer;
+struct Context;
+struct UringConn;
+
+class UringReactor{
+public:
+  UringReactor(HttpServer* server,int listen_sock);
+  ~UringReactor();
+  //创建 ring 并注册接收缓冲区，返回小于0表示内核不支持，调用方退回到 epoll
+  int Init();
+  //事件循环，正常情况下不会返回，返回小于0表示出错
+  int Run();
+private:
+  void HandleCompletion(const io_uring_cqe* cqe);
+  void HandleAccept(const io_uring_cqe* cqe);
+  void HandleRecv(UringConn* conn,const io_uring_cqe* cqe);
+  void HandleSend(UringConn* conn,int result);
+  void HandleSplice(UringConn* conn,int op,int result);
+  //CGI 的文件描述符可读(或者 body 可以继续写)了，回到写阶段继续转发
+  void HandleCgi(UringConn* conn);
+  //提交等 CGI 输出的 poll 请求，连接进入 STATE_CGI
+  void ArmCgi(UringConn* conn);
+  //取消还在内核中的 poll 请求
+  void CancelCgi(UringConn* conn);
+  //一次发送完成之后继续发送剩下的部分，全部发完就处理下一个请求
+  void AfterSend(UringConn* conn);
+  //依次处理 read_buf 中已经完整的请求，遇到需要异步发送的响应就先返回
+  void ProcessRequests(UringConn* conn);
+  //继续发送当前的响应，返回0表示已经发完，返回1表示已经提交了发送请求，返回小于0表示出错
+  int ContinueSend(UringConn* conn);
+  //响应发完之后准备处理下一个请求，返回小于0表示连接需要关闭
+  int FinishSend(UringConn* conn);
+  //大文件的 body：文件 -> 管道 -> socket，返回1表示已经提交，返回小于0表示出错
+  int StartSplice(UringConn* conn);
+  //SQ 满了的时候先把已有的提交掉
+  io_uring_sqe* GetSqe();
+  void ArmAccept();
+  void ArmRecv(UringConn* conn);
+  //处理完一个完成事件之后按照连接当前的阶段重新设置超时
+  void UpdateTimer(UringConn* conn);
+  void OnTimeout(TimerNode* node);
+  //标记成关闭，还有请求在内核中没有完成的时候先 shutdown，调用方随后调用 ReleaseIfDone，
+  //等最后一个完成事件到了再释放
+  void CloseConnection(UringConn* conn);
+  void ReleaseIfDone(UringConn* conn);
+
+  HttpServer* server_;
+  int listen_sock_;
+  std::unique_ptr<IoUring> ring_;
+  bool multishot_accept_;
+  bool multishot_recv_;
+  //当前所有的连接，析构的时候释放
+  std::unordered_set<UringConn*> connections_;
+  TimerWheel timers_;
+};
+
+}//end of http_server
@@ -6,11 +6,26 @@
 #include <iostream>
 #include <fstream>
 #include <sys/time.h>
+#include <time.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <ctype.h>
 #include <sys/socket.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sched.h>
+#include <pthread.h>
+#include <algorithm>
 #include <unordered_map>
 #include <vector>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/utility/string_view.hpp>
+#include "logger.hpp"
+#include "scan.hpp"
 
 //获取时间的函数
 class TimeUtil{
@@ -27,109 +42,79 @@ public:
     gettimeofday(&tv,NULL);
     return 1000 * 1000 * tv.tv_sec + tv.tv_usec;
   }
-};
-
-enum LogLevel{
-  DEBUG,
-  INFO,
-  WARNING,
-  ERROR,
-  CRITIAL,
-};
-
-//加上内联是为了绕开函数重载的坑
-//也可以使用static，可以避免函数名重复定义的坑
-//LOG(INFO) << "hehe"
-inline std::ostream& Log(LogLevel level,const char* file,int line){
-  std::string prefix = "I";
-  if(level == WARNING){
-    prefix ="W";
-  }else if(level == ERROR){
-    prefix = "E";
-  }else if(level == CRITIAL){
-    prefix = "C";
-  }else if(level == DEBUG){
-    prefix = "D";
+  //单调时钟的纳秒数，不受系统时间调整的影响，只能用来计算时间间隔(耗时、超时)
+  //CLOCK_MONOTONIC 通过 vDSO 读取，不会陷入内核，可以在每个请求的每个阶段调用
+  static int64_t MonotonicNS(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000 * 1000 * 1000 + ts.tv_nsec;
   }
-  
-  std::cout << "[" << prefix << TimeUtil::TimeStamp() << " " << file << ":" << line << "]";
-  return std::cout;
-}
-
-//文件名和行号的出处
-//为什么要定义宏不定义函数来替换？？？
-//如果定义函数返回文件名和行号，永远都返回的是util.hpp，行号也是固定的，不会替换的
-//__FILE__ __LINE__
-#define LOG(level) Log(level,__FILE__,__LINE__)
-
-class FileUtil{
-public:
-  //从文件描述符中读取一行
-  //一行的界定标识是  \n \r \r\n
-  //返回的line 中是不包含界定标识的
-  //例如：
-  //aaa\nbbb\nccc
-  //调用ReadLine 返回的 line 对象的内容是 aaa ,不包含\n
-  static int ReadLine(int fd,std::string* line){
-    line->clear();//只清空并不释放内存
-    while(true){
-      char c = '\0';
-      //resv()函数和read函数类似，也是可以从文件描述符中读取一个字符,放到缓冲区
-      ssize_t read_size = recv(fd,&c,1,0);
-      if(read_size <= 0){
-        return -1;
-      }
-     //如果当前字符是\r 把这个情况处理成\n
-      if(c == '\r'){
-        //虽然从缓冲区中读了一个字符，但是缓冲区并没有删掉字符
-        recv(fd,&c,1,MSG_PEEK);
-        if(c == '\n'){
-          //发现\r后面一个字符刚好就是\n,为了不影响下次循环
-          //就需要把这样的字符从缓冲区中干掉
-          recv(fd,&c,1,0);
-        }else {
-          c = '\n';
-        }
-      }
-      //这个条件是\r \r\n
-      if(c == '\n'){
-        break;
-      }
-      line->push_back(c);
-    }
-    return 0;
+  //单调时钟的毫秒数，计算超时用
+  static int64_t MonotonicMS(){
+    return MonotonicNS() / (1000 * 1000);
   }
-  static int ReadN(int fd,size_t len,std::string* output){
-    output->clear();
-    char c = '\0';
-    for(size_t i = 0;i < len;++i){
-      recv(fd,&c,1,0);
-      output->push_back(c);
+  //HTTP 协议中使用的时间格式，例如 Sun, 06 Nov 1994 08:49:37 GMT
+  static std::string HttpDate(time_t t){
+    struct tm tm;
+    gmtime_r(&t,&tm);
+    char buf[64];
+    strftime(buf,sizeof(buf),"%a, %d %b %Y %H:%M:%S GMT",&tm);
+    return buf;
+  }
+  //解析 HttpDate 格式的时间，返回0表示成功，返回小于0表示格式不对
+  static int ParseHttpDate(const std::string& date,time_t* t){
+    struct tm tm;
+    memset(&tm,0,sizeof(tm));
+    const char* end = strptime(date.c_str(),"%a, %d %b %Y %H:%M:%S GMT",&tm);
+    if(end == NULL || *end != '\0'){
+      return -1;
     }
+    *t = timegm(&tm);
     return 0;
   }
+};
+
+
+class FileUtil{
+public:
   //从文件中读取全部内容到std::string中
+  //用 pread 按文件大小一次读完，不经过 ifstream 的缓冲区
   static int ReadAll(const std::string& file_path,std::string* output){
-    std::ifstream file(file_path.c_str());
-    if(!file.is_open()){
+    int fd = open(file_path.c_str(),O_RDONLY | O_CLOEXEC);
+    if(fd < 0){
       LOG(ERROR) << "Open file error! file_path=" << file_path << "\n";
       return -1;
     }
-    //修改当前文件指针的位置,此处是将文件指针调整到文件末尾
-    file.seekg(0,file.end);
-    //查询当前文件指针的位置，返回值就是文件指针位置相对于文件,起始位置的偏移量
-    int length = file.tellg();
-    //为了从头读取文件，需要把文件指针设置到开头位置
-    file.seekg(0,file.beg);
-    output->resize(length);//提前开辟空间，不保证是length这么长的空间，只是保证能把length存进去.
-   
-    //读取完整的文件内容
-    file.read(const_cast<char*>(output->c_str()),length);
-    //万一忘记写下面的close ，也问题不大，因为ifstream对象会在析构的时候自动进行关闭文件描述符
-    file.close();
-    return 0;
+    struct stat st;
+    int ret = fstat(fd,&st) < 0 ? -1 : ReadAll(fd,st.st_size,output);
+    close(fd);
+    return ret;
   }
   
+  //从已经打开的文件中读取 size 个字节，文件内容可以包含 '\0'
+  static int ReadAll(int fd,size_t size,std::string* output){
+    output->clear();
+    return ReadAt(fd,0,size,output);
+  }
+
+  //从文件的 offset 位置读取 size 个字节，追加到 output 的后面
+  static int ReadAt(int fd,off_t offset,size_t size,std::string* output){
+    size_t start = output->size();
+    output->resize(start + size);
+    size_t total = 0;
+    while(total < size){
+      ssize_t read_size = pread(fd,&(*output)[start + total],size - total,offset + total);
+      if(read_size < 0 && errno == EINTR){
+        continue;
+      }
+      if(read_size <= 0){
+        return -1;
+      }
+      total += read_size;
+    }
+    return 0;
+  }
+
   static int ReadAll(int fd,std::string* output){
    //此函数完成从文件描述符中读取所有数据的操作
     while(true){
@@ -151,6 +136,36 @@ public:
   static bool IsDir(const std::string& file_path){
     return boost::filesystem::is_directory(file_path);
   }
+  //根据文件的扩展名得到 Content-Type，不认识的扩展名按照二进制数据处理
+  static const char* ContentType(const std::string& file_path){
+    static const std::unordered_map<std::string,std::string> types = {
+      {"html","text/html; charset=utf-8"},
+      {"htm","text/html; charset=utf-8"},
+      {"css","text/css"},
+      {"js","application/javascript"},
+      {"json","application/json"},
+      {"txt","text/plain; charset=utf-8"},
+      {"png","image/png"},
+      {"jpg","image/jpeg"},
+      {"jpeg","image/jpeg"},
+      {"gif","image/gif"},
+      {"ico","image/x-icon"},
+      {"svg","image/svg+xml"},
+      {"woff","font/woff"},
+      {"ttf","font/ttf"},
+      {"otf","font/otf"},
+      {"eot","application/vnd.ms-fontobject"},
+    };
+    size_t pos = file_path.rfind('.');
+    if(pos == std::string::npos || file_path.find('/',pos) != std::string::npos){
+      return "application/octet-stream";
+    }
+    auto it = types.find(file_path.substr(pos + 1));
+    if(it == types.end()){
+      return "application/octet-stream";
+    }
+    return it->second.c_str();
+  }
 
 };
 
@@ -165,29 +180,186 @@ public:
   //对于这种情况，返回的子串就是有两个，"a","b"
   //token_compress_off
   //对于关闭压缩的情况，返回的子串就是有三个，"a" "," "b"
-  static int Split(const std::string& input,const std::string& split_char,std::vector<std::string>* output){
-    boost::split(*output,input,boost::is_any_of(split_char),boost::token_compress_on);
+  //分隔符的查找交给 ScanUtil，一次比较16或者32个字节，结果和 boost::split 一致
+  static int Split(boost::string_view input,const std::string& split_char,std::vector<std::string>* output){
+    output->clear();
+    const char* chars = split_char.data();
+    size_t n = split_char.size();
+    const char* p = input.data();
+    const char* end = p + input.size();
+    while(true){
+      const char* q = ScanUtil::FindAny(p,end,chars,n);
+      output->push_back(std::string(p,q));
+      if(q == end){
+        break;
+      }
+      //连续的多个分隔符当作一个
+      p = q + 1;
+      while(p < end && memchr(chars,*p,n) != NULL){
+        ++p;
+      }
+    }
+    return 0;
+  }
+
+  //去掉首尾的空白字符，返回的结果指向输入的数据，不复制
+  static boost::string_view Trim(boost::string_view input){
+    while(!input.empty() && isspace(static_cast<unsigned char>(input.front()))){
+      input.remove_prefix(1);
+    }
+    while(!input.empty() && isspace(static_cast<unsigned char>(input.back()))){
+      input.remove_suffix(1);
+    }
+    return input;
+  }
+
+  //解析十进制的非负整数，必须全部是数字
+  //返回0表示成功，返回小于0表示为空、包含其他字符或者溢出
+  static int ParseUint(boost::string_view input,unsigned long long* output){
+    if(input.empty()){
+      return -1;
+    }
+    unsigned long long value = 0;
+    for(size_t i = 0;i < input.size();++i){
+      if(input[i] < '0' || input[i] > '9'){
+        return -1;
+      }
+      unsigned long long digit = input[i] - '0';
+      if(value > (~0ULL - digit) / 10){
+        return -1;
+      }
+      value = value * 10 + digit;
+    }
+    *output = value;
+    return 0;
+  }
+
+  //整个字符串都是 int 范围内的十进制整数才算成功，返回0表示成功，返回小于0表示失败
+  //CGI 程序和插件版本的 a+b 计算器用同一个函数校验参数，"1abc" 这种都返回 400
+  static int ParseInt(const std::string& input,long* output){
+    if(input.empty()){
+      return -1;
+    }
+    char* end = NULL;
+    errno = 0;
+    long value = strtol(input.c_str(),&end,10);
+    if(errno != 0 || *end != '\0' || value < INT_MIN || value > INT_MAX){
+      return -1;
+    }
+    *output = value;
     return 0;
   }
 
   typedef std::unordered_map<std::string,std::string> UrlParam;
-  static int ParseUrlParam(const std::string& input,UrlParam* output){
-    //1.先按照取地址符号切分成若干个kv
-    std::vector<std::string> params;
-    Split(input,"&",&params);
-    //2.再针对每一个 kv，按照 = 切分，放到输出结果中
-    //range based for 
-    for(auto item : params){
-      std::vector<std::string> kv;
-      Split(item,"=",&kv);
-      if(kv.size() != 2){
+  //key 和 value 都会做百分号解码，+ 解码成空格；没有 = 或者解码失败的参数忽略掉
+  static int ParseUrlParam(boost::string_view input,UrlParam* output){
+    const char* p = input.data();
+    const char* end = p + input.size();
+    std::string key;
+    std::string value;
+    while(p < end){
+      //1.先按照取地址符号找到一个kv
+      const char* amp = ScanUtil::FindAny(p,end,"&",1);
+      boost::string_view item(p,amp - p);
+      p = amp == end ? end : amp + 1;
+      if(item.empty()){
+        continue;
+      }
+      //2.再针对每一个 kv，按照第一个 = 切分，放到输出结果中
+      const char* eq = ScanUtil::FindAny(item.data(),item.data() + item.size(),"=",1);
+      if(eq == item.data() + item.size()){
         //该参数非法
         LOG(WARNING) << "kv format error! item=" << item <<"\n";
         continue;
       }
+      size_t key_size = eq - item.data();
+      if(ScanUtil::PercentDecode(item.substr(0,key_size),true,&key) < 0
+          || ScanUtil::PercentDecode(item.substr(key_size + 1),true,&value) < 0){
+        LOG(WARNING) << "kv decode error! item=" << item <<"\n";
+        continue;
+      }
       //这是unordered_map的kv
       //如果数据存在就查找，不存在就插入
-      (*output)[kv[0]] = kv[1]; 
+      (*output)[key] = value;
+    }
+    return 0;
+  }
+};
+
+//CPU 相关的工具：当前进程可以使用哪些 CPU，以及把线程绑定到某个 CPU 上
+class CpuUtil{
+public:
+  //当前进程允许使用的 CPU(受 taskset/cgroup 限制)，按编号排序
+  //numa 为 true 的时候按照 NUMA 节点分组排列，依次分配的时候先用满一个节点再用下一个
+  static int AllowedCpus(bool numa,std::vector<int>* cpus){
+    cpus->clear();
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0,sizeof(set),&set) < 0){
+      return -1;
+    }
+    for(int i = 0;i < CPU_SETSIZE;++i){
+      if(CPU_ISSET(i,&set)){
+        cpus->push_back(i);
+      }
+    }
+    if(numa){
+      std::vector<int> nodes(CPU_SETSIZE,0);
+      for(int node = 0;;++node){
+        std::string cpulist;
+        if(ReadFirstLine("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist",
+                         &cpulist) < 0){
+          break;
+        }
+        std::vector<int> node_cpus;
+        ParseCpuList(cpulist,&node_cpus);
+        for(size_t i = 0;i < node_cpus.size();++i){
+          if(node_cpus[i] >= 0 && node_cpus[i] < CPU_SETSIZE){
+            nodes[node_cpus[i]] = node;
+          }
+        }
+      }
+      std::stable_sort(cpus->begin(),cpus->end(),
+                       [&nodes](int a,int b){ return nodes[a] < nodes[b]; });
+    }
+    return cpus->empty() ? -1 : 0;
+  }
+
+  //把调用线程绑定到 cpu 上，之后这个线程只会在这个 CPU 上运行
+  static int PinCurrentThread(int cpu){
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu,&set);
+    return pthread_setaffinity_np(pthread_self(),sizeof(set),&set) == 0 ? 0 : -1;
+  }
+
+  //解析 sysfs 中 CPU 列表的格式，例如 0-3,8-11
+  static void ParseCpuList(const std::string& input,std::vector<int>* cpus){
+    std::vector<std::string> items;
+    StringUtil::Split(input,",",&items);
+    for(size_t i = 0;i < items.size();++i){
+      size_t dash = items[i].find('-');
+      unsigned long long first = 0;
+      unsigned long long last = 0;
+      if(dash == std::string::npos){
+        if(StringUtil::ParseUint(StringUtil::Trim(items[i]),&first) < 0){
+          continue;
+        }
+        last = first;
+      }else if(StringUtil::ParseUint(StringUtil::Trim(items[i].substr(0,dash)),&first) < 0
+          || StringUtil::ParseUint(StringUtil::Trim(items[i].substr(dash + 1)),&last) < 0){
+        continue;
+      }
+      for(unsigned long long cpu = first;cpu <= last && cpu < CPU_SETSIZE;++cpu){
+        cpus->push_back(static_cast<int>(cpu));
+      }
+    }
+  }
+private:
+  static int ReadFirstLine(const std::string& path,std::string* line){
+    std::ifstream file(path.c_str());
+    if(!file.is_open() || !std::getline(file,*line)){
+      return -1;
     }
     return 0;
   }